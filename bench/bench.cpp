@@ -0,0 +1,111 @@
+#include "bench.h"
+
+#include <time.h>
+#include <cstdio>
+#include <cstring>
+
+using namespace std;
+
+volatile MCfloat benchSink;
+
+static vector<Bench *> benchmarks;
+static const double minTime = 0.2;
+
+static double monotonicTime()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+Bench::Bench(const char *name, double bytesPerOp)
+{
+    _name = name;
+    _bytesPerOp = bytesPerOp;
+}
+
+Bench::~Bench()
+{
+}
+
+void Bench::setUp()
+{
+}
+
+void Bench::tearDown()
+{
+}
+
+const string &Bench::name() const
+{
+    return _name;
+}
+
+double Bench::bytesPerOp() const
+{
+    return _bytesPerOp;
+}
+
+void registerBench(Bench *bench)
+{
+    benchmarks.push_back(bench);
+}
+
+/**
+ * @brief Runs the registered benchmarks
+ * @param argc
+ * @param argv optional substrings; only benchmarks whose name contains one of
+ * them are run
+ * @return
+ */
+
+int runBenchmarks(int argc, char *argv[])
+{
+    printf("%-40s %14s %12s %16s\n", "benchmark", "ops", "ns/op",
+           "throughput");
+
+    for (size_t i = 0; i < benchmarks.size(); ++i) {
+        Bench *b = benchmarks[i];
+
+        bool selected = argc < 2;
+        for (int j = 1; j < argc; ++j) {
+            if(strstr(b->name().c_str(), argv[j]) != NULL)
+                selected = true;
+        }
+        if(!selected)
+            continue;
+
+        b->setUp();
+        b->run(1000);  // warm up
+
+        u_int64_t nOps = 1000;
+        double elapsed = 0;
+        while(true) {
+            double start = monotonicTime();
+            b->run(nOps);
+            elapsed = monotonicTime() - start;
+            if(elapsed >= minTime)
+                break;
+            nOps *= 2;
+        }
+        b->tearDown();
+
+        double nsPerOp = 1e9 * elapsed / nOps;
+        char throughput[32];
+        if(b->bytesPerOp() > 0)
+            snprintf(throughput, 32, "%.1f MB/s",
+                     nOps * b->bytesPerOp() / elapsed / 1e6);
+        else
+            snprintf(throughput, 32, "%.2f Mop/s", nOps / elapsed / 1e6);
+
+        printf("%-40s %14lu %12.2f %16s\n", b->name().c_str(), nOps,
+               nsPerOp, throughput);
+        fflush(stdout);
+    }
+
+    for (size_t i = 0; i < benchmarks.size(); ++i) {
+        delete benchmarks[i];
+    }
+    benchmarks.clear();
+    return 0;
+}
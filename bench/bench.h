@@ -0,0 +1,46 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <MCPlusPlus/MCglobal.h>
+
+#include <string>
+#include <vector>
+
+/**
+ * @brief Base class of the microbenchmarks of the mcpp_bench target
+ *
+ * Subclasses implement run(), performing the given number of operations of
+ * the kernel under test. The number of operations is doubled until a run lasts
+ * at least minTime seconds; the result of the last run is reported as ns/op
+ * and throughput (operations per second, or bytes per second if bytesPerOp()
+ * is not zero).
+ */
+
+class Bench
+{
+public:
+    Bench(const char *name, double bytesPerOp=0);
+    virtual ~Bench();
+
+    virtual void setUp();
+    virtual void run(u_int64_t nOps) = 0;
+    virtual void tearDown();
+
+    const std::string &name() const;
+    double bytesPerOp() const;
+
+private:
+    std::string _name;
+    double _bytesPerOp;
+};
+
+void registerBench(Bench *bench);
+int runBenchmarks(int argc, char *argv[]);
+
+/**
+ * @brief Prevents the compiler from optimizing away the result of a kernel
+ */
+
+extern volatile MCfloat benchSink;
+
+#endif // BENCH_H
@@ -0,0 +1,456 @@
+#include "bench.h"
+
+#include <MCPlusPlus/costhetagenerator.h>
+#include <MCPlusPlus/distributions.h>
+#include <MCPlusPlus/gaussianraybundlesource.h>
+#include <MCPlusPlus/h5outputfile.h>
+#include <MCPlusPlus/histogram.h>
+#include <MCPlusPlus/source.h>
+#include <MCPlusPlus/transport.h>
+
+#include <boost/math/constants/constants.hpp>
+#include <cstdio>
+#include <unistd.h>
+
+using namespace MCPP;
+using namespace boost::math::constants;
+
+#define BENCH_BUFSIZE 8192
+#define MULTI_HISTOGRAM_COUNT 20
+
+
+
+
+class CosThetaBench : public Bench
+{
+public:
+    CosThetaBench(const char *name, double g) :
+        Bench(name), gen(g)
+    {
+        gen.setSeed(0);
+    }
+
+    virtual void run(u_int64_t nOps)
+    {
+        MCfloat sum = 0;
+        for (u_int64_t i = 0; i < nOps; ++i)
+            sum += gen.spin();
+        benchSink = sum;
+    }
+
+private:
+    CosThetaGenerator gen;
+};
+
+
+
+
+class FreePathBench : public Bench
+{
+public:
+    FreePathBench() :
+        Bench("sampleFreePath"), mt(0)
+    {
+    }
+
+    virtual void run(u_int64_t nOps)
+    {
+        MCfloat sum = 0;
+        for (u_int64_t i = 0; i < nOps; ++i)
+            sum += sampleFreePath(0.5, &mt);
+        benchSink = sum;
+    }
+
+private:
+    MCEngine mt;
+};
+
+
+
+
+/**
+ * @brief Chains scattering events, so that every call depends on the previous
+ * one as in the transport loop. Deflection angles are precomputed.
+ */
+
+class ScatterDirectionBench : public Bench
+{
+public:
+    ScatterDirectionBench() :
+        Bench("scatterDirection")
+    {
+        MCEngine mt(0);
+        for (uint i = 0; i < BENCH_BUFSIZE; ++i) {
+            cosTheta[i] = 2 * uniform_01<MCfloat>()(mt) - 1;
+            psi[i] = uniform_01<MCfloat>()(mt) * two_pi<MCfloat>();
+        }
+    }
+
+    virtual void run(u_int64_t nOps)
+    {
+        MCfloat k[2][3] = {{0, 0, 1}, {0, 0, 1}};
+        for (u_int64_t i = 0; i < nOps; ++i) {
+            uint j = i % BENCH_BUFSIZE;
+            scatterDirection(k[i & 1], cosTheta[j], psi[j], k[(i + 1) & 1]);
+        }
+        benchSink = k[0][2];
+    }
+
+private:
+    MCfloat cosTheta[BENCH_BUFSIZE];
+    MCfloat psi[BENCH_BUFSIZE];
+};
+
+
+
+
+class ReflectionProbabilityBench : public Bench
+{
+public:
+    ReflectionProbabilityBench() :
+        Bench("fresnelReflectionProbability")
+    {
+        MCEngine mt(0);
+        MCfloat n0 = 1.5, n1 = 1.3;
+        for (uint i = 0; i < BENCH_BUFSIZE; ++i) {
+            // angles below the critical angle
+            MCfloat s0 = uniform_01<MCfloat>()(mt) * n1 / n0;
+            sinTheta0[i] = s0;
+            cosTheta0[i] = sqrt(1 - s0 * s0);
+            sinTheta1[i] = n0 * s0 / n1;
+            cosTheta1[i] = sqrt(1 - sinTheta1[i] * sinTheta1[i]);
+        }
+    }
+
+    virtual void run(u_int64_t nOps)
+    {
+        MCfloat sum = 0;
+        for (u_int64_t i = 0; i < nOps; ++i) {
+            uint j = i % BENCH_BUFSIZE;
+            sum += fresnelReflectionProbability(cosTheta0[j], sinTheta0[j],
+                                                cosTheta1[j], sinTheta1[j],
+                                                1.5, 1.3);
+        }
+        benchSink = sum;
+    }
+
+private:
+    MCfloat cosTheta0[BENCH_BUFSIZE], sinTheta0[BENCH_BUFSIZE];
+    MCfloat cosTheta1[BENCH_BUFSIZE], sinTheta1[BENCH_BUFSIZE];
+};
+
+
+
+
+/**
+ * @brief Histograms a buffer of random transmitted walkers, one op per walker
+ */
+
+class HistogramBench : public Bench
+{
+public:
+    HistogramBench(const char *name, Histogram *hist) :
+        Bench(name)
+    {
+        this->hist = hist;
+        hist->setPhotonTypeFlags(FLAG_TRANSMITTED);
+        hist->initialize();
+
+        MCEngine mt(0);
+        for (uint i = 0; i < BENCH_BUFSIZE; ++i) {
+            Walker *w = &buf[i];
+            w->r0[0] = 400 * uniform_01<MCfloat>()(mt) - 200;
+            w->r0[1] = 400 * uniform_01<MCfloat>()(mt) - 200;
+            w->r0[2] = 80;
+            MCfloat cosTheta = uniform_01<MCfloat>()(mt);
+            MCfloat psi = uniform_01<MCfloat>()(mt) * two_pi<MCfloat>();
+            MCfloat k[3] = {0, 0, 1};
+            scatterDirection(k, cosTheta, psi, w->k0);
+            w->walkTime = 50 * uniform_01<MCfloat>()(mt);
+            w->type = TRANSMITTED;
+        }
+    }
+
+    ~HistogramBench()
+    {
+        delete hist;
+    }
+
+    virtual void run(u_int64_t nOps)
+    {
+        while(nOps > 0) {
+            size_t n = nOps < BENCH_BUFSIZE ? nOps : BENCH_BUFSIZE;
+            hist->run(buf, n);
+            nOps -= n;
+        }
+    }
+
+private:
+    Histogram *hist;
+    Walker buf[BENCH_BUFSIZE];
+};
+
+static Histogram *newHistogram(MCData type1, MCfloat max1, MCfloat binSize1,
+                               MCData type2=DATA_NONE, MCfloat max2=0,
+                               MCfloat binSize2=0)
+{
+    Histogram *hist = new Histogram();
+    hist->setDataDomain(type1, type2);
+    if(type2 == DATA_NONE) {
+        hist->setMax(max1);
+        hist->setBinSize(binSize1);
+    }
+    else {
+        hist->setMax(max1, max2);
+        hist->setBinSize(binSize1, binSize2);
+    }
+    return hist;
+}
+
+
+/**
+ * @brief Histograms a buffer of random walkers of mixed types with many
+ * histograms, one op per walker
+ *
+ * With a shared WalkerBatch (as in Simulation) the derived quantities are
+ * computed once for all the histograms; otherwise each histogram runs on the
+ * buffer on its own.
+ */
+
+class MultiHistogramBench : public Bench
+{
+public:
+    MultiHistogramBench(const char *name, bool shared) :
+        Bench(name)
+    {
+        this->shared = shared;
+        for (uint i = 0; i < MULTI_HISTOGRAM_COUNT; ++i) {
+            Histogram *hist;
+            switch(i % 4) {
+            case 0:
+                hist = newHistogram(DATA_TIMES, 50, 1);
+                break;
+            case 1:
+                hist = newHistogram(DATA_POINTS, 500, 2);
+                break;
+            case 2:
+                hist = newHistogram(DATA_K, 90, 5);
+                break;
+            default:
+                hist = newHistogram(DATA_POINTS, 500, 2, DATA_TIMES, 50, 1);
+                break;
+            }
+            hist->setPhotonTypeFlags(i % 2 ? FLAG_TRANSMITTED
+                                           : FLAG_REFLECTED);
+            hist->initialize();
+            hist->requireColumns(&batch);
+            hists.push_back(hist);
+        }
+
+        MCEngine mt(0);
+        for (uint i = 0; i < BENCH_BUFSIZE; ++i) {
+            Walker *w = &buf[i];
+            w->r0[0] = 400 * uniform_01<MCfloat>()(mt) - 200;
+            w->r0[1] = 400 * uniform_01<MCfloat>()(mt) - 200;
+            w->r0[2] = 80;
+            MCfloat cosTheta = uniform_01<MCfloat>()(mt);
+            MCfloat psi = uniform_01<MCfloat>()(mt) * two_pi<MCfloat>();
+            MCfloat k[3] = {0, 0, 1};
+            scatterDirection(k, cosTheta, psi, w->k0);
+            w->walkTime = 50 * uniform_01<MCfloat>()(mt);
+            w->type = uniform_01<MCfloat>()(mt) < 0.5 ? TRANSMITTED
+                                                      : REFLECTED;
+        }
+    }
+
+    ~MultiHistogramBench()
+    {
+        for (size_t i = 0; i < hists.size(); ++i) {
+            delete hists[i];
+        }
+    }
+
+    virtual void run(u_int64_t nOps)
+    {
+        while(nOps > 0) {
+            size_t n = nOps < BENCH_BUFSIZE ? nOps : BENCH_BUFSIZE;
+            if(shared)
+                batch.fill(buf, n);
+            for (size_t i = 0; i < hists.size(); ++i) {
+                if(shared)
+                    hists[i]->run(batch);
+                else
+                    hists[i]->run(buf, n);
+            }
+            nOps -= n;
+        }
+    }
+
+private:
+    vector<Histogram *> hists;
+    WalkerBatch batch;
+    bool shared;
+    Walker buf[BENCH_BUFSIZE];
+};
+
+
+
+
+class SourceBench : public Bench
+{
+public:
+    SourceBench(const char *name, Source *src) :
+        Bench(name)
+    {
+        this->src = src;
+        src->setWalkTimeDistribution(new DeltaDistribution(0));
+        src->setSeed(0);
+    }
+
+    ~SourceBench()
+    {
+        delete src;
+    }
+
+    virtual void run(u_int64_t nOps)
+    {
+        Walker w;
+        MCfloat sum = 0;
+        for (u_int64_t i = 0; i < nOps; ++i) {
+            src->spin(&w);
+            sum += w.r0[0];
+        }
+        benchSink = sum;
+    }
+
+private:
+    Source *src;
+};
+
+
+
+
+/**
+ * @brief Appends raw output in chunks of BENCH_BUFSIZE photons, one op per
+ * photon
+ */
+
+class H5AppendBench : public Bench
+{
+public:
+    H5AppendBench(const char *name, MCData type, uint floatsPerPhoton) :
+        Bench(name, floatsPerPhoton * sizeof(MCfloat))
+    {
+        this->type = type;
+        this->floatsPerPhoton = floatsPerPhoton;
+        buf.assign(BENCH_BUFSIZE * floatsPerPhoton, 0.5);
+        fileName = "mcpp_bench.h5";
+    }
+
+    virtual void setUp()
+    {
+        remove(fileName);
+        file.newFile(fileName);
+    }
+
+    virtual void run(u_int64_t nOps)
+    {
+        while(nOps > 0) {
+            hsize_t n = nOps < BENCH_BUFSIZE ? nOps : BENCH_BUFSIZE;
+            switch (type) {
+            case DATA_POINTS:
+                file.appendExitPoints(TRANSMITTED, buf.data(),
+                                      n * floatsPerPhoton);
+                break;
+            case DATA_K:
+                file.appendExitKVectors(TRANSMITTED, buf.data(),
+                                        n * floatsPerPhoton);
+                break;
+            default:
+                file.appendWalkTimes(TRANSMITTED, buf.data(),
+                                     n * floatsPerPhoton);
+                break;
+            }
+            nOps -= n;
+        }
+    }
+
+    virtual void tearDown()
+    {
+        file.close();
+        remove(fileName);
+    }
+
+private:
+    H5OutputFile file;
+    MCData type;
+    uint floatsPerPhoton;
+    vector<MCfloat> buf;
+    const char *fileName;
+};
+
+
+
+
+int main(int argc, char *argv[])
+{
+    registerBench(new CosThetaBench("CosThetaGenerator::spin g=0", 0));
+    registerBench(new CosThetaBench("CosThetaGenerator::spin g=0.9", 0.9));
+    registerBench(new FreePathBench());
+    registerBench(new ScatterDirectionBench());
+    registerBench(new ReflectionProbabilityBench());
+
+    registerBench(new HistogramBench("Histogram::run times",
+                                     newHistogram(DATA_TIMES, 50, 1)));
+    registerBench(new HistogramBench("Histogram::run points",
+                                     newHistogram(DATA_POINTS, 500, 2)));
+    registerBench(new HistogramBench("Histogram::run k",
+                                     newHistogram(DATA_K, 90, 5)));
+    registerBench(new HistogramBench("Histogram::run cos(theta)",
+                                     newHistogram(DATA_COS_THETA, 1, 0.05)));
+    registerBench(new HistogramBench(
+                      "Histogram::run points,times",
+                      newHistogram(DATA_POINTS, 500, 2, DATA_TIMES, 50, 1)));
+    Histogram *hist = newHistogram(DATA_POINTS, 500, 2, DATA_TIMES, 50, 1);
+    hist->setTiledStorage(true);
+    registerBench(new HistogramBench("Histogram::run points,times tiled",
+                                     hist));
+    hist = newHistogram(DATA_TIMES, 50, 1);
+    hist->setLogBinning(0, 0.01, 50, 50);
+    registerBench(new HistogramBench("Histogram::run times log", hist));
+    vector<double> edges;
+    for (uint i = 0; i <= 50; ++i)
+        edges.push_back(i * i / 50.);
+    hist = newHistogram(DATA_TIMES, 50, 1);
+    hist->setBinEdges(0, edges);
+    registerBench(new HistogramBench("Histogram::run times edges", hist));
+    hist = newHistogram(DATA_POINTS, 500, 2, DATA_TIMES, 50, 1);
+    hist->setAxis(2, DATA_PHOTON_TYPE, 0, 0, 0);
+    registerBench(new HistogramBench("Histogram::run points,times,type",
+                                     hist));
+    hist = newHistogram(DATA_TIMES, 50, 1);
+    hist->addMomentExponent(2);
+    registerBench(new HistogramBench("Histogram::run times+moments", hist));
+    registerBench(new MultiHistogramBench("Histogram::run x20 separate",
+                                          false));
+    registerBench(new MultiHistogramBench("Histogram::run x20 WalkerBatch",
+                                          true));
+
+    registerBench(new SourceBench("PencilBeamSource::spin",
+                                  new PencilBeamSource()));
+    registerBench(new SourceBench("GaussianBeamSource::spin",
+                                  new GaussianBeamSource(10)));
+    registerBench(new SourceBench("IsotropicPointSource::spin",
+                                  new IsotropicPointSource(10)));
+    registerBench(new SourceBench("GaussianRayBundleSource::spin",
+                                  new GaussianRayBundleSource(1000, 10, 1e4)));
+
+    registerBench(new H5AppendBench("H5OutputFile::appendExitPoints",
+                                    DATA_POINTS, 2));
+    registerBench(new H5AppendBench("H5OutputFile::appendWalkTimes",
+                                    DATA_TIMES, 1));
+    registerBench(new H5AppendBench("H5OutputFile::appendExitKVectors",
+                                    DATA_K, 3));
+
+    return runBenchmarks(argc, argv);
+}
@@ -0,0 +1,389 @@
+/*
+ * End-to-end scaling benchmarks.
+ *
+ * Runs canonical simulations across thread counts (strong and weak scaling),
+ * layer counts and histogram counts, and reports photons/s and photons/s per
+ * thread. Results can be written to a JSON file and compared against a
+ * baseline file written by a previous run, flagging throughput regressions.
+ *
+ * Usage: mcpp_scaling [--output results.json] [--baseline baseline.json]
+ *                     [--tolerance 0.1] [--scale 1] [--max-threads N]
+ *                     [filter...]
+ *
+ * The exit status is 1 if a regression is found, 0 otherwise.
+ */
+
+#include <MCPlusPlus/simulation.h>
+#include <MCPlusPlus/distributions.h>
+
+#include <boost/property_tree/ptree.hpp>
+#include <boost/property_tree/json_parser.hpp>
+#include <boost/thread.hpp>
+#include <boost/foreach.hpp>
+
+#include <time.h>
+#include <cstdio>
+#include <cstring>
+
+using namespace MCPP;
+using boost::property_tree::ptree;
+
+#define SCALING_TMP_FILE "mcpp_scaling.h5"
+#define SCALING_SHARD_PREFIX "mcpp_scaling.shard-"
+
+/**
+ * @brief Describes a single benchmark run
+ */
+
+struct Configuration {
+    string name;
+    string sampleType;  // "bilayer", "slab" or "graded"
+    uint nLayers;
+    uint nHistograms;
+    bool rawOutput;
+    bool sharedHistograms;
+    uint nThreads;
+    u_int64_t nPhotons;
+};
+
+struct Result {
+    string name;
+    uint nThreads;
+    u_int64_t nPhotons;
+    double seconds;
+    double photonsPerSecond;
+    double photonsPerSecondPerThread;
+};
+
+static Sample *newSample(const Configuration &cfg, vector<Material *> *mats)
+{
+    Sample *sample = new Sample();
+    Material *air = new Air();
+    mats->push_back(air);
+
+    if(cfg.sampleType == "bilayer") {
+        // same as tests/testCounters.cpp
+        Material *mat1 = new Material();
+        Material *mat2 = new Material();
+        mat1->n = 1.5;
+        mat1->ls = 1;
+        mat1->g = 0;
+        mat2->n = 1.3;
+        mat2->ls = 2;
+        mat2->g = 0.5;
+        mats->push_back(mat1);
+        mats->push_back(mat2);
+        sample->addLayer(mat1, 40);
+        sample->addLayer(mat2, 40);
+    }
+    else if(cfg.sampleType == "slab") {
+        // thick diffusive slab
+        Material *mat = new Material();
+        mat->n = 1.4;
+        mat->ls = 0.5;
+        mat->g = 0.8;
+        mats->push_back(mat);
+        sample->addLayer(mat, 200);
+    }
+    else {
+        // graded refractive index, total thickness 80
+        for (uint i = 0; i < cfg.nLayers; ++i) {
+            Material *mat = new Material();
+            mat->n = 1.3 + 0.2 * i / (cfg.nLayers > 1 ? cfg.nLayers - 1 : 1);
+            mat->ls = 1;
+            mat->g = 0.5;
+            mats->push_back(mat);
+            sample->addLayer(mat, 80. / cfg.nLayers);
+        }
+    }
+    sample->setSurroundingEnvironment(air);
+    return sample;
+}
+
+static void addHistograms(Simulation *sim, uint nHistograms, bool shared)
+{
+    for (uint i = 0; i < nHistograms; ++i) {
+        Histogram *hist = new Histogram();
+        stringstream ss;
+        ss << "hist-" << i;
+        hist->setName(ss.str().c_str());
+        hist->setPhotonTypeFlags(FLAG_TRANSMITTED | FLAG_REFLECTED);
+        switch (i % 4) {
+        case 0:
+            hist->setDataDomain(DATA_TIMES);
+            hist->setMax(50);
+            hist->setBinSize(1);
+            hist->addMomentExponent(2);
+            break;
+        case 1:
+            hist->setDataDomain(DATA_POINTS);
+            hist->setMax(500);
+            hist->setBinSize(2);
+            break;
+        case 2:
+            hist->setDataDomain(DATA_K);
+            hist->setMax(90);
+            hist->setBinSize(5);
+            break;
+        default:
+            hist->setDataDomain(DATA_POINTS, DATA_TIMES);
+            hist->setMax(500, 50);
+            hist->setBinSize(2, 1);
+            break;
+        }
+        // spatial moments cannot be shared
+        hist->setSharedAcrossThreads(shared && i % 4 != 0);
+        sim->addHistogram(hist);
+    }
+}
+
+static Result runConfiguration(const Configuration &cfg)
+{
+    vector<Material *> mats;
+    Source *src = new PencilBeamSource();
+    src->setWalkTimeDistribution(new DeltaDistribution(0));
+
+    Simulation *sim = new Simulation();
+    sim->setSample(newSample(cfg, &mats));
+    sim->setSource(src);
+    addHistograms(sim, cfg.nHistograms, cfg.sharedHistograms);
+    sim->setNPhotons(cfg.nPhotons);
+    sim->setNThreads(cfg.nThreads);
+    sim->setSeed(0);
+    if(cfg.rawOutput) {
+        sim->setRawOutputEnabled(true);
+        sim->setExitPointsSaveFlags(FLAG_ALL_WALKERS);
+        sim->setWalkTimesSaveFlags(FLAG_ALL_WALKERS);
+        sim->setExitKVectorsSaveFlags(FLAG_ALL_WALKERS);
+        sim->setExitKVectorsDirsSaveFlags(DIR_X | DIR_Y | DIR_Z);
+    }
+    remove(SCALING_TMP_FILE);
+    sim->setOutputFileName(SCALING_TMP_FILE);
+
+    double start = monotonicTime();
+    sim->run();
+    double seconds = monotonicTime() - start;
+
+    delete sim;
+    for (size_t i = 0; i < mats.size(); ++i) {
+        delete mats[i];
+    }
+    remove(SCALING_TMP_FILE);
+    for (unsigned int i = 0; i < cfg.nThreads; ++i) {
+        stringstream ss;
+        ss << SCALING_SHARD_PREFIX << i << ".h5";
+        remove(ss.str().c_str());
+    }
+
+    Result r;
+    r.name = cfg.name;
+    r.nThreads = cfg.nThreads;
+    r.nPhotons = cfg.nPhotons;
+    r.seconds = seconds;
+    r.photonsPerSecond = cfg.nPhotons / seconds;
+    r.photonsPerSecondPerThread = r.photonsPerSecond / cfg.nThreads;
+    return r;
+}
+
+static Configuration newConfiguration(const string &name,
+                                      const string &sampleType,
+                                      u_int64_t nPhotons, uint nThreads)
+{
+    Configuration cfg;
+    cfg.name = name;
+    cfg.sampleType = sampleType;
+    cfg.nLayers = 2;
+    cfg.nHistograms = 4;
+    cfg.rawOutput = false;
+    cfg.sharedHistograms = false;
+    cfg.nThreads = nThreads;
+    cfg.nPhotons = nPhotons;
+    return cfg;
+}
+
+static vector<Configuration> canonicalConfigurations(double scale,
+                                                     uint maxThreads)
+{
+    vector<Configuration> cfgs;
+    const u_int64_t N = 200000 * scale;
+
+    vector<uint> threadCounts;
+    for (uint t = 1; t < maxThreads; t *= 2)
+        threadCounts.push_back(t);
+    threadCounts.push_back(maxThreads);
+
+    const char *samples[] = {"bilayer", "slab"};
+    for (uint s = 0; s < 2; ++s) {
+        for (size_t i = 0; i < threadCounts.size(); ++i) {
+            uint t = threadCounts[i];
+            stringstream ss;
+            ss << samples[s] << "/strong/threads=" << t;
+            cfgs.push_back(newConfiguration(ss.str(), samples[s], N, t));
+            ss.str("");
+            ss << samples[s] << "/weak/threads=" << t;
+            cfgs.push_back(newConfiguration(ss.str(), samples[s], N / 4 * t,
+                                            t));
+        }
+    }
+
+    uint layerCounts[] = {2, 8, 32};
+    for (uint i = 0; i < 3; ++i) {
+        stringstream ss;
+        ss << "graded/layers=" << layerCounts[i];
+        Configuration cfg = newConfiguration(ss.str(), "graded", N, 1);
+        cfg.nLayers = layerCounts[i];
+        cfgs.push_back(cfg);
+    }
+
+    uint histCounts[] = {0, 4, 16};
+    for (uint i = 0; i < 3; ++i) {
+        stringstream ss;
+        ss << "bilayer/histograms=" << histCounts[i];
+        Configuration cfg = newConfiguration(ss.str(), "bilayer", N, 1);
+        cfg.nHistograms = histCounts[i];
+        cfgs.push_back(cfg);
+    }
+
+    for (size_t i = 0; i < threadCounts.size(); ++i) {
+        uint t = threadCounts[i];
+        stringstream ss;
+        ss << "raw-output/threads=" << t;
+        Configuration cfg = newConfiguration(ss.str(), "bilayer", N, t);
+        cfg.rawOutput = true;
+        cfgs.push_back(cfg);
+    }
+
+    for (size_t i = 0; i < threadCounts.size(); ++i) {
+        uint t = threadCounts[i];
+        stringstream ss;
+        ss << "shared-histograms/threads=" << t;
+        Configuration cfg = newConfiguration(ss.str(), "bilayer", N, t);
+        cfg.nHistograms = 16;
+        cfg.sharedHistograms = true;
+        cfgs.push_back(cfg);
+    }
+
+    return cfgs;
+}
+
+static void writeResults(const char *fileName, const vector<Result> &results)
+{
+    ptree root, list;
+    for (size_t i = 0; i < results.size(); ++i) {
+        const Result &r = results[i];
+        ptree item;
+        item.put("name", r.name);
+        item.put("threads", r.nThreads);
+        item.put("photons", r.nPhotons);
+        item.put("seconds", r.seconds);
+        item.put("photons_per_s", r.photonsPerSecond);
+        item.put("photons_per_s_per_thread", r.photonsPerSecondPerThread);
+        list.push_back(make_pair("", item));
+    }
+    root.add_child("results", list);
+    write_json(fileName, root);
+}
+
+/**
+ * @brief Compares the results with a baseline
+ * @return the number of regressions
+ *
+ * A regression is a per-thread throughput lower than the baseline by more than
+ * the given relative tolerance. Results missing from the baseline are skipped.
+ */
+
+static uint compareWithBaseline(const char *fileName,
+                                const vector<Result> &results,
+                                double tolerance)
+{
+    ptree root;
+    try {
+        read_json(fileName, root);
+    }
+    catch (boost::property_tree::json_parser_error &e) {
+        fprintf(stderr, "Cannot read baseline %s: %s\n", fileName, e.what());
+        return 1;
+    }
+
+    map<string, double> baseline;
+    BOOST_FOREACH(const ptree::value_type &v, root.get_child("results")) {
+        baseline[v.second.get<string>("name")] =
+                v.second.get<double>("photons_per_s_per_thread");
+    }
+
+    uint regressions = 0;
+    printf("\n%-36s %14s %14s %9s\n", "benchmark", "baseline", "current",
+           "change");
+    for (size_t i = 0; i < results.size(); ++i) {
+        const Result &r = results[i];
+        if(baseline.find(r.name) == baseline.end())
+            continue;
+        double b = baseline[r.name];
+        double change = r.photonsPerSecondPerThread / b - 1;
+        bool regression = change < -tolerance;
+        if(regression)
+            regressions++;
+        printf("%-36s %14.0f %14.0f %+8.1f%%%s\n", r.name.c_str(), b,
+               r.photonsPerSecondPerThread, 100 * change,
+               regression ? "  REGRESSION" : "");
+    }
+    return regressions;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *outputFile = NULL;
+    const char *baselineFile = NULL;
+    double tolerance = 0.1;
+    double scale = 1;
+    uint maxThreads = boost::thread::hardware_concurrency();
+    vector<string> filters;
+
+    for (int i = 1; i < argc; ++i) {
+        if(!strcmp(argv[i], "--output") && i + 1 < argc)
+            outputFile = argv[++i];
+        else if(!strcmp(argv[i], "--baseline") && i + 1 < argc)
+            baselineFile = argv[++i];
+        else if(!strcmp(argv[i], "--tolerance") && i + 1 < argc)
+            tolerance = atof(argv[++i]);
+        else if(!strcmp(argv[i], "--scale") && i + 1 < argc)
+            scale = atof(argv[++i]);
+        else if(!strcmp(argv[i], "--max-threads") && i + 1 < argc)
+            maxThreads = atoi(argv[++i]);
+        else
+            filters.push_back(argv[i]);
+    }
+    if(maxThreads == 0)
+        maxThreads = 1;
+
+    vector<Configuration> cfgs = canonicalConfigurations(scale, maxThreads);
+    vector<Result> results;
+
+    for (size_t i = 0; i < cfgs.size(); ++i) {
+        bool selected = filters.empty();
+        for (size_t j = 0; j < filters.size(); ++j) {
+            if(cfgs[i].name.find(filters[j]) != string::npos)
+                selected = true;
+        }
+        if(!selected)
+            continue;
+        results.push_back(runConfiguration(cfgs[i]));
+    }
+
+    printf("%-36s %8s %12s %10s %14s %14s\n", "benchmark", "threads",
+           "photons", "seconds", "photons/s", "photons/s/thr");
+    for (size_t i = 0; i < results.size(); ++i) {
+        const Result &r = results[i];
+        printf("%-36s %8u %12lu %10.3f %14.0f %14.0f\n", r.name.c_str(),
+               r.nThreads, r.nPhotons, r.seconds, r.photonsPerSecond,
+               r.photonsPerSecondPerThread);
+    }
+
+    if(outputFile != NULL)
+        writeResults(outputFile, results);
+
+    if(baselineFile != NULL
+            && compareWithBaseline(baselineFile, results, tolerance) > 0)
+        return 1;
+    return 0;
+}
@@ -17,6 +17,8 @@
 
 #include <MCPlusPlus/MCglobal.h>
 
+#include <time.h>
+
 namespace MCPP {
 
 uint walkerFlagToType(walkerFlags flag)
@@ -85,4 +87,18 @@ unsigned int walkerSaveFlags(const string flags) {
     return ret;
 }
 
+/**
+ * @brief Seconds elapsed since an arbitrary point, from a monotonic clock
+ *
+ * For measuring intervals and rates, unaffected by changes of the system
+ * time.
+ */
+
+double monotonicTime()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
 }
@@ -0,0 +1,120 @@
+/*
+  This file is part of MCPlusPlus.
+
+  MCPlusPlus is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Mcplusplus is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with MCPlusPlus.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <MCPlusPlus/beamconvolver.h>
+
+#include <cmath>
+#include <algorithm>
+#include <boost/math/constants/constants.hpp>
+#include <boost/math/distributions/non_central_chi_squared.hpp>
+
+using namespace boost::math::constants;
+using namespace MCPP;
+
+/**
+ * @brief Computes the ring-to-ring transfer probabilities
+ * @param edges edges of the regular bins of the radial axis (i.e. excluding
+ * the overflow bin), non-negative and increasing
+ * @param FWHM full width at half maximum of the beam intensity profile, as in
+ * GaussianBeamSource
+ */
+
+BeamConvolver::BeamConvolver(const vector<double> &edges, const double FWHM)
+{
+    n = edges.empty() ? 0 : edges.size() - 1;
+    sigma = FWHM / (2 * root_ln_four<double>());
+    _valid = n > 0 && sigma > 0 && edges[0] >= 0;
+    if(!_valid)
+        return;
+
+    const double cutoff = BEAM_CONVOLVER_CUTOFF * sigma;
+    const size_t Q = BEAM_CONVOLVER_SUBRINGS;
+    first.resize(n);
+    weights.resize(n);
+    for (size_t j = 0; j < n; ++j) {
+        const double a2 = edges[j] * edges[j];
+        const double b2 = edges[j + 1] * edges[j + 1];
+
+        // destination bins within the cutoff, n being the overflow bin
+        size_t lo = upper_bound(edges.begin(), edges.end(),
+                                edges[j] - cutoff) - edges.begin();
+        size_t hi = upper_bound(edges.begin(), edges.end(),
+                                edges[j + 1] + cutoff) - edges.begin();
+        lo = lo > 0 ? lo - 1 : 0;
+        hi = std::min(hi, n);
+        first[j] = lo;
+        vector<double> &w = weights[j];
+        w.assign(hi - lo + 1, 0);
+
+        for (size_t q = 0; q < Q; ++q) {
+            const double r0 = sqrt(a2 + (q + 0.5) / Q * (b2 - a2));
+            double below = cdf(r0, edges[lo]);
+            for (size_t i = lo; i < hi; ++i) {
+                double above = cdf(r0, edges[i + 1]);
+                w[i - lo] += (above - below) / Q;
+                below = above;
+            }
+            if(hi == n)
+                w[n - lo] += (1 - below) / Q;
+        }
+    }
+}
+
+/**
+ * @brief Whether the profile could be discretized
+ */
+
+bool BeamConvolver::valid() const
+{
+    return _valid;
+}
+
+/**
+ * @brief Convolves the given counts with the beam profile
+ * @param in nBins regular bins followed by the overflow bin
+ * @param out as in
+ */
+
+void BeamConvolver::convolve(const double *in, double *out) const
+{
+    for (size_t i = 0; i < n; ++i)
+        out[i] = 0;
+    out[n] = in[n];
+    for (size_t j = 0; j < n; ++j) {
+        if(in[j] == 0)
+            continue;
+        const vector<double> &w = weights[j];
+        double *dest = out + first[j];
+        for (size_t i = 0; i < w.size(); ++i)
+            dest[i] += in[j] * w[i];
+    }
+}
+
+/**
+ * @brief Probability that a photon exiting at radius r0 in the pencil-beam
+ * response exits within radius r
+ */
+
+double BeamConvolver::cdf(const double r0, const double r) const
+{
+    if(r <= r0 - BEAM_CONVOLVER_CUTOFF * sigma || r <= 0)
+        return 0;
+    if(r >= r0 + BEAM_CONVOLVER_CUTOFF * sigma)
+        return 1;
+    boost::math::non_central_chi_squared rice(2, (r0 / sigma) * (r0 / sigma));
+    return boost::math::cdf(rice, (r / sigma) * (r / sigma));
+}
@@ -0,0 +1,324 @@
+/*
+  This file is part of MCPlusPlus.
+
+  MCPlusPlus is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Mcplusplus is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with MCPlusPlus.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <MCPlusPlus/detector.h>
+
+#include <cmath>
+#include <boost/math/constants/constants.hpp>
+
+using namespace boost::math::constants;
+using namespace MCPP;
+
+
+
+// Detector
+
+Detector::Detector(BaseObject *parent) :
+    BaseObject(parent)
+{
+}
+
+Detector::~Detector()
+{
+}
+
+
+
+
+// Radial range detector
+
+RadialRangeDetector::RadialRangeDetector(double rMin, double rMax,
+                                         BaseObject *parent) :
+    Detector(parent)
+{
+    this->rMin = rMin;
+    this->rMax = rMax;
+    rMin2 = rMin * rMin;
+    rMax2 = rMax * rMax;
+}
+
+bool RadialRangeDetector::accept(const Walker * const w) const
+{
+    MCfloat r2 = w->r0[0] * w->r0[0] + w->r0[1] * w->r0[1];
+    return r2 >= rMin2 && r2 < rMax2;
+}
+
+BaseObject *RadialRangeDetector::clone_impl() const
+{
+    return new RadialRangeDetector(rMin, rMax);
+}
+
+bool RadialRangeDetector::sanityCheck_impl() const
+{
+    return rMin >= 0 && rMax > rMin;
+}
+
+void RadialRangeDetector::describe_impl() const
+{
+    logMessage("rMin = %f, rMax = %f", rMin, rMax);
+}
+
+
+
+
+// Ring detector
+
+/**
+ * @brief Constructs a ring detector
+ * @param radius mean radius of the ring
+ * @param width width of the ring
+ * @param x0 \f$ x \f$ coordinate of the center of the ring
+ * @param y0 \f$ y \f$ coordinate of the center of the ring
+ * @param parent
+ */
+
+RingDetector::RingDetector(double radius, double width, double x0, double y0,
+                           BaseObject *parent) :
+    Detector(parent)
+{
+    this->radius = radius;
+    this->width = width;
+    this->x0 = x0;
+    this->y0 = y0;
+    MCfloat rMin = radius - width / 2;
+    MCfloat rMax = radius + width / 2;
+    rMin2 = rMin > 0 ? rMin * rMin : 0;
+    rMax2 = rMax * rMax;
+}
+
+bool RingDetector::accept(const Walker * const w) const
+{
+    MCfloat dx = w->r0[0] - x0;
+    MCfloat dy = w->r0[1] - y0;
+    MCfloat r2 = dx * dx + dy * dy;
+    return r2 >= rMin2 && r2 < rMax2;
+}
+
+BaseObject *RingDetector::clone_impl() const
+{
+    return new RingDetector(radius, width, x0, y0);
+}
+
+bool RingDetector::sanityCheck_impl() const
+{
+    return radius >= 0 && width > 0;
+}
+
+void RingDetector::describe_impl() const
+{
+    logMessage("radius = %f, width = %f, center = (%f, %f)",
+               radius, width, x0, y0);
+}
+
+
+
+
+// Rectangular detector
+
+RectangularDetector::RectangularDetector(double xMin, double xMax, double yMin,
+                                         double yMax, BaseObject *parent) :
+    Detector(parent)
+{
+    this->xMin = xMin;
+    this->xMax = xMax;
+    this->yMin = yMin;
+    this->yMax = yMax;
+}
+
+bool RectangularDetector::accept(const Walker * const w) const
+{
+    return w->r0[0] >= xMin && w->r0[0] < xMax
+            && w->r0[1] >= yMin && w->r0[1] < yMax;
+}
+
+BaseObject *RectangularDetector::clone_impl() const
+{
+    return new RectangularDetector(xMin, xMax, yMin, yMax);
+}
+
+bool RectangularDetector::sanityCheck_impl() const
+{
+    return xMax > xMin && yMax > yMin;
+}
+
+void RectangularDetector::describe_impl() const
+{
+    logMessage("x = [%f, %f), y = [%f, %f)", xMin, xMax, yMin, yMax);
+}
+
+
+
+
+// Acceptance cone detector
+
+/**
+ * @brief Constructs an acceptance cone detector
+ * @param halfAngle half-angle of the cone, in degrees
+ * @param parent
+ */
+
+AcceptanceConeDetector::AcceptanceConeDetector(double halfAngle,
+                                               BaseObject *parent) :
+    Detector(parent)
+{
+    setHalfAngle(halfAngle);
+}
+
+/**
+ * @brief Sets the half-angle of the acceptance cone
+ * @param halfAngle in degrees
+ */
+
+void AcceptanceConeDetector::setHalfAngle(double halfAngle)
+{
+    this->halfAngle = halfAngle;
+    cosHalfAngle = cos(halfAngle * pi<MCfloat>() / 180);
+}
+
+/**
+ * @brief Sets the acceptance cone from a numerical aperture
+ * @param NA numerical aperture \f$ NA = n \sin \theta \f$
+ * @param n refractive index of the medium surrounding the sample on the
+ * detection side
+ */
+
+void AcceptanceConeDetector::setNumericalAperture(double NA, double n)
+{
+    setHalfAngle(asin(NA / n) * 180 / pi<MCfloat>());
+}
+
+bool AcceptanceConeDetector::accept(const Walker * const w) const
+{
+    return fabs(w->k0[2]) >= cosHalfAngle;
+}
+
+BaseObject *AcceptanceConeDetector::clone_impl() const
+{
+    return new AcceptanceConeDetector(halfAngle);
+}
+
+bool AcceptanceConeDetector::sanityCheck_impl() const
+{
+    return halfAngle > 0 && halfAngle <= 90;
+}
+
+void AcceptanceConeDetector::describe_impl() const
+{
+    logMessage("half-angle = %f deg", halfAngle);
+}
+
+
+
+
+// Time gate detector
+
+TimeGateDetector::TimeGateDetector(double tMin, double tMax,
+                                   BaseObject *parent) :
+    Detector(parent)
+{
+    this->tMin = tMin;
+    this->tMax = tMax;
+}
+
+bool TimeGateDetector::accept(const Walker * const w) const
+{
+    return w->walkTime >= tMin && w->walkTime < tMax;
+}
+
+BaseObject *TimeGateDetector::clone_impl() const
+{
+    return new TimeGateDetector(tMin, tMax);
+}
+
+bool TimeGateDetector::sanityCheck_impl() const
+{
+    return tMax > tMin;
+}
+
+void TimeGateDetector::describe_impl() const
+{
+    logMessage("t = [%f, %f)", tMin, tMax);
+}
+
+
+
+
+// Composite detector
+
+CompositeDetector::CompositeDetector(Mode mode, BaseObject *parent) :
+    Detector(parent)
+{
+    this->mode = mode;
+}
+
+/**
+ * @brief Adds a detector to the combination. The composite detector takes
+ * ownership of the detector.
+ * @param detector
+ */
+
+void CompositeDetector::addDetector(Detector *detector)
+{
+    detector->setParent(this);
+    detectors.push_back(detector);
+}
+
+bool CompositeDetector::accept(const Walker * const w) const
+{
+    if(mode == DETECTOR_ANY) {
+        for (size_t i = 0; i < detectors.size(); ++i) {
+            if(detectors[i]->accept(w))
+                return true;
+        }
+        return false;
+    }
+
+    for (size_t i = 0; i < detectors.size(); ++i) {
+        if(!detectors[i]->accept(w))
+            return false;
+    }
+    return true;
+}
+
+BaseObject *CompositeDetector::clone_impl() const
+{
+    CompositeDetector *d = new CompositeDetector(mode);
+    for (size_t i = 0; i < detectors.size(); ++i) {
+        d->addDetector((Detector *)detectors[i]->clone());
+    }
+    return d;
+}
+
+bool CompositeDetector::sanityCheck_impl() const
+{
+    if(detectors.empty())
+        return false;
+    for (size_t i = 0; i < detectors.size(); ++i) {
+        if(!detectors[i]->sanityCheck())
+            return false;
+    }
+    return true;
+}
+
+void CompositeDetector::describe_impl() const
+{
+    logMessage("%lu detectors, mode = %s", detectors.size(),
+               mode == DETECTOR_ALL ? "all" : "any");
+    for (size_t i = 0; i < detectors.size(); ++i) {
+        detectors[i]->describe();
+    }
+}
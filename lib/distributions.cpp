@@ -17,6 +17,7 @@
 
 #include <MCPlusPlus/distributions.h>
 
+#include <limits>
 #include <boost/math/constants/constants.hpp>
 
 using namespace boost::math::constants;
@@ -67,6 +68,21 @@ void AbstractDistribution::setRNG_impl() {
     reset();
 }
 
+/**
+ * @brief Cumulative distribution function \f$ P(X \leq x) \f$
+ * @param x
+ * @return NaN, i.e. not available, unless reimplemented by derived classes
+ *
+ * The cdf is used to discretize a distribution without drawing random
+ * numbers, e.g. to convolve histograms with a pulse profile (see
+ * PulseConvolver).
+ */
+
+double AbstractDistribution::cdf(const double x) const
+{
+    return numeric_limits<double>::quiet_NaN();
+}
+
 
 
 
@@ -86,6 +102,11 @@ MCfloat DeltaDistribution::spin() const {
     return x0;
 }
 
+double DeltaDistribution::cdf(const double x) const
+{
+    return x >= x0 ? 1 : 0;
+}
+
 BaseObject * DeltaDistribution::clone_impl() const
 {
     return new DeltaDistribution(x0);
@@ -151,6 +172,11 @@ MCfloat NormalDistribution::spin() const {
     return (*distribution)(*mt);
 }
 
+double NormalDistribution::cdf(const double x) const
+{
+    return 0.5 * erfc(-(x - mean) / (sigma * root_two<double>()));
+}
+
 
 
 
@@ -178,6 +204,15 @@ MCfloat UniformDistribution::spin() const {
     return distribution(*mt);
 }
 
+double UniformDistribution::cdf(const double x) const
+{
+    if(x <= min)
+        return 0;
+    if(x >= max)
+        return 1;
+    return (x - min) / (max - min);
+}
+
 /**
  * @brief Spins a number uniformly distributed in the open interval
  *        \f$ [\textup{min,max}) \f$
@@ -254,6 +289,11 @@ MCfloat ExponentialDistribution::spin() const {
     return distribution(*mt);
 }
 
+double ExponentialDistribution::cdf(const double x) const
+{
+    return x <= 0 ? 0 : -expm1(-lambda * x);
+}
+
 
 
 
@@ -276,6 +316,11 @@ MCfloat Sech2Distribution::spin() const {
     return  mean + scale*log(p/(1.-p));
 }
 
+double Sech2Distribution::cdf(const double x) const
+{
+    return 1. / (1. + exp(-(x - mean) / scale));
+}
+
 BaseObject *Sech2Distribution::clone_impl() const
 {
     return new Sech2Distribution(mean,scale);
@@ -0,0 +1,67 @@
+/*
+  This file is part of MCPlusPlus.
+
+  MCPlusPlus is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Mcplusplus is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with MCPlusPlus.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <MCPlusPlus/exitobserver.h>
+
+using namespace MCPP;
+
+ExitObserver::ExitObserver(BaseObject *parent) :
+    BaseObject(parent)
+{
+}
+
+ExitObserver::~ExitObserver()
+{
+}
+
+/**
+ * @brief Sets up the observer for a new run
+ *
+ * Called at the beginning of every run, on the observer and on each of its
+ * clones. The default implementation does nothing.
+ */
+
+void ExitObserver::initialize()
+{
+}
+
+/**
+ * @brief Registers the derived quantities needed by observe()
+ * @param batch
+ *
+ * Call WalkerBatch::require() with the needed #batchColumns. The default
+ * implementation requires none.
+ */
+
+void ExitObserver::requireColumns(WalkerBatch *batch) const
+{
+}
+
+/**
+ * @brief Saves the results at the end of the simulation
+ * @param fileName the H5 output file of the simulation, which might not have
+ * been created yet
+ * @param groupName if not NULL, the group of the simulation within the file,
+ * see SimulationBatch
+ *
+ * The default implementation does nothing.
+ */
+
+void ExitObserver::saveToFile(const char *fileName,
+                              const char *groupName) const
+{
+}
@@ -32,6 +32,7 @@ H5FileHelper::H5FileHelper(BaseObject *parent) :
     dataSpace = NULL;
     dataSet = NULL;
     dims = NULL;
+    latestFormat = false;
 }
 
 H5FileHelper::~H5FileHelper() {
@@ -138,7 +139,7 @@ bool H5FileHelper::_openFile(const char *fileName) {
             return false;
         }
 
-        file->openFile(fileName, H5F_ACC_RDWR);
+        file->openFile(fileName, H5F_ACC_RDWR, fileAccessList());
         opened = true;
     }
     catch ( Exception error )
@@ -149,6 +150,58 @@ bool H5FileHelper::_openFile(const char *fileName) {
     return true;
 }
 
+/**
+ * @brief Makes files created or opened afterwards use the latest file format
+ * @param enable
+ *
+ * The latest file format is required by SWMR (see startSWMRWrite()) and
+ * cannot be read by HDF5 versions older than 1.10.
+ */
+
+void H5FileHelper::setLatestFormat(bool enable)
+{
+    latestFormat = enable;
+}
+
+/**
+ * @brief Switches the open file to single-writer/multiple-reader (SWMR) mode
+ * @return true on success, false on error
+ *
+ * Afterwards, readers can open the file concurrently with the
+ * H5F_ACC_SWMR_READ flag and see the data written up to the last flush().
+ * Existing datasets can be written and extended, but no object or attribute
+ * can be created until the file is closed.
+ *
+ * \pre The file must have been created and opened with setLatestFormat().
+ */
+
+bool H5FileHelper::startSWMRWrite()
+{
+    closeDataSet();
+    if(H5Fstart_swmr_write(file->getId()) < 0) {
+        logMessage("Cannot start SWMR write mode on %s", fName);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Flushes the open file to disk
+ */
+
+void H5FileHelper::flush()
+{
+    file->flush(H5F_SCOPE_GLOBAL);
+}
+
+FileAccPropList H5FileHelper::fileAccessList() const
+{
+    FileAccPropList fapl;
+    if(latestFormat)
+        fapl.setLibverBounds(H5F_LIBVER_LATEST, H5F_LIBVER_LATEST);
+    return fapl;
+}
+
 /**
  * @brief Reopens the currently open HDF5 file
  */
@@ -170,7 +223,8 @@ bool H5FileHelper::newFile(const char *fileName) {
     logMessage("Creating new file %s... ", fileName);
 #endif
     try{
-        file = new H5File(fileName, H5F_ACC_TRUNC);
+        file = new H5File(fileName, H5F_ACC_TRUNC,
+                          FileCreatPropList::DEFAULT, fileAccessList());
         opened = true;
     }
     catch (Exception error) {
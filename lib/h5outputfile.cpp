@@ -19,15 +19,84 @@
 
 #include <fstream>
 #include <string.h>
+#include <cmath>
+#include <stdint.h>
 
 #define MAX_RNGSTATE_STR_LEN 6900
+#define OCT_MAX 65535.
 
 using namespace MCPP;
 
+static int32_t encodeFixedPoint(const MCfloat x, const double scale,
+                                const double offset)
+{
+    double q = floor((x - offset) / scale + 0.5);
+    if(q > INT32_MAX)
+        return INT32_MAX;
+    if(q < INT32_MIN)
+        return INT32_MIN;
+    return q;
+}
+
+static inline MCfloat signNotZero(const MCfloat x)
+{
+    return x >= 0 ? 1 : -1;
+}
+
+/**
+ * @brief Maps a unit vector on the octahedron \f$ |x| + |y| + |z| = 1 \f$,
+ * whose lower half is folded onto the upper one, and quantizes the resulting
+ * \f$ (x,y) \f$ coordinates in \f$ [-1,1] \f$ to 16 bits
+ */
+
+static void encodeOctahedral(const MCfloat *k, uint16_t *dest)
+{
+    MCfloat l1 = fabs(k[0]) + fabs(k[1]) + fabs(k[2]);
+    MCfloat px = k[0] / l1;
+    MCfloat py = k[1] / l1;
+    if(k[2] < 0) {
+        MCfloat tx = (1 - fabs(py)) * signNotZero(px);
+        py = (1 - fabs(px)) * signNotZero(py);
+        px = tx;
+    }
+    dest[0] = floor((px * 0.5 + 0.5) * OCT_MAX + 0.5);
+    dest[1] = floor((py * 0.5 + 0.5) * OCT_MAX + 0.5);
+}
+
+static void decodeOctahedral(const uint16_t *src, MCfloat *k)
+{
+    MCfloat px = src[0] / OCT_MAX * 2 - 1;
+    MCfloat py = src[1] / OCT_MAX * 2 - 1;
+    MCfloat pz = 1 - fabs(px) - fabs(py);
+    if(pz < 0) {
+        MCfloat tx = (1 - fabs(py)) * signNotZero(px);
+        py = (1 - fabs(px)) * signNotZero(py);
+        px = tx;
+    }
+    MCfloat norm = sqrt(px * px + py * py + pz * pz);
+    k[0] = px / norm;
+    k[1] = py / norm;
+    k[2] = pz / norm;
+}
+
+RawDatasetOptions::RawDatasetOptions(hsize_t chunkSize, int deflateLevel,
+                                     bool shuffle, RawEncoding encoding,
+                                     double scale, double offset)
+{
+    this->chunkSize = chunkSize;
+    this->deflateLevel = deflateLevel;
+    this->shuffle = shuffle;
+    filter = H5Z_FILTER_NONE;
+    this->encoding = encoding;
+    this->scale = scale;
+    this->offset = offset;
+}
+
 H5OutputFile::H5OutputFile()
     : H5FileHelper()
 {
     memset(_photonCounters,0,4*sizeof(u_int64_t));
+    setRawDatasetFlags(FLAG_ALL_WALKERS, FLAG_ALL_WALKERS, FLAG_ALL_WALKERS);
 }
 
 H5OutputFile::~H5OutputFile()
@@ -41,23 +110,37 @@ bool H5OutputFile::newFile(const char *fileName, bool create_datasets)
     if(!ret)
         return false;
 
+    rootGroup = "";
+    return initializeGroup(create_datasets);
+}
+
+/**
+ * @brief Creates the datasets common to every simulation in the current root
+ * group
+ * @param create_datasets whether to create the raw output datasets too
+ * @return
+ */
+
+bool H5OutputFile::initializeGroup(bool create_datasets)
+{
     int ndims = 1;
     hsize_t dims[ndims];
     dims[0] = 4;
+    string dsName = path("photon-counters");
     try {
         DataSpace dspace(ndims, dims, dims);
-        DataSet dset = file->createDataSet("photon-counters",
-                                           PredType::NATIVE_INT64, dspace);
+        DataSet dset = file->createDataSet(dsName, PredType::NATIVE_INT64,
+                                           dspace);
         dspace.close();
         dset.close();
     }
     catch (Exception error) {
-        logMessage("Cannot create dataset %s.\n", "photon-counters");
+        logMessage("Cannot create dataset %s.\n", dsName.c_str());
     }
 
     if(create_datasets) {
-        ret = createDatasets(FLAG_ALL_WALKERS, FLAG_ALL_WALKERS,
-                             FLAG_ALL_WALKERS);
+        bool ret = createDatasets(rawFlags[DATA_TIMES], rawFlags[DATA_POINTS],
+                                  rawFlags[DATA_K]);
         if(!ret)
             return false;
     }
@@ -67,149 +150,179 @@ bool H5OutputFile::newFile(const char *fileName, bool create_datasets)
 void H5OutputFile::appendExitKVectors(walkerType type, const MCfloat *buffer,
                                       const hsize_t size)
 {
-    switch (type) {
-    case TRANSMITTED:
-        appendTo1Ddataset("exit-k-vectors/transmitted", buffer, size);
-        break;
-    case BALLISTIC:
-        appendTo1Ddataset("exit-k-vectors/ballistic", buffer, size);
-        break;
-    case REFLECTED:
-        appendTo1Ddataset("exit-k-vectors/reflected", buffer, size);
-        break;
-    case BACKREFLECTED:
-        appendTo1Ddataset("exit-k-vectors/back-reflected", buffer, size);
-        break;
-    default:
-        break;
-    }
+    appendTo1Ddataset(rawDatasetName(DATA_K, type).c_str(), buffer, size);
 }
 
 void H5OutputFile::appendExitPoints(walkerType type, const MCfloat *buffer,
                                     const hsize_t size)
 {
-    switch (type) {
-    case TRANSMITTED:
-        appendTo1Ddataset("exit-points/transmitted", buffer, size);
-        break;
-    case BALLISTIC:
-        appendTo1Ddataset("exit-points/ballistic", buffer, size);
-        break;
-    case REFLECTED:
-        appendTo1Ddataset("exit-points/reflected", buffer, size);
-        break;
-    case BACKREFLECTED:
-        appendTo1Ddataset("exit-points/back-reflected", buffer, size);
-        break;
-    default:
-        break;
-    }
+    appendTo1Ddataset(rawDatasetName(DATA_POINTS, type).c_str(), buffer, size);
 }
 
 void H5OutputFile::appendWalkTimes(walkerType type, const MCfloat *buffer,
                                    const hsize_t size)
 {
-    switch (type) {
-    case TRANSMITTED:
-        appendTo1Ddataset("walk-times/transmitted", buffer, size);
-        break;
-    case BALLISTIC:
-        appendTo1Ddataset("walk-times/ballistic", buffer, size);
-        break;
-    case REFLECTED:
-        appendTo1Ddataset("walk-times/reflected", buffer, size);
-        break;
-    case BACKREFLECTED:
-        appendTo1Ddataset("walk-times/back-reflected", buffer, size);
-        break;
-    default:
-        break;
-    }
+    appendTo1Ddataset(rawDatasetName(DATA_TIMES, type).c_str(), buffer, size);
 }
 
 bool H5OutputFile::loadExitPoints(walkerType type, MCfloat *destBuffer,
                                   const hsize_t *start, const hsize_t *count)
 {
-    bool ret = false;
-    switch (type) {
-    case TRANSMITTED:
-        ret = loadFrom1Ddataset("exit-points/transmitted", destBuffer, start,
-                                count);
-        break;
-    case BALLISTIC:
-        ret = loadFrom1Ddataset("exit-points/ballistic", destBuffer, start,
-                                count);
-        break;
-    case REFLECTED:
-        ret = loadFrom1Ddataset("exit-points/reflected", destBuffer, start,
-                                count);
-        break;
-    case BACKREFLECTED:
-        ret = loadFrom1Ddataset("exit-points/back-reflected", destBuffer, start,
-                                count);
-        break;
-    default:
-        break;
-    }
-    return ret;
+    return loadData(DATA_POINTS, type, destBuffer, start, count);
 }
 
 bool H5OutputFile::loadWalkTimes(walkerType type, MCfloat *destBuffer,
                                  const hsize_t *start, const hsize_t *count)
 {
-    bool ret = false;
-    switch (type) {
-    case TRANSMITTED:
-        ret = loadFrom1Ddataset("walk-times/transmitted", destBuffer, start,
-                                count);
-        break;
-    case BALLISTIC:
-        ret = loadFrom1Ddataset("walk-times/ballistic", destBuffer, start,
-                                count);
-        break;
-    case REFLECTED:
-        ret = loadFrom1Ddataset("walk-times/reflected", destBuffer, start,
-                                count);
-        break;
-    case BACKREFLECTED:
-        ret = loadFrom1Ddataset("walk-times/back-reflected", destBuffer, start,
-                                count);
-        break;
-    default:
-        break;
-    }
-    return ret;
+    return loadData(DATA_TIMES, type, destBuffer, start, count);
 }
 
 bool H5OutputFile::loadExitKVectors(walkerType type, MCfloat *destBuffer,
                                     const hsize_t *start, const hsize_t *count)
 {
-    bool ret = false;
-    switch (type) {
-    case TRANSMITTED:
-        ret = loadFrom1Ddataset("exit-k-vectors/transmitted", destBuffer, start,
-                                count);
-        break;
-    case BALLISTIC:
-        ret = loadFrom1Ddataset("exit-k-vectors/ballistic", destBuffer, start,
-                                count);
-        break;
-    case REFLECTED:
-        ret = loadFrom1Ddataset("exit-k-vectors/reflected", destBuffer, start,
-                                count);
-        break;
-    case BACKREFLECTED:
-        ret = loadFrom1Ddataset("exit-k-vectors/back-reflected", destBuffer,
-                                start, count);
-        break;
-    default:
-        break;
-    }
-    return ret;
+    return loadData(DATA_K, type, destBuffer, start, count);
 }
 
+/**
+ * @brief Loads raw data, decoding it if it was stored with reduced precision
+ * @param group
+ * @param type
+ * @param destBuffer
+ * @param start offset of the first value to load
+ * @param count number of values to load; if NULL the whole dataset is loaded
+ * @return true on success, false on error
+ *
+ * start and count refer to decoded MCfloat values. For octahedrally encoded
+ * k vectors they must be multiples of 3.
+ *
+ * \pre destBuffer must be big enough to hold the data, see rawDataSize().
+ */
+
 bool H5OutputFile::loadData(MCData group, walkerType type, MCfloat *destBuffer,
                             const hsize_t *start, const hsize_t *count)
+{
+    if(walkerTypeToString(type) == "")
+        return false;
+    return loadFrom1Ddataset(rawDatasetName(group, type).c_str(), destBuffer,
+                             start, count);
+}
+
+/**
+ * @brief Number of MCfloat values that loadData() returns for the given
+ * dataset
+ * @param group
+ * @param type
+ * @return 0 if the dataset does not exist
+ */
+
+hsize_t H5OutputFile::rawDataSize(MCData group, walkerType type)
+{
+    if(walkerTypeToString(type) == "")
+        return 0;
+    string dsName = rawDatasetName(group, type);
+    if(!dataSetExists(dsName.c_str()) || !openDataSet(dsName.c_str()))
+        return 0;
+    if(rawEncoding(NULL, NULL) == RAW_ENCODING_OCTAHEDRAL)
+        return dims[0] / 2 * 3;
+    return dims[0];
+}
+
+/**
+ * @brief Records in the "sampling-fraction" attribute of the raw datasets of
+ * the given type the fraction of the simulated photons they hold
+ * @param type
+ * @param fraction
+ *
+ * \see Simulation::setRawOutputReservoirSize()
+ */
+
+void H5OutputFile::setSamplingFraction(walkerType type, double fraction)
+{
+    const MCData groups[3] = {DATA_POINTS, DATA_K, DATA_TIMES};
+    for (uint i = 0; i < 3; ++i) {
+        if(!rawDatasetExists(groups[i], type))
+            continue;
+        string dsName = rawDatasetName(groups[i], type);
+        if(!openDataSet(dsName.c_str()))
+            continue;
+        if(dataSet->attrExists("sampling-fraction"))
+            dataSet->removeAttr("sampling-fraction");
+        DataSpace attrSpace(H5S_SCALAR);
+        dataSet->createAttribute("sampling-fraction", PredType::NATIVE_DOUBLE,
+                                 attrSpace).write(PredType::NATIVE_DOUBLE,
+                                                  &fraction);
+        closeDataSet();
+    }
+}
+
+/**
+ * @brief Fraction of the simulated photons held by the given raw dataset
+ * @param group
+ * @param type
+ * @return 1 if the dataset has no "sampling-fraction" attribute, i.e. holds
+ * all the photons, 0 if it does not exist
+ */
+
+double H5OutputFile::samplingFraction(MCData group, walkerType type)
+{
+    if(!rawDatasetExists(group, type)
+            || !openDataSet(rawDatasetName(group, type).c_str()))
+        return 0;
+    double fraction = 1;
+    if(dataSet->attrExists("sampling-fraction"))
+        dataSet->openAttribute("sampling-fraction").read(
+                    PredType::NATIVE_DOUBLE, &fraction);
+    return fraction;
+}
+
+/**
+ * @brief Makes the given group the root of all the datasets read or written
+ * by this object
+ * @param groupName
+ * @param create_datasets whether to create the raw output datasets if the
+ * group is created
+ * @return true on success, false on error
+ *
+ * This allows to store several independent simulations in the same file (see
+ * SimulationBatch). If the group does not exist it is created, together with
+ * the "photon-counters" dataset. Passing NULL resets the root to the file
+ * root.
+ */
+
+bool H5OutputFile::openRootGroup(const char *groupName, bool create_datasets)
+{
+    closeDataSet();
+    rootGroup = groupName == NULL ? "" : groupName;
+    memset(_photonCounters, 0, 4*sizeof(u_int64_t));
+    if(rootGroup.empty() || dataSetExists(rootGroup.c_str()))
+        return openFile_impl();
+    try {
+        newGroup(rootGroup.c_str());
+    }
+    catch (const Exception &error) {
+        logMessage("Cannot create group %s.\n", rootGroup.c_str());
+        return false;
+    }
+    return initializeGroup(create_datasets);
+}
+
+/**
+ * @brief The full path of the given dataset, taking into account the root
+ * group
+ * @param name
+ * @return
+ *
+ * \see openRootGroup()
+ */
+
+string H5OutputFile::path(const char *name) const
+{
+    if(rootGroup.empty())
+        return name;
+    return rootGroup + "/" + name;
+}
+
+string H5OutputFile::rawDatasetName(MCData group, walkerType type) const
 {
     stringstream ss;
     switch (group) {
@@ -227,7 +340,19 @@ bool H5OutputFile::loadData(MCData group, walkerType type, MCfloat *destBuffer,
     }
 
     ss << "/" << walkerTypeToString(type);
-    return loadFrom1Ddataset(ss.str().c_str(), destBuffer, start, count);
+    return path(ss.str().c_str());
+}
+
+/**
+ * @brief Whether the given raw dataset exists, checking its group first
+ */
+
+bool H5OutputFile::rawDatasetExists(MCData group, walkerType type) const
+{
+    string name = rawDatasetName(group, type);
+    string groupName = name.substr(0, name.rfind('/'));
+    return H5Lexists(file->getId(), groupName.c_str(), H5P_DEFAULT) > 0
+            && H5Lexists(file->getId(), name.c_str(), H5P_DEFAULT) > 0;
 }
 
 void H5OutputFile::appendTo1Ddataset(const char *datasetName, const MCfloat *buffer,
@@ -236,10 +361,32 @@ void H5OutputFile::appendTo1Ddataset(const char *datasetName, const MCfloat *buf
         return;
     openDataSet(datasetName);
 
-    hsize_t dims[1];
-    *dims = *extentDims();
-
-    writeHyperSlab(dims, &size, buffer);
+    double scale, offset;
+    switch (rawEncoding(&scale, &offset)) {
+    case RAW_ENCODING_FIXED_POINT:
+    {
+        vector<int32_t> q(size);
+        for (hsize_t i = 0; i < size; ++i) {
+            q[i] = encodeFixedPoint(buffer[i], scale, offset);
+        }
+        appendToCurrentDataset(q.data(), size, PredType::NATIVE_INT32);
+        break;
+    }
+    case RAW_ENCODING_OCTAHEDRAL:
+    {
+        hsize_t n = size / 3;
+        vector<uint16_t> q(2 * n);
+        for (hsize_t i = 0; i < n; ++i) {
+            encodeOctahedral(buffer + 3 * i, &q[2 * i]);
+        }
+        appendToCurrentDataset(q.data(), 2 * n, PredType::NATIVE_UINT16);
+        break;
+    }
+    default:
+        // float32 is converted by the HDF5 library
+        appendToCurrentDataset(buffer, size, MCH5FLOAT);
+        break;
+    }
 }
 
 bool H5OutputFile::loadFrom1Ddataset(const char *datasetName,
@@ -248,13 +395,128 @@ bool H5OutputFile::loadFrom1Ddataset(const char *datasetName,
 {
     if(!openDataSet(datasetName))
         return false;
-    if(count!=NULL)
-        loadHyperSlab(start, count, destBuffer);
-    else
-        loadAll(destBuffer);
+
+    double scale, offset;
+    RawEncoding encoding = rawEncoding(&scale, &offset);
+    hsize_t s = count != NULL ? *start : 0;
+    hsize_t c = count != NULL ? *count : dims[0];
+
+    switch (encoding) {
+    case RAW_ENCODING_FIXED_POINT:
+    {
+        vector<int32_t> q(c);
+        loadFromCurrentDataset(q.data(), s, c, PredType::NATIVE_INT32);
+        for (hsize_t i = 0; i < c; ++i) {
+            destBuffer[i] = q[i] * scale + offset;
+        }
+        break;
+    }
+    case RAW_ENCODING_OCTAHEDRAL:
+    {
+        if(count != NULL) {
+            if(s % 3 || c % 3) {
+                logMessage("%s: start and count must be multiples of 3",
+                           datasetName);
+                return false;
+            }
+            s = s / 3 * 2;
+            c = c / 3 * 2;
+        }
+        vector<uint16_t> q(c);
+        loadFromCurrentDataset(q.data(), s, c, PredType::NATIVE_UINT16);
+        for (hsize_t i = 0; i < c / 2; ++i) {
+            decodeOctahedral(&q[2 * i], destBuffer + 3 * i);
+        }
+        break;
+    }
+    default:
+        if(count!=NULL)
+            loadHyperSlab(start, count, destBuffer);
+        else
+            loadAll(destBuffer);
+        break;
+    }
     return true;
 }
 
+/**
+ * @brief Writes the encoding attributes of a raw dataset
+ * @param dset
+ * @param encoding
+ * @param scale
+ * @param offset
+ *
+ * Nothing is written for RAW_ENCODING_NATIVE.
+ */
+
+void H5OutputFile::writeEncoding(DataSet *dset, const RawEncoding encoding,
+                                 const double scale, const double offset)
+{
+    if(encoding == RAW_ENCODING_NATIVE)
+        return;
+    DataSpace attrSpace(H5S_SCALAR);
+    int enc = encoding;
+    dset->createAttribute("encoding", PredType::NATIVE_INT,
+                          attrSpace).write(PredType::NATIVE_INT, &enc);
+    if(encoding != RAW_ENCODING_FIXED_POINT)
+        return;
+    dset->createAttribute("scale", PredType::NATIVE_DOUBLE,
+                          attrSpace).write(PredType::NATIVE_DOUBLE, &scale);
+    dset->createAttribute("offset", PredType::NATIVE_DOUBLE,
+                          attrSpace).write(PredType::NATIVE_DOUBLE, &offset);
+}
+
+/**
+ * @brief Reads the encoding attributes of the current dataset
+ * @param scale if not NULL, set to the scale of fixed point encoding
+ * @param offset if not NULL, set to the offset of fixed point encoding
+ * @return RAW_ENCODING_NATIVE if the dataset has no "encoding" attribute
+ */
+
+RawEncoding H5OutputFile::rawEncoding(double *scale, double *offset) const
+{
+    if(!dataSet->attrExists("encoding"))
+        return RAW_ENCODING_NATIVE;
+    int encoding;
+    dataSet->openAttribute("encoding").read(PredType::NATIVE_INT, &encoding);
+    if(encoding == RAW_ENCODING_FIXED_POINT) {
+        if(scale != NULL)
+            dataSet->openAttribute("scale").read(PredType::NATIVE_DOUBLE,
+                                                 scale);
+        if(offset != NULL)
+            dataSet->openAttribute("offset").read(PredType::NATIVE_DOUBLE,
+                                                  offset);
+    }
+    return (RawEncoding)encoding;
+}
+
+void H5OutputFile::appendToCurrentDataset(const void *buffer,
+                                          const hsize_t size,
+                                          const PredType &memType)
+{
+    hsize_t start = dims[0];
+    hsize_t extDims = start + size;
+    dataSet->extend(&extDims);
+    *dataSpace = dataSet->getSpace();
+    dataSpace->getSimpleExtentDims(dims);
+
+    DataSpace memspace(1, &size);
+    dataSpace->selectHyperslab(H5S_SELECT_SET, &size, &start);
+    dataSet->write(buffer, memType, memspace, *dataSpace);
+}
+
+void H5OutputFile::loadFromCurrentDataset(void *destBuffer,
+                                          const hsize_t start,
+                                          const hsize_t count,
+                                          const PredType &memType)
+{
+    if(!count)
+        return;
+    DataSpace memspace(1, &count);
+    dataSpace->selectHyperslab(H5S_SELECT_SET, &count, &start);
+    dataSet->read(destBuffer, memType, memspace, *dataSpace);
+}
+
 void H5OutputFile::writeVLenString(const char *datasetName, const string str)
 {
     closeDataSet();
@@ -273,7 +535,7 @@ void H5OutputFile::writeVLenString(const char *datasetName, const string str)
 }
 
 void H5OutputFile::saveRNGState(uint seed, const string str) {
-    openDataSet("RNGStates");
+    openDataSet(path("RNGStates").c_str());
     if(seed > dims[0] - 1) {
         hsize_t extDims[ndims];
         extDims[0] = seed + 1;
@@ -334,7 +596,9 @@ string H5OutputFile::readVLenString(const char *datasetName) const
 
 bool H5OutputFile::openFile_impl()
 {
-    DataSet dSet = file->openDataSet("photon-counters");
+    if(!dataSetExists(path("photon-counters").c_str()))
+        return true;
+    DataSet dSet = file->openDataSet(path("photon-counters"));
     dSet.read(_photonCounters, dSet.getDataType());
     dSet.close();
 
@@ -343,7 +607,7 @@ bool H5OutputFile::openFile_impl()
 
 string H5OutputFile::readRNGState(const uint seed) const
 {
-    DataSet dset = file->openDataSet("RNGStates");
+    DataSet dset = file->openDataSet(path("RNGStates").c_str());
     DataType dtype = dset.getDataType();
 
     DataSpace dspace = dset.getSpace();
@@ -384,7 +648,7 @@ void H5OutputFile::appendPhotonCounts(const u_int64_t transmitted,
     _photonCounters[REFLECTED] += reflected;
     _photonCounters[BACKREFLECTED] += backReflected;
 
-    DataSet dset = file->openDataSet("photon-counters");
+    DataSet dset = file->openDataSet(path("photon-counters"));
     dset.write(_photonCounters,dset.getDataType());
     dset.close();
 }
@@ -394,7 +658,7 @@ void H5OutputFile::appendPhotonCounts(const u_int64_t *counters)
     for (uint i = 0; i < 4; ++i) {
         _photonCounters[i] += counters[i];
     }
-    DataSet dset = file->openDataSet("photon-counters");
+    DataSet dset = file->openDataSet(path("photon-counters"));
     dset.write(_photonCounters,dset.getDataType());
     dset.close();
 }
@@ -424,9 +688,71 @@ const u_int64_t *H5OutputFile::photonCounters() const
     return _photonCounters;
 }
 
+/**
+ * @brief Saves the event counters in the "stats" group
+ * @param stats
+ *
+ * Existing counters are left untouched.
+ */
+
+void H5OutputFile::saveStats(const SimulationStats *stats)
+{
+    string groupName = path("stats");
+    if(dataSetExists(groupName.c_str()))
+        return;
+    try {
+        newGroup(groupName.c_str());
+    }
+    catch (const Exception &error) {
+        logMessage("Cannot create group %s.\n", groupName.c_str());
+        return;
+    }
+
+    const uint nCounters = 8;
+    u_int64_t counters[nCounters] = {
+        stats->nPhotons, stats->totalSteps, stats->scatteringEvents,
+        stats->interfaceHits, stats->reflections, stats->refractions,
+        stats->TIREvents, stats->layerSwitches
+    };
+    string names[nCounters] = {
+        "photons", "steps", "scattering-events", "interface-hits",
+        "reflections", "refractions", "TIR-events", "layer-switches"
+    };
+
+    string dsName = groupName + "/counters";
+    writeUInt64Dataset(dsName.c_str(), counters, nCounters);
+    openDataSet(dsName.c_str());
+    writeColumnNames(nCounters, names);
+    closeDataSet();
+
+    dsName = groupName + "/steps-histogram";
+    writeUInt64Dataset(dsName.c_str(), stats->stepsHisto, STATS_LOG2_BINS);
+    dsName = groupName + "/path-length-histogram";
+    writeUInt64Dataset(dsName.c_str(), stats->pathLengthHisto,
+                       STATS_LOG2_BINS);
+}
+
+void H5OutputFile::writeUInt64Dataset(const char *datasetName,
+                                      const u_int64_t *buffer,
+                                      const hsize_t size)
+{
+    try {
+        DataSpace dspace(1, &size, &size);
+        DataSet dset = file->createDataSet(datasetName,
+                                           PredType::NATIVE_UINT64, dspace);
+        dset.write(buffer, PredType::NATIVE_UINT64);
+        dspace.close();
+        dset.close();
+    }
+    catch (const Exception &error) {
+        logMessage("Cannot create dataset %s.\n", datasetName);
+    }
+}
+
 void H5OutputFile::saveSample(const Sample *sample)
 {
-    char datasetName[] = "sample";
+    string dsName = path("sample");
+    const char *datasetName = dsName.c_str();
     if(dataSetExists(datasetName))
         return;
 
@@ -477,68 +803,255 @@ bool H5OutputFile::createDatasets(uint walkTimesSaveFlags,
                                   uint exitPointsSaveFlags,
                                   uint exitKVectorsSaveFlags)
 {
-#define NWALKER_CHUNK sizeof(MCfloat) * 8192
-    int ndims = 1;
-    hsize_t dims[ndims], chunkDims[ndims];
-    bool ret = false;
+    bool ret = true;
 
     createRNGDataset();
 
     if(exitPointsSaveFlags) {
-        newGroup("exit-points");
-
-        dims[0] = 0; chunkDims[0] = 2 * NWALKER_CHUNK;
-        if(exitPointsSaveFlags & FLAG_TRANSMITTED)
-            ret = newDataset("exit-points/transmitted", ndims, dims, chunkDims,
-                             MCH5FLOAT);
-        if(exitPointsSaveFlags & FLAG_BALLISTIC)
-            ret = newDataset("exit-points/ballistic", ndims, dims, chunkDims,
-                             MCH5FLOAT);
-        if(exitPointsSaveFlags & FLAG_REFLECTED)
-            ret = newDataset("exit-points/reflected", ndims, dims, chunkDims,
-                             MCH5FLOAT);
-        if(exitPointsSaveFlags & FLAG_BACKREFLECTED)
-            ret = newDataset("exit-points/back-reflected", ndims, dims,
-                             chunkDims, MCH5FLOAT);
+        newGroup(path("exit-points").c_str());
+        ret &= createRawDatasets(DATA_POINTS, exitPointsSaveFlags, 2);
     }
 
     if(walkTimesSaveFlags) {
-        dims[0] = 0; chunkDims[0] = NWALKER_CHUNK;
-        newGroup("walk-times");
-        if(walkTimesSaveFlags & FLAG_TRANSMITTED)
-            ret = newDataset("walk-times/transmitted",ndims, dims, chunkDims,
-                             MCH5FLOAT);
-        if(walkTimesSaveFlags & FLAG_BALLISTIC)
-            ret = newDataset("walk-times/ballistic", ndims, dims, chunkDims,
-                             MCH5FLOAT);
-        if(walkTimesSaveFlags & FLAG_REFLECTED)
-            ret = newDataset("walk-times/reflected", ndims, dims, chunkDims,
-                             MCH5FLOAT);
-        if(walkTimesSaveFlags & FLAG_BACKREFLECTED)
-            ret = newDataset("walk-times/back-reflected", ndims, dims, chunkDims,
-                             MCH5FLOAT);
+        newGroup(path("walk-times").c_str());
+        ret &= createRawDatasets(DATA_TIMES, walkTimesSaveFlags, 1);
     }
 
     if(exitKVectorsSaveFlags) {
-        dims[0] = 0; chunkDims[0] = 3 * NWALKER_CHUNK / 2;
-        newGroup("exit-k-vectors");
-        if(exitKVectorsSaveFlags & FLAG_TRANSMITTED)
-            ret = newDataset("exit-k-vectors/transmitted", ndims, dims,
-                             chunkDims, MCH5FLOAT);
-        if(exitKVectorsSaveFlags & FLAG_BALLISTIC)
-            ret = newDataset("exit-k-vectors/ballistic", ndims, dims, chunkDims,
-                             MCH5FLOAT);
-        if(exitKVectorsSaveFlags & FLAG_REFLECTED)
-            ret = newDataset("exit-k-vectors/reflected", ndims, dims, chunkDims,
-                             MCH5FLOAT);
-        if(exitKVectorsSaveFlags & FLAG_BACKREFLECTED)
-            ret = newDataset("exit-k-vectors/back-reflected", ndims, dims,
-                             chunkDims, MCH5FLOAT);
+        newGroup(path("exit-k-vectors").c_str());
+        ret &= createRawDatasets(DATA_K, exitKVectorsSaveFlags, nKVectorDirs);
+    }
+
+    return ret;
+}
+
+bool H5OutputFile::createRawDatasets(MCData group, uint flags,
+                                     uint floatsPerPhoton)
+{
+    const RawDatasetOptions &opt = rawOptions[group];
+
+    RawEncoding encoding = opt.encoding;
+    if(encoding == RAW_ENCODING_OCTAHEDRAL
+            && (group != DATA_K || floatsPerPhoton != 3)) {
+        logMessage("Octahedral encoding requires all the components of the "
+                   "exit k vectors, using float32");
+        encoding = RAW_ENCODING_FLOAT32;
+    }
+    if(encoding == RAW_ENCODING_FIXED_POINT && !(opt.scale > 0)) {
+        logMessage("Invalid fixed point scale %g, using float32", opt.scale);
+        encoding = RAW_ENCODING_FLOAT32;
     }
 
+    PredType fileType = MCH5FLOAT;
+    switch (encoding) {
+    case RAW_ENCODING_FLOAT32:
+        fileType = PredType::IEEE_F32LE;
+        break;
+    case RAW_ENCODING_FIXED_POINT:
+        fileType = PredType::STD_I32LE;
+        break;
+    case RAW_ENCODING_OCTAHEDRAL:
+        fileType = PredType::STD_U16LE;
+        floatsPerPhoton = 2;
+        break;
+    default:
+        break;
+    }
+
+    hsize_t dims[1] = {0};
+    hsize_t maxDims[1] = {H5S_UNLIMITED};
+    hsize_t chunkDims[1] = {opt.chunkSize * floatsPerPhoton};
+
+    DSetCreatPropList plist;
+    plist.setChunk(1, chunkDims);
+    if(opt.shuffle) {
+        if(H5Zfilter_avail(H5Z_FILTER_SHUFFLE) > 0)
+            plist.setShuffle();
+        else
+            logMessage("Shuffle filter not available");
+    }
+    if(opt.filter != H5Z_FILTER_NONE) {
+        if(H5Zfilter_avail(opt.filter) > 0)
+            plist.setFilter(opt.filter, H5Z_FLAG_OPTIONAL,
+                            opt.filterParams.size(),
+                            opt.filterParams.data());
+        else
+            logMessage("Filter %d not available", opt.filter);
+    }
+    if(opt.deflateLevel > 0) {
+        if(H5Zfilter_avail(H5Z_FILTER_DEFLATE) > 0)
+            plist.setDeflate(opt.deflateLevel);
+        else
+            logMessage("Deflate filter not available");
+    }
+
+    bool ret = true;
+    DataSpace dspace(1, dims, maxDims);
+    for (uint type = 0; type < 4; ++type) {
+        if(!(flags & walkerTypeToFlag(type)))
+            continue;
+        string dsName = rawDatasetName(group, (walkerType)type);
+        try {
+            DataSet dset = file->createDataSet(dsName, fileType, dspace,
+                                               plist);
+            writeEncoding(&dset, encoding, opt.scale, opt.offset);
+            dset.close();
+        }
+        catch (const Exception &error) {
+            logMessage("Cannot create dataset %s.\n", dsName.c_str());
+            ret = false;
+        }
+    }
+    dspace.close();
     return ret;
 }
 
+/**
+ * @brief Creates the raw datasets as virtual datasets concatenating the ones of
+ * the given source files
+ * @param sourceFiles files created by newFile() with the same raw dataset
+ * flags and options as this one, with their raw output already written
+ * @return true on success, false on error
+ *
+ * This is the counterpart of newFile() with create_datasets set to true, to
+ * be used on a file created with create_datasets set to false. The records of
+ * the source files are concatenated in the given order. Source files are
+ * referred to by their name relative to the directory of this file, where
+ * they must be kept.
+ */
+
+bool H5OutputFile::createVirtualDatasets(const vector<string> &sourceFiles)
+{
+    createRNGDataset();
+
+    const char *groupNames[4] = {
+        NULL, "exit-points", "exit-k-vectors", "walk-times"
+    };
+
+    bool ret = true;
+    for (uint group = DATA_POINTS; group <= DATA_TIMES; ++group) {
+        if(!rawFlags[group])
+            continue;
+        newGroup(path(groupNames[group]).c_str());
+        for (uint type = 0; type < 4; ++type) {
+            if(!(rawFlags[group] & walkerTypeToFlag(type)))
+                continue;
+            ret &= createVirtualDataset(rawDatasetName((MCData)group,
+                                                       (walkerType)type),
+                                        sourceFiles);
+        }
+    }
+    return ret;
+}
+
+bool H5OutputFile::createVirtualDataset(const string &dsName,
+                                        const vector<string> &sourceFiles)
+{
+    DSetCreatPropList plist;
+    DataType dtype(MCH5FLOAT);
+    vector<hsize_t> sizes(sourceFiles.size(), 0);
+    hsize_t total = 0;
+    int encoding = RAW_ENCODING_NATIVE;
+    double scale = 0, offset = 0;
+
+    try {
+        for (size_t i = 0; i < sourceFiles.size(); ++i) {
+            H5File source(sourceFiles[i], H5F_ACC_RDONLY);
+            DataSet sourceSet = source.openDataSet(dsName);
+            sourceSet.getSpace().getSimpleExtentDims(&sizes[i]);
+            if(i == 0) {
+                dtype = sourceSet.getDataType();
+                if(sourceSet.attrExists("encoding")) {
+                    sourceSet.openAttribute("encoding").read(
+                                PredType::NATIVE_INT, &encoding);
+                }
+                if(encoding == RAW_ENCODING_FIXED_POINT) {
+                    sourceSet.openAttribute("scale").read(
+                                PredType::NATIVE_DOUBLE, &scale);
+                    sourceSet.openAttribute("offset").read(
+                                PredType::NATIVE_DOUBLE, &offset);
+                }
+            }
+        }
+
+        hsize_t dims[1] = {0};
+        for (size_t i = 0; i < sourceFiles.size(); ++i) {
+            dims[0] += sizes[i];
+        }
+        DataSpace vspace(1, dims, dims);
+        for (size_t i = 0; i < sourceFiles.size(); ++i) {
+            if(!sizes[i])
+                continue;
+            DataSpace srcSpace(1, &sizes[i], &sizes[i]);
+            vspace.selectHyperslab(H5S_SELECT_SET, &sizes[i], &total);
+            string srcName = sourceFiles[i];
+            size_t pos = srcName.find_last_of('/');
+            if(pos != string::npos)
+                srcName = srcName.substr(pos + 1);
+            H5Pset_virtual(plist.getId(), vspace.getId(), srcName.c_str(),
+                           dsName.c_str(), srcSpace.getId());
+            total += sizes[i];
+        }
+        vspace.selectAll();
+
+        DataSet dset = file->createDataSet(dsName, dtype, vspace, plist);
+        writeEncoding(&dset, (RawEncoding)encoding, scale, offset);
+        dset.close();
+    }
+    catch (const Exception &error) {
+        logMessage("Cannot create virtual dataset %s.\n", dsName.c_str());
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Selects the raw datasets created by newFile() and openRootGroup()
+ * @param walkTimesSaveFlags
+ * @param exitPointsSaveFlags
+ * @param exitKVectorsSaveFlags
+ * @param exitKVectorsDirsSaveFlags used to compute the chunk size of the exit
+ * k vectors datasets
+ *
+ * Flags are combinations of walkerFlags, as in Simulation. All the datasets
+ * are created by default.
+ */
+
+void H5OutputFile::setRawDatasetFlags(uint walkTimesSaveFlags,
+                                      uint exitPointsSaveFlags,
+                                      uint exitKVectorsSaveFlags,
+                                      uint exitKVectorsDirsSaveFlags)
+{
+    rawFlags[DATA_NONE] = 0;
+    rawFlags[DATA_TIMES] = walkTimesSaveFlags;
+    rawFlags[DATA_POINTS] = exitPointsSaveFlags;
+    rawFlags[DATA_K] = exitKVectorsSaveFlags;
+    nKVectorDirs = 0;
+    for (uint i = 0; i < 3; ++i) {
+        if(exitKVectorsDirsSaveFlags & (1 << i))
+            nKVectorDirs++;
+    }
+    if(nKVectorDirs == 0)
+        nKVectorDirs = 3;
+}
+
+/**
+ * @brief Sets chunking, compression and encoding of the raw datasets of the
+ * given group
+ * @param group DATA_POINTS, DATA_TIMES or DATA_K
+ * @param options
+ *
+ * Only affects datasets created afterwards.
+ */
+
+void H5OutputFile::setRawDatasetOptions(MCData group,
+                                        const RawDatasetOptions &options)
+{
+    if(group == DATA_NONE || group > DATA_TIMES)
+        return;
+    rawOptions[group] = options;
+}
+
 bool H5OutputFile::createRNGDataset()
 {
     int ndims = 1;
@@ -551,7 +1064,7 @@ bool H5OutputFile::createRNGDataset()
     dtype.setSize(size);
     DataSpace dspace(1, dims, maxdims);
     stringstream ss;
-    ss << "RNGStates";
+    ss << path("RNGStates");
     if(!dataSetExists(ss.str().c_str())) {
 #ifdef PRINT_DEBUG_MSG
         logMessage("Creating dataset %s", ss.str().c_str());
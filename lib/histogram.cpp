@@ -19,9 +19,14 @@
 #include <cmath>
 
 #include <MCPlusPlus/h5filehelper.h>
+#include <MCPlusPlus/pulseconvolver.h>
+#include <MCPlusPlus/beamconvolver.h>
 
 #include <boost/math/constants/constants.hpp>
 #include <sstream>
+#include <typeinfo>
+#include <algorithm>
+#include <limits>
 
 
 using namespace boost::math::constants;
@@ -31,25 +36,47 @@ using namespace MCPP;
 Histogram::Histogram(BaseObject *parent) :
     BaseObject(parent)
 {
-    type[0] = DATA_NONE;
-    type[1] = DATA_NONE;
-    min[0] = 0;
-    max[0] = 0;
-    min[1] = 0;
-    max[1] = 0;
-    binSize[0] = 0;
-    binSize[1] = 0;
+    for (uint i = 0; i < HISTOGRAM_MAX_AXES; ++i) {
+        type[i] = DATA_NONE;
+        min[i] = 0;
+        max[i] = 0;
+        binSize[i] = 0;
+        invBinSize[i] = 0;
+        normalBin[i] = 0;
+        _binning[i] = BINNING_UNIFORM;
+        _autoRange[i] = false;
+        rangeLevel[i] = 0;
+        binWidth[i] = 0;
+        logBins[i] = 0;
+        nBins[i] = 1;
+        strides[i] = 0;
+    }
+    autoRanging = false;
+    kernel = NULL;
+    ownBatch = NULL;
+    tiled = false;
+    tiles = NULL;
+    sharedStorage = false;
+    sharedTarget = NULL;
+    sharing = false;
+    combining = NULL;
+    stripes = NULL;
     histo = NULL;
     moments = NULL;
     totExponents = 0;
     computeSpatialMoments = false;
     photonTypeFlags = -1;
+    _detector = NULL;
     scale = 1;
     histName = "";
 }
 
 Histogram::~Histogram()
 {
+    delete ownBatch;
+    delete tiles;
+    free(combining);
+    delete[] stripes;
     if(histo != NULL) {
         free(histo);
     }
@@ -58,10 +85,62 @@ Histogram::~Histogram()
     }
 }
 
-void Histogram::setDataDomain(const MCData type1, const MCData type2)
+/**
+ * @brief Sets the data domain of each axis
+ * @param type1
+ * @param type2 DATA_NONE (the default) for 1D histograms
+ *
+ * Exit angles can be binned either in degrees (DATA_K) or in
+ * \f$ \cos \theta \f$ (DATA_COS_THETA), where \f$ \theta \f$ is measured
+ * from the outward normal on the side the photon exits from. Bins of equal
+ * width in \f$ \cos \theta \f$ subtend equal solid angles, so that they have
+ * uniform statistical weight for an isotropic emission, and do not require an
+ * inverse cosine per photon. Their range is specified in cosine units, e.g.
+ * \code
+ * hist->setDataDomain(DATA_COS_THETA);
+ * hist->setMax(1);
+ * hist->setBinSize(0.01);
+ * \endcode
+ * When saved, bin centers are converted back to degrees.
+ *
+ * DATA_AZIMUTH bins the azimuth \f$ \phi \in [0, 360) \f$ of the exit
+ * direction, in degrees. When it is another axis of an angular histogram
+ * the saved values are normalized to the solid angle of each
+ * \f$ (\theta, \phi) \f$ bin rather than of the whole ring.
+ *
+ * DATA_PHOTON_TYPE has a bin per #walkerType, e.g. to histogram transmitted
+ * and reflected photons together; its range and bin size are ignored.
+ *
+ * The axes following the first DATA_NONE are ignored. Histograms with more
+ * than two axes are set up with setAxis(), setLogBinning() or setBinEdges().
+ */
+
+void Histogram::setDataDomain(const MCData type1, const MCData type2,
+                              const MCData type3, const MCData type4)
 {
     type[0] = type1;
     type[1] = type2;
+    type[2] = type3;
+    type[3] = type4;
+}
+
+/**
+ * @brief Sets up an axis with uniform bins
+ * @param axis 0 for the first axis, up to HISTOGRAM_MAX_AXES - 1
+ * @param type data domain of the axis
+ * @param min
+ * @param max
+ * @param binSize
+ */
+
+void Histogram::setAxis(const uint axis, const MCData type, const double min,
+                        const double max, const double binSize)
+{
+    this->type[axis] = type;
+    this->min[axis] = min;
+    this->max[axis] = max;
+    this->binSize[axis] = binSize;
+    _binning[axis] = BINNING_UNIFORM;
 }
 
 void Histogram::setMax(const double max1)
@@ -99,17 +178,102 @@ void Histogram::setMin2(const double min2)
 void Histogram::setBinSize(const double binSize1)
 {
     binSize[0] = binSize1;
+    _binning[0] = BINNING_UNIFORM;
 }
 
 void Histogram::setBinSize(const double binSize1, const double binSize2)
 {
     binSize[0] = binSize1;
     binSize[1] = binSize2;
+    _binning[0] = BINNING_UNIFORM;
+    _binning[1] = BINNING_UNIFORM;
 }
 
 void Histogram::setBinSize2(const double binSize2)
 {
     binSize[1] = binSize2;
+    _binning[1] = BINNING_UNIFORM;
+}
+
+/**
+ * @brief Bins an axis with logarithmically spaced bins
+ * @param axis 0 for the first axis, 1 for the second one
+ * @param min lower edge of the first bin, must be positive
+ * @param max upper edge of the last bin
+ * @param nBins number of bins between min and max, not counting the overflow
+ * bin
+ *
+ * Useful e.g. for time-resolved transmittance, which spans several decades:
+ * early times get narrow bins without millions of bins at late times. The bin
+ * index is computed in constant time from \f$ \log x \f$. Bin centers are
+ * saved as the geometric mean of the bin edges.
+ *
+ * Overrides setMin(), setMax() and setBinSize() for the given axis, until the
+ * next call to setBinSize().
+ */
+
+void Histogram::setLogBinning(const uint axis, const double min,
+                              const double max, const uint64_t nBins)
+{
+    this->min[axis] = min;
+    this->max[axis] = max;
+    logBins[axis] = nBins;
+    _binning[axis] = BINNING_LOG;
+}
+
+/**
+ * @brief Bins an axis with arbitrary bin edges
+ * @param axis 0 for the first axis, 1 for the second one
+ * @param edges the \f$ n + 1 \f$ strictly increasing edges of the \f$ n \f$
+ * bins
+ *
+ * Values are looked up with a branch-free binary search over the edges.
+ * Values outside [edges.front(), edges.back()) are counted in the overflow
+ * bin.
+ *
+ * Overrides setMin(), setMax() and setBinSize() for the given axis, until the
+ * next call to setBinSize().
+ */
+
+void Histogram::setBinEdges(const uint axis, const vector<double> &edges)
+{
+    this->edges[axis] = edges;
+    if(!edges.empty()) {
+        min[axis] = edges.front();
+        max[axis] = edges.back();
+    }
+    _binning[axis] = BINNING_EDGES;
+}
+
+enum HistogramBinning Histogram::binning(const uint axis) const
+{
+    return _binning[axis];
+}
+
+/**
+ * @brief Lets the range of an axis grow with the data
+ * @param axis 0 for the first axis, up to HISTOGRAM_MAX_AXES - 1
+ * @param enabled
+ *
+ * The range set with setMax() is only a guess. Whenever a photon would end up
+ * beyond the last bin, pairs of adjacent bins are merged, doubling the bin
+ * width and the range, until the photon fits. The number of bins does not
+ * change, and the overflow bin only collects values below the range. The
+ * histograms of the single threads are brought to the widest range before
+ * being summed, and the saved bin centers reflect the range actually used.
+ *
+ * Only available for uniform DATA_TIMES and DATA_POINTS axes, and not
+ * compatible with setSharedAcrossThreads().
+ */
+
+void Histogram::setAutoRange(const uint axis, const bool enabled)
+{
+    _autoRange[axis] = enabled;
+}
+
+bool Histogram::autoRange(const uint axis) const
+{
+    return _autoRange[axis];
 }
 
 /**
@@ -127,14 +291,26 @@ void Histogram::addMomentExponent(const double exponent)
     momentExponents.push_back(exponent);
 }
 
+/**
+ * @brief Number of axes, i.e. of data domains before the first DATA_NONE
+ */
+
+uint Histogram::nAxes() const
+{
+    uint n = 0;
+    while(n < HISTOGRAM_MAX_AXES && type[n] != DATA_NONE)
+        n++;
+    return n;
+}
+
 bool Histogram::is1D() const
 {
-    return (type[1] == DATA_NONE);
+    return nAxes() == 1;
 }
 
 bool Histogram::is2D() const
 {
-    return !is1D();
+    return nAxes() == 2;
 }
 
 bool Histogram::initialize()
@@ -144,228 +320,1012 @@ bool Histogram::initialize()
     computeSpatialMoments = !momentExponents.empty();
     totExponents = momentExponents.size();
     degPerRad = 180 / pi<MCfloat>();
-    nBins[0] = ceil((max[0] - min[0]) / binSize[0]) + 1; //+1 for overflow bin
-    if(is2D())
-        nBins[1] = ceil((max[1] - min[1]) / binSize[1]) + 1;
+    uint n = nAxes();
+    for (uint i = 0; i < HISTOGRAM_MAX_AXES; ++i) {
+        if(i >= n) {
+            nBins[i] = 1;
+            continue;
+        }
+        if(type[i] == DATA_PHOTON_TYPE) {
+            // bin centers are the walker types
+            _binning[i] = BINNING_UNIFORM;
+            min[i] = -0.5;
+            max[i] = 3.5;
+            binSize[i] = 1;
+        }
+        switch(_binning[i]) {
+        case BINNING_LOG:
+            nBins[i] = logBins[i] + 1; //+1 for overflow bin
+            break;
+        case BINNING_EDGES:
+            nBins[i] = edges[i].size();
+            break;
+        case BINNING_UNIFORM:
+        default:
+            nBins[i] = ceil((max[i] - min[i]) / binSize[i]) + 1;
+            break;
+        }
+    }
+    // row-major layout, the last axis being contiguous
+    totBins = 1;
+    for (int i = HISTOGRAM_MAX_AXES - 1; i >= 0; --i) {
+        strides[i] = totBins;
+        totBins *= nBins[i];
+    }
+    if(histo != NULL)
+        free(histo);
+    delete tiles;
+    free(combining);
+    histo = NULL;
+    tiles = NULL;
+    combining = NULL;
+    sharing = false;
+    if(sharedTarget != NULL)
+        combining = (CombiningSlot *)calloc(HISTOGRAM_COMBINING_SLOTS,
+                                            sizeof(CombiningSlot));
+    else if(tiled)
+        tiles = new TiledCounts(totBins);
     else
-        nBins[1] = 1;
-    totBins = nBins[0]*nBins[1];
-    histo = (u_int64_t *)calloc(totBins, sizeof(u_int64_t));
+        histo = (u_int64_t *)calloc(totBins, sizeof(u_int64_t));
     if(computeSpatialMoments) {
         moments = (MCfloat *)calloc(totExponents * totBins, sizeof(MCfloat));
     }
     else
         moments = NULL;
 
-    firstBinEdge[0] = min[0];
-    firstBinEdge[1] = min[1];
-    firstBinCenter[0] = firstBinEdge[0] + binSize[0]*0.5;
-    firstBinCenter[1] = firstBinEdge[1] + binSize[1]*0.5;
+    autoRanging = false;
+    for (uint i = 0; i < HISTOGRAM_MAX_AXES; ++i) {
+        rangeLevel[i] = 0;
+        binWidth[i] = binSize[i];
+        if(i >= n) {
+            invBinSize[i] = 0;
+            continue;
+        }
+        if(_autoRange[i])
+            autoRanging = true;
+        updateAxis(i);
+    }
+    momentColumns.assign(totExponents, NULL);
+    for (uint i = 0; i < HISTOGRAM_MAX_AXES; ++i) {
+        // bin of cos(theta) = 1, the upper edge of the range being inclusive
+        uint64_t last = nBins[i] - 1;
+        if(i >= n) {
+            normalBin[i] = 0;
+            continue;
+        }
+        normalBin[i] = axisIndex<DATA_NONE>(1, i, last);
+        if(max[i] >= 1 && normalBin[i] == last && last > 0)
+            normalBin[i] = last - 1;
+    }
+    // the columns needed by run(const Walker *, size_t) might have changed
+    delete ownBatch;
+    ownBatch = NULL;
+
+    selectKernel();
 
     return true;
 }
 
+/**
+ * @brief Computes the lookup parameters of an axis from its current range
+ * @param axis
+ */
+
+void Histogram::updateAxis(const uint axis)
+{
+    firstBinEdge[axis] = min[axis];
+    firstBinCenter[axis] = firstBinEdge[axis] + binWidth[axis]*0.5;
+    invBinSize[axis] = 1 / binWidth[axis];
+    if(_binning[axis] == BINNING_LOG) {
+        firstBinEdge[axis] = log(min[axis]);
+        invBinSize[axis] = logBins[axis]
+                / (log(max[axis]) - log(min[axis]));
+    }
+}
+
 void Histogram::setPhotonTypeFlags(int value)
 {
     photonTypeFlags = value;
 }
 
-void Histogram::run(const Walker * const buf, size_t bufSize)
-{
-    for (uint i = 0; i < bufSize; ++i) {
-        const Walker * const w = &buf[i];
-        if(!pickPhoton(w))
-            continue;
+/**
+ * @brief Restricts the histogrammed photons to those accepted by the given
+ * detector
+ * @param detector
+ *
+ * The Histogram takes ownership of the detector, unless the detector already
+ * has a parent. Pass NULL to histogram all the photons of the selected types.
+ */
 
-        size_t index[2] = {0, 0};
-        switch(type[0]) {
-        case DATA_K:
-            index[0] =
-                    (acos(w->k0[2])*degPerRad - firstBinEdge[0]) / binSize[0];
-            break;
+void Histogram::setDetector(Detector *detector)
+{
+    if(detector != NULL && detector->parent() == NULL)
+        detector->setParent(this);
+    _detector = detector;
+    if(kernel != NULL)
+        selectKernel();
+}
 
-        case DATA_POINTS: {
-            MCfloat module = sqrt(pow(w->r0[0], 2) + pow(w->r0[1], 2));
-            index[0] = (module - firstBinEdge[0]) / binSize[0];
-        }
-            break;
+const Detector *Histogram::detector() const
+{
+    return _detector;
+}
 
-        case DATA_TIMES:
-            index[0] = (w->walkTime - firstBinEdge[0]) / binSize[0];
-            break;
+/**
+ * @brief Adds a pulse profile the time histogram is convolved with when saved
+ * @param profile distribution of the emission times, providing
+ * AbstractDistribution::cdf(), e.g. a Sech2Distribution or a
+ * NormalDistribution
+ * @param name suffix of the dataset of the convolved histogram
+ *
+ * Since transport is time-invariant, simulating with an impulsive source
+ * (the default DeltaDistribution of Source) and convolving the impulse
+ * response with several profiles gives the response to each of them from a
+ * single simulation, without the variance added by sampling the emission
+ * times. The convolved histogram is saved in the dataset named after the
+ * histogram followed by "_" and the given name, with the same layout and
+ * normalization, next to the impulse response; see PulseConvolver.
+ *
+ * The first axis must be a uniform DATA_TIMES axis. The Histogram takes
+ * ownership of the profile, unless it already has a parent.
+ */
 
-        case DATA_NONE:
-        default:
-            return;
-        }
+void Histogram::addTimeConvolution(AbstractDistribution *profile,
+                                   const char *name)
+{
+    if(profile->parent() == NULL)
+        profile->setParent(this);
+    pulses.push_back(profile);
+    pulseNames.push_back(name);
+}
 
-        if(index[0] > nBins[0] -1)
-            index[0] = nBins[0] -1;
+size_t Histogram::nTimeConvolutions() const
+{
+    return pulses.size();
+}
 
-        if(is2D()) {
-            switch(type[1]) {
-            case DATA_K:
-                index[1] = (acos(w->k0[2]) * degPerRad - firstBinEdge[1])
-                        / binSize[1];
-                break;
+/**
+ * @brief Adds a Gaussian beam the radial histogram is convolved with when
+ * saved
+ * @param FWHM full width at half maximum of the beam intensity profile, as
+ * given to GaussianBeamSource
+ * @param name suffix of the dataset of the convolved histogram
+ *
+ * For a laterally infinite sample, the response to a Gaussian beam at
+ * normal incidence is the pencil-beam response convolved with the beam
+ * profile. Simulating with a PencilBeamSource and adding a convolution per
+ * beam size gives the response to each of them from a single simulation,
+ * with the statistics of the pencil beam. The convolved histogram is saved
+ * in the dataset named after the histogram followed by "_" and the given
+ * name, with the same layout and normalization; see BeamConvolver.
+ *
+ * The histogram must have a DATA_POINTS axis; the first one is convolved.
+ */
 
-            case DATA_POINTS: {
-                MCfloat module = sqrt(pow(w->r0[0], 2) + pow(w->r0[1], 2));
-                index[1] = (module - firstBinEdge[1]) / binSize[1];
-            }
-                break;
+void Histogram::addBeamConvolution(const double FWHM, const char *name)
+{
+    beamFWHMs.push_back(FWHM);
+    beamNames.push_back(name);
+}
 
-            case DATA_TIMES:
-                index[1] = (w->walkTime - firstBinEdge[1]) / binSize[1];
-                break;
+size_t Histogram::nBeamConvolutions() const
+{
+    return beamFWHMs.size();
+}
 
-            case DATA_NONE:
-            default:
-                return;
-            }
+/**
+ * @brief Histograms the given walkers
+ * @param buf
+ * @param bufSize
+ *
+ * Convenience overload for a single histogram. When several histograms are
+ * filled with the same walkers, fill a WalkerBatch once and use
+ * run(const WalkerBatch &) instead.
+ */
 
-            if(index[1] > nBins[1] - 1)
-                index[1] = nBins[1] - 1;
-        }
-        size_t idx =  index[0] * nBins[1] + index[1];
-        histo[idx]++;
-        if(computeSpatialMoments) {
-            MCfloat module = sqrt(pow(w->r0[0], 2) + pow(w->r0[1], 2));
-            for (size_t i = 0; i < totExponents; ++i) {
-                moments[totBins * i + idx] += pow(module, momentExponents[i]);
-            }
-        }
+void Histogram::run(const Walker * const buf, size_t bufSize)
+{
+    if(ownBatch == NULL) {
+        ownBatch = new WalkerBatch();
+        requireColumns(ownBatch);
     }
+    ownBatch->fill(buf, bufSize);
+    run(*ownBatch);
 }
 
-bool Histogram::pickPhoton(const Walker * const w) const
+/**
+ * @brief Histograms the walkers of the given batch
+ * @param batch a batch filled with (at least) the columns registered by
+ * requireColumns()
+ *
+ * Dispatches to the kernel selected by initialize(), see selectKernel().
+ */
+
+void Histogram::run(const WalkerBatch &batch)
 {
-    walkerFlags flag = walkerTypeToFlag(w->type);
-    if(!(photonTypeFlags & flag))
-        return false;
-    return pickPhoton_impl(w);
+    if(autoRanging)
+        fitRange(batch);
+    (this->*kernel)(batch);
 }
 
-void Histogram::appendCounts(const Histogram *rhs)
+/**
+ * @brief Registers the columns needed by this histogram with the given batch
+ * @param batch
+ */
+
+void Histogram::requireColumns(WalkerBatch *batch) const
 {
-    for (size_t i = 0; i < totBins; ++i) {
-        histo[i] += rhs->histo[i];
-    }
-    if(moments != NULL && rhs->moments!= NULL) {
-        for (size_t i = 0; i < totExponents; ++i) {
-                for (size_t idx = 0; idx < totBins; ++idx) {
-                    moments[totBins * i + idx]
-                            += rhs->moments[totBins * i + idx];
-            }
+    for (uint i = 0; i < nAxes(); ++i) {
+        switch(type[i]) {
+        case DATA_K:
+            batch->require(COLUMN_ANGLES);
+            break;
+        case DATA_POINTS:
+            batch->require(COLUMN_RADII);
+            break;
+        case DATA_TIMES:
+            batch->require(COLUMN_TIMES);
+            break;
+        case DATA_COS_THETA:
+            batch->require(COLUMN_COSINES);
+            break;
+        case DATA_AZIMUTH:
+            batch->require(COLUMN_AZIMUTHS);
+            break;
+        case DATA_PHOTON_TYPE:  // given by the partition of the batch
+        case DATA_NONE:
+        default:
+            break;
         }
     }
+    for (size_t i = 0; i < momentExponents.size(); ++i) {
+        batch->requireMomentExponent(momentExponents[i]);
+    }
 }
 
-void Histogram::dump() const
+/**
+ * @brief Column of the batch holding the coordinate along an axis of the
+ * given data domain, NULL for DATA_PHOTON_TYPE
+ */
+
+static inline const MCfloat *batchColumn(const WalkerBatch &batch,
+                                         const enum MCData type)
 {
-    u_int64_t total = 0;
-    for (size_t i = 0; i < nBins[0]; ++i) {
-        for (size_t j = 0; j < nBins[1]; ++j) {
-            size_t idx = i * nBins[1] + j;
-            cout << histo[idx] << "\t";
-            total += histo[idx];
-        }
-        cout << endl;
+    switch(type) {
+    case DATA_K:
+        return batch.angles();
+    case DATA_POINTS:
+        return batch.radii();
+    case DATA_TIMES:
+        return batch.times();
+    case DATA_COS_THETA:
+        return batch.cosines();
+    case DATA_AZIMUTH:
+        return batch.azimuths();
+    case DATA_PHOTON_TYPE:
+    case DATA_NONE:
+    default:
+        return NULL;
     }
-    cout << "total: " << total << endl;
 }
 
-void Histogram::saveToFile(const char *fileName) const
+template <enum MCData T>
+static inline const MCfloat *batchColumn(const WalkerBatch &batch)
 {
-    string _dsName = histName;
-    if(_dsName == "")
-        _dsName = "histogram";
-    H5FileHelper *file = new H5FileHelper(0);
-    if(access(fileName, F_OK)<0)
-        file->newFile(fileName);
-    else
-        file->openFile(fileName);
-    hsize_t dims[2] = {nBins[0], nBins[1]+1};
-    if(computeSpatialMoments)
-        dims[1] += totExponents;
-    file->newDataset(_dsName.c_str(), 2, dims);
-
-    uint ncols = dims[1];
-    string colNames[ncols];
-
-    double *data; //convert all histograms to double
-    data = (double *)malloc(totBins*sizeof(double));
+    return batchColumn(batch, T);
+}
 
-    hsize_t start[2];
-    hsize_t count[2];
+/**
+ * @brief Index of the bin containing x, clamped to the overflow bin
+ *
+ * Values beyond the last bin, values more than one bin below the first edge
+ * and NaNs end up in the overflow bin.
+ */
 
-    for (size_t i = 0; i < nBins[0]; ++i) {
-        data[i] = 1.* firstBinCenter[0] + i * binSize[0];
-    }
+static inline size_t binIndex(const MCfloat x, const MCfloat firstEdge,
+                              const MCfloat invBinSize, const uint64_t last)
+{
+    MCfloat v = (x - firstEdge) * invBinSize;
+    return (v > -1 && v < last) ? (size_t)v : last;
+}
 
-    start[0] = 0;
-    start[1] = 0;
-    count[0] = nBins[0];
-    count[1] = 1;
+/**
+ * @brief Index of the logarithmic bin containing x, clamped to the overflow
+ * bin
+ *
+ * Unlike binIndex(), values below the first edge always end up in the
+ * overflow bin. So do zero, negative values and NaNs, whose logarithm is
+ * -inf or NaN.
+ */
 
-    file->writeHyperSlabDouble(start, count, data);
+static inline size_t logBinIndex(const MCfloat x, const MCfloat logFirstEdge,
+                                 const MCfloat invBinSize, const uint64_t last)
+{
+    MCfloat v = (log(x) - logFirstEdge) * invBinSize;
+    return (v >= 0 && v < last) ? (size_t)v : last;
+}
 
+/**
+ * @brief Index of the bin containing x among the last + 1 given edges,
+ * clamped to the overflow bin
+ *
+ * The binary search only uses conditional moves, so that its cost does not
+ * depend on the (unpredictable) outcome of the comparisons.
+ */
 
+static inline size_t edgeIndex(const MCfloat x, const double *edges,
+                               const uint64_t last)
+{
+    if(!(x >= edges[0] && x < edges[last]))
+        return last;
+    const double *base = edges;
+    size_t n = last;
+    while(n > 1) {
+        size_t half = n / 2;
+        base = base[half] <= x ? base + half : base;
+        n -= half;
+    }
+    return base - edges;
+}
 
-    switch (type[0]) {
-    case DATA_K:
-        colNames[0] = "k";
-        for (size_t i = 0; i < nBins[0]; ++i) {
-            MCfloat scale2 = scale * 4.0 *pi<MCfloat>()
-                    * sin((i + 0.5) * binSize[0] / degPerRad)
-                    * sin(binSize[0] / 2. /degPerRad);
-            for (size_t j = 0; j < nBins[1]; ++j)
-                data[i * nBins[1] + j] = 1. * histo[i * nBins[1] + j] / scale2;
-        }
-        break;
+/**
+ * @brief Index of the bin containing x along the given axis
+ *
+ * Photons exiting exactly along the normal (\f$ \cos \theta = 1 \f$) are
+ * counted in the bin computed by initialize(), i.e. in the last regular bin
+ * when the range extends up to 1.
+ *
+ * The branch on the binning of the axis is taken the same way for all the
+ * photons, and is thus predicted correctly.
+ */
 
-    case DATA_TIMES:
-        colNames[0] = "time";
-        for (size_t i = 0; i < nBins[0]; ++i) {
-            MCfloat scale2 = scale;
-            for (size_t j = 0; j < nBins[1]; ++j)
-                data[i * nBins[1] + j] = 1. * histo[i * nBins[1] + j] / scale2;
-        }
+template <enum MCData T>
+inline size_t Histogram::axisIndex(const MCfloat x, const uint axis,
+                                   const uint64_t last) const
+{
+    size_t index;
+    switch(_binning[axis]) {
+    case BINNING_LOG:
+        index = logBinIndex(x, firstBinEdge[axis], invBinSize[axis], last);
         break;
-
-    case DATA_POINTS:
-        colNames[0] = "um";
-        for (size_t i = 0; i < nBins[0]; ++i) {
-            MCfloat dr = binSize[0];
-            MCfloat scale2 = scale * (2 * pi<MCfloat>() * (i + 0.5) * dr * dr);
-            for (size_t j = 0; j < nBins[1]; ++j)
-               data[i*nBins[1] + j] = 1. * histo[i * nBins[1] + j] / scale2;
-        }
+    case BINNING_EDGES:
+        index = edgeIndex(x, &edges[axis][0], last);
         break;
-
+    case BINNING_UNIFORM:
     default:
+        index = binIndex(x, firstBinEdge[axis], invBinSize[axis], last);
         break;
     }
+    if(T == DATA_COS_THETA && x >= 1)
+        return normalBin[axis];
+    return index;
+}
 
-    start[0] = 0;
-    start[1] = 1;
-    count[0] = nBins[0];
-    count[1] = nBins[1];
-
-    file->writeHyperSlabDouble(start, count, data);
+/**
+ * @brief Increments the counts of the given bins
+ * @param idx
+ * @param n
+ */
 
+inline void Histogram::addCounts(const size_t *idx, const size_t n)
+{
+    if(combining != NULL) {
+        for (size_t i = 0; i < n; ++i) {
+            combine(idx[i]);
+        }
+    }
+    else if(tiles != NULL) {
+        for (size_t i = 0; i < n; ++i) {
+            tiles->increment(idx[i]);
+        }
+    }
+    else {
+        for (size_t i = 0; i < n; ++i) {
+            histo[idx[i]]++;
+        }
+    }
+}
 
+/**
+ * @brief Histogramming kernel specialized for the given data domains
+ *
+ * Only the walker types selected with setPhotonTypeFlags() are visited. The
+ * rows of each type are processed in batches of HISTOGRAM_KERNEL_BATCH: the
+ * bin indices are first computed from the precomputed columns in a
+ * branch-free loop, then the counts are incremented.
+ *
+ * @tparam T0 data domain of the first axis
+ * @tparam T1 data domain of the second axis, DATA_NONE for 1D histograms
+ * @tparam MOMENTS whether spatial moments are computed
+ * @tparam FILTER whether photons are further selected with pickPhoton()
+ * (detector or subclass)
+ */
 
-    if(computeSpatialMoments) {
-        for (size_t i = 0; i < totExponents; ++i) {
+template <enum MCData T0, enum MCData T1, bool MOMENTS, bool FILTER>
+void Histogram::runKernel(const WalkerBatch &batch)
+{
+    size_t rows[HISTOGRAM_KERNEL_BATCH];
+    size_t idx[HISTOGRAM_KERNEL_BATCH];
+    const uint64_t last0 = nBins[0] - 1;
+    const uint64_t last1 = nBins[1] - 1;
+    const MCfloat *col0 = batchColumn<T0>(batch);
+    const MCfloat *col1 = batchColumn<T1>(batch);
+    if(MOMENTS) {
+        for (size_t j = 0; j < totExponents; ++j) {
+            momentColumns[j] = batch.radialPowers(momentExponents[j]);
+        }
+    }
 
-            ostringstream strs;
-            strs << "mom_" << momentExponents[i];
+    for (uint t = 0; t < 4; ++t) {
+        if(!((photonTypeFlags >> t) & 1))
+            continue;
+        for (size_t start = batch.begin(t); start < batch.end(t);
+             start += HISTOGRAM_KERNEL_BATCH) {
+            size_t end = std::min(batch.end(t),
+                                  start + HISTOGRAM_KERNEL_BATCH);
+            size_t n = 0;
+            if(FILTER) {
+                for (size_t r = start; r < end; ++r) {
+                    rows[n] = r;
+                    n += pickPhoton(batch.walker(r));
+                }
+            }
+            else
+                n = end - start;
+
+            for (size_t i = 0; i < n; ++i) {
+                size_t r = FILTER ? rows[i] : start + i;
+                size_t index = axisIndex<T0>(col0[r], 0, last0);
+                if(T1 != DATA_NONE)
+                    index = index * nBins[1] + axisIndex<T1>(col1[r], 1, last1);
+                idx[i] = index;
+            }
 
-            colNames[2+i] = strs.str();
+            addCounts(idx, n);
 
-            for (size_t idx = 0; idx < nBins[0]; ++idx)
-                    data[idx] = moments[totBins * i + idx] / histo[idx];
+            if(MOMENTS) {
+                for (size_t j = 0; j < totExponents; ++j) {
+                    const MCfloat *p = momentColumns[j];
+                    MCfloat *m = moments + totBins * j;
+                    for (size_t i = 0; i < n; ++i) {
+                        m[idx[i]] += p[FILTER ? rows[i] : start + i];
+                    }
+                }
+            }
+        }
+    }
+}
+
+/**
+ * @brief Generic histogramming kernel, for histograms with more than two axes
+ * or binned by photon type
+ *
+ * Same as runKernel(), with the bin index accumulated over the axes with the
+ * strides computed by initialize().
+ *
+ * @tparam FILTER whether photons are further selected with pickPhoton()
+ */
+
+template <bool FILTER>
+void Histogram::runKernelND(const WalkerBatch &batch)
+{
+    size_t rows[HISTOGRAM_KERNEL_BATCH];
+    size_t idx[HISTOGRAM_KERNEL_BATCH];
+    const uint n = nAxes();
+    const MCfloat *cols[HISTOGRAM_MAX_AXES];
+    for (uint a = 0; a < n; ++a) {
+        cols[a] = batchColumn(batch, type[a]);
+    }
+
+    for (uint t = 0; t < 4; ++t) {
+        if(!((photonTypeFlags >> t) & 1))
+            continue;
+        // offset of the photon type axes, constant for the rows of a type
+        size_t typeOffset = 0;
+        for (uint a = 0; a < n; ++a) {
+            if(type[a] == DATA_PHOTON_TYPE)
+                typeOffset += t * strides[a];
+        }
+        for (size_t start = batch.begin(t); start < batch.end(t);
+             start += HISTOGRAM_KERNEL_BATCH) {
+            size_t end = std::min(batch.end(t),
+                                  start + HISTOGRAM_KERNEL_BATCH);
+            size_t count = 0;
+            if(FILTER) {
+                for (size_t r = start; r < end; ++r) {
+                    rows[count] = r;
+                    count += pickPhoton(batch.walker(r));
+                }
+            }
+            else
+                count = end - start;
+
+            for (size_t i = 0; i < count; ++i) {
+                idx[i] = typeOffset;
+            }
+            for (uint a = 0; a < n; ++a) {
+                const MCfloat *col = cols[a];
+                if(col == NULL)
+                    continue;
+                const uint64_t last = nBins[a] - 1;
+                const bool cosTheta = type[a] == DATA_COS_THETA;
+                for (size_t i = 0; i < count; ++i) {
+                    MCfloat x = col[FILTER ? rows[i] : start + i];
+                    size_t index = axisIndex<DATA_NONE>(x, a, last);
+                    if(cosTheta && x >= 1)
+                        index = normalBin[a];
+                    idx[i] += index * strides[a];
+                }
+            }
+
+            addCounts(idx, count);
+        }
+    }
+}
+
+template <enum MCData T0, enum MCData T1>
+void Histogram::selectKernel()
+{
+    // pickPhoton_impl() might be overridden by a subclass
+    bool filter = _detector != NULL || typeid(*this) != typeid(Histogram);
+    if(computeSpatialMoments)
+        kernel = filter ? &Histogram::runKernel<T0, T1, true, true>
+                        : &Histogram::runKernel<T0, T1, true, false>;
+    else
+        kernel = filter ? &Histogram::runKernel<T0, T1, false, true>
+                        : &Histogram::runKernel<T0, T1, false, false>;
+}
+
+template <enum MCData T0>
+void Histogram::selectKernel()
+{
+    switch(type[1]) {
+    case DATA_K:
+        selectKernel<T0, DATA_K>();
+        break;
+    case DATA_POINTS:
+        selectKernel<T0, DATA_POINTS>();
+        break;
+    case DATA_TIMES:
+        selectKernel<T0, DATA_TIMES>();
+        break;
+    case DATA_COS_THETA:
+        selectKernel<T0, DATA_COS_THETA>();
+        break;
+    case DATA_AZIMUTH:
+        selectKernel<T0, DATA_AZIMUTH>();
+        break;
+    case DATA_NONE:
+    default:
+        selectKernel<T0, DATA_NONE>();
+        break;
+    }
+}
+
+/**
+ * @brief Selects the histogramming kernel for the current data domains,
+ * moments and photon selection
+ *
+ * The dispatch on the data domains is resolved here, once, rather than for
+ * every photon in run(). Histograms with more than two axes or binned by
+ * photon type use the generic runKernelND().
+ */
+
+void Histogram::selectKernel()
+{
+    bool generic = nAxes() > 2;
+    for (uint i = 0; i < nAxes(); ++i) {
+        if(type[i] == DATA_PHOTON_TYPE)
+            generic = true;
+    }
+    if(generic) {
+        // pickPhoton_impl() might be overridden by a subclass
+        bool filter = _detector != NULL || typeid(*this) != typeid(Histogram);
+        kernel = filter ? &Histogram::runKernelND<true>
+                        : &Histogram::runKernelND<false>;
+        return;
+    }
+
+    switch(type[0]) {
+    case DATA_K:
+        selectKernel<DATA_K>();
+        break;
+    case DATA_POINTS:
+        selectKernel<DATA_POINTS>();
+        break;
+    case DATA_COS_THETA:
+        selectKernel<DATA_COS_THETA>();
+        break;
+    case DATA_AZIMUTH:
+        selectKernel<DATA_AZIMUTH>();
+        break;
+    case DATA_TIMES:
+    default:
+        selectKernel<DATA_TIMES>();
+        break;
+    }
+}
+
+bool Histogram::pickPhoton(const Walker * const w) const
+{
+    walkerFlags flag = walkerTypeToFlag(w->type);
+    if(!(photonTypeFlags & flag))
+        return false;
+    if(_detector != NULL && !_detector->accept(w))
+        return false;
+    return pickPhoton_impl(w);
+}
+
+/**
+ * @brief Adds the counts and moments of another histogram with the same
+ * layout
+ * @param rhs
+ *
+ * The two histograms may use different storage, see setTiledStorage(). A
+ * per-thread clone of a histogram shared across threads has no counts of its
+ * own: they are already in the shared histogram.
+ */
+
+void Histogram::appendCounts(const Histogram *rhs)
+{
+    if(rhs->sharedTarget != NULL)
+        return;
+    if(rhs->sharing) {
+        appendSharedCounts(rhs);
+        return;
+    }
+    if(autoRanging) {
+        // bring both histograms to the widest range
+        bool finer = false;
+        for (uint i = 0; i < HISTOGRAM_MAX_AXES; ++i) {
+            if(rhs->rangeLevel[i] > rangeLevel[i])
+                rebin(i, rhs->rangeLevel[i] - rangeLevel[i]);
+            else if(rhs->rangeLevel[i] < rangeLevel[i])
+                finer = true;
+        }
+        if(finer) {
+            appendRebinnedCounts(rhs);
+            return;
+        }
+    }
+    if(histo != NULL && rhs->histo != NULL) {
+        for (size_t i = 0; i < totBins; ++i) {
+            histo[i] += rhs->histo[i];
+        }
+    }
+    else if(histo != NULL)
+        rhs->tiles->addTo(histo);
+    else if(rhs->tiles != NULL)
+        tiles->add(rhs->tiles);
+    else {
+        for (size_t i = 0; i < totBins; ++i) {
+            tiles->add(i, rhs->histo[i]);
+        }
+    }
+    if(moments != NULL && rhs->moments!= NULL) {
+        for (size_t i = 0; i < totExponents; ++i) {
+                for (size_t idx = 0; idx < totBins; ++idx) {
+                    moments[totBins * i + idx]
+                            += rhs->moments[totBins * i + idx];
+            }
+        }
+    }
+}
+
+void Histogram::dump() const
+{
+    u_int64_t total = 0;
+    size_t rowBins = totBins / nBins[0];
+    for (size_t i = 0; i < nBins[0]; ++i) {
+        for (size_t j = 0; j < rowBins; ++j) {
+            size_t idx = i * rowBins + j;
+            cout << binCount(idx) << "\t";
+            total += binCount(idx);
+        }
+        cout << endl;
+    }
+    cout << "total: " << total << endl;
+}
+
+/**
+ * @brief Saves the histogram in the given H5 file
+ * @param fileName
+ * @param groupName if not NULL, the dataset is created within this (existing)
+ * group
+ */
+
+void Histogram::saveToFile(const char *fileName, const char *groupName) const
+{
+    string _dsName = name();
+    if(groupName != NULL)
+        _dsName = string(groupName) + "/" + _dsName;
+    H5FileHelper *file = new H5FileHelper(0);
+    if(access(fileName, F_OK)<0)
+        file->newFile(fileName);
+    else
+        file->openFile(fileName);
+    writeDataset(file, _dsName.c_str());
+    writeConvolvedDatasets(file, _dsName);
+    file->close();
+    delete file;
+}
+
+/**
+ * @brief Writes the datasets convolved with the time profiles given with
+ * addTimeConvolution() and the beams given with addBeamConvolution()
+ * @param file
+ * @param datasetName name of the dataset of the histogram
+ *
+ * Each convolution is saved in the dataset datasetName_name, with the same
+ * layout and normalization as the histogram.
+ */
+
+void Histogram::writeConvolvedDatasets(H5FileHelper *file,
+                                       const string &datasetName) const
+{
+    writeBeamConvolutions(file, datasetName);
+    if(pulses.empty())
+        return;
+    const size_t n = nBins[0] - 1;
+    const size_t rowBins = strides[0];
+    vector<double> counts(totBins), sums(totBins * totExponents);
+    vector<double> in(n + 1), out(n + 1);
+
+    for (size_t p = 0; p < pulses.size(); ++p) {
+        PulseConvolver convolver(pulses[p], binWidth[0], n);
+        if(!convolver.valid()) {
+            logMessage("Time profile %s cannot be discretized, skipping",
+                       pulseNames[p].c_str());
+            continue;
+        }
+        for (size_t j = 0; j < rowBins; ++j) {
+            for (size_t i = 0; i <= n; ++i)
+                in[i] = binCount(i * rowBins + j);
+            convolver.convolve(&in[0], &out[0]);
+            for (size_t i = 0; i <= n; ++i)
+                counts[i * rowBins + j] = out[i];
+        }
+        // moment sums are linear in the photons too (1D histograms only)
+        for (size_t e = 0; e < totExponents && computeSpatialMoments; ++e) {
+            for (size_t i = 0; i <= n; ++i)
+                in[i] = moments[totBins * e + i];
+            convolver.convolve(&in[0], &sums[totBins * e]);
+        }
+
+        string name = datasetName + "_" + pulseNames[p];
+        if(nAxes() > 2)
+            writeDatasetND(file, name.c_str(), true, false, &counts[0]);
+        else
+            writeTable(file, name.c_str(), true, false, &counts[0],
+                       sums.empty() ? NULL : &sums[0]);
+    }
+}
+
+/**
+ * @brief Writes the datasets convolved with the beams given with
+ * addBeamConvolution()
+ * @param file
+ * @param datasetName name of the dataset of the histogram
+ */
+
+void Histogram::writeBeamConvolutions(H5FileHelper *file,
+                                      const string &datasetName) const
+{
+    if(beamFWHMs.empty())
+        return;
+    uint axis = 0;
+    while(type[axis] != DATA_POINTS)
+        axis++;
+    const size_t n = nBins[axis] - 1;
+    const size_t stride = strides[axis];
+    const size_t outer = totBins / (nBins[axis] * stride);
+    vector<double> edges(n + 1);
+    for (size_t i = 0; i <= n; ++i)
+        edges[i] = binEdge(axis, i);
+    vector<double> counts(totBins);
+    vector<double> in(n + 1), out(n + 1);
+
+    for (size_t b = 0; b < beamFWHMs.size(); ++b) {
+        BeamConvolver convolver(edges, beamFWHMs[b]);
+        if(!convolver.valid()) {
+            logMessage("Beam %s cannot be convolved, skipping",
+                       beamNames[b].c_str());
+            continue;
+        }
+        for (size_t o = 0; o < outer; ++o) {
+            for (size_t j = 0; j < stride; ++j) {
+                const size_t offset = o * nBins[axis] * stride + j;
+                for (size_t i = 0; i <= n; ++i)
+                    in[i] = binCount(offset + i * stride);
+                convolver.convolve(&in[0], &out[0]);
+                for (size_t i = 0; i <= n; ++i)
+                    counts[offset + i * stride] = out[i];
+            }
+        }
+
+        string name = datasetName + "_" + beamNames[b];
+        if(nAxes() > 2)
+            writeDatasetND(file, name.c_str(), true, false, &counts[0]);
+        else
+            writeTable(file, name.c_str(), true, false, &counts[0], NULL);
+    }
+}
+
+/**
+ * @brief Lower edge of the given bin
+ * @param axis
+ * @param bin index of the bin, up to nBins (i.e. the upper edge of the
+ * overflow bin)
+ *
+ * The overflow bin of a BINNING_EDGES axis is given the width of the last
+ * regular bin.
+ */
+
+double Histogram::binEdge(const uint axis, const size_t bin) const
+{
+    switch(_binning[axis]) {
+    case BINNING_LOG:
+        return exp(firstBinEdge[axis] + bin / invBinSize[axis]);
+    case BINNING_EDGES: {
+        const vector<double> &e = edges[axis];
+        size_t n = e.size() - 1;
+        if(bin <= n)
+            return e[bin];
+        return e[n] + (bin - n) * (e[n] - e[n - 1]);
+    }
+    case BINNING_UNIFORM:
+    default:
+        return firstBinEdge[axis] + bin * binWidth[axis];
+    }
+}
+
+/**
+ * @brief Center of the given bin, as saved in the output file
+ * @param axis
+ * @param bin
+ *
+ * Bins in the DATA_COS_THETA domain are mapped back to angles in degrees.
+ * The center of logarithmic bins is the geometric mean of their edges.
+ */
+
+double Histogram::binCenter(const uint axis, const size_t bin) const
+{
+    double center;
+    switch(_binning[axis]) {
+    case BINNING_LOG:
+        center = sqrt(binEdge(axis, bin) * binEdge(axis, bin + 1));
+        break;
+    case BINNING_EDGES:
+        center = 0.5 * (binEdge(axis, bin) + binEdge(axis, bin + 1));
+        break;
+    case BINNING_UNIFORM:
+    default:
+        center = firstBinCenter[axis] + bin * binWidth[axis];
+        break;
+    }
+    if(type[axis] == DATA_COS_THETA)
+        return acos(std::max(-1., std::min(1., center))) * degPerRad;
+    return center;
+}
+
+/**
+ * @brief Writes the histogram in a dataset of an open H5 file
+ * @param file
+ * @param datasetName
+ * @param create if true the dataset is created, together with its
+ * "column_names" attribute, otherwise the existing dataset is overwritten
+ * @param chunked whether the created dataset is chunked, as required e.g. by
+ * SWMR (see H5FileHelper::startSWMRWrite())
+ *
+ * 1D and 2D histograms are saved as a table: the first column holds the bin
+ * centers along the first axis, the following ones the normalized counts
+ * (one column per bin of the second axis) and the moments. Histograms with
+ * more axes are saved as described in writeDatasetND().
+ */
+
+void Histogram::writeDataset(H5FileHelper *file, const char *datasetName,
+                             bool create, bool chunked) const
+{
+    if(nAxes() > 2)
+        writeDatasetND(file, datasetName, create, chunked, NULL);
+    else
+        writeTable(file, datasetName, create, chunked, NULL, NULL);
+}
+
+/**
+ * @brief Writes a 1D or 2D histogram as a table, see writeDataset()
+ * @param file
+ * @param datasetName
+ * @param create
+ * @param chunked
+ * @param counts if not NULL, totBins values replacing the counts
+ * @param sums if not NULL, the moment sums matching counts
+ */
+
+void Histogram::writeTable(H5FileHelper *file, const char *datasetName,
+                           bool create, bool chunked, const double *counts,
+                           const double *sums) const
+{
+    hsize_t dims[2] = {nBins[0], nBins[1]+1};
+    if(computeSpatialMoments)
+        dims[1] += totExponents;
+    if(!create)
+        file->openDataSet(datasetName);
+    else if(chunked)
+        file->newDataset(datasetName, 2, dims, dims);
+    else
+        file->newDataset(datasetName, 2, dims);
+
+    uint ncols = dims[1];
+    string colNames[ncols];
+
+    // counts are converted and written a slab of rows at a time, so that
+    // large histograms do not need a dense copy in memory
+    size_t slabRows = HISTOGRAM_SLAB_BINS / nBins[1];
+    if(slabRows == 0)
+        slabRows = 1;
+    if(slabRows > nBins[0])
+        slabRows = nBins[0];
+
+    double *data; //convert all histograms to double
+    data = (double *)malloc(std::max(slabRows * nBins[1], nBins[0])
+                            * sizeof(double));
+
+    hsize_t start[2];
+    hsize_t count[2];
+
+    for (size_t i = 0; i < nBins[0]; ++i) {
+        data[i] = binCenter(0, i);
+    }
+
+    start[0] = 0;
+    start[1] = 0;
+    count[0] = nBins[0];
+    count[1] = 1;
+
+    file->writeHyperSlabDouble(start, count, data);
+
+
+
+    colNames[0] = axisName(0);
+
+    vector<MCfloat> columnScale(nBins[1]);
+    for (size_t j = 0; j < nBins[1]; ++j)
+        columnScale[j] = is2D() ? axisNormalization(1, j) : 1;
+
+    for (size_t i0 = 0; i0 < nBins[0]; i0 += slabRows) {
+        size_t rows = std::min(slabRows, (size_t)(nBins[0] - i0));
+        for (size_t i = i0; i < i0 + rows; ++i) {
+            MCfloat scale2 = normalization(i);
+            double *row = data + (i - i0) * nBins[1];
+            for (size_t j = 0; j < nBins[1]; ++j)
+                row[j] = binValue(i * nBins[1] + j, counts)
+                        / (scale2 * columnScale[j]);
+        }
+
+        start[0] = i0;
+        start[1] = 1;
+        count[0] = rows;
+        count[1] = nBins[1];
+
+        file->writeHyperSlabDouble(start, count, data);
+    }
+
+
+
+    if(computeSpatialMoments) {
+        for (size_t i = 0; i < totExponents; ++i) {
+
+            ostringstream strs;
+            strs << "mom_" << momentExponents[i];
+
+            colNames[2+i] = strs.str();
+
+            for (size_t idx = 0; idx < nBins[0]; ++idx) {
+                double sum = sums != NULL ? sums[totBins * i + idx]
+                                          : moments[totBins * i + idx];
+                data[idx] = sum / binValue(idx, counts);
+            }
 
             start[0] = 0;
             start[1] = 2 + i;
@@ -381,16 +1341,578 @@ void Histogram::saveToFile(const char *fileName) const
     else {
         for (size_t j = 0; j < nBins[1]; ++j) {
             stringstream ss;
-            ss << "b-" << firstBinCenter[1] + j * binSize[1];
+            ss << "b-" << binCenter(1, j);
             colNames[j + 1] = ss.str();
         }
     }
 
-    file->writeColumnNames(ncols, colNames);
-    file->close();
+    if(create)
+        file->writeColumnNames(ncols, colNames);
+    file->closeDataSet();
 
     free(data);
-    delete file;
+}
+
+/**
+ * @brief Writes a histogram with more than two axes in a dataset of an open
+ * H5 file
+ *
+ * The normalized counts are saved in an N-dimensional dataset, with a
+ * dimension per axis and the last bin along each of them holding the
+ * overflow. Its "column_names" attribute holds the names of the axes. When
+ * the dataset is created, the nBins edges of the regular bins of each axis
+ * \f$ i \f$ are saved in the 1D dataset datasetName_edges_\f$ i \f$, in the
+ * same units as the bin centers of a 1D histogram (i.e. DATA_COS_THETA edges
+ * are converted to degrees).
+ *
+ * Counts are normalized as in 1D and 2D histograms: the first axis
+ * contributes the area or solid angle of the bin, see normalization(), the
+ * other ones a factor given by axisNormalization().
+ */
+
+void Histogram::writeDatasetND(H5FileHelper *file, const char *datasetName,
+                               bool create, bool chunked,
+                               const double *counts) const
+{
+    uint n = nAxes();
+    hsize_t dims[HISTOGRAM_MAX_AXES];
+    hsize_t start[HISTOGRAM_MAX_AXES];
+    hsize_t count[HISTOGRAM_MAX_AXES];
+    for (uint a = 0; a < n; ++a) {
+        dims[a] = nBins[a];
+        start[a] = 0;
+        count[a] = nBins[a];
+    }
+
+    if(create) {
+        string names[HISTOGRAM_MAX_AXES];
+        for (uint a = 0; a < n; ++a) {
+            stringstream ss;
+            ss << datasetName << "_edges_" << a;
+            vector<double> e(nBins[a]);
+            for (size_t k = 0; k < nBins[a]; ++k) {
+                e[k] = binEdge(a, k);
+                if(type[a] == DATA_COS_THETA)
+                    e[k] = acos(std::max(-1., std::min(1., e[k]))) * degPerRad;
+            }
+            file->newDataset(ss.str().c_str(), 1, &dims[a]);
+            file->writeHyperSlabDouble(start, &dims[a], &e[0]);
+            file->closeDataSet();
+            names[a] = axisName(a);
+        }
+        if(chunked)
+            file->newDataset(datasetName, n, dims, dims);
+        else
+            file->newDataset(datasetName, n, dims);
+        file->writeColumnNames(n, names);
+    }
+    else
+        file->openDataSet(datasetName);
+
+    // normalization of the bins of a row, i.e. along all axes but the first
+    size_t rowBins = totBins / nBins[0];
+    vector<MCfloat> rowScale(rowBins, 1);
+    for (size_t j = 0; j < rowBins; ++j) {
+        for (uint a = 1; a < n; ++a) {
+            rowScale[j] *= axisNormalization(a, (j / strides[a]) % nBins[a]);
+        }
+    }
+
+    size_t slabRows = HISTOGRAM_SLAB_BINS / rowBins;
+    if(slabRows == 0)
+        slabRows = 1;
+    if(slabRows > nBins[0])
+        slabRows = nBins[0];
+    double *data = (double *)malloc(slabRows * rowBins * sizeof(double));
+
+    for (size_t i0 = 0; i0 < nBins[0]; i0 += slabRows) {
+        size_t rows = std::min(slabRows, (size_t)(nBins[0] - i0));
+        for (size_t i = i0; i < i0 + rows; ++i) {
+            MCfloat scale2 = normalization(i);
+            double *row = data + (i - i0) * rowBins;
+            for (size_t j = 0; j < rowBins; ++j)
+                row[j] = binValue(i * rowBins + j, counts)
+                        / (scale2 * rowScale[j]);
+        }
+        start[0] = i0;
+        count[0] = rows;
+        file->writeHyperSlabDouble(start, count, data);
+    }
+
+    file->closeDataSet();
+    free(data);
+}
+
+/**
+ * @brief Name of the given axis in the saved datasets
+ */
+
+string Histogram::axisName(const uint axis) const
+{
+    switch (type[axis]) {
+    case DATA_K:
+    case DATA_COS_THETA:
+        return "k";
+    case DATA_TIMES:
+        return "time";
+    case DATA_POINTS:
+        return "um";
+    case DATA_AZIMUTH:
+        return "phi";
+    case DATA_PHOTON_TYPE:
+        return "type";
+    default:
+        return "";
+    }
+}
+
+/**
+ * @brief The factor the counts of the given row are divided by when saved
+ * @param bin0 index of the bin along the first axis
+ *
+ * Angular histograms are normalized to the solid angle of the bin, spatial
+ * ones to the area of the ring, all of them to the total number of photons.
+ * Areas and solid angles are computed from the actual edges of the bin. The
+ * other domains are normalized to the bin width only when the binning is not
+ * uniform, so that bins of different widths can be compared.
+ */
+
+MCfloat Histogram::normalization(const size_t bin0) const
+{
+    // azimuthal extent of the solid angle of a bin, in radians; with an
+    // azimuth axis it depends on the bin, see axisNormalization()
+    MCfloat azimuthalRange = 2 * pi<MCfloat>();
+    for (uint a = 1; a < nAxes(); ++a) {
+        if(type[a] == DATA_AZIMUTH)
+            azimuthalRange = 1;
+    }
+    MCfloat lo = binEdge(0, bin0);
+    MCfloat hi = binEdge(0, bin0 + 1);
+
+    switch (type[0]) {
+    case DATA_K:
+        return scale * 2 * azimuthalRange
+                * sin((lo + hi) / 2 / degPerRad)
+                * sin((hi - lo) / 2 / degPerRad);
+
+    case DATA_COS_THETA:
+        // bins of equal width in cos(theta) subtend equal solid angles
+        return scale * azimuthalRange * (hi - lo);
+
+    case DATA_POINTS:
+        return scale * pi<MCfloat>() * (hi * hi - lo * lo);
+
+    case DATA_TIMES:
+    case DATA_AZIMUTH:
+    default:
+        if(_binning[0] != BINNING_UNIFORM)
+            return scale * (hi - lo);
+        return scale;
+    }
+}
+
+/**
+ * @brief The factor the counts are divided by when saved, for the given bin
+ * of an axis other than the first one, in addition to normalization()
+ * @param axis
+ * @param bin
+ *
+ * The azimuth axis of an angular histogram contributes its share of the
+ * solid angle of the bin. Other axes are normalized to the bin width only
+ * when the binning is not uniform.
+ */
+
+MCfloat Histogram::axisNormalization(const uint axis, const size_t bin) const
+{
+    MCfloat width = binEdge(axis, bin + 1) - binEdge(axis, bin);
+    if(type[axis] == DATA_AZIMUTH
+            && (type[0] == DATA_K || type[0] == DATA_COS_THETA))
+        return width / degPerRad;
+    if(_binning[axis] != BINNING_UNIFORM)
+        return width;
+    return 1;
+}
+
+/**
+ * @brief Name of the dataset the histogram is saved into
+ * @return the name set with setName(), or "histogram"
+ */
+
+string Histogram::name() const
+{
+    return histName.empty() ? "histogram" : histName;
+}
+
+/**
+ * @brief Publishes the histogram in a POSIX shared memory segment while the
+ * simulation is running
+ * @param name name of the segment, e.g. "/mcpp-times"; an empty string
+ * disables publishing (the default)
+ *
+ * The merged counts are updated every Simulation::setSharedMemoryInterval()
+ * seconds, see HistogramPublisher.
+ */
+
+void Histogram::setSharedMemoryName(const char *name)
+{
+    shmName = name;
+}
+
+string Histogram::sharedMemoryName() const
+{
+    return shmName;
+}
+
+/**
+ * @brief Stores the counts in tiles allocated on demand
+ * @param enabled
+ *
+ * By default counts are stored in a dense array of 64-bit counters, one per
+ * bin, which is replicated for every simulating thread. For large and mostly
+ * empty histograms (e.g. high-resolution radius vs time maps) tiled storage
+ * only allocates the tiles of bins that are actually hit, with 32-bit
+ * counters that are promoted to 64 bits on overflow (see TiledCounts).
+ * Incrementing a bin is slightly slower.
+ *
+ * The histogram is saved with the same dense layout in both cases. Must be
+ * called before initialize().
+ */
+
+void Histogram::setTiledStorage(bool enabled)
+{
+    tiled = enabled;
+}
+
+bool Histogram::tiledStorage() const
+{
+    return tiled;
+}
+
+/**
+ * @brief Number of counters currently allocated
+ *
+ * Equal to the number of bins, unless tiled storage is enabled.
+ */
+
+uint64_t Histogram::allocatedBins() const
+{
+    if(tiles != NULL)
+        return tiles->allocatedBins();
+    return histo != NULL ? totBins : 0;
+}
+
+u_int64_t Histogram::binCount(const uint64_t bin) const
+{
+    if(tiles != NULL)
+        return tiles->count(bin);
+    return histo != NULL ? histo[bin] : 0;
+}
+
+/**
+ * @brief Copies the counts into a dense array of totBins counters
+ * @param dest
+ */
+
+void Histogram::copyCounts(u_int64_t *dest) const
+{
+    if(histo != NULL) {
+        memcpy(dest, histo, totBins * sizeof(u_int64_t));
+        return;
+    }
+    memset(dest, 0, totBins * sizeof(u_int64_t));
+    if(tiles != NULL)
+        tiles->addTo(dest);
+}
+
+/**
+ * @brief Shares the counts of a single histogram among all the simulating
+ * threads
+ * @param enabled
+ *
+ * By default every thread of a multithreaded Simulation fills its own copy of
+ * each histogram, and the copies are summed when the threads complete (with a
+ * parallel tree reduction). This is the fastest option for small histograms,
+ * but memory grows with the number of threads.
+ *
+ * When enabled, the threads add their counts directly to this histogram
+ * through a small per-thread write-combining buffer of
+ * HISTOGRAM_COMBINING_SLOTS bins, which coalesces repeated hits to the same
+ * bin. Dense counters are updated with atomic additions, tiled ones (see
+ * setTiledStorage()) under HISTOGRAM_LOCK_STRIPES striped locks. Memory no
+ * longer depends on the number of threads and no reduction is needed, at the
+ * cost of contention on the most populated bins.
+ *
+ * Not compatible with spatial moments. Ignored by single-threaded runs and by
+ * SimulationBatch.
+ */
+
+void Histogram::setSharedAcrossThreads(bool enabled)
+{
+    sharedStorage = enabled;
+}
+
+bool Histogram::sharedAcrossThreads() const
+{
+    return sharedStorage;
+}
+
+/**
+ * @brief Makes this per-thread clone add its counts to the given histogram
+ * @param target the (initialized) histogram of the main simulation
+ *
+ * Must be called before initialize(), from the main thread.
+ */
+
+void Histogram::shareStorageWith(Histogram *target)
+{
+    sharedTarget = target;
+    target->sharing = true;
+    if(target->tiles != NULL && target->stripes == NULL)
+        target->stripes = new boost::mutex[HISTOGRAM_LOCK_STRIPES];
+}
+
+/**
+ * @brief Adds counts to a bin of a shared histogram, from any thread
+ * @param bin
+ * @param count
+ */
+
+void Histogram::addShared(const uint64_t bin, const u_int64_t count)
+{
+    if(histo != NULL) {
+        __atomic_fetch_add(&histo[bin], count, __ATOMIC_RELAXED);
+        return;
+    }
+    size_t stripe = (bin >> TILE_SHIFT) % HISTOGRAM_LOCK_STRIPES;
+    boost::mutex::scoped_lock lock(stripes[stripe]);
+    tiles->add(bin, count);
+}
+
+/**
+ * @brief Adds the counts of a shared histogram that might be being updated
+ * @param rhs
+ */
+
+void Histogram::appendSharedCounts(const Histogram *rhs)
+{
+    if(rhs->histo != NULL) {
+        for (size_t i = 0; i < totBins; ++i) {
+            u_int64_t value = __atomic_load_n(&rhs->histo[i], __ATOMIC_RELAXED);
+            if(histo != NULL)
+                histo[i] += value;
+            else
+                tiles->add(i, value);
+        }
+        return;
+    }
+    // one stripe at a time, so that at most the threads adding to the tiles
+    // of that stripe have to wait
+    const size_t nTiles = rhs->tiles->nTiles();
+    for (size_t i = 0; i < HISTOGRAM_LOCK_STRIPES && i < nTiles; ++i) {
+        boost::mutex::scoped_lock lock(rhs->stripes[i]);
+        for (size_t t = i; t < nTiles; t += HISTOGRAM_LOCK_STRIPES) {
+            if(histo != NULL)
+                rhs->tiles->addTileTo(histo, t);
+            else
+                tiles->addTile(rhs->tiles, t);
+        }
+    }
+}
+
+/**
+ * @brief Adds the pending counts of the write-combining buffer to the shared
+ * histogram
+ */
+
+void Histogram::flushCombiningBuffer()
+{
+    if(combining == NULL)
+        return;
+    for (size_t i = 0; i < HISTOGRAM_COMBINING_SLOTS; ++i) {
+        CombiningSlot &s = combining[i];
+        if(s.count != 0)
+            sharedTarget->addShared(s.bin, s.count);
+        s.count = 0;
+    }
+}
+
+/**
+ * @brief Index of a bin once the bins along an axis have been merged in
+ * groups of \f$ 2^{shift} \f$
+ *
+ * The overflow bin stays the overflow bin.
+ */
+
+static inline uint64_t mergedIndex(const uint64_t bin, const uint64_t stride,
+                                   const uint64_t nBins, const uint shift)
+{
+    const uint64_t last = nBins - 1;
+    uint64_t c = (bin / stride) % nBins;
+    uint64_t merged = c == last ? last : (shift < 64 ? c >> shift : 0);
+    return bin - (c - merged) * stride;
+}
+
+/**
+ * @brief Extends the range of the given auto-ranging axis so that the
+ * photons of the batch fit in it
+ * @param batch
+ *
+ * Photons rejected by pickPhoton() do not extend the range. They are only
+ * checked when beyond the current range, which is rare.
+ */
+
+void Histogram::fitRange(const WalkerBatch &batch)
+{
+    bool filter = _detector != NULL || typeid(*this) != typeid(Histogram);
+    for (uint a = 0; a < nAxes(); ++a) {
+        if(!_autoRange[a])
+            continue;
+        const MCfloat *col = batchColumn(batch, type[a]);
+        MCfloat limit = min[a] + binWidth[a] * (nBins[a] - 1);
+        MCfloat xMax = limit;
+        for (uint t = 0; t < 4; ++t) {
+            if(!((photonTypeFlags >> t) & 1))
+                continue;
+            for (size_t r = batch.begin(t); r < batch.end(t); ++r) {
+                // NaNs and infinities do not extend the range
+                MCfloat x = col[r];
+                if(x < xMax || !(x <= numeric_limits<MCfloat>::max()))
+                    continue;
+                if(filter && !pickPhoton(batch.walker(r)))
+                    continue;
+                xMax = x;
+            }
+        }
+        uint shift = 0;
+        while(xMax >= limit) {
+            limit = min[a] + (limit - min[a]) * 2;
+            shift++;
+        }
+        if(shift > 0)
+            rebin(a, shift);
+    }
+}
+
+/**
+ * @brief Merges the bins of an auto-ranging axis in groups of
+ * \f$ 2^{shift} \f$
+ * @param axis
+ * @param shift
+ *
+ * Counts and moments are moved in place: bins only move towards lower
+ * indices, so that visiting them in increasing order never overwrites counts
+ * still to be moved.
+ */
+
+void Histogram::rebin(const uint axis, const uint shift)
+{
+    const uint64_t stride = strides[axis];
+    if(histo != NULL) {
+        for (uint64_t i = 0; i < totBins; ++i) {
+            uint64_t j = mergedIndex(i, stride, nBins[axis], shift);
+            if(j == i)
+                continue;
+            histo[j] += histo[i];
+            histo[i] = 0;
+        }
+    }
+    else if(tiles != NULL) {
+        TiledCounts *merged = new TiledCounts(totBins);
+        for (size_t t = 0; t < tiles->nTiles(); ++t) {
+            if(!tiles->allocated(t))
+                continue;
+            uint64_t first = (uint64_t)t << TILE_SHIFT;
+            uint64_t last = std::min(first + TILE_BINS, totBins);
+            for (uint64_t i = first; i < last; ++i) {
+                u_int64_t value = tiles->count(i);
+                if(value != 0)
+                    merged->add(mergedIndex(i, stride, nBins[axis], shift),
+                                value);
+            }
+        }
+        delete tiles;
+        tiles = merged;
+    }
+    if(moments != NULL) {
+        for (size_t e = 0; e < totExponents; ++e) {
+            MCfloat *m = moments + totBins * e;
+            for (uint64_t i = 0; i < totBins; ++i) {
+                uint64_t j = mergedIndex(i, stride, nBins[axis], shift);
+                if(j == i)
+                    continue;
+                m[j] += m[i];
+                m[i] = 0;
+            }
+        }
+    }
+    rangeLevel[axis] += shift;
+    binWidth[axis] = ldexp(binSize[axis], rangeLevel[axis]);
+    updateAxis(axis);
+}
+
+/**
+ * @brief Adds the counts of a histogram whose auto-ranging axes are
+ * narrower, merging its bins on the fly
+ * @param rhs
+ */
+
+void Histogram::appendRebinnedCounts(const Histogram *rhs)
+{
+    for (uint64_t i = 0; i < totBins; ++i) {
+        u_int64_t value = rhs->binCount(i);
+        uint64_t j = i;
+        for (uint a = 0; a < HISTOGRAM_MAX_AXES; ++a) {
+            if(rangeLevel[a] > rhs->rangeLevel[a])
+                j = mergedIndex(j, strides[a], nBins[a],
+                                rangeLevel[a] - rhs->rangeLevel[a]);
+        }
+        if(value != 0) {
+            if(histo != NULL)
+                histo[j] += value;
+            else
+                tiles->add(j, value);
+        }
+        if(moments != NULL && rhs->moments != NULL) {
+            for (size_t e = 0; e < totExponents; ++e) {
+                moments[totBins * e + j] += rhs->moments[totBins * e + i];
+            }
+        }
+    }
+}
+
+/**
+ * @brief Restores the initial range of the auto-ranging axes
+ */
+
+void Histogram::resetRange()
+{
+    for (uint a = 0; a < nAxes(); ++a) {
+        if(!_autoRange[a])
+            continue;
+        rangeLevel[a] = 0;
+        binWidth[a] = binSize[a];
+        updateAxis(a);
+    }
+}
+
+/**
+ * @brief Sets all the counts and moments to zero
+ *
+ * Auto-ranging axes are brought back to their initial range.
+ */
+
+void Histogram::clearCounts()
+{
+    if(combining != NULL)
+        memset(combining, 0, HISTOGRAM_COMBINING_SLOTS * sizeof(CombiningSlot));
+    else if(tiles != NULL)
+        tiles->clear();
+    else
+        memset(histo, 0, totBins * sizeof(u_int64_t));
+    if(moments != NULL)
+        memset(moments, 0, totExponents * totBins * sizeof(MCfloat));
+    if(autoRanging)
+        resetRange();
 }
 
 void Histogram::setScale(u_int64_t totalPhotons)
@@ -411,16 +1933,30 @@ bool Histogram::pickPhoton_impl(const Walker * const w) const
 BaseObject *Histogram::clone_impl() const
 {
     Histogram *h = new Histogram(NULL);
-    h->type[0] = type[0];
-    h->type[1] = type[1];
-    h->min[0] = min[0];
-    h->min[1] = min[1];
-    h->max[0] = max[0];
-    h->max[1] = max[1];
-    h->binSize[0] = binSize[0];
-    h->binSize[1] = binSize[1];
+    for (uint i = 0; i < HISTOGRAM_MAX_AXES; ++i) {
+        h->type[i] = type[i];
+        h->min[i] = min[i];
+        h->max[i] = max[i];
+        h->binSize[i] = binSize[i];
+        h->_binning[i] = _binning[i];
+        h->_autoRange[i] = _autoRange[i];
+        h->logBins[i] = logBins[i];
+        h->edges[i] = edges[i];
+    }
     h->computeSpatialMoments = computeSpatialMoments;
     h->photonTypeFlags = photonTypeFlags;
+    h->histName = histName;
+    h->shmName = shmName;
+    h->tiled = tiled;
+    h->sharedStorage = sharedStorage;
+    if(_detector != NULL)
+        h->setDetector((Detector *)_detector->clone());
+    for (size_t i = 0; i < pulses.size(); ++i) {
+        h->addTimeConvolution((AbstractDistribution *)pulses[i]->clone(),
+                              pulseNames[i].c_str());
+    }
+    h->beamFWHMs = beamFWHMs;
+    h->beamNames = beamNames;
     h->scale = scale;
 
     if(computeSpatialMoments) {
@@ -437,21 +1973,69 @@ bool Histogram::sanityCheck_impl() const
 {
     if(photonTypeFlags < 0)
         return false;
-    if(type[0] == DATA_NONE)
-        return false;
-    if(binSize[0] == 0)
+    if(_detector != NULL && !_detector->sanityCheck())
         return false;
-    if(is2D() && binSize[1] == 0)
+    if(type[0] == DATA_NONE)
         return false;
-    if(max[0] - min[0] <= 0)
+    uint azimuthAxes = 0;
+    for (uint i = 0; i < nAxes(); ++i) {
+        if(type[i] == DATA_PHOTON_TYPE)  // fixed binning
+            continue;
+        if(type[i] == DATA_COS_THETA && (min[i] < 0 || max[i] > 1))
+            return false;
+        if(type[i] == DATA_AZIMUTH && (min[i] < 0 || max[i] > 360))
+            return false;
+        if(type[i] == DATA_AZIMUTH)
+            azimuthAxes++;
+        if(_autoRange[i] && (_binning[i] != BINNING_UNIFORM || sharedStorage
+                             || (type[i] != DATA_TIMES
+                                 && type[i] != DATA_POINTS)))
+            return false;
+        if(max[i] - min[i] <= 0)
+            return false;
+        switch(_binning[i]) {
+        case BINNING_LOG:
+            if(logBins[i] == 0 || min[i] <= 0)
+                return false;
+            break;
+        case BINNING_EDGES:
+            if(edges[i].size() < 2)
+                return false;
+            for (size_t j = 1; j < edges[i].size(); ++j) {
+                if(!(edges[i][j] > edges[i][j - 1]))
+                    return false;
+            }
+            break;
+        case BINNING_UNIFORM:
+        default:
+            if(binSize[i] == 0)
+                return false;
+            break;
+        }
+    }
+    if(azimuthAxes > 1)
         return false;
-    if(is2D() && max[1] - min[1] <= 0)
+    if(sharedStorage && !momentExponents.empty())
         return false;
     if(computeSpatialMoments) {
-        if(is2D())
+        if(!is1D())
             return false;
         if(type[0] != DATA_TIMES)
             return false;
     }
+    if(!pulses.empty()
+            && (type[0] != DATA_TIMES || _binning[0] != BINNING_UNIFORM))
+        return false;
+    if(!beamFWHMs.empty()) {
+        uint axis = 0;
+        while(axis < nAxes() && type[axis] != DATA_POINTS)
+            axis++;
+        if(axis == nAxes() || min[axis] < 0)
+            return false;
+        for (size_t b = 0; b < beamFWHMs.size(); ++b) {
+            if(!(beamFWHMs[b] > 0))
+                return false;
+        }
+    }
     return true;
 }
@@ -0,0 +1,207 @@
+/*
+  This file is part of MCPlusPlus.
+
+  MCPlusPlus is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Mcplusplus is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with MCPlusPlus.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <MCPlusPlus/histogrampublisher.h>
+
+#include <boost/thread.hpp>
+#include <boost/bind.hpp>
+
+#include <errno.h>
+#include <stdio.h>
+
+using namespace MCPP;
+
+/**
+ * @brief Creates the shared memory segments and starts the publishing thread
+ * @param slots the slots of the simulating threads, which must outlive the
+ * publisher
+ * @param nSlots
+ * @param interval seconds between updates
+ */
+
+HistogramPublisher::HistogramPublisher(SnapshotSlot *slots,
+                                       const unsigned int nSlots,
+                                       const double interval)
+{
+    this->slots = slots;
+    this->nSlots = nSlots;
+    this->interval = interval;
+    merged = slots[0].cloneHistograms();
+    for (size_t i = 0; i < merged.size(); ++i) {
+        if(!merged[i]->sharedMemoryName().empty())
+            createSegment(i);
+    }
+    stopRequested = false;
+    thread = new boost::thread(boost::bind(
+                                   &HistogramPublisher::publisherLoop, this));
+}
+
+HistogramPublisher::~HistogramPublisher()
+{
+    stop();
+    for (size_t i = 0; i < segments.size(); ++i) {
+        munmap(segments[i].header, segments[i].size);
+    }
+    for (size_t i = 0; i < merged.size(); ++i) {
+        delete merged[i];
+    }
+}
+
+/**
+ * @brief Stops the publishing thread, after a last update with the "done"
+ * flag set
+ */
+
+void HistogramPublisher::stop()
+{
+    if(thread == NULL)
+        return;
+    {
+        boost::mutex::scoped_lock lock(mutex);
+        stopRequested = true;
+    }
+    stopCondition.notify_one();
+    thread->join();
+    delete thread;
+    thread = NULL;
+    publish(true);
+}
+
+bool HistogramPublisher::createSegment(const size_t index)
+{
+    const Histogram *h = merged[index];
+    string shmName = h->sharedMemoryName();
+    const char *name = shmName.c_str();
+    uint64_t totEdges = 0;
+    for (uint i = 0; i < HISTOGRAM_MAX_AXES; ++i) {
+        if(h->_binning[i] != BINNING_UNIFORM)
+            totEdges += h->nBins[i];
+    }
+    size_t size = mcpp_shm_segment_size(h->totBins, h->totExponents,
+                                        totEdges);
+
+    shm_unlink(name);
+    int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0644);
+    if(fd < 0) {
+        fprintf(stderr, "Cannot create shared memory segment %s: %s\n", name,
+                strerror(errno));
+        return false;
+    }
+    void *base = MAP_FAILED;
+    if(ftruncate(fd, size) == 0)
+        base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(base == MAP_FAILED) {
+        fprintf(stderr, "Cannot map shared memory segment %s: %s\n", name,
+                strerror(errno));
+        shm_unlink(name);
+        return false;
+    }
+
+    // the segment is zero-filled by ftruncate()
+    mcpp_shm_header *header = (mcpp_shm_header *)base;
+    header->version = MCPP_SHM_VERSION;
+    header->size = size;
+    header->nExponents = h->totExponents;
+    for (uint i = 0; i < HISTOGRAM_MAX_AXES; ++i) {
+        header->type[i] = h->type[i];
+        header->nBins[i] = h->nBins[i];
+        header->min[i] = h->min[i];
+        header->binSize[i] = h->_binning[i] == BINNING_UNIFORM ? h->binSize[i]
+                                                               : 0;
+        header->nEdges[i] = h->_binning[i] == BINNING_UNIFORM ? 0
+                                                              : h->nBins[i];
+    }
+    double *exponents = (double *)(header + 1);
+    for (size_t i = 0; i < h->totExponents; ++i) {
+        exponents[i] = h->momentExponents[i];
+    }
+    for (uint i = 0; i < HISTOGRAM_MAX_AXES; ++i) {
+        double *edges = (double *)mcpp_shm_edges(header, i);
+        for (size_t k = 0; k < header->nEdges[i]; ++k) {
+            edges[k] = h->binEdge(i, k);
+        }
+    }
+    __atomic_store_n(&header->magic, MCPP_SHM_MAGIC, __ATOMIC_RELEASE);
+
+    Segment s;
+    s.hist = h;
+    s.index = index;
+    s.header = header;
+    s.size = size;
+    segments.push_back(s);
+    return true;
+}
+
+void HistogramPublisher::publisherLoop()
+{
+    boost::posix_time::time_duration period =
+            boost::posix_time::microseconds((int64_t)(interval * 1e6));
+    boost::mutex::scoped_lock lock(mutex);
+    while(!stopRequested) {
+        boost::system_time deadline = boost::get_system_time() + period;
+        while(!stopRequested && boost::get_system_time() < deadline)
+            stopCondition.timed_wait(lock, deadline);
+        if(stopRequested)
+            return;
+        lock.unlock();
+        publish(false);
+        lock.lock();
+    }
+}
+
+/**
+ * @brief Merges the snapshot slots and updates the segments
+ * @param done
+ */
+
+void HistogramPublisher::publish(const bool done)
+{
+    u_int64_t counters[4];
+    vector<u_int64_t> histPhotons;
+    SnapshotSlot::merge(slots, nSlots, merged, counters, &histPhotons);
+
+    for (size_t i = 0; i < segments.size(); ++i) {
+        const Histogram *h = segments[i].hist;
+        mcpp_shm_header *header = segments[i].header;
+        uint64_t *counts = (uint64_t *)(mcpp_shm_exponents(header)
+                                        + h->totExponents
+                                        + mcpp_shm_total_edges(header));
+        double *moments = (double *)(counts + h->totBins);
+
+        uint64_t seq = header->sequence;
+        __atomic_store_n(&header->sequence, seq + 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+
+        h->copyCounts(counts);
+        for (uint j = 0; j < HISTOGRAM_MAX_AXES; ++j) {
+            // the range of auto-ranging axes grows during the simulation
+            if(h->_binning[j] == BINNING_UNIFORM)
+                header->binSize[j] = h->binWidth[j];
+        }
+        if(h->moments != NULL) {
+            // MCfloat might not be double
+            for (size_t j = 0; j < h->totExponents * h->totBins; ++j) {
+                moments[j] = h->moments[j];
+            }
+        }
+        header->photons = histPhotons[segments[i].index];
+        memcpy(header->photonCounters, counters, 4 * sizeof(uint64_t));
+        header->done = done;
+
+        __atomic_store_n(&header->sequence, seq + 2, __ATOMIC_RELEASE);
+    }
+}
@@ -87,6 +87,10 @@ enum MCData {
     DATA_POINTS,
     DATA_K,
     DATA_TIMES,
+    DATA_COS_THETA,  /**< @brief cosine of the exit angle, histograms only */
+    DATA_AZIMUTH,  /**< @brief azimuth of the exit direction, in degrees,
+                        histograms only */
+    DATA_PHOTON_TYPE,  /**< @brief #walkerType, histograms only */
 };
 
 #define MC_ASSERT_MSG(x, msg) if(!(x)) { \
@@ -97,6 +101,7 @@ extern uint walkerFlagToType(walkerFlags flag);
 extern walkerFlags walkerTypeToFlag(uint index);
 extern string walkerTypeToString(uint index);
 extern unsigned int walkerSaveFlags(const string flags);
+extern double monotonicTime();
 }
 
 #endif // MCGLOBAL_H
@@ -0,0 +1,78 @@
+/*
+  This file is part of MCPlusPlus.
+
+  MCPlusPlus is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Mcplusplus is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with MCPlusPlus.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef BEAMCONVOLVER_H
+#define BEAMCONVOLVER_H
+
+#include <vector>
+#include <cstddef>
+
+#define BEAM_CONVOLVER_SUBRINGS 4
+#define BEAM_CONVOLVER_CUTOFF 8  /**< @brief in units of the beam sigma */
+
+namespace MCPP {
+
+using namespace std;
+
+/**
+ * @brief The BeamConvolver class convolves radial exit-point histograms
+ * with the lateral profile of a Gaussian beam
+ *
+ * For a laterally infinite sample and normal incidence, the response to a
+ * Gaussian beam is the response to a pencil beam convolved in the
+ * \f$ z = 0 \f$ plane with the beam intensity profile. A photon exiting at
+ * radius \f$ r' \f$ in the pencil-beam run exits at radius \f$ r \f$ with a
+ * Rice distribution when its entry point is displaced by a 2D Gaussian of
+ * standard deviation \f$ \sigma \f$, i.e. \f$ (r / \sigma)^2 \f$ is
+ * non-central \f$ \chi^2 \f$ distributed with two degrees of freedom and
+ * non-centrality \f$ (r' / \sigma)^2 \f$.
+ *
+ * The convolution is the matrix of the probabilities of moving from each
+ * ring of the histogram to each other ring. Photons are taken to be
+ * uniformly spread over the area of their ring, which is sampled at the
+ * centers of BEAM_CONVOLVER_SUBRINGS sub-rings of equal area. Displacements
+ * larger than BEAM_CONVOLVER_CUTOFF standard deviations are neglected, so
+ * that the matrix is banded. Counts moved beyond the last regular bin are
+ * added to the overflow bin, counts moved below the first bin edge (when it
+ * is positive) are dropped. Counts in the overflow bin are kept as they are.
+ *
+ * \see Histogram::addBeamConvolution()
+ */
+
+class BeamConvolver
+{
+public:
+    BeamConvolver(const vector<double> &edges, const double FWHM);
+
+    bool valid() const;
+    void convolve(const double *in, double *out) const;
+
+private:
+    double cdf(const double r0, const double r) const;
+
+    size_t n;  /**< @brief number of regular bins */
+    double sigma;
+    vector<size_t> first;  /**< @brief first destination bin of each bin */
+    vector<vector<double> > weights;  /**< @brief probabilities of moving to
+                                           the destination bins, starting
+                                           from first */
+    bool _valid;
+};
+
+}
+
+#endif // BEAMCONVOLVER_H
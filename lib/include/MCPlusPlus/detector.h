@@ -0,0 +1,237 @@
+/*
+  This file is part of MCPlusPlus.
+
+  MCPlusPlus is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Mcplusplus is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with MCPlusPlus.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef DETECTOR_H
+#define DETECTOR_H
+
+#include "baseobject.h"
+#include "walker.h"
+
+namespace MCPP {
+
+/**
+  * \defgroup Detectors Detectors
+  * \brief Classes selecting exiting photons by position, direction and time
+  */
+
+/**
+ * @brief Base detector class. Decides whether an exiting photon is detected.
+ *
+ * Detectors can be attached both to a Histogram (see Histogram::setDetector())
+ * and to the raw output of a Simulation (see
+ * Simulation::setRawOutputDetector()); photons that are not accepted are
+ * neither histogrammed nor stored. The same Detector object can be attached
+ * to several of them: it is owned by the first object it is attached to,
+ * unless it already has a parent.
+ *
+ * Detectors can be combined with a CompositeDetector.
+ *
+ * Positions refer to the exit point on the sample surface, directions to the
+ * exit k vector. Angles are expressed in degrees.
+ *
+ * \ingroup Detectors
+ */
+
+class Detector : public BaseObject
+{
+public:
+    Detector(BaseObject *parent=NULL);
+    virtual ~Detector();
+
+    /**
+     * @brief Determines whether the given exiting walker is detected
+     * @param w
+     * @return true if the walker is detected, false otherwise
+     */
+    virtual bool accept(const Walker * const w) const = 0;
+    virtual BaseObject *clone_impl() const = 0;
+};
+
+
+
+
+/**
+ * @brief Accepts photons exiting at a distance \f$ \rho \f$ from the
+ * \f$ z \f$ axis such that \f$ \rho_{min} \leq \rho < \rho_{max} \f$
+ * \ingroup Detectors
+ */
+
+class RadialRangeDetector : public Detector
+{
+public:
+    RadialRangeDetector(double rMin, double rMax, BaseObject *parent=NULL);
+
+    virtual bool accept(const Walker * const w) const;
+
+private:
+    virtual BaseObject *clone_impl() const;
+    virtual bool sanityCheck_impl() const;
+    virtual void describe_impl() const;
+
+    MCfloat rMin, rMax;
+    MCfloat rMin2, rMax2;
+};
+
+
+
+
+/**
+ * @brief Accepts photons exiting within a ring of given mean radius and width
+ * centered in \f$ (x_0, y_0) \f$
+ *
+ * A ring whose width is twice its radius is a disk, e.g. the face of an
+ * optical fiber placed off-axis.
+ * \ingroup Detectors
+ */
+
+class RingDetector : public Detector
+{
+public:
+    RingDetector(double radius, double width, double x0=0, double y0=0,
+                 BaseObject *parent=NULL);
+
+    virtual bool accept(const Walker * const w) const;
+
+private:
+    virtual BaseObject *clone_impl() const;
+    virtual bool sanityCheck_impl() const;
+    virtual void describe_impl() const;
+
+    MCfloat radius, width, x0, y0;
+    MCfloat rMin2, rMax2;
+};
+
+
+
+
+/**
+ * @brief Accepts photons exiting within the rectangle
+ * \f$ [x_{min}, x_{max}) \times [y_{min}, y_{max}) \f$
+ * \ingroup Detectors
+ */
+
+class RectangularDetector : public Detector
+{
+public:
+    RectangularDetector(double xMin, double xMax, double yMin, double yMax,
+                        BaseObject *parent=NULL);
+
+    virtual bool accept(const Walker * const w) const;
+
+private:
+    virtual BaseObject *clone_impl() const;
+    virtual bool sanityCheck_impl() const;
+    virtual void describe_impl() const;
+
+    MCfloat xMin, xMax, yMin, yMax;
+};
+
+
+
+
+/**
+ * @brief Accepts photons exiting within a cone of given half-angle around the
+ * sample normal
+ *
+ * The cone is centered on the \f$ z \f$ axis, on the side the photon exits
+ * from, so that the same detector works for both transmitted and reflected
+ * photons. The acceptance can also be specified as a numerical aperture, see
+ * setNumericalAperture().
+ * \ingroup Detectors
+ */
+
+class AcceptanceConeDetector : public Detector
+{
+public:
+    AcceptanceConeDetector(double halfAngle, BaseObject *parent=NULL);
+
+    void setHalfAngle(double halfAngle);
+    void setNumericalAperture(double NA, double n=1);
+    virtual bool accept(const Walker * const w) const;
+
+private:
+    virtual BaseObject *clone_impl() const;
+    virtual bool sanityCheck_impl() const;
+    virtual void describe_impl() const;
+
+    MCfloat halfAngle;
+    MCfloat cosHalfAngle;
+};
+
+
+
+
+/**
+ * @brief Accepts photons with walk time \f$ t_{min} \leq t < t_{max} \f$
+ * \ingroup Detectors
+ */
+
+class TimeGateDetector : public Detector
+{
+public:
+    TimeGateDetector(double tMin, double tMax, BaseObject *parent=NULL);
+
+    virtual bool accept(const Walker * const w) const;
+
+private:
+    virtual BaseObject *clone_impl() const;
+    virtual bool sanityCheck_impl() const;
+    virtual void describe_impl() const;
+
+    MCfloat tMin, tMax;
+};
+
+
+
+
+/**
+ * @brief Combines several detectors
+ *
+ * Depending on the mode, a photon is accepted if it is accepted by all the
+ * detectors (DETECTOR_ALL, the default) or by at least one of them
+ * (DETECTOR_ANY). For example, an annulus with a given numerical aperture is
+ * obtained combining a RadialRangeDetector and an AcceptanceConeDetector.
+ * \ingroup Detectors
+ */
+
+class CompositeDetector : public Detector
+{
+public:
+    enum Mode {
+        DETECTOR_ALL,
+        DETECTOR_ANY,
+    };
+
+    CompositeDetector(Mode mode=DETECTOR_ALL, BaseObject *parent=NULL);
+
+#ifdef SWIG
+    %apply SWIGTYPE *DISOWN {Detector *detector};
+#endif
+    void addDetector(Detector *detector);
+    virtual bool accept(const Walker * const w) const;
+
+private:
+    virtual BaseObject *clone_impl() const;
+    virtual bool sanityCheck_impl() const;
+    virtual void describe_impl() const;
+
+    Mode mode;
+    vector<const Detector *> detectors;
+};
+
+}
+#endif // DETECTOR_H
@@ -39,7 +39,8 @@ namespace MCPP {
  * object, the RNG used can be internal or the parent's.
  *
  * A new random number can be drawn by calling the spin() method which must be
- * reimplemented by derived classes.
+ * reimplemented by derived classes. Distributions can also provide their
+ * cumulative distribution function, see cdf().
  *
  * \ingroup Distributions
  */
@@ -57,6 +58,7 @@ public:
      * \pre The RNG has to be valid (see BaseRandom)
      */
     virtual MCfloat spin() const = 0;
+    virtual double cdf(const double x) const;
     virtual BaseObject *clone_impl() const = 0;
 
 protected:
@@ -83,6 +85,7 @@ public:
 
     void setCenter(double val);
     MCfloat spin() const;
+    virtual double cdf(const double x) const;
 
 private:
     MCfloat x0;
@@ -112,6 +115,7 @@ public:
     void setSigma(double value);
     void setFWHM(double value);
     virtual MCfloat spin() const;
+    virtual double cdf(const double x) const;
 
 private:
     void reconstructDistribution();
@@ -138,6 +142,7 @@ public:
 
     virtual MCfloat spin() const;
     MCfloat spinOpen() const;
+    virtual double cdf(const double x) const;
 
 private:
     void reconstructDistribution();
@@ -166,6 +171,7 @@ public:
     void setBeta(double value);
     void setLambda(double value);
     MCfloat spin() const;
+    virtual double cdf(const double x) const;
 
 private:
     void reconstructDistribution();
@@ -198,6 +204,7 @@ public:
     void setScale(double value);
     void setFWHM(double value);
     MCfloat spin() const;
+    virtual double cdf(const double x) const;
 
 private:
     virtual BaseObject* clone_impl() const;
@@ -0,0 +1,81 @@
+/*
+  This file is part of MCPlusPlus.
+
+  MCPlusPlus is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Mcplusplus is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with MCPlusPlus.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef EXITOBSERVER_H
+#define EXITOBSERVER_H
+
+#include "baseobject.h"
+#include "walker.h"
+#include "walkerbatch.h"
+
+namespace MCPP {
+
+/**
+ * @brief Base class of user-defined tallies of the exiting photons
+ *
+ * ExitObservers extend the output of a Simulation beyond Histograms and
+ * SummaryTallies without modifying the Simulation itself, see
+ * Simulation::addExitObserver(). Subclasses implement observe(), which is
+ * called for every buffer of exiting walkers, merge(), clone_impl() and,
+ * to write their results, saveToFile().
+ *
+ * Each buffer is passed as is, without copies: the walkers in the order they
+ * exited, together with the WalkerBatch computed for the histograms, which
+ * holds the walkers partitioned by type and the contiguous columns of
+ * derived quantities registered in requireColumns().
+ *
+ * With multiple threads (or in a SimulationBatch), every thread observes
+ * its own clone of the observer. When the threads are done, the clones are
+ * merged pairwise with merge() and finally into the original observer, so
+ * that merge() must only access the two observers involved.
+ */
+
+class ExitObserver : public BaseObject
+{
+public:
+    ExitObserver(BaseObject *parent=NULL);
+    virtual ~ExitObserver();
+
+    virtual void initialize();
+    virtual void requireColumns(WalkerBatch *batch) const;
+
+    /**
+     * @brief Observes a buffer of exiting walkers
+     * @param buf the walkers, in the order they exited the sample
+     * @param size number of walkers in buf
+     * @param batch the same walkers, partitioned by type, with the columns
+     * registered by requireColumns()
+     *
+     * The buffer is reused after this function returns: the walkers must
+     * not be referenced afterwards.
+     */
+    virtual void observe(const Walker * const buf, const size_t size,
+                         const WalkerBatch &batch) = 0;
+
+    /**
+     * @brief Merges the data of a clone of this observer
+     * @param rhs
+     */
+    virtual void merge(const ExitObserver *rhs) = 0;
+    virtual void saveToFile(const char *fileName,
+                            const char *groupName=NULL) const;
+    virtual BaseObject *clone_impl() const = 0;
+};
+
+}
+
+#endif // EXITOBSERVER_H
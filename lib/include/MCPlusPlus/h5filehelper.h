@@ -57,6 +57,9 @@ public:
     void writeHyperSlab(const hsize_t *start, const hsize_t *count,
                         const u_int64_t *srcBuffer);
     void loadAll(MCfloat *destBuffer);
+    void setLatestFormat(bool enable);
+    bool startSWMRWrite();
+    void flush();
     void close();
     void closeDataSet();
     const hsize_t *extentDims() const;
@@ -77,6 +80,7 @@ protected:
 
 private:
     void resetErrorAutoPrint();
+    FileAccPropList fileAccessList() const;
     bool _openFile(const char *fileName);
     void _openDataSet(const char *dataSetName);
     virtual bool openFile_impl();
@@ -84,6 +88,7 @@ private:
 
     char *fName, *dName;
     bool opened, dsOpened;
+    bool latestFormat;
 
     H5E_auto2_t Efunc;
     void *EclientData;
@@ -20,9 +20,70 @@
 
 #include "h5filehelper.h"
 #include "sample.h"
+#include "simulationstats.h"
+
+#define RAW_DEFAULT_CHUNK_PHOTONS 65536
 
 namespace MCPP {
 
+/**
+ * @brief Storage encodings of the raw datasets
+ *
+ * \see RawDatasetOptions
+ */
+
+enum RawEncoding {
+    RAW_ENCODING_NATIVE,  /**< @brief MCfloat, as in memory */
+    RAW_ENCODING_FLOAT32,  /**< @brief single precision floating point */
+    RAW_ENCODING_FIXED_POINT,  /**< @brief 32-bit integers \f$ q \f$, with
+                                    \f$ x = q \cdot scale + offset \f$ */
+    RAW_ENCODING_OCTAHEDRAL,  /**< @brief unit vectors as two 16-bit
+                                   octahedral coordinates (exit k vectors
+                                   only) */
+};
+
+/**
+ * @brief Storage options of the raw datasets of a group (exit points, walk
+ * times or exit k vectors)
+ *
+ * Filters are applied in the following order: shuffle, the additional filter
+ * (if any), deflate. Filters that are not available in the HDF5 library are
+ * skipped with a warning. Shuffle followed by deflate usually works well with
+ * floating point raw data.
+ *
+ * The encoding trades precision for size. RAW_ENCODING_FIXED_POINT suits walk
+ * times and exit points, whose absolute resolution is given by scale (e.g. a
+ * scale of 1e-3 stores positions in \f$ \mu m \f$ with a resolution of
+ * 1 nm, up to about 2 m). RAW_ENCODING_OCTAHEDRAL stores unit vectors in 4
+ * bytes with an error below \f$ 10^{-4} \f$ on each component and
+ * requires all the three components of the exit k vectors to be saved.
+ * Invalid combinations fall back to RAW_ENCODING_FLOAT32 with a warning.
+ * The encoding is recorded in the "encoding", "scale" and "offset" attributes
+ * of each dataset, so that the loaders of H5OutputFile decode transparently.
+ *
+ * \see H5OutputFile::setRawDatasetOptions()
+ */
+
+class RawDatasetOptions
+{
+public:
+    RawDatasetOptions(hsize_t chunkSize=RAW_DEFAULT_CHUNK_PHOTONS,
+                      int deflateLevel=0, bool shuffle=false,
+                      RawEncoding encoding=RAW_ENCODING_NATIVE,
+                      double scale=0, double offset=0);
+
+    hsize_t chunkSize;  /**< @brief number of photons per chunk */
+    int deflateLevel;  /**< @brief from 1 to 9, 0 disables compression */
+    bool shuffle;  /**< @brief enables the byte shuffle filter */
+    int filter;  /**< @brief identifier of an additional filter, e.g. a
+                      registered plugin, or H5Z_FILTER_NONE */
+    vector<unsigned int> filterParams;  /**< @brief client data values of the
+                                             additional filter */
+    RawEncoding encoding;  /**< @brief storage encoding */
+    double scale;  /**< @brief resolution of RAW_ENCODING_FIXED_POINT */
+    double offset;  /**< @brief offset of RAW_ENCODING_FIXED_POINT */
+};
+
 /**
  * @brief The H5OutputFile class allows to manipulate the HDF5 files generated
  * by MCPlusPlus
@@ -40,11 +101,33 @@ namespace MCPP {
  *
  * Three other groups contain the actual simulated data: "exit-k-vectors",
  * "exit-points", "walk-times". Each group contains as many datasets as are the
- * photon types currently saved (see walkerType).
+ * photon types currently saved (see walkerType). Which groups and datasets
+ * are created is set with setRawDatasetFlags(); chunking and compression are
+ * set per group with setRawDatasetOptions().
  *
  * The "exit-points" dataset contains the exit \f$ (x,y) \f$ coordinates
  * written sequentially for each photon. The same applies for the saved
- * components of the exit k vectors.
+ * components of the exit k vectors. Raw datasets can be stored with reduced
+ * precision (see RawDatasetOptions::encoding): the loaders always return
+ * MCfloat values, whose number is given by rawDataSize().
+ *
+ * The "stats" group contains the event counters of the transport loop (see
+ * SimulationStats): the "counters" dataset, whose "column_names" attribute
+ * names each element, and the "steps-histogram" and "path-length-histogram"
+ * datasets.
+ *
+ * Raw datasets holding a random sample of the photons (see
+ * Simulation::setRawOutputReservoirSize()) record the fraction of photons
+ * kept in their "sampling-fraction" attribute, see samplingFraction().
+ *
+ * The raw datasets of a multithreaded Simulation are virtual datasets (see
+ * createVirtualDatasets()) concatenating the datasets of one shard file per
+ * thread, which must be kept next to the main file. They are read as the
+ * regular ones.
+ *
+ * The structure above can also be rooted in a group other than the file root
+ * (see openRootGroup()), which is how SimulationBatch stores several
+ * simulations in a single file.
  */
 
 class H5OutputFile : public H5FileHelper
@@ -68,6 +151,10 @@ public:
                           const hsize_t *start=NULL, const hsize_t *count=NULL);
     bool loadData(MCData group, walkerType type, MCfloat *destBuffer,
                   const hsize_t *start=NULL, const hsize_t *count=NULL);
+    hsize_t rawDataSize(MCData group, walkerType type);
+    bool createVirtualDatasets(const vector<string> &sourceFiles);
+    void setSamplingFraction(walkerType type, double fraction);
+    double samplingFraction(MCData group, walkerType type);
 
     void saveRNGState(const uint seed, const string s);
     string readRNGState(const uint seed) const;
@@ -82,11 +169,33 @@ public:
     u_int64_t backReflected() const;
     const u_int64_t *photonCounters() const;
     void saveSample(const Sample *sample);
+    void saveStats(const SimulationStats *stats);
+    bool openRootGroup(const char *groupName, bool create_datasets=true);
+    void setRawDatasetFlags(uint walkTimesSaveFlags, uint exitPointsSaveFlags,
+                            uint exitKVectorsSaveFlags,
+                            uint exitKVectorsDirsSaveFlags=DIR_X|DIR_Y|DIR_Z);
+    void setRawDatasetOptions(MCData group, const RawDatasetOptions &options);
 
 private:
+    bool initializeGroup(bool create_datasets);
     bool createDatasets(uint walkTimesSaveFlags, uint exitPointsSaveFlags,
                         uint exitKVectorsSaveFlags);
+    bool createRawDatasets(MCData group, uint flags, uint floatsPerPhoton);
+    bool createVirtualDataset(const string &dsName,
+                              const vector<string> &sourceFiles);
+    void writeEncoding(DataSet *dset, const RawEncoding encoding,
+                       const double scale, const double offset);
+    RawEncoding rawEncoding(double *scale, double *offset) const;
+    void appendToCurrentDataset(const void *buffer, const hsize_t size,
+                                const PredType &memType);
+    void loadFromCurrentDataset(void *destBuffer, const hsize_t start,
+                                const hsize_t count, const PredType &memType);
+    string path(const char *name) const;
+    string rawDatasetName(MCData group, walkerType type) const;
+    bool rawDatasetExists(MCData group, walkerType type) const;
     bool createRNGDataset();
+    void writeUInt64Dataset(const char *datasetName, const u_int64_t *buffer,
+                            const hsize_t size);
     void appendTo1Ddataset(const char *datasetName, const MCfloat *buffer,
                            const hsize_t size);
     bool loadFrom1Ddataset(const char *datasetName, MCfloat *destBuffer,
@@ -96,6 +205,10 @@ private:
     bool openFile_impl();
 
     u_int64_t _photonCounters[4];
+    uint rawFlags[4];  /**< @brief save flags, indexed by MCData */
+    uint nKVectorDirs;
+    RawDatasetOptions rawOptions[4];  /**< @brief indexed by MCData */
+    string rootGroup;
 };
 
 }
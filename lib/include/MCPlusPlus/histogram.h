@@ -20,25 +20,72 @@
 
 #include "baseobject.h"
 #include "walker.h"
+#include "detector.h"
+#include "h5filehelper.h"
+#include "walkerbatch.h"
+#include "tiledcounts.h"
+#include "distributions.h"
+
+#include <boost/thread/mutex.hpp>
+
+#define HISTOGRAM_MAX_AXES 4
+#define HISTOGRAM_KERNEL_BATCH 64
+#define HISTOGRAM_SLAB_BINS (1 << 20)
+#define HISTOGRAM_COMBINING_SLOTS 256
+#define HISTOGRAM_LOCK_STRIPES 64
 
 namespace MCPP {
 
+/**
+ * @brief Spacing of the bins along an axis of a Histogram
+ */
+
+enum HistogramBinning {
+    BINNING_UNIFORM,  /**< @brief bins of equal width, see
+                           Histogram::setBinSize() */
+    BINNING_LOG,  /**< @brief logarithmically spaced bins, see
+                       Histogram::setLogBinning() */
+    BINNING_EDGES,  /**< @brief arbitrary bin edges, see
+                         Histogram::setBinEdges() */
+};
+
 /**
  * @brief The Histogram class provides a flexible live histogramming interface
  *
- * A single Histogram object describes a single 1D or 2D histogram of the
- * simulated data. The histogram parameters such as bin size and range can be
+ * A single Histogram object describes a single histogram of the simulated
+ * data, with up to HISTOGRAM_MAX_AXES axes (e.g. time, exit radius, exit
+ * angle and photon type). The histogram parameters such as bin size and range can be
  * specified using the respective setter functions; an extra last bin keeps
  * track of overflow counts. The data domain (i.e. exit time, space or angles)
  * and photon type (e.g. transmitted, reflected, etc.) to be histogrammed must
  * be specified through setDataDomain() and setPhotonTypeFlags() respectively.
+ * Exit angles can also be binned in \f$ \cos \theta \f$ and azimuth, and
+ * photons by type (DATA_PHOTON_TYPE).
+ * Bins are uniform by default; each axis can be binned logarithmically or
+ * with arbitrary edges instead, see setLogBinning() and setBinEdges(). The
+ * range of uniform axes can also grow with the data, see setAutoRange().
+ * Large, mostly empty histograms can be stored sparsely, see
+ * setTiledStorage(), and shared by all the simulating threads rather than
+ * replicated, see setSharedAcrossThreads().
  *
  * Multiple Histograms can be added to a Simulation object and are performed
  * live during the simulation; see Simulation::addHistogram().
  *
+ * An optional Detector further restricts the photons that are histogrammed,
+ * e.g. to those exiting within a given radius; see setDetector().
+ *
+ * Time histograms of a simulation whose source emits all the photons at
+ * \f$ t = 0 \f$ can be convolved with one or more pulse profiles when saved,
+ * see addTimeConvolution(). Likewise, radial histograms of a simulation with
+ * a PencilBeamSource can be convolved with the profiles of Gaussian beams,
+ * see addBeamConvolution().
+ *
  * Histograms can be assigned a name through setName() and are saved in a H5
- * file in a dataset with that name at the end of the simulation. When saved,
- * data are scaled with the total number of simulated photons.
+ * file in a dataset with that name at the end of the simulation, see
+ * writeDataset(). When saved,
+ * data are scaled with the total number of simulated photons. The
+ * current counts can also be published in shared memory while the simulation
+ * is running, see setSharedMemoryName().
  *
  * \pre The following conditions must hold for a Histogram to be in a valid
  * state:
@@ -48,7 +95,14 @@ namespace MCPP {
  *
  * - a valid upper limit for each axis must be specified. Minimum defaults to 0.
  *
+ * - logarithmic axes must have a positive minimum, bin edges must be strictly
+ *   increasing
+ *
  * - spatial variance can only be computed for 1D Histograms in the time domain
+ *
+ * - time convolutions require a uniform DATA_TIMES first axis
+ *
+ * - beam convolutions require a DATA_POINTS axis and a positive FWHM
  */
 
 class Histogram : public BaseObject
@@ -58,7 +112,11 @@ public:
     virtual ~Histogram();
 
     void setDataDomain(const enum MCData type1,
-                       const enum MCData type2 = DATA_NONE);
+                       const enum MCData type2 = DATA_NONE,
+                       const enum MCData type3 = DATA_NONE,
+                       const enum MCData type4 = DATA_NONE);
+    void setAxis(const uint axis, const enum MCData type, const double min,
+                 const double max, const double binSize);
     void setMax(const double max1);
     void setMax(const double max1, const double max2);
     void setMax2(const double max2);
@@ -68,42 +126,185 @@ public:
     void setBinSize(const double binSize1);
     void setBinSize(const double binSize1, const double binSize2);
     void setBinSize2(const double binSize2);
+    void setLogBinning(const uint axis, const double min, const double max,
+                       const uint64_t nBins);
+    void setBinEdges(const uint axis, const vector<double> &edges);
+    enum HistogramBinning binning(const uint axis) const;
+    void setAutoRange(const uint axis, const bool enabled=true);
+    bool autoRange(const uint axis) const;
     void addMomentExponent(const double exponent);
+    uint nAxes() const;
     bool is1D() const;
     bool is2D() const;
     bool initialize();
     void setPhotonTypeFlags(int value);
+#ifdef SWIG
+    %apply SWIGTYPE *DISOWN {Detector *detector};
+#endif
+    void setDetector(Detector *detector);
+    const Detector *detector() const;
+#ifdef SWIG
+    %apply SWIGTYPE *DISOWN {AbstractDistribution *profile};
+#endif
+    void addTimeConvolution(AbstractDistribution *profile, const char *name);
+    size_t nTimeConvolutions() const;
+    void addBeamConvolution(const double FWHM, const char *name);
+    size_t nBeamConvolutions() const;
     void run(const Walker * const buf, size_t bufSize);
+    void run(const WalkerBatch &batch);
+    void requireColumns(WalkerBatch *batch) const;
     void appendCounts(const Histogram *rhs);
+    void clearCounts();
     void dump() const;
-    void saveToFile(const char *fileName) const;
+    void saveToFile(const char *fileName,
+                    const char *groupName=NULL) const;
+    void writeDataset(H5FileHelper *file, const char *datasetName,
+                      bool create=true, bool chunked=false) const;
     void setScale(u_int64_t totalPhotons);
     void setName(const char *name);
+    string name() const;
+    void setSharedMemoryName(const char *name);
+    string sharedMemoryName() const;
+    void setTiledStorage(bool enabled);
+    bool tiledStorage() const;
+    void setSharedAcrossThreads(bool enabled);
+    bool sharedAcrossThreads() const;
+    uint64_t allocatedBins() const;
 
 private:
+    friend class HistogramPublisher;
+    friend class SnapshotSlot;
+    friend class Simulation;
+
+    struct CombiningSlot {
+        uint64_t bin;
+        u_int64_t count;
+    };
+
     virtual bool sanityCheck_impl() const;
     virtual bool pickPhoton_impl(const Walker * const w) const;
     virtual BaseObject* clone_impl() const;
     bool pickPhoton(const Walker * const w) const;
+    double binEdge(const uint axis, const size_t bin) const;
+    double binCenter(const uint axis, const size_t bin) const;
+    MCfloat normalization(const size_t bin0) const;
+    MCfloat axisNormalization(const uint axis, const size_t bin) const;
+    string axisName(const uint axis) const;
+    void writeTable(H5FileHelper *file, const char *datasetName,
+                    bool create, bool chunked, const double *counts,
+                    const double *sums) const;
+    void writeDatasetND(H5FileHelper *file, const char *datasetName,
+                        bool create, bool chunked,
+                        const double *counts) const;
+    void writeConvolvedDatasets(H5FileHelper *file,
+                                const string &datasetName) const;
+    void writeBeamConvolutions(H5FileHelper *file,
+                               const string &datasetName) const;
+    u_int64_t binCount(const uint64_t bin) const;
+
+    /**
+     * @brief Count of the given bin, or the given value if counts is not NULL
+     */
+    inline double binValue(const uint64_t bin, const double *counts) const
+    {
+        return counts != NULL ? counts[bin] : binCount(bin);
+    }
+    void copyCounts(u_int64_t *dest) const;
+    void shareStorageWith(Histogram *target);
+    void addShared(const uint64_t bin, const u_int64_t count);
+    void appendSharedCounts(const Histogram *rhs);
+    void appendRebinnedCounts(const Histogram *rhs);
+    void fitRange(const WalkerBatch &batch);
+    void rebin(const uint axis, const uint shift);
+    void resetRange();
+    void updateAxis(const uint axis);
+    void flushCombiningBuffer();
+
+    /**
+     * @brief Counts a photon in the given bin of the shared target, through
+     * the write-combining buffer
+     */
+    inline void combine(const uint64_t bin)
+    {
+        CombiningSlot &s = combining[bin & (HISTOGRAM_COMBINING_SLOTS - 1)];
+        if(s.bin == bin) {
+            s.count++;
+            return;
+        }
+        if(s.count != 0)
+            sharedTarget->addShared(s.bin, s.count);
+        s.bin = bin;
+        s.count = 1;
+    }
+    void selectKernel();
+    template <enum MCData T0> void selectKernel();
+    template <enum MCData T0, enum MCData T1> void selectKernel();
+    template <enum MCData T0, enum MCData T1, bool MOMENTS, bool FILTER>
+    void runKernel(const WalkerBatch &batch);
+    template <bool FILTER>
+    void runKernelND(const WalkerBatch &batch);
+    inline void addCounts(const size_t *idx, const size_t n);
+    template <enum MCData T>
+    inline size_t axisIndex(const MCfloat x, const uint axis,
+                            const uint64_t last) const;
+
+    typedef void (Histogram::*RunKernel)(const WalkerBatch &batch);
+    RunKernel kernel;
+    WalkerBatch *ownBatch;  /**< @brief used by run(const Walker *, size_t) */
+    vector<const MCfloat *> momentColumns;
 
     string histName;
+    string shmName;
 
-    enum MCData type[2];
-    MCfloat min[2], max[2];
-    MCfloat binSize[2];
+    enum MCData type[HISTOGRAM_MAX_AXES];
+    MCfloat min[HISTOGRAM_MAX_AXES], max[HISTOGRAM_MAX_AXES];
+    MCfloat binSize[HISTOGRAM_MAX_AXES];
+    MCfloat invBinSize[HISTOGRAM_MAX_AXES];  /**< @brief inverse bin size, in
+                                                  log units for BINNING_LOG
+                                                  axes */
+    enum HistogramBinning _binning[HISTOGRAM_MAX_AXES];
+    bool _autoRange[HISTOGRAM_MAX_AXES];
+    bool autoRanging;  /**< @brief at least one axis is auto-ranging */
+    uint rangeLevel[HISTOGRAM_MAX_AXES];  /**< @brief number of times the bin
+                                               width has been doubled */
+    MCfloat binWidth[HISTOGRAM_MAX_AXES];  /**< @brief current width of
+                                                uniform bins */
+    uint64_t logBins[HISTOGRAM_MAX_AXES];
+    vector<double> edges[HISTOGRAM_MAX_AXES];  /**< @brief bin edges of
+                                                    BINNING_EDGES axes */
+    size_t normalBin[HISTOGRAM_MAX_AXES];
     bool computeSpatialMoments;
     int photonTypeFlags;
+    Detector *_detector;
+    vector<AbstractDistribution *> pulses;  /**< @brief time profiles, see
+                                                 addTimeConvolution() */
+    vector<string> pulseNames;
+    vector<double> beamFWHMs;  /**< @brief see addBeamConvolution() */
+    vector<string> beamNames;
 
-    MCfloat firstBinCenter[2];
-    MCfloat firstBinEdge[2];
-    uint64_t nBins[2];
+    MCfloat firstBinCenter[HISTOGRAM_MAX_AXES];
+    MCfloat firstBinEdge[HISTOGRAM_MAX_AXES];  /**< @brief \f$ \log x_{min} \f$
+                                                for BINNING_LOG axes */
+    uint64_t nBins[HISTOGRAM_MAX_AXES];  /**< @brief 1 for unused axes */
+    uint64_t strides[HISTOGRAM_MAX_AXES];
     MCfloat *moments;
 
     MCfloat degPerRad;
     uint64_t totBins, totExponents;
     vector<double> momentExponents;
     u_int64_t scale;
-    u_int64_t *histo;
+    u_int64_t *histo;  /**< @brief dense counts, NULL with tiled storage */
+    bool tiled;
+    TiledCounts *tiles;
+
+    // shared storage
+    bool sharedStorage;  /**< @brief setting, see setSharedAcrossThreads() */
+    Histogram *sharedTarget;  /**< @brief the histogram this per-thread clone
+                                   adds its counts to, or NULL */
+    bool sharing;  /**< @brief other histograms add counts to this one */
+    CombiningSlot *combining;  /**< @brief write-combining buffer, used when
+                                    sharedTarget is not NULL */
+    boost::mutex *stripes;  /**< @brief lock the tiles of a shared target */
 };
 
 }
@@ -0,0 +1,89 @@
+/*
+  This file is part of MCPlusPlus.
+
+  MCPlusPlus is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Mcplusplus is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with MCPlusPlus.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef HISTOGRAMPUBLISHER_H
+#define HISTOGRAMPUBLISHER_H
+
+#include "snapshotslot.h"
+#include "histogramshm.h"
+
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+#define SHM_DEFAULT_INTERVAL 0.25
+
+namespace boost {
+class thread;
+}
+
+namespace MCPP {
+
+/**
+ * @brief The HistogramPublisher class periodically publishes the merged
+ * histograms of a running Simulation in POSIX shared memory
+ *
+ * A segment is created for every histogram with a shared memory name (see
+ * Histogram::setSharedMemoryName()). Any existing segment with the same name
+ * is replaced. Every interval the publisher merges the SnapshotSlot of every
+ * thread and copies the raw counts and moments into the segments under a
+ * sequence lock, so that readers in other processes never see a partial
+ * update and never block the publisher. The layout and a C reader API are
+ * defined in histogramshm.h.
+ *
+ * Segments are not removed at the end of the simulation: the last update has
+ * the "done" flag set. They can be removed with shm_unlink().
+ *
+ * \see Simulation::setSharedMemoryInterval()
+ */
+
+class HistogramPublisher
+{
+public:
+    HistogramPublisher(SnapshotSlot *slots, const unsigned int nSlots,
+                       const double interval=SHM_DEFAULT_INTERVAL);
+    ~HistogramPublisher();
+
+    void stop();
+
+private:
+    HistogramPublisher(const HistogramPublisher &);
+    HistogramPublisher &operator=(const HistogramPublisher &);
+
+    struct Segment {
+        const Histogram *hist;
+        size_t index;  /**< @brief of the histogram among the merged ones */
+        mcpp_shm_header *header;
+        size_t size;
+    };
+
+    bool createSegment(const size_t index);
+    void publisherLoop();
+    void publish(const bool done);
+
+    SnapshotSlot *slots;
+    unsigned int nSlots;
+    vector<Histogram *> merged;
+    vector<Segment> segments;
+    double interval;
+
+    boost::thread *thread;
+    boost::mutex mutex;
+    boost::condition_variable stopCondition;
+    bool stopRequested;
+};
+
+}
+#endif // HISTOGRAMPUBLISHER_H
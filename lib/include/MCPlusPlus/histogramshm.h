@@ -0,0 +1,225 @@
+/*
+  This file is part of MCPlusPlus.
+
+  MCPlusPlus is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Mcplusplus is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with MCPlusPlus.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef HISTOGRAMSHM_H
+#define HISTOGRAMSHM_H
+
+/*
+ * Layout of the shared memory segments written by HistogramPublisher, and a
+ * small C reader API. This header does not depend on the rest of MCPlusPlus
+ * and can be used from C programs; link with -lrt on old glibc versions.
+ *
+ * A segment contains, in this order:
+ *
+ * - a struct mcpp_shm_header
+ * - double exponents[nExponents]: the moment exponents
+ * - double edges[nEdges[0] + ... + nEdges[3]]: the lower edge of every bin
+ *   of the axes with logarithmic or arbitrary bins, axis after axis, as in
+ *   the "_edges_" datasets of the output file (see mcpp_shm_edges())
+ * - uint64_t counts[nBins[0] * ... * nBins[3]]: the raw (not normalized)
+ *   counts, row-major, the last bin along each axis holding the overflow
+ * - double moments[nExponents * nBins[0]]: the raw moment sums (1D
+ *   histograms only)
+ *
+ * The header (but for binSize, photons, photonCounters and done), the
+ * exponents and the edges are written once, when the segment is created. The rest is
+ * protected by a sequence lock: the writer makes
+ * "sequence" odd before updating and even again afterwards, so that a copy
+ * taken between two equal, even values of "sequence" is consistent (see
+ * mcpp_shm_snapshot()).
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define MCPP_SHM_MAGIC 0x4850434d /* "MCPH" */
+#define MCPP_SHM_VERSION 3
+#define MCPP_SHM_MAX_AXES 4
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct mcpp_shm_header {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t sequence;  /* odd while the data is being updated */
+    uint64_t size;  /* of the whole segment, in bytes */
+    uint32_t type[MCPP_SHM_MAX_AXES];  /* MCData of each axis, DATA_NONE if
+                                          unused */
+    uint32_t nExponents;
+    uint32_t done;  /* set when the simulation has completed */
+    uint64_t nBins[MCPP_SHM_MAX_AXES];  /* 1 for unused axes */
+    double min[MCPP_SHM_MAX_AXES];
+    double binSize[MCPP_SHM_MAX_AXES];  /* 0 for axes with logarithmic or
+                                           arbitrary bins (see nEdges);
+                                           protected by the sequence lock,
+                                           as it grows for auto-ranging
+                                           axes */
+    uint64_t nEdges[MCPP_SHM_MAX_AXES];  /* nBins for axes with logarithmic
+                                            or arbitrary bins, 0 otherwise */
+    uint64_t photons;  /* number of photons the counts refer to */
+    uint64_t photonCounters[4];  /* see walkerType */
+};
+
+struct mcpp_shm_reader {
+    void *base;
+    size_t size;
+};
+
+static inline uint64_t mcpp_shm_total_bins(const struct mcpp_shm_header *h)
+{
+    uint64_t n = 1;
+    int i;
+    for (i = 0; i < MCPP_SHM_MAX_AXES; ++i)
+        n *= h->nBins[i];
+    return n;
+}
+
+static inline const double *mcpp_shm_exponents(const struct mcpp_shm_header *h)
+{
+    return (const double *)(h + 1);
+}
+
+static inline uint64_t mcpp_shm_total_edges(const struct mcpp_shm_header *h)
+{
+    uint64_t n = 0;
+    int i;
+    for (i = 0; i < MCPP_SHM_MAX_AXES; ++i)
+        n += h->nEdges[i];
+    return n;
+}
+
+/*
+ * The nEdges[axis] bin edges of the given axis, the last one being the lower
+ * edge of the overflow bin.
+ */
+static inline const double *mcpp_shm_edges(const struct mcpp_shm_header *h,
+                                           int axis)
+{
+    const double *e = mcpp_shm_exponents(h) + h->nExponents;
+    int i;
+    for (i = 0; i < axis; ++i)
+        e += h->nEdges[i];
+    return e;
+}
+
+static inline size_t mcpp_shm_segment_size(uint64_t totBins,
+                                           uint32_t nExponents,
+                                           uint64_t totEdges)
+{
+    return sizeof(struct mcpp_shm_header) + nExponents * sizeof(double)
+            + totEdges * sizeof(double) + totBins * sizeof(uint64_t)
+            + (size_t)nExponents * totBins * sizeof(double);
+}
+
+/*
+ * Maps the segment with the given name (e.g. "/mcpp-times") read-only.
+ * Returns 0 on success, -1 on error.
+ */
+static inline int mcpp_shm_open(struct mcpp_shm_reader *r, const char *name)
+{
+    struct stat st;
+    int fd = shm_open(name, O_RDONLY, 0);
+    r->base = NULL;
+    r->size = 0;
+    if(fd < 0)
+        return -1;
+    if(fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(struct mcpp_shm_header)) {
+        close(fd);
+        return -1;
+    }
+    r->base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(r->base == MAP_FAILED) {
+        r->base = NULL;
+        return -1;
+    }
+    r->size = st.st_size;
+    if(((const struct mcpp_shm_header *)r->base)->magic != MCPP_SHM_MAGIC) {
+        munmap(r->base, r->size);
+        r->base = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+static inline void mcpp_shm_close(struct mcpp_shm_reader *r)
+{
+    if(r->base != NULL)
+        munmap(r->base, r->size);
+    r->base = NULL;
+    r->size = 0;
+}
+
+/*
+ * The header of the mapped segment, to read the bin metadata and size the
+ * buffers passed to mcpp_shm_snapshot(). Fields protected by the sequence
+ * lock must be read with mcpp_shm_snapshot().
+ */
+static inline const struct mcpp_shm_header *mcpp_shm_get_header(
+        const struct mcpp_shm_reader *r)
+{
+    return (const struct mcpp_shm_header *)r->base;
+}
+
+/*
+ * Takes a consistent copy of the segment. header receives a copy of the
+ * header; counts (totBins elements) and moments (nExponents * totBins
+ * elements) can be NULL. Returns the number of attempts, or -1 if no
+ * consistent copy could be taken within maxAttempts attempts.
+ */
+static inline int mcpp_shm_snapshot(const struct mcpp_shm_reader *r,
+                                    struct mcpp_shm_header *header,
+                                    uint64_t *counts, double *moments,
+                                    int maxAttempts)
+{
+    const struct mcpp_shm_header *h = mcpp_shm_get_header(r);
+    uint64_t totBins = mcpp_shm_total_bins(h);
+    const uint64_t *srcCounts = (const uint64_t *)(
+                mcpp_shm_exponents(h) + h->nExponents
+                + mcpp_shm_total_edges(h));
+    const double *srcMoments = (const double *)(srcCounts + totBins);
+    int attempt;
+
+    for (attempt = 1; attempt <= maxAttempts; ++attempt) {
+        uint64_t seq0 = __atomic_load_n(&h->sequence, __ATOMIC_ACQUIRE);
+        uint64_t seq1;
+        if(seq0 & 1)
+            continue;
+        memcpy(header, h, sizeof(struct mcpp_shm_header));
+        if(counts != NULL)
+            memcpy(counts, srcCounts, totBins * sizeof(uint64_t));
+        if(moments != NULL)
+            memcpy(moments, srcMoments,
+                   h->nExponents * totBins * sizeof(double));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        seq1 = __atomic_load_n(&h->sequence, __ATOMIC_RELAXED);
+        if(seq0 == seq1)
+            return attempt;
+    }
+    return -1;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // HISTOGRAMSHM_H
@@ -0,0 +1,107 @@
+/*
+  This file is part of MCPlusPlus.
+
+  MCPlusPlus is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Mcplusplus is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with MCPlusPlus.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef KLLSKETCH_H
+#define KLLSKETCH_H
+
+#include "MCglobal.h"
+
+#include <stdint.h>
+#include <vector>
+
+#define KLL_DEFAULT_K 200
+
+namespace MCPP {
+
+using namespace std;
+
+/**
+ * @brief The KLLSketch class is a mergeable streaming quantile sketch
+ *
+ * The sketch (Karnin, Lang and Liberty, 2016) keeps a stack of compactors.
+ * Items retained at level \f$ h \f$ stand for \f$ 2^h \f$ items of the
+ * stream. When the sketch is full, the lowest level exceeding its capacity is
+ * sorted and every other item, starting at a random offset, is promoted to
+ * the next level. Level capacities decrease geometrically, by a factor 2/3,
+ * from the top level, whose capacity is \f$ k \f$.
+ *
+ * Memory is \f$ O(k) \f$ regardless of the number of items; the rank error
+ * of quantile() is about \f$ 1.7 / k \f$ with high probability (about 1% for
+ * the default \f$ k = \f$ KLL_DEFAULT_K). Up to a few \f$ k \f$ items are
+ * kept exactly, so that quantiles of small samples are exact. The minimum and
+ * maximum are always exact.
+ *
+ * Two sketches with the same \f$ k \f$ are merged with merge(); the result
+ * has the same accuracy as a sketch of the concatenated streams, provided
+ * that the sketches have been given different seeds (see setSeed()). The
+ * random offsets are drawn from an internal deterministic generator, so that
+ * results are reproducible.
+ */
+
+class KLLSketch
+{
+public:
+    KLLSketch(const uint k=KLL_DEFAULT_K);
+
+    void setK(const uint k);
+    uint k() const;
+    void setSeed(const uint64_t seed);
+
+    /**
+     * @brief Adds an item to the sketch
+     */
+    inline void update(const double x)
+    {
+        compactors[0].push_back(x);
+        if(x < _min)
+            _min = x;
+        if(x > _max)
+            _max = x;
+        _size++;
+        _n++;
+        if(_size >= maxSize)
+            compress();
+    }
+
+    void merge(const KLLSketch &rhs);
+    void clear();
+    u_int64_t count() const;
+    size_t retained() const;
+    double quantile(const double q) const;
+    double min() const;
+    double max() const;
+
+private:
+    void grow();
+    void compress();
+    void compact(const size_t level);
+    size_t capacity(const size_t level) const;
+    bool randomBit();
+
+    uint _k;
+    u_int64_t _n;
+    size_t _size;  /**< @brief number of retained items */
+    size_t maxSize;  /**< @brief sum of the capacities of the levels */
+    vector<vector<double> > compactors;
+    double _min, _max;  /**< @brief exact extremes of the stream */
+    uint64_t seed;
+    uint64_t rngState;
+};
+
+}
+
+#endif // KLLSKETCH_H
@@ -0,0 +1,74 @@
+/*
+  This file is part of MCPlusPlus.
+
+  MCPlusPlus is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Mcplusplus is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with MCPlusPlus.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef LAYERTABLES_H
+#define LAYERTABLES_H
+
+#include "sample.h"
+#include "source.h"
+
+namespace MCPP {
+
+/**
+ * @brief The LayerTables class caches the per-layer quantities used by the
+ * transport loop of a Simulation
+ *
+ * The tables only depend on the Sample, on the Source wavelength and position
+ * and on the time origin (see Simulation::setTimeOriginZ()). They are computed
+ * once per run and shared read-only by all the threads (or SimulationBatch
+ * work units) simulating the same configuration.
+ *
+ * \note Constructing a LayerTables object sets the wavelength of the sample
+ * materials to the wavelength of the source.
+ */
+
+class LayerTables
+{
+public:
+    LayerTables(const Sample *sample, const Source *source,
+                const MCfloat timeOriginZ);
+    ~LayerTables();
+
+    bool matches(const Sample *sample, const Source *source,
+                 const MCfloat timeOriginZ) const;
+
+    unsigned int nLayers;
+    MCfloat *upperZBoundaries;  /**< @brief nLayers + 1 boundaries */
+    Material *materials;  /**< @brief nLayers + 2 materials, including the
+                               surrounding environment */
+    MCfloat *mus;  /**< @brief scattering coefficients \f$ 1 / l_s \f$ */
+    MCfloat timeOffset;  /**< @brief time offset to be added to each walker,
+                              see Simulation::setTimeOriginZ() */
+    unsigned int initialLayer;  /**< @brief layer the walkers are injected
+                                     into */
+    MCfloat leftPoint;  /**< @brief injection \f$ z \f$ for sources placed at
+                             \f$ -\infty \f$ */
+
+private:
+    LayerTables(const LayerTables &);
+    LayerTables &operator=(const LayerTables &);
+
+    unsigned int layerAt(const MCfloat z) const;
+
+    const Sample *sample;
+    MCfloat wavelength;
+    MCfloat z0;
+    MCfloat timeOriginZ;
+};
+
+}
+#endif // LAYERTABLES_H
@@ -0,0 +1,143 @@
+/*
+  This file is part of MCPlusPlus.
+
+  MCPlusPlus is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Mcplusplus is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with MCPlusPlus.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef PROGRESSMONITOR_H
+#define PROGRESSMONITOR_H
+
+#include "baseobject.h"
+#include "simulationstats.h"
+
+#include <boost/atomic.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+#define PROGRESS_DEFAULT_INTERVAL 10.
+#define PROGRESS_SLOT_PADDING 64  /**< @brief bytes, at least a cache line */
+
+namespace boost {
+class thread;
+}
+
+namespace MCPP {
+
+/**
+ * @brief The ProgressSlot class publishes the progress of a single thread
+ *
+ * The slot is written by the simulating thread only, with relaxed atomic
+ * stores, and can be read at any time from other threads without locking.
+ * Besides the photon counts, it mirrors the per-photon event counters of the
+ * thread's SimulationStats, see publishStats() and stats(). These are
+ * published every WALKER_BUFSIZE photons only.
+ *
+ * The slots of the threads are allocated contiguously: each one is padded so
+ * that the stores of different threads never hit the same cache line.
+ */
+
+class ProgressSlot
+{
+public:
+    ProgressSlot();
+
+    void reset(const u_int64_t total, const uint seed);
+    void publishStats(const SimulationStats &stats);
+    SimulationStats stats() const;
+
+    boost::atomic<u_int64_t> photons;  /**< @brief completed photons */
+    boost::atomic<u_int64_t> total;  /**< @brief photons to be simulated */
+    boost::atomic<u_int64_t> counters[4];  /**< @brief see walkerType */
+    boost::atomic<uint> seed;
+
+private:
+    // see SimulationStats
+    boost::atomic<u_int64_t> nPhotons;
+    boost::atomic<u_int64_t> totalSteps;
+    boost::atomic<u_int64_t> scatteringEvents;
+    boost::atomic<u_int64_t> interfaceHits;
+    boost::atomic<u_int64_t> reflections;
+    boost::atomic<u_int64_t> refractions;
+    boost::atomic<u_int64_t> TIREvents;
+    boost::atomic<u_int64_t> layerSwitches;
+
+    char padding[PROGRESS_SLOT_PADDING];
+};
+
+/**
+ * @brief The ProgressMonitor class periodically writes the progress of a
+ * running Simulation as JSON lines
+ *
+ * A monitoring thread samples the ProgressSlot of every simulating thread each
+ * interval() seconds and writes a line such as:
+ *
+ * \code
+ * {"elapsed": 10.001, "photons": 1200000, "total": 10000000, "rate": 119988.1,
+ * "mean_rate": 119988.1, "eta": 73.3, "counters": {"transmitted": 67300,
+ * "ballistic": 0, "reflected": 1084400, "back-reflected": 48300},
+ * "threads": [{"seed": 0, "photons": 600000, "total": 5000000,
+ * "rate": 59994.0}, ...], "done": false}
+ * \endcode
+ *
+ * Rates are expressed in photons per second and are measured with a monotonic
+ * clock; "rate" refers to the last interval, "mean_rate" to the whole run. The
+ * ETA is in seconds, null until the first photon is completed. A last line
+ * with "done": true is written when the simulation ends.
+ *
+ * Output goes to stderr by default; see setOutputFileDescriptor() and
+ * setOutputFileName(). The workers never wait for the monitor: they only
+ * update their own slot.
+ *
+ * \see Simulation::setProgressMonitor()
+ */
+
+class ProgressMonitor : public BaseObject
+{
+public:
+    ProgressMonitor(BaseObject *parent=NULL);
+    virtual ~ProgressMonitor();
+
+    void setInterval(const double seconds);
+    double interval() const;
+    void setOutputFileDescriptor(const int fd);
+    bool setOutputFileName(const char *fileName);
+
+    void start(const ProgressSlot * const *slots, const size_t nSlots,
+               const u_int64_t totalPhotons);
+    void stop();
+
+private:
+    void monitorLoop();
+    void writeSample(const double now, const bool done);
+    void closeOutput();
+
+    virtual bool sanityCheck_impl() const;
+
+    double _interval;
+    int fd;
+    bool ownsFd;
+
+    vector<const ProgressSlot *> slots;
+    vector<u_int64_t> lastPhotons;
+    u_int64_t totalPhotons;
+    double startTime, lastTime;
+
+    boost::thread *thread;
+    boost::mutex mutex;
+    boost::condition_variable stopCondition;
+    bool stopRequested;
+};
+
+}
+#endif // PROGRESSMONITOR_H
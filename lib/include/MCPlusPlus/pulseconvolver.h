@@ -0,0 +1,72 @@
+/*
+  This file is part of MCPlusPlus.
+
+  MCPlusPlus is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Mcplusplus is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with MCPlusPlus.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef PULSECONVOLVER_H
+#define PULSECONVOLVER_H
+
+#include "distributions.h"
+
+#include <complex>
+#include <vector>
+
+namespace MCPP {
+
+using namespace std;
+
+/**
+ * @brief The PulseConvolver class convolves time-domain histograms with the
+ * time profile of a source pulse
+ *
+ * Transport is time-invariant, so that the time response to a pulse is the
+ * convolution of the impulse response (a simulation whose source emits all
+ * the photons at \f$ t = 0 \f$) with the pulse profile. The profile is
+ * discretized on the bins of the histogram, bin \f$ k \f$ holding the
+ * probability that the emission delay lies within
+ * \f$ [(k - \frac{1}{2})w, (k + \frac{1}{2})w) \f$, \f$ w \f$ being the bin
+ * width, as given by AbstractDistribution::cdf().
+ *
+ * The linear convolution is computed with a radix-2 FFT, whose kernel
+ * transform is computed once per convolver. Counts delayed beyond the last
+ * regular bin are added to the overflow bin, counts moved before the first
+ * bin (by profiles with negative delays) are dropped. Counts in the overflow
+ * bin are kept as they are.
+ *
+ * \see Histogram::addTimeConvolution()
+ */
+
+class PulseConvolver
+{
+public:
+    PulseConvolver(const AbstractDistribution *profile, const double binWidth,
+                   const size_t nBins);
+
+    bool valid() const;
+    void convolve(const double *in, double *out) const;
+
+    static void fft(vector<complex<double> > &a, const bool inverse);
+
+private:
+    size_t n;  /**< @brief number of regular bins */
+    size_t size;  /**< @brief length of the transforms, a power of two */
+    vector<complex<double> > kernel;  /**< @brief transform of the profile */
+    double tail;  /**< @brief probability of delays of nBins or more */
+    bool _valid;
+};
+
+}
+
+#endif // PULSECONVOLVER_H
@@ -0,0 +1,144 @@
+/*
+  This file is part of MCPlusPlus.
+
+  MCPlusPlus is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Mcplusplus is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with MCPlusPlus.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef RAWOUTPUTWRITER_H
+#define RAWOUTPUTWRITER_H
+
+#include "h5outputfile.h"
+#include "snapshotslot.h"
+
+#include <deque>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/thread_time.hpp>
+
+#define RAW_OUTPUT_CHUNK_SIZE 65536
+
+namespace boost {
+class thread;
+}
+
+namespace MCPP {
+
+/**
+ * @brief A chunk of raw output, holding whole photons only
+ *
+ * The layout of the vectors is the same as in the output file (see
+ * H5OutputFile).
+ */
+
+class RawOutputChunk
+{
+public:
+    RawOutputChunk();
+
+    vector<MCfloat> exitPoints[4];
+    vector<MCfloat> walkTimes[4];
+    vector<MCfloat> exitKVectors[4];
+    bool pending;  /**< @brief submitted and not yet written */
+};
+
+/**
+ * @brief The RawOutputWriter class appends raw output chunks to the output
+ * file from a dedicated thread
+ *
+ * Simulating threads fill a chunk of at most RAW_OUTPUT_CHUNK_SIZE photons and
+ * submit() it, then keep on simulating into a second buffer. Before submitting
+ * the next chunk they wait() for the previous one to be written, which
+ * normally has already happened. This way memory usage does not depend on the
+ * number of simulated photons and writing overlaps with transport.
+ *
+ * Chunks are written in submission order. Since every chunk holds whole
+ * photons, the \f$ i \f$-th record of the raw datasets of a given photon type
+ * refers to the same photon.
+ *
+ * While the writer is running, the output file must not be accessed by other
+ * threads.
+ *
+ * Several writers can run at the same time, each on its own file (e.g. the
+ * shards of a multithreaded Simulation). Since the HDF5 C++ API is not
+ * thread-safe, all the HDF5 calls of the writers are serialized by a single
+ * process-wide mutex: each writer queues and waits for its own chunks only,
+ * but the chunks of different writers are written one at a time.
+ *
+ * <h2>Live output</h2> When constructed with a set of SnapshotSlot, the writer
+ * also keeps a live view of the running simulation in the "live" group of
+ * the file:
+ *
+ * - one dataset per histogram, with the same name and layout as the final
+ * one, normalized to the number of photons simulated so far
+ *
+ * - photon-counters: as in the file root
+ *
+ * - photons: the number of photons the histograms refer to
+ *
+ * The file is switched to SWMR mode (see H5FileHelper::startSWMRWrite()), and
+ * every liveInterval seconds the writer merges the slots, updates the "live"
+ * group and flushes the file, raw chunks included. External readers can open
+ * the file concurrently in SWMR read mode, e.g. with h5py:
+ *
+ * \code
+ * f = h5py.File("output.h5", "r", libver="latest", swmr=True)
+ * d = f["live/histogram"]
+ * d.refresh()
+ * \endcode
+ *
+ * The slots must outlive the writer, which performs a last update when
+ * stopped.
+ */
+
+class RawOutputWriter
+{
+public:
+    RawOutputWriter(const char *fileName, SnapshotSlot *slots=NULL,
+                    const unsigned int nSlots=0, const double liveInterval=0);
+    ~RawOutputWriter();
+
+    void submit(RawOutputChunk *chunk);
+    void wait(RawOutputChunk *chunk);
+    void stop();
+
+private:
+    RawOutputWriter(const RawOutputWriter &);
+    RawOutputWriter &operator=(const RawOutputWriter &);
+
+    void writerLoop();
+    void write(RawOutputChunk *chunk);
+    void initializeLiveOutput();
+    bool liveUpdateDue() const;
+    void updateLiveOutput();
+
+    H5OutputFile file;
+    boost::thread *thread;
+    boost::mutex mutex;
+    boost::condition_variable queueCondition;
+    boost::condition_variable doneCondition;
+    deque<RawOutputChunk *> queue;
+    bool stopRequested;
+
+    SnapshotSlot *slots;
+    unsigned int nSlots;
+    vector<Histogram *> liveHists;  /**< @brief merged snapshot */
+    boost::posix_time::time_duration liveInterval;
+    boost::system_time nextLiveUpdate;
+
+    static boost::mutex hdf5Mutex;  /**< @brief serializes the HDF5 calls of
+                                         all the writers */
+};
+
+}
+#endif // RAWOUTPUTWRITER_H
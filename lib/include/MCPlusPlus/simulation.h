@@ -22,11 +22,22 @@
 #include "sample.h"
 #include "costhetagenerator.h"
 #include "histogram.h"
+#include "summarytally.h"
+#include "exitobserver.h"
+#include "layertables.h"
+#include "simulationstats.h"
+#include "progressmonitor.h"
+#include "rawoutputwriter.h"
+#include "histogrampublisher.h"
+
+#include <boost/shared_ptr.hpp>
 
 #define WALKER_BUFSIZE 1000
 
 namespace MCPP {
 
+class H5OutputFile;
+
 /**
  * @brief The Simulation class is the core of the MC method
  *
@@ -35,11 +46,26 @@ namespace MCPP {
  * total number of walkers to be simulated.
  *
  * Several Histograms can be performed with every simulation; see addHistogram.
+ * Summary statistics of exit observables that do not need a histogram (mean,
+ * variance, quantiles) are computed by SummaryTally objects, see
+ * addSummaryTally(). Custom tallies can be implemented by subclassing
+ * ExitObserver, see addExitObserver().
  * The output file can be specified using setOutputFileName(). Additionally,
  * raw output with the data of each single simulated photons can be enabled
  * using setRawOutputEnabled(). In the latter case output flags can be
  * specified with their setter functions: setWalkTimesSaveFlags(), etc.; keep
- * in mind that this causes heavy memory usage and big output file sizes.
+ * in mind that this causes big output file sizes. Raw output is streamed to
+ * the output file during the simulation by a RawOutputWriter, in chunks of
+ * RAW_OUTPUT_CHUNK_SIZE photons per thread. With multiple threads, each
+ * thread writes a shard file next to the output file, whose raw datasets are
+ * virtual datasets referring to the shards: keep the shards together with the
+ * output file. Only the datasets selected by
+ * the flags are created; chunking and compression can be set with
+ * setRawDatasetOptions(). A
+ * Detector can be used to store only the photons that would actually be
+ * detected; see setRawOutputDetector(). Alternatively, memory can be bounded
+ * by keeping a uniform random sample of a fixed number of photons per type,
+ * see setRawOutputReservoirSize().
  *
  * Before running the simulation, a RNG has to be initialized by either calling
  * setSeed(), loadGeneratorState() or setGeneratorState(). Use run() to start
@@ -50,6 +76,14 @@ namespace MCPP {
  * can be loaded with setMultipleRNGStates(), otherwise sequential numbers from
  * 0 to the number of threads will be used as seeds for each thread.
  *
+ * A machine-readable progress stream can be obtained with
+ * setProgressMonitor().
+ *
+ * Histograms and raw output can be inspected while the simulation is running
+ * with setLiveOutputInterval(). Histograms can also be published in shared
+ * memory for zero-copy access by other processes on the same machine, see
+ * Histogram::setSharedMemoryName() and setSharedMemoryInterval().
+ *
  * <h2>Signals</h2> The progress of the simulation currently running can be
  * printed on stderr by sending the USR1 signal to the process instantiating a
  * Simulation object. Progress of all threads can be printed by sending
@@ -84,22 +118,45 @@ public:
     void clear();
     const vector<vector<MCfloat> *> *trajectories() const;
     void reportProgress() const;
+    const SimulationStats *stats() const;
     void setMultipleRNGStates(const vector<string> states);
     void setTimeOriginZ(const MCfloat z);
     void setWalkTimesSaveFlags(unsigned int value);
     void setExitPointsSaveFlags(unsigned int value);
     void setExitKVectorsSaveFlags(unsigned int value);
     void setExitKVectorsDirsSaveFlags(unsigned int value);
+    void setRawDatasetOptions(MCData group, const RawDatasetOptions &options);
     void terminate();
     uint nThreads();
 #ifdef SWIG
     %apply SWIGTYPE *DISOWN {Histogram *hist};
 #endif
     void addHistogram(Histogram *hist);
+#ifdef SWIG
+    %apply SWIGTYPE *DISOWN {SummaryTally *tally};
+#endif
+    void addSummaryTally(SummaryTally *tally);
+#ifdef SWIG
+    %apply SWIGTYPE *DISOWN {ExitObserver *observer};
+#endif
+    void addExitObserver(ExitObserver *observer);
     void setRawOutputEnabled(bool enable);
+#ifdef SWIG
+    %apply SWIGTYPE *DISOWN {Detector *detector};
+#endif
+    void setRawOutputDetector(Detector *detector);
+    void setRawOutputReservoirSize(u_int64_t nPhotons);
+    u_int64_t rawOutputReservoirSize() const;
+#ifdef SWIG
+    %apply SWIGTYPE *DISOWN {ProgressMonitor *monitor};
+#endif
+    void setProgressMonitor(ProgressMonitor *monitor);
+    void setLiveOutputInterval(double seconds);
+    void setSharedMemoryInterval(double seconds);
 
 private:
-    unsigned int layerAt(const MCfloat *r0) const;
+    friend class SimulationBatch;
+
     void handleInterface();
     void checkIfWalkerExitedSample();
     MCfloat reflectionProbability();
@@ -111,14 +168,28 @@ private:
     void appendExitPoint(walkerType type);
     void appendExitKVector(walkerType type);
     void appendWalker(walkerType type);
+    void appendRawPhoton(walkerType type);
+    void sampleRawPhoton(walkerType type);
+    void mergeRawReservoir(const Simulation *rhs);
+    bool rawOutputStreamed() const;
 
-    void runMultipleThreads();
+    bool runMultipleThreads();
     bool runSingleThread();
 
     void switchToLayer(const uint layer);
     void updateLayerVariables(const uint layer);
+    void initializeHistograms();
+    void reduceHistograms();
+    void appendHistograms(const Simulation *rhs);
     void flushHistogram();
     void saveRawOutput();
+    void configureOutputFile(H5OutputFile *file) const;
+    string shardFileName(unsigned int thread) const;
+    void flushRawOutput();
+    void stopOutputWriter();
+    void writeRawOutput(H5OutputFile *file);
+    void writeRawDatasets(H5OutputFile *file);
+    void saveStats();
 
     inline void swap_r0_r1()
     {
@@ -151,12 +222,21 @@ private:
     unsigned int exitKVectorsDirsSaveFlags;
     unsigned int exitKVectorsSaveFlags;
     MCfloat timeOriginZ;
+    Detector *rawOutputDetector;
+    RawDatasetOptions rawDatasetOptions[4];  /**< @brief indexed by MCData */
 
     //walker counters
     u_int64_t _totalWalkers;  /**< @brief total number of walkers to be
                                    simulated*/
     u_int64_t photonCounters[4];
     u_int64_t n;
+    SimulationStats _stats;
+    ProgressSlot _progress;
+    ProgressSlot *progressSlot;  /**< @brief the slot updated by this thread,
+                                      possibly owned by the main simulation */
+    ProgressMonitor *monitor;
+    u_int64_t photonSteps;
+    MCfloat photonPathLength;
 
     uint nBuf;
     uint _nThreads;
@@ -168,8 +248,27 @@ private:
     vector<MCfloat> exitPoints[4];
     vector<MCfloat> walkTimes[4];
     vector<MCfloat> exitKVectors[4];
+    RawOutputWriter *rawWriter;  /**< @brief the writer of this thread's raw
+                                      output, possibly owned by the main
+                                      simulation */
+    RawOutputWriter *outputWriter;  /**< @brief owned by the main
+                                         simulation */
+    double liveOutputInterval;
+    SnapshotSlot *snapshotSlots;  /**< @brief one per thread */
+    SnapshotSlot *snapshotSlot;  /**< @brief the slot of this thread */
+    HistogramPublisher *publisher;  /**< @brief owned by the main
+                                         simulation */
+    double sharedMemoryInterval;
+    RawOutputChunk rawChunk;  /**< @brief the chunk being written */
+    u_int64_t nRawPhotons;  /**< @brief photons in the current chunk */
+    u_int64_t rawReservoirSize;  /**< @brief per type, 0 to keep all the
+                                      photons */
+    u_int64_t rawSeen[4];  /**< @brief photons offered to the reservoirs */
+    MCEngine reservoirEngine;  /**< @brief separate from the transport RNG,
+                                    which is left untouched */
 
     //internal temporary variables
+    boost::shared_ptr<const LayerTables> layerTables;
     CosThetaGenerator deflCosine;
     MCfloat currLayerLowerBoundary, currLayerUpperBoundary;
     const Material *currentMaterial;
@@ -187,14 +286,18 @@ private:
     bool kNeedsToBeScattered;
     bool walkerExitedSample;
     time_t startTime;
+    double monotonicStartTime;  /**< @brief see monotonicTime() */
     Walker walker;
     MCfloat n0, n1, cosTheta1, sinTheta0, sinTheta1;
 
     char *outputFile;
     vector<string> multipleRNGStates;
     vector<Histogram *> hists;
+    vector<SummaryTally *> tallies;
+    vector<ExitObserver *> observers;
     bool forceTermination;
     Walker walkerBuf[WALKER_BUFSIZE];
+    WalkerBatch walkerBatch;
 };
 
 }
@@ -0,0 +1,118 @@
+/*
+  This file is part of MCPlusPlus.
+
+  MCPlusPlus is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Mcplusplus is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with MCPlusPlus.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SIMULATIONBATCH_H
+#define SIMULATIONBATCH_H
+
+#include "simulation.h"
+
+#include <boost/thread/mutex.hpp>
+#include <boost/atomic.hpp>
+
+#define BATCH_DEFAULT_CHUNK_SIZE 100000
+
+namespace MCPP {
+
+/**
+ * @brief The SimulationBatch class runs a parameter sweep over a single pool
+ * of threads
+ *
+ * Every configuration of the sweep is described by a fully set up Simulation
+ * (sample, source, histograms, number of photons, RNG seed and raw output
+ * flags) that is added to the batch with addSimulation(). The number of
+ * threads and the output file name of the single simulations are ignored:
+ * each configuration is split into work units of at most chunkSize() photons,
+ * and the work units of all the configurations are scheduled, in order, over
+ * the setNThreads() threads of the batch. This way no core sits idle waiting
+ * for the last threads of a small simulation to complete, as happens when
+ * simulations are run one after the other.
+ *
+ * The LayerTables are computed once per configuration and shared by all of
+ * its work units. Configurations simulating the same Sample object (with the
+ * same source wavelength, source position and time origin) share them too.
+ *
+ * All the results are saved in the single file specified with
+ * setOutputFileName(), with a group per configuration (see
+ * H5OutputFile::openRootGroup()). Each group has the same structure as the
+ * output file of a standalone Simulation.
+ *
+ * Work unit \f$ i \f$ of a configuration uses the seed
+ * BaseRandom::currentSeed() \f$ + i \f$ of the configuration's Simulation, or
+ * the \f$ i \f$-th RNG state given with Simulation::setMultipleRNGStates().
+ * Results depend on the chunk size, but not on the number of threads.
+ */
+
+class SimulationBatch : public BaseObject
+{
+public:
+    SimulationBatch(BaseObject *parent=NULL);
+    ~SimulationBatch();
+
+#ifdef SWIG
+    %apply SWIGTYPE *DISOWN {Simulation *sim};
+#endif
+    void addSimulation(Simulation *sim, const char *groupName=NULL);
+    size_t nSimulations() const;
+    void setNThreads(unsigned int value);
+    unsigned int nThreads() const;
+    void setChunkSize(u_int64_t nPhotons);
+    u_int64_t chunkSize() const;
+    void setOutputFileName(const char *name);
+    void run();
+    void terminate();
+    void reportProgress() const;
+
+private:
+    struct Configuration {
+        Simulation *sim;
+        string groupName;
+        u_int64_t nUnits;
+        u_int64_t unitsDone;
+        boost::atomic<bool> saved;  /**< @brief set under fileMutex, read by
+                                         reportProgress() */
+        boost::mutex mutex;
+    };
+
+    struct WorkUnit {
+        size_t config;
+        u_int64_t index;
+        u_int64_t nPhotons;
+    };
+
+    void prepareConfigurations();
+    void processWorkUnits(unsigned int slot);
+    Simulation *createUnitSimulation(const WorkUnit &unit) const;
+    void mergeWorkUnit(const WorkUnit &unit, Simulation *unitSim);
+    void saveConfiguration(Configuration *cfg);
+
+    virtual bool sanityCheck_impl() const;
+
+    vector<Configuration *> configs;
+    vector<WorkUnit> units;
+    vector<Simulation *> running;
+    size_t nextUnit;
+    u_int64_t _chunkSize;
+    unsigned int _nThreads;
+    char *outputFile;
+    bool forceTermination;
+
+    mutable boost::mutex scheduleMutex;
+    boost::mutex fileMutex;
+};
+
+}
+#endif // SIMULATIONBATCH_H
@@ -0,0 +1,106 @@
+/*
+  This file is part of MCPlusPlus.
+
+  MCPlusPlus is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Mcplusplus is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with MCPlusPlus.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SIMULATIONSTATS_H
+#define SIMULATIONSTATS_H
+
+#include "MCglobal.h"
+
+#include <cmath>
+#include <string>
+
+#define STATS_LOG2_BINS 64
+#define STATS_PATH_LENGTH_MIN_EXP -16
+
+namespace MCPP {
+
+using namespace std;
+
+/**
+ * @brief The SimulationStats class counts the events occurring in the
+ * transport loop of a Simulation
+ *
+ * Every thread (or SimulationBatch work unit) updates its own counters, which
+ * are merged at join; see Simulation::stats(). Counters are plain integers
+ * incremented by the owning thread only, so they are cheap enough to be
+ * always enabled.
+ *
+ * Reflections include total internal reflections, which are also counted
+ * separately in TIREvents. Layer switches include interfaces between layers
+ * with the same refractive index, which are crossed without being counted as
+ * refractions.
+ *
+ * The number of steps and the geometrical path length of each photon are also
+ * histogrammed on a logarithmic scale: bin \f$ i \f$ of stepsHisto counts the
+ * photons with \f$ 2^i \leq \f$ steps \f$ < 2^{i+1} \f$, bin \f$ i \f$ of
+ * pathLengthHisto the photons with \f$ 2^{i + e} \leq l < 2^{i + e + 1} \f$,
+ * where \f$ e \f$ = STATS_PATH_LENGTH_MIN_EXP. Out of range values are
+ * accumulated in the first and last bin.
+ *
+ * \see H5OutputFile::saveStats()
+ */
+
+class SimulationStats
+{
+public:
+    SimulationStats();
+
+    void clear();
+    void merge(const SimulationStats &rhs);
+    string toString() const;
+
+    /**
+     * @brief Accounts for a completed photon
+     * @param steps number of steps of the photon
+     * @param pathLength total geometrical path length of the photon
+     */
+
+    inline void addPhoton(const u_int64_t steps, const MCfloat pathLength)
+    {
+        nPhotons++;
+        totalSteps += steps;
+        stepsHisto[log2Bin(steps, 0)]++;
+        pathLengthHisto[log2Bin(pathLength, STATS_PATH_LENGTH_MIN_EXP)]++;
+    }
+
+    u_int64_t nPhotons;
+    u_int64_t totalSteps;
+    u_int64_t scatteringEvents;
+    u_int64_t interfaceHits;
+    u_int64_t reflections;
+    u_int64_t refractions;
+    u_int64_t TIREvents;
+    u_int64_t layerSwitches;
+    u_int64_t stepsHisto[STATS_LOG2_BINS];
+    u_int64_t pathLengthHisto[STATS_LOG2_BINS];
+
+private:
+    static inline uint log2Bin(const MCfloat value, const int minExp)
+    {
+        if(!(value > 0))
+            return 0;
+        int bin = ilogb(value) - minExp;
+        if(bin < 0)
+            return 0;
+        if(bin >= STATS_LOG2_BINS)
+            return STATS_LOG2_BINS - 1;
+        return bin;
+    }
+};
+
+}
+#endif // SIMULATIONSTATS_H
@@ -0,0 +1,84 @@
+/*
+  This file is part of MCPlusPlus.
+
+  MCPlusPlus is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Mcplusplus is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with MCPlusPlus.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef SNAPSHOTSLOT_H
+#define SNAPSHOTSLOT_H
+
+#include "histogram.h"
+
+#include <boost/atomic.hpp>
+#include <boost/thread/mutex.hpp>
+
+namespace MCPP {
+
+/**
+ * @brief The SnapshotSlot class holds a copy of the histograms of a single
+ * simulating thread, from which merged snapshots are taken while the
+ * simulation is running
+ *
+ * The simulating thread only copies its histograms into the slot when a new
+ * snapshot has been requested, and only every WALKER_BUFSIZE photons, when
+ * its histograms are up to date. The cost for the thread is therefore bounded
+ * by the rate of the snapshots and does not depend on the number of photons.
+ * The consumer (see merge()) never waits for the simulating threads: it
+ * merges the most recent copy of every slot, which is at most one snapshot
+ * period old, and requests a new one. Neither do the simulating threads wait
+ * for the consumer: while a slot is being merged its copy is skipped and
+ * retried WALKER_BUFSIZE photons later.
+ *
+ * A last copy is published when the thread completes, waiting for the
+ * consumer if needed.
+ *
+ * Histograms shared across threads (see Histogram::setSharedAcrossThreads())
+ * are not copied: their current counts are read once by merge(), along with
+ * the number of photons every thread has added to them (see
+ * sharedPhotons).
+ */
+
+class SnapshotSlot
+{
+public:
+    SnapshotSlot();
+    ~SnapshotSlot();
+
+    void initialize(const vector<Histogram *> &hists);
+    vector<Histogram *> cloneHistograms() const;
+    bool publish(const vector<Histogram *> &hists,
+                 const u_int64_t *photonCounters, const u_int64_t photons,
+                 const bool wait = false);
+    static u_int64_t merge(SnapshotSlot *slots, const unsigned int nSlots,
+                           const vector<Histogram *> &dest,
+                           u_int64_t *photonCounters,
+                           vector<u_int64_t> *histPhotons);
+
+    boost::atomic<bool> requested;  /**< @brief a new copy is wanted */
+    /** @brief photons of the thread whose counts are all in the shared
+     * histograms */
+    boost::atomic<u_int64_t> sharedPhotons;
+
+private:
+    SnapshotSlot(const SnapshotSlot &);
+    SnapshotSlot &operator=(const SnapshotSlot &);
+
+    boost::mutex mutex;
+    vector<Histogram *> hists;
+    vector<const Histogram *> sources;  /**< @brief given to initialize() */
+    u_int64_t photonCounters[4];
+    u_int64_t photons;
+};
+
+}
+#endif // SNAPSHOTSLOT_H
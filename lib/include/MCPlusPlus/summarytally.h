@@ -0,0 +1,131 @@
+/*
+  This file is part of MCPlusPlus.
+
+  MCPlusPlus is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Mcplusplus is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with MCPlusPlus.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SUMMARYTALLY_H
+#define SUMMARYTALLY_H
+
+#include "baseobject.h"
+#include "detector.h"
+#include "h5filehelper.h"
+#include "walkerbatch.h"
+#include "kllsketch.h"
+
+namespace MCPP {
+
+/**
+ * @brief The SummaryTally class computes streaming summary statistics of an
+ * exit observable, for each photon type
+ *
+ * A SummaryTally is a lightweight alternative to a Histogram when only a few
+ * numbers are needed, e.g. the mean and variance of the walk time or a few
+ * percentiles of the exit radius. For every photon type selected with
+ * setPhotonTypeFlags(), it keeps:
+ *
+ * - count, mean and variance, accumulated with Welford's algorithm and
+ *   merged across threads with Chan's pairwise formula;
+ *
+ * - exact minimum and maximum;
+ *
+ * - the quantiles given with setQuantiles() (by default the 1st, 5th, 50th,
+ *   95th and 99th percentiles), estimated with a KLLSketch of size
+ *   setSketchSize().
+ *
+ * No binning is involved, so the results do not depend on a bin size or
+ * range. The observable is chosen with setDataDomain(): walk time
+ * (DATA_TIMES), exit radius (DATA_POINTS), exit angle in degrees (DATA_K),
+ * cosine of the exit angle (DATA_COS_THETA) or azimuth in degrees
+ * (DATA_AZIMUTH). As for Histograms, a Detector can restrict the tallied
+ * photons, see setDetector().
+ *
+ * Tallies are added to a Simulation with Simulation::addSummaryTally(), are
+ * fed the same buffered walkers as the histograms and are saved in the H5
+ * output file in a dataset with the name given by setName(), see
+ * writeDataset().
+ *
+ * \pre The following conditions must hold for a SummaryTally to be in a valid
+ * state:
+ * - data domain and photon type must be specified
+ *
+ * - quantiles must lie between 0 and 1
+ */
+
+class SummaryTally : public BaseObject
+{
+public:
+    SummaryTally(BaseObject *parent=NULL);
+    virtual ~SummaryTally();
+
+    void setDataDomain(const enum MCData type);
+    enum MCData dataDomain() const;
+    void setPhotonTypeFlags(int value);
+#ifdef SWIG
+    %apply SWIGTYPE *DISOWN {Detector *detector};
+#endif
+    void setDetector(Detector *detector);
+    const Detector *detector() const;
+    void setQuantiles(const vector<double> &q);
+    vector<double> quantiles() const;
+    void setSketchSize(const uint k);
+    uint sketchSize() const;
+    void setName(const char *name);
+    string name() const;
+    bool initialize(const uint seed=0);
+    void requireColumns(WalkerBatch *batch) const;
+    void run(const WalkerBatch &batch);
+    void append(const SummaryTally *rhs);
+    void clear();
+    u_int64_t count(const uint type) const;
+    double mean(const uint type) const;
+    double variance(const uint type) const;
+    double min(const uint type) const;
+    double max(const uint type) const;
+    double quantile(const uint type, const double q) const;
+    void saveToFile(const char *fileName,
+                    const char *groupName=NULL) const;
+    void writeDataset(H5FileHelper *file, const char *datasetName) const;
+
+private:
+    /**
+     * @brief Running moments, see Welford's algorithm
+     */
+    struct Moments {
+        u_int64_t n;
+        double mean;
+        double m2;  /**< @brief sum of squared deviations from the mean */
+    };
+
+    virtual bool sanityCheck_impl() const;
+    virtual BaseObject *clone_impl() const;
+    virtual void describe_impl() const;
+    const MCfloat *column(const WalkerBatch &batch) const;
+    static void merge(Moments &lhs, const Moments &rhs);
+
+    string tallyName;
+    enum MCData type;
+    int photonTypeFlags;
+    Detector *_detector;
+    vector<double> _quantiles;
+    uint k;
+
+    Moments moments[4];
+    KLLSketch sketches[4];
+    vector<MCfloat> selected;  /**< @brief values accepted by the detector */
+};
+
+}
+
+#endif // SUMMARYTALLY_H
@@ -0,0 +1,101 @@
+/*
+  This file is part of MCPlusPlus.
+
+  MCPlusPlus is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Mcplusplus is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with MCPlusPlus.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef TILEDCOUNTS_H
+#define TILEDCOUNTS_H
+
+#include "MCglobal.h"
+
+#include <stdint.h>
+#include <vector>
+
+#define TILE_SHIFT 10
+#define TILE_BINS (1 << TILE_SHIFT)
+
+namespace MCPP {
+
+using namespace std;
+
+/**
+ * @brief The TiledCounts class is a sparse array of histogram counts
+ *
+ * The bins are grouped in tiles of TILE_BINS consecutive bins, which are only
+ * allocated when one of their bins is first incremented. Tiles start with
+ * 32-bit counters and are promoted to 64-bit counters when one of them is
+ * about to overflow. Memory is therefore proportional to the populated region
+ * of the histogram rather than to its total number of bins.
+ *
+ * \see Histogram::setTiledStorage()
+ */
+
+class TiledCounts
+{
+public:
+    TiledCounts(const uint64_t nBins);
+    ~TiledCounts();
+
+    /**
+     * @brief Increments the given bin by one
+     */
+    inline void increment(const uint64_t bin)
+    {
+        Tile &t = tiles[bin >> TILE_SHIFT];
+        const size_t offset = bin & (TILE_BINS - 1);
+        if(t.c64 != NULL) {
+            t.c64[offset]++;
+            return;
+        }
+        if(t.c32 == NULL)
+            allocate(t);
+        if(t.c32[offset] == UINT32_MAX) {
+            promote(t);
+            t.c64[offset]++;
+        }
+        else
+            t.c32[offset]++;
+    }
+
+    uint64_t count(const uint64_t bin) const;
+    void add(const uint64_t bin, const uint64_t value);
+    void add(const TiledCounts *rhs);
+    void addTile(const TiledCounts *rhs, const size_t tile);
+    size_t nTiles() const;
+    bool allocated(const size_t tile) const;
+    void addTo(uint64_t *dest) const;
+    void addTileTo(uint64_t *dest, const size_t tile) const;
+    void clear();
+    uint64_t nBins() const;
+    uint64_t allocatedBins() const;
+
+private:
+    TiledCounts(const TiledCounts &);
+    TiledCounts &operator=(const TiledCounts &);
+
+    struct Tile {
+        uint32_t *c32;
+        uint64_t *c64;
+    };
+
+    void allocate(Tile &t);
+    void promote(Tile &t);
+    size_t tileSize(const size_t tile) const;
+
+    uint64_t _nBins;
+    vector<Tile> tiles;
+};
+
+}
+#endif // TILEDCOUNTS_H
@@ -0,0 +1,153 @@
+/*
+  This file is part of MCPlusPlus.
+
+  MCPlusPlus is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Mcplusplus is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with MCPlusPlus.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+#include "baserandom.h"
+
+#include <cmath>
+#include <boost/math/special_functions/sign.hpp>
+
+#ifdef SINGLEPRECISION
+#define COSZERO (1.0-1.0E-5)
+#endif
+
+#ifdef DOUBLEPRECISION
+#define COSZERO (1.0-1.0E-12)
+#endif
+
+#ifdef LONGDOUBLEPRECISION
+#define COSZERO (1.0-1.0E-30)
+#endif
+
+/**
+ * \file transport.h
+ * @brief Kernels of the photon transport loop of Simulation
+ *
+ * The kernels are inline free functions, so that they can be benchmarked in
+ * isolation (see the mcpp_bench target) without any overhead in the
+ * simulation.
+ */
+
+namespace MCPP {
+
+/**
+ * @brief Samples the free path between two scattering events
+ * @param mus scattering coefficient \f$ \mu_s = 1 / l_s \f$
+ * @param mt
+ * @return
+ *
+ * Using long double moves the truncation of the exponential distribution to 44
+ * times the mfp, then the result is cast to MCfloat.
+ */
+
+inline MCfloat sampleFreePath(const MCfloat mus, MCEngine *mt)
+{
+    return boost::random::exponential_distribution<long double>(mus)(*mt);
+}
+
+/**
+ * @brief Computes the direction after a scattering event
+ * @param k0 direction before the scattering event
+ * @param cosTheta cosine of the deflection angle
+ * @param psi azimuthal angle in \f$ [0, 2\pi) \f$
+ * @param k1 the new (normalized) direction
+ */
+
+inline void scatterDirection(const MCfloat *k0, const MCfloat cosTheta,
+                             const MCfloat psi, MCfloat *k1)
+{
+    MCfloat sinTheta = sqrt(1 - pow(cosTheta, 2));
+    MCfloat cosPsi, sinPsi;
+
+#ifdef DOUBLEPRECISION
+    sincos(psi, &sinPsi, &cosPsi);
+#endif
+#ifdef LONGDOUBLEPRECISION
+    sincosl(psi, &sinPsi, &cosPsi);
+#endif
+#ifdef SINGLEPRECISION
+    sincosf(psi, &sinPsi, &cosPsi);
+#endif
+
+    if(fabs(k0[2]) > COSZERO) {
+        k1[0] = sinTheta * cosPsi;
+        k1[1] = sinTheta * sinPsi;
+        k1[2] = cosTheta * boost::math::sign<MCfloat>(k0[2]);
+    }
+    else {
+        MCfloat temp = sqrt(1 - pow(k0[2], 2));
+        k1[0] = (sinTheta
+                 * (k0[0] * k0[2] * cosPsi - k0[1] * sinPsi))
+                / temp + cosTheta * k0[0];
+        k1[1] = (sinTheta
+                 * (k0[1] * k0[2] * cosPsi + k0[0] * sinPsi))
+                / temp + cosTheta * k0[1];
+        k1[2] = -sinTheta * cosPsi * temp + cosTheta * k0[2];
+    }
+
+    MCfloat mod = sqrt(k1[0] * k1[0] + k1[1] * k1[1]
+            + k1[2] * k1[2]);
+    k1[0] /= mod;
+    k1[1] /= mod;
+    k1[2] /= mod;
+}
+
+/**
+ * @brief Calculates the probability \f$r(\theta_0,n_0,n_1)\f$ of being
+ * reflected at an interface (Fresnel equations for unpolarized light)
+ * @param cosTheta0 cosine of the angle of incidence (positive)
+ * @param sinTheta0 sine of the angle of incidence
+ * @param cosTheta1 cosine of the angle of refraction (positive)
+ * @param sinTheta1 sine of the angle of refraction
+ * @param n0 refractive index of the incidence medium
+ * @param n1 refractive index of the refraction medium
+ * @return \f$ r \f$
+ */
+
+inline MCfloat fresnelReflectionProbability(
+        const MCfloat cosTheta0, const MCfloat sinTheta0,
+        const MCfloat cosTheta1, const MCfloat sinTheta1,
+        const MCfloat n0, const MCfloat n1)
+{
+    MCfloat r;
+
+    //cos(Theta0 + Theta1) and cos(Theta0 - Theta1)
+    MCfloat cThetaSum, cThetaDiff;
+
+    //sin(Theta0 + Theta1) and sin(Theta0 - Theta1)
+    MCfloat sThetaSum, sThetaDiff;
+
+    if(cosTheta0 > COSZERO) { //normal incidence
+        r = (n1-n0)/(n1+n0);
+        r *= r;
+    }
+    else { //general case
+        cThetaSum = cosTheta0 * cosTheta1 - sinTheta0 * sinTheta1;
+        cThetaDiff = cosTheta0 * cosTheta1 + sinTheta0 * sinTheta1;
+        sThetaSum = sinTheta0 * cosTheta1 + cosTheta0 * sinTheta1;
+        sThetaDiff = sinTheta0 * cosTheta1 - cosTheta0 * sinTheta1;
+        r = 0.5 * sThetaDiff * sThetaDiff
+                * (cThetaDiff * cThetaDiff + cThetaSum * cThetaSum)
+                / (sThetaSum * sThetaSum * cThetaDiff * cThetaDiff);
+    }
+    return r;
+}
+
+}
+#endif // TRANSPORT_H
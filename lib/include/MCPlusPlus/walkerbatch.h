@@ -0,0 +1,133 @@
+/*
+  This file is part of MCPlusPlus.
+
+  MCPlusPlus is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Mcplusplus is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with MCPlusPlus.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef WALKERBATCH_H
+#define WALKERBATCH_H
+
+#include "walker.h"
+
+namespace MCPP {
+
+/**
+ * @brief Columns of derived quantities that can be computed by a WalkerBatch
+ *
+ * This enum is intended to be used in a bitwise fashion.
+ */
+
+enum batchColumns {
+    COLUMN_TIMES = 1 << 0,  /**< @brief walk time */
+    COLUMN_RADII = 1 << 1,  /**< @brief exit radius \f$ \rho \f$ */
+    COLUMN_ANGLES = 1 << 2,  /**< @brief exit angle, in degrees */
+    COLUMN_COSINES = 1 << 3,  /**< @brief cosine of the exit angle with
+                                   respect to the outward normal */
+    COLUMN_AZIMUTHS = 1 << 4,  /**< @brief azimuth of the exit direction, in
+                                    degrees */
+};
+
+/**
+ * @brief The WalkerBatch class holds the exiting walkers of a buffer in
+ * structure-of-arrays form, partitioned by walker type
+ *
+ * The derived quantities histogrammed by several Histograms (exit radius,
+ * exit angle and powers of the exit radius for the spatial moments) are
+ * computed once per buffer, in contiguous columns, rather than once per
+ * walker and per histogram. Only the columns registered with require() and
+ * requireMomentExponent() are computed.
+ *
+ * Walkers of type \f$ t \f$ occupy the rows from begin(t) to end(t), so that
+ * each histogram only visits the walker types it is interested in. Within a
+ * type, the order of the buffer is preserved.
+ */
+
+class WalkerBatch
+{
+public:
+    WalkerBatch();
+
+    void require(unsigned int columns);
+    void requireMomentExponent(const double exponent);
+    void clearRequirements();
+    void fill(const Walker * const buf, const size_t size);
+
+    /**
+     * @brief First row of the walkers of the given type
+     */
+    inline size_t begin(const uint type) const
+    {
+        return offsets[type];
+    }
+
+    /**
+     * @brief One past the last row of the walkers of the given type
+     */
+    inline size_t end(const uint type) const
+    {
+        return offsets[type + 1];
+    }
+
+    inline size_t size() const
+    {
+        return offsets[4];
+    }
+
+    inline const Walker *walker(const size_t row) const
+    {
+        return walkers[row];
+    }
+
+    inline const MCfloat *times() const
+    {
+        return _times.empty() ? NULL : &_times[0];
+    }
+
+    inline const MCfloat *radii() const
+    {
+        return _radii.empty() ? NULL : &_radii[0];
+    }
+
+    inline const MCfloat *angles() const
+    {
+        return _angles.empty() ? NULL : &_angles[0];
+    }
+
+    inline const MCfloat *cosines() const
+    {
+        return _cosines.empty() ? NULL : &_cosines[0];
+    }
+
+    inline const MCfloat *azimuths() const
+    {
+        return _azimuths.empty() ? NULL : &_azimuths[0];
+    }
+
+    const MCfloat *radialPowers(const double exponent) const;
+
+private:
+    unsigned int columns;
+    vector<double> exponents;
+    size_t offsets[5];
+
+    vector<const Walker *> walkers;
+    vector<MCfloat> _times;
+    vector<MCfloat> _radii;
+    vector<MCfloat> _angles;
+    vector<MCfloat> _cosines;
+    vector<MCfloat> _azimuths;
+    vector<vector<MCfloat> > powers;  /**< @brief one per exponent */
+};
+
+}
+#endif // WALKERBATCH_H
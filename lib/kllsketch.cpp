@@ -0,0 +1,253 @@
+/*
+  This file is part of MCPlusPlus.
+
+  MCPlusPlus is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Mcplusplus is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with MCPlusPlus.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <MCPlusPlus/kllsketch.h>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <utility>
+
+#define KLL_RNG_SEED 0x9E3779B97F4A7C15ULL
+
+using namespace MCPP;
+
+KLLSketch::KLLSketch(const uint k)
+{
+    _k = k < 2 ? 2 : k;
+    seed = 0;
+    clear();
+}
+
+/**
+ * @brief Sets the accuracy parameter of the sketch. Clears the sketch.
+ * @param k capacity of the top compactor, at least 2
+ */
+
+void KLLSketch::setK(const uint k)
+{
+    _k = k < 2 ? 2 : k;
+    clear();
+}
+
+uint KLLSketch::k() const
+{
+    return _k;
+}
+
+/**
+ * @brief Seeds the generator of the compaction offsets. Clears the sketch.
+ * @param seed
+ *
+ * Sketches that are going to be merged should have different seeds, otherwise
+ * their compaction errors are correlated and add up instead of partially
+ * cancelling out.
+ */
+
+void KLLSketch::setSeed(const uint64_t seed)
+{
+    this->seed = seed;
+    clear();
+}
+
+/**
+ * @brief Merges the items of another sketch into this one
+ * @param rhs
+ *
+ * Both sketches should have the same k().
+ */
+
+void KLLSketch::merge(const KLLSketch &rhs)
+{
+    if(rhs._n == 0)
+        return;
+    while(compactors.size() < rhs.compactors.size())
+        grow();
+    for (size_t h = 0; h < rhs.compactors.size(); ++h) {
+        const vector<double> &c = rhs.compactors[h];
+        compactors[h].insert(compactors[h].end(), c.begin(), c.end());
+        _size += c.size();
+    }
+    _n += rhs._n;
+    if(rhs._min < _min)
+        _min = rhs._min;
+    if(rhs._max > _max)
+        _max = rhs._max;
+    while(_size >= maxSize)
+        compress();
+}
+
+void KLLSketch::clear()
+{
+    compactors.assign(1, vector<double>());
+    compactors[0].reserve(_k);
+    _n = 0;
+    _size = 0;
+    maxSize = capacity(0);
+    _min = numeric_limits<double>::infinity();
+    _max = -numeric_limits<double>::infinity();
+    // splitmix64 step, so that close seeds give unrelated sequences; the
+    // state of xorshift64 must not be zero
+    uint64_t z = seed * KLL_RNG_SEED + KLL_RNG_SEED;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    z ^= z >> 31;
+    rngState = z != 0 ? z : KLL_RNG_SEED;
+}
+
+/**
+ * @brief Number of items added to the sketch
+ */
+
+u_int64_t KLLSketch::count() const
+{
+    return _n;
+}
+
+/**
+ * @brief Number of items currently stored by the sketch
+ */
+
+size_t KLLSketch::retained() const
+{
+    return _size;
+}
+
+/**
+ * @brief Estimated quantile of the items added to the sketch
+ * @param q fraction of the items, between 0 and 1
+ * @return the smallest retained item whose estimated rank is at least
+ * \f$ q \f$ times count(), or NaN if the sketch is empty
+ */
+
+double KLLSketch::quantile(const double q) const
+{
+    if(_n == 0)
+        return numeric_limits<double>::quiet_NaN();
+    if(q <= 0)
+        return _min;
+    if(q >= 1)
+        return _max;
+
+    vector<pair<double, u_int64_t> > items;
+    items.reserve(_size);
+    for (size_t h = 0; h < compactors.size(); ++h) {
+        const u_int64_t weight = (u_int64_t)1 << h;
+        for (size_t i = 0; i < compactors[h].size(); ++i)
+            items.push_back(make_pair(compactors[h][i], weight));
+    }
+    sort(items.begin(), items.end());
+
+    const double target = q * _n;
+    u_int64_t rank = 0;
+    for (size_t i = 0; i < items.size(); ++i) {
+        rank += items[i].second;
+        if(rank >= target)
+            return items[i].first;
+    }
+    return _max;
+}
+
+/**
+ * @brief Smallest item added to the sketch, or \f$ +\infty \f$ if empty
+ */
+
+double KLLSketch::min() const
+{
+    return _min;
+}
+
+/**
+ * @brief Largest item added to the sketch, or \f$ -\infty \f$ if empty
+ */
+
+double KLLSketch::max() const
+{
+    return _max;
+}
+
+/**
+ * @brief Adds a level on top of the stack and updates the capacities
+ */
+
+void KLLSketch::grow()
+{
+    compactors.push_back(vector<double>());
+    maxSize = 0;
+    for (size_t h = 0; h < compactors.size(); ++h)
+        maxSize += capacity(h);
+}
+
+/**
+ * @brief Compacts the lowest level exceeding its capacity, and the following
+ * ones if the sketch is still full
+ */
+
+void KLLSketch::compress()
+{
+    for (size_t h = 0; h < compactors.size(); ++h) {
+        if(compactors[h].size() < capacity(h))
+            continue;
+        if(h + 1 == compactors.size())
+            grow();
+        compact(h);
+        if(_size < maxSize)
+            break;
+    }
+}
+
+/**
+ * @brief Promotes every other item of the given level to the next one
+ *
+ * When the level holds an odd number of items, its largest item stays.
+ */
+
+void KLLSketch::compact(const size_t level)
+{
+    vector<double> &c = compactors[level];
+    sort(c.begin(), c.end());
+    const size_t m = c.size() & ~(size_t)1;
+    vector<double> &next = compactors[level + 1];
+    for (size_t i = randomBit() ? 1 : 0; i < m; i += 2)
+        next.push_back(c[i]);
+    c.erase(c.begin(), c.begin() + m);
+    _size -= m / 2;
+}
+
+/**
+ * @brief Capacity of the given level, \f$ \lceil k (2/3)^{H - h - 1} \rceil
+ * \f$ where \f$ H \f$ is the number of levels, but at least 2
+ */
+
+size_t KLLSketch::capacity(const size_t level) const
+{
+    const double depth = compactors.size() - level - 1;
+    const size_t c = (size_t)ceil(_k * pow(2. / 3., depth));
+    return c < 2 ? 2 : c;
+}
+
+/**
+ * @brief Next bit of a xorshift64 generator
+ */
+
+bool KLLSketch::randomBit()
+{
+    rngState ^= rngState << 13;
+    rngState ^= rngState >> 7;
+    rngState ^= rngState << 17;
+    return (rngState >> 32) & 1;
+}
@@ -0,0 +1,123 @@
+/*
+  This file is part of MCPlusPlus.
+
+  MCPlusPlus is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Mcplusplus is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with MCPlusPlus.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <MCPlusPlus/layertables.h>
+
+#include <limits>
+#include <boost/math/special_functions/sign.hpp>
+
+using namespace boost::math;
+using namespace MCPP;
+
+LayerTables::LayerTables(const Sample *sample, const Source *source,
+                         const MCfloat timeOriginZ)
+{
+    this->sample = sample;
+    this->wavelength = source->wavelength();
+    this->z0 = source->z0();
+    this->timeOriginZ = timeOriginZ;
+
+    nLayers = sample->nLayers();
+
+    upperZBoundaries = new MCfloat[nLayers + 2];
+    materials = new Material[nLayers + 2];
+    mus = new MCfloat[nLayers + 2];
+
+    for (unsigned int i = 0; i < nLayers + 1; ++i) {
+        upperZBoundaries[i] = sample->zBoundaries()->at(i);
+    }
+
+    for (unsigned int i = 0; i < nLayers + 2; ++i) {
+        Material *m = sample->material(i);
+        m->setWavelength(wavelength);
+        materials[i] = *m;
+        mus[i] = 1. / materials[i].ls;
+    }
+
+    timeOffset = 0;
+
+    unsigned int layer0 = layerAt(z0);
+    unsigned int layer1 = layerAt(timeOriginZ);
+
+    initialLayer = layer0;
+    unsigned int leftLayer = min(layer0, layer1);
+    unsigned int rightLayer = max(layer0, layer1);
+    leftPoint = min(z0, timeOriginZ);
+    if(leftPoint == -1*numeric_limits<MCfloat>::infinity()) {
+        leftPoint = min(upperZBoundaries[0], timeOriginZ);
+        initialLayer = 0;
+    }
+    MCfloat rightPoint = max(z0, timeOriginZ);
+    if(leftLayer != rightLayer) { //add first and last portion of distance
+        timeOffset += (upperZBoundaries[leftLayer] - leftPoint)
+                / materials[leftLayer].v;
+        timeOffset += (rightPoint - upperZBoundaries[rightLayer - 1])
+                / materials[rightLayer].v;
+        for (unsigned int i = leftLayer + 1; i <= rightLayer - 1 ; ++i) {
+            timeOffset += (upperZBoundaries[i] - upperZBoundaries[i-1])
+                    / materials[i].v;
+        }
+    }
+    else {
+        timeOffset += fabs(rightPoint - leftPoint)
+                / materials[leftLayer].v;
+    }
+    timeOffset *= -1 * sign<MCfloat>(timeOriginZ - z0);
+}
+
+LayerTables::~LayerTables()
+{
+    delete[] upperZBoundaries;
+    delete[] materials;
+    delete[] mus;
+}
+
+/**
+ * @brief Checks whether these tables can be reused for the given
+ * configuration
+ * @param sample
+ * @param source
+ * @param timeOriginZ
+ * @return true if the tables were computed for the same sample, source
+ * wavelength, source position and time origin
+ */
+
+bool LayerTables::matches(const Sample *sample, const Source *source,
+                          const MCfloat timeOriginZ) const
+{
+    return this->sample == sample
+            && wavelength == source->wavelength()
+            && z0 == source->z0()
+            && this->timeOriginZ == timeOriginZ;
+}
+
+/**
+ * @brief Determines the layer index for the given \f$ z \f$
+ * @param z
+ * @return
+ *
+ * Interfaces are considered to belong to the preceding layer
+ */
+
+unsigned int LayerTables::layerAt(const MCfloat z) const
+{
+    for (unsigned int i = 0; i < nLayers + 1; ++i) {
+        if(z <= upperZBoundaries[i])
+            return i;
+    }
+    return nLayers + 1;
+}
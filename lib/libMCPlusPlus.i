@@ -13,8 +13,22 @@ namespace MCPP {}
 #include <MCPlusPlus/gaussianraybundlesource.h>
 #include <MCPlusPlus/MCglobal.h>
 #include <MCPlusPlus/psigenerator.h>
+#include <MCPlusPlus/detector.h>
+#include <MCPlusPlus/walkerbatch.h>
+#include <MCPlusPlus/tiledcounts.h>
+#include <MCPlusPlus/pulseconvolver.h>
+#include <MCPlusPlus/beamconvolver.h>
 #include <MCPlusPlus/histogram.h>
+#include <MCPlusPlus/kllsketch.h>
+#include <MCPlusPlus/summarytally.h>
+#include <MCPlusPlus/exitobserver.h>
+#include <MCPlusPlus/simulationstats.h>
+#include <MCPlusPlus/progressmonitor.h>
+#include <MCPlusPlus/snapshotslot.h>
+#include <MCPlusPlus/histogrampublisher.h>
+#include <MCPlusPlus/rawoutputwriter.h>
 #include <MCPlusPlus/simulation.h>
+#include <MCPlusPlus/simulationbatch.h>
 #include <MCPlusPlus/source.h>
 #include <MCPlusPlus/walker.h>
 
@@ -51,8 +65,22 @@ typedef long long int u_int64_t;
 %include "include/MCPlusPlus/sample.h"
 %include "include/MCPlusPlus/gaussianraybundlesource.h"
 %include "include/MCPlusPlus/MCglobal.h"
+%include "include/MCPlusPlus/detector.h"
+%include "include/MCPlusPlus/walkerbatch.h"
+%include "include/MCPlusPlus/tiledcounts.h"
+%include "include/MCPlusPlus/pulseconvolver.h"
+%include "include/MCPlusPlus/beamconvolver.h"
 %include "include/MCPlusPlus/histogram.h"
+%include "include/MCPlusPlus/kllsketch.h"
+%include "include/MCPlusPlus/summarytally.h"
+%include "include/MCPlusPlus/exitobserver.h"
+%include "include/MCPlusPlus/simulationstats.h"
+%include "include/MCPlusPlus/progressmonitor.h"
+%include "include/MCPlusPlus/snapshotslot.h"
+%include "include/MCPlusPlus/histogrampublisher.h"
+%include "include/MCPlusPlus/rawoutputwriter.h"
 %include "include/MCPlusPlus/simulation.h"
+%include "include/MCPlusPlus/simulationbatch.h"
 %include <boost/random.hpp>
 %include <boost/property_tree/ptree.hpp>
 %include "include/MCPlusPlus/h5filehelper.h"
@@ -0,0 +1,305 @@
+/*
+  This file is part of MCPlusPlus.
+
+  MCPlusPlus is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Mcplusplus is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with MCPlusPlus.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <MCPlusPlus/progressmonitor.h>
+#include <MCPlusPlus/MCglobal.h>
+
+#include <boost/thread.hpp>
+#include <boost/bind.hpp>
+
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+
+using namespace MCPP;
+
+ProgressSlot::ProgressSlot()
+{
+    reset(0, 0);
+}
+
+void ProgressSlot::reset(const u_int64_t total, const uint seed)
+{
+    photons.store(0, boost::memory_order_relaxed);
+    this->total.store(total, boost::memory_order_relaxed);
+    for (uint i = 0; i < 4; ++i) {
+        counters[i].store(0, boost::memory_order_relaxed);
+    }
+    this->seed.store(seed, boost::memory_order_relaxed);
+    publishStats(SimulationStats());
+}
+
+/**
+ * @brief Publishes the event counters of the owning thread
+ * @param stats
+ */
+
+void ProgressSlot::publishStats(const SimulationStats &stats)
+{
+    nPhotons.store(stats.nPhotons, boost::memory_order_relaxed);
+    totalSteps.store(stats.totalSteps, boost::memory_order_relaxed);
+    scatteringEvents.store(stats.scatteringEvents,
+                           boost::memory_order_relaxed);
+    interfaceHits.store(stats.interfaceHits, boost::memory_order_relaxed);
+    reflections.store(stats.reflections, boost::memory_order_relaxed);
+    refractions.store(stats.refractions, boost::memory_order_relaxed);
+    TIREvents.store(stats.TIREvents, boost::memory_order_relaxed);
+    layerSwitches.store(stats.layerSwitches, boost::memory_order_relaxed);
+}
+
+/**
+ * @brief The event counters last published by the owning thread
+ *
+ * Can be called from any thread. The step and path length histograms are not
+ * published and are left empty.
+ */
+
+SimulationStats ProgressSlot::stats() const
+{
+    SimulationStats s;
+    s.nPhotons = nPhotons.load(boost::memory_order_relaxed);
+    s.totalSteps = totalSteps.load(boost::memory_order_relaxed);
+    s.scatteringEvents = scatteringEvents.load(boost::memory_order_relaxed);
+    s.interfaceHits = interfaceHits.load(boost::memory_order_relaxed);
+    s.reflections = reflections.load(boost::memory_order_relaxed);
+    s.refractions = refractions.load(boost::memory_order_relaxed);
+    s.TIREvents = TIREvents.load(boost::memory_order_relaxed);
+    s.layerSwitches = layerSwitches.load(boost::memory_order_relaxed);
+    return s;
+}
+
+
+
+
+ProgressMonitor::ProgressMonitor(BaseObject *parent) :
+    BaseObject(parent)
+{
+    _interval = PROGRESS_DEFAULT_INTERVAL;
+    fd = STDERR_FILENO;
+    ownsFd = false;
+    totalPhotons = 0;
+    startTime = 0;
+    lastTime = 0;
+    thread = NULL;
+    stopRequested = false;
+}
+
+ProgressMonitor::~ProgressMonitor()
+{
+    stop();
+    closeOutput();
+}
+
+/**
+ * @brief Sets the sampling interval
+ * @param seconds
+ *
+ * Defaults to PROGRESS_DEFAULT_INTERVAL.
+ */
+
+void ProgressMonitor::setInterval(const double seconds)
+{
+    _interval = seconds;
+}
+
+double ProgressMonitor::interval() const
+{
+    return _interval;
+}
+
+/**
+ * @brief Writes the progress to the given file descriptor
+ * @param fd
+ *
+ * The file descriptor is not closed by the monitor.
+ */
+
+void ProgressMonitor::setOutputFileDescriptor(const int fd)
+{
+    closeOutput();
+    this->fd = fd;
+}
+
+/**
+ * @brief Appends the progress to the given file, which is created if needed
+ * @param fileName a regular file or a named pipe
+ * @return false if the file cannot be opened
+ */
+
+bool ProgressMonitor::setOutputFileName(const char *fileName)
+{
+    int newFd = open(fileName, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if(newFd < 0) {
+        logMessage("Cannot open %s", fileName);
+        return false;
+    }
+    closeOutput();
+    fd = newFd;
+    ownsFd = true;
+    return true;
+}
+
+/**
+ * @brief Starts the monitoring thread
+ * @param slots one slot per simulating thread
+ * @param nSlots
+ * @param totalPhotons the total number of photons to be simulated
+ *
+ * The slots must stay valid until stop() is called.
+ */
+
+void ProgressMonitor::start(const ProgressSlot * const *slots,
+                            const size_t nSlots, const u_int64_t totalPhotons)
+{
+    stop();
+    this->slots.assign(slots, slots + nSlots);
+    this->totalPhotons = totalPhotons;
+    lastPhotons.assign(nSlots, 0);
+    startTime = monotonicTime();
+    lastTime = startTime;
+    stopRequested = false;
+    thread = new boost::thread(boost::bind(&ProgressMonitor::monitorLoop,
+                                           this));
+}
+
+/**
+ * @brief Stops the monitoring thread, writing a last line
+ *
+ * Does nothing if the monitor is not running.
+ */
+
+void ProgressMonitor::stop()
+{
+    if(thread == NULL)
+        return;
+    {
+        boost::mutex::scoped_lock lock(mutex);
+        stopRequested = true;
+    }
+    stopCondition.notify_all();
+    thread->join();
+    delete thread;
+    thread = NULL;
+
+    writeSample(monotonicTime(), true);
+    slots.clear();
+}
+
+void ProgressMonitor::monitorLoop()
+{
+    boost::mutex::scoped_lock lock(mutex);
+    while(!stopRequested) {
+        boost::system_time timeout = boost::get_system_time()
+                + boost::posix_time::microseconds((int64_t)(_interval * 1e6));
+        while(!stopRequested) {
+            if(!stopCondition.timed_wait(lock, timeout))
+                break;
+        }
+        if(stopRequested)
+            break;
+        writeSample(monotonicTime(), false);
+    }
+}
+
+void ProgressMonitor::writeSample(const double now, const bool done)
+{
+    u_int64_t photons = 0;
+    u_int64_t counters[4] = {0, 0, 0, 0};
+    double dt = now - lastTime;
+    double elapsed = now - startTime;
+
+    u_int64_t lastTotal = 0;
+    stringstream threads;
+    threads.precision(1);
+    threads << fixed;
+    for (size_t i = 0; i < slots.size(); ++i) {
+        const ProgressSlot *slot = slots[i];
+        u_int64_t p = slot->photons.load(boost::memory_order_relaxed);
+        for (uint j = 0; j < 4; ++j) {
+            counters[j] += slot->counters[j].load(boost::memory_order_relaxed);
+        }
+        if(i > 0)
+            threads << ", ";
+        threads << "{\"seed\": "
+                << slot->seed.load(boost::memory_order_relaxed)
+                << ", \"photons\": " << p << ", \"total\": "
+                << slot->total.load(boost::memory_order_relaxed)
+                << ", \"rate\": " << (dt > 0 ? (p - lastPhotons[i]) / dt : 0.)
+                << "}";
+        photons += p;
+        // the same sample is the base of the next rate, so that no photon
+        // is left out
+        lastTotal += lastPhotons[i];
+        lastPhotons[i] = p;
+    }
+    lastTime = now;
+
+    double meanRate = elapsed > 0 ? photons / elapsed : 0.;
+
+    stringstream ss;
+    ss.precision(3);
+    ss << fixed;
+    ss << "{\"elapsed\": " << elapsed
+       << ", \"photons\": " << photons
+       << ", \"total\": " << totalPhotons;
+    ss.precision(1);
+    ss << ", \"rate\": " << (dt > 0 ? (photons - lastTotal) / dt : 0.)
+       << ", \"mean_rate\": " << meanRate
+       << ", \"eta\": ";
+    if(done)
+        ss << 0.;
+    else if(meanRate > 0 && totalPhotons >= photons)
+        ss << (totalPhotons - photons) / meanRate;
+    else
+        ss << "null";
+    ss << ", \"counters\": {";
+    for (uint i = 0; i < 4; ++i) {
+        if(i > 0)
+            ss << ", ";
+        ss << "\"" << walkerTypeToString(i) << "\": " << counters[i];
+    }
+    ss << "}, \"threads\": [" << threads.str() << "], \"done\": "
+       << (done ? "true" : "false") << "}\n";
+
+    string line = ss.str();
+    const char *buf = line.c_str();
+    size_t remaining = line.size();
+    while(remaining > 0) {
+        ssize_t written = write(fd, buf, remaining);
+        if(written < 0) {
+            if(errno == EINTR)
+                continue;
+            return;
+        }
+        buf += written;
+        remaining -= written;
+    }
+}
+
+void ProgressMonitor::closeOutput()
+{
+    if(ownsFd)
+        close(fd);
+    ownsFd = false;
+    fd = STDERR_FILENO;
+}
+
+bool ProgressMonitor::sanityCheck_impl() const
+{
+    return _interval > 0 && fd >= 0;
+}
@@ -0,0 +1,135 @@
+/*
+  This file is part of MCPlusPlus.
+
+  MCPlusPlus is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Mcplusplus is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with MCPlusPlus.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <MCPlusPlus/pulseconvolver.h>
+
+#include <cmath>
+#include <boost/math/constants/constants.hpp>
+
+using namespace boost::math::constants;
+using namespace MCPP;
+
+/**
+ * @brief Discretizes the given profile and computes its transform
+ * @param profile
+ * @param binWidth
+ * @param nBins number of regular bins of the histograms to be convolved,
+ * i.e. excluding the overflow bin
+ */
+
+PulseConvolver::PulseConvolver(const AbstractDistribution *profile,
+                               const double binWidth, const size_t nBins)
+{
+    n = nBins;
+    // the linear convolution of n counts with the 2n - 1 delays of the kernel
+    const size_t length = n > 0 ? 3 * n - 2 : 1;
+    size = 1;
+    while(size < length)
+        size <<= 1;
+
+    _valid = n > 0 && binWidth > 0;
+    kernel.assign(size, complex<double>(0, 0));
+    for (size_t i = 0; _valid && i + 1 < 2 * n; ++i) {
+        double k = (double)i - (double)(n - 1);
+        double p = profile->cdf((k + 0.5) * binWidth)
+                - profile->cdf((k - 0.5) * binWidth);
+        if(!(p >= 0))  // NaN if the profile has no cdf
+            _valid = false;
+        kernel[i] = p;
+    }
+    // delays of n bins or more, beyond the kernel
+    tail = _valid ? 1 - profile->cdf((n - 0.5) * binWidth) : 0;
+    if(_valid)
+        fft(kernel, false);
+}
+
+/**
+ * @brief Whether the profile could be discretized
+ */
+
+bool PulseConvolver::valid() const
+{
+    return _valid;
+}
+
+/**
+ * @brief Convolves the given counts with the profile
+ * @param in nBins regular bins followed by the overflow bin
+ * @param out as in
+ */
+
+void PulseConvolver::convolve(const double *in, double *out) const
+{
+    vector<complex<double> > a(size, complex<double>(0, 0));
+    for (size_t i = 0; i < n; ++i)
+        a[i] = in[i];
+    fft(a, false);
+    for (size_t i = 0; i < size; ++i)
+        a[i] *= kernel[i];
+    fft(a, true);
+
+    // index i + n - 1 of the linear convolution is delayed by i bins
+    for (size_t i = 0; i < n; ++i)
+        out[i] = std::max(0., a[i + n - 1].real());
+    out[n] = in[n];
+    for (size_t i = 2 * n - 1; i + 2 < 3 * n; ++i)
+        out[n] += std::max(0., a[i].real());
+    double total = 0;
+    for (size_t i = 0; i < n; ++i)
+        total += in[i];
+    out[n] += total * std::max(0., tail);
+}
+
+/**
+ * @brief In-place radix-2 FFT
+ * @param a its size must be a power of two
+ * @param inverse computes the inverse transform, including the \f$ 1/N \f$
+ * factor
+ */
+
+void PulseConvolver::fft(vector<complex<double> > &a, const bool inverse)
+{
+    const size_t N = a.size();
+    for (size_t i = 1, j = 0; i < N; ++i) {
+        size_t bit = N >> 1;
+        for (; j & bit; bit >>= 1)
+            j ^= bit;
+        j ^= bit;
+        if(i < j)
+            swap(a[i], a[j]);
+    }
+
+    for (size_t len = 2; len <= N; len <<= 1) {
+        double angle = 2 * pi<double>() / len * (inverse ? 1 : -1);
+        complex<double> wLen(cos(angle), sin(angle));
+        for (size_t i = 0; i < N; i += len) {
+            complex<double> w(1, 0);
+            for (size_t j = 0; j < len / 2; ++j) {
+                complex<double> u = a[i + j];
+                complex<double> v = a[i + j + len / 2] * w;
+                a[i + j] = u + v;
+                a[i + j + len / 2] = u - v;
+                w *= wLen;
+            }
+        }
+    }
+
+    if(inverse) {
+        for (size_t i = 0; i < N; ++i)
+            a[i] /= (double)N;
+    }
+}
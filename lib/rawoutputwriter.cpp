@@ -0,0 +1,231 @@
+/*
+  This file is part of MCPlusPlus.
+
+  MCPlusPlus is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Mcplusplus is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with MCPlusPlus.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <MCPlusPlus/rawoutputwriter.h>
+
+#include <boost/thread.hpp>
+#include <boost/bind.hpp>
+
+using namespace MCPP;
+
+RawOutputChunk::RawOutputChunk()
+{
+    pending = false;
+}
+
+/**
+ * @brief Opens the given (existing) output file and starts the writer thread
+ * @param fileName
+ * @param slots if not NULL, enables live output (the file must have been
+ * created with H5FileHelper::setLatestFormat())
+ * @param nSlots
+ * @param liveInterval seconds between live output updates
+ */
+
+boost::mutex RawOutputWriter::hdf5Mutex;
+
+RawOutputWriter::RawOutputWriter(const char *fileName, SnapshotSlot *slots,
+                                 const unsigned int nSlots,
+                                 const double liveInterval)
+{
+    this->slots = slots;
+    this->nSlots = nSlots;
+    this->liveInterval = boost::posix_time::microseconds(
+                (int64_t)(liveInterval * 1e6));
+    {
+        boost::mutex::scoped_lock lock(hdf5Mutex);
+        file.setLatestFormat(slots != NULL);
+        file.openFile(fileName);
+        if(slots != NULL)
+            initializeLiveOutput();
+    }
+    stopRequested = false;
+    thread = new boost::thread(boost::bind(&RawOutputWriter::writerLoop,
+                                           this));
+}
+
+RawOutputWriter::~RawOutputWriter()
+{
+    stop();
+    for (size_t i = 0; i < liveHists.size(); ++i) {
+        delete liveHists[i];
+    }
+}
+
+/**
+ * @brief Queues a chunk for writing
+ * @param chunk
+ *
+ * The chunk must not be modified until wait() returns. Written chunks are
+ * cleared, preserving the capacity of the vectors.
+ */
+
+void RawOutputWriter::submit(RawOutputChunk *chunk)
+{
+    boost::mutex::scoped_lock lock(mutex);
+    chunk->pending = true;
+    queue.push_back(chunk);
+    queueCondition.notify_one();
+}
+
+/**
+ * @brief Blocks until the given chunk has been written
+ * @param chunk
+ *
+ * Returns immediately if the chunk was never submitted.
+ */
+
+void RawOutputWriter::wait(RawOutputChunk *chunk)
+{
+    boost::mutex::scoped_lock lock(mutex);
+    while(chunk->pending)
+        doneCondition.wait(lock);
+}
+
+/**
+ * @brief Writes all the queued chunks, stops the writer thread and closes the
+ * file
+ */
+
+void RawOutputWriter::stop()
+{
+    if(thread == NULL)
+        return;
+    {
+        boost::mutex::scoped_lock lock(mutex);
+        stopRequested = true;
+    }
+    queueCondition.notify_one();
+    thread->join();
+    delete thread;
+    thread = NULL;
+    if(slots != NULL)
+        updateLiveOutput();
+    boost::mutex::scoped_lock lock(hdf5Mutex);
+    file.close();
+}
+
+void RawOutputWriter::writerLoop()
+{
+    boost::mutex::scoped_lock lock(mutex);
+    while(true) {
+        while(queue.empty() && !stopRequested && !liveUpdateDue()) {
+            if(slots != NULL)
+                queueCondition.timed_wait(lock, nextLiveUpdate);
+            else
+                queueCondition.wait(lock);
+        }
+        if(liveUpdateDue()) {
+            lock.unlock();
+            updateLiveOutput();
+            lock.lock();
+            continue;
+        }
+        if(queue.empty())
+            return;
+
+        RawOutputChunk *chunk = queue.front();
+        queue.pop_front();
+
+        lock.unlock();
+        write(chunk);
+        lock.lock();
+
+        chunk->pending = false;
+        doneCondition.notify_all();
+    }
+}
+
+void RawOutputWriter::write(RawOutputChunk *chunk)
+{
+    boost::mutex::scoped_lock lock(hdf5Mutex);
+    for (uint type = 0; type < 4; ++type) {
+        vector<MCfloat> &points = chunk->exitPoints[type];
+        if(!points.empty())
+            file.appendExitPoints((walkerType)type, points.data(),
+                                  points.size());
+        points.clear();
+
+        vector<MCfloat> &times = chunk->walkTimes[type];
+        if(!times.empty())
+            file.appendWalkTimes((walkerType)type, times.data(), times.size());
+        times.clear();
+
+        vector<MCfloat> &kVectors = chunk->exitKVectors[type];
+        if(!kVectors.empty())
+            file.appendExitKVectors((walkerType)type, kVectors.data(),
+                                    kVectors.size());
+        kVectors.clear();
+    }
+}
+
+/**
+ * @brief Creates the "live" group and switches the file to SWMR mode
+ */
+
+void RawOutputWriter::initializeLiveOutput()
+{
+    liveHists = slots[0].cloneHistograms();
+    hsize_t dims[1] = {4};
+    file.newGroup("live");
+    file.newDataset("live/photon-counters", 1, dims, dims,
+                    PredType::NATIVE_UINT64);
+    dims[0] = 1;
+    file.newDataset("live/photons", 1, dims, dims, PredType::NATIVE_UINT64);
+    for (size_t i = 0; i < liveHists.size(); ++i) {
+        string dsName = "live/" + liveHists[i]->name();
+        liveHists[i]->setScale(1);
+        liveHists[i]->writeDataset(&file, dsName.c_str(), true, true);
+    }
+    file.startSWMRWrite();
+    nextLiveUpdate = boost::get_system_time() + liveInterval;
+}
+
+bool RawOutputWriter::liveUpdateDue() const
+{
+    return slots != NULL && boost::get_system_time() >= nextLiveUpdate;
+}
+
+/**
+ * @brief Merges the snapshot slots and writes the "live" group
+ */
+
+void RawOutputWriter::updateLiveOutput()
+{
+    u_int64_t counters[4];
+    vector<u_int64_t> histPhotons;
+    u_int64_t photons = SnapshotSlot::merge(slots, nSlots, liveHists,
+                                            counters, &histPhotons);
+    boost::mutex::scoped_lock lock(hdf5Mutex);
+    for (size_t i = 0; i < liveHists.size(); ++i) {
+        string dsName = "live/" + liveHists[i]->name();
+        liveHists[i]->setScale(histPhotons[i] > 0 ? histPhotons[i] : 1);
+        liveHists[i]->writeDataset(&file, dsName.c_str(), false);
+    }
+
+    hsize_t start[1] = {0};
+    hsize_t count[1] = {4};
+    file.openDataSet("live/photon-counters");
+    file.writeHyperSlab(start, count, counters);
+    count[0] = 1;
+    file.openDataSet("live/photons");
+    file.writeHyperSlab(start, count, &photons);
+    file.closeDataSet();
+    file.flush();
+
+    nextLiveUpdate = boost::get_system_time() + liveInterval;
+}
@@ -18,6 +18,7 @@
 #include <MCPlusPlus/simulation.h>
 #include <MCPlusPlus/distributions.h>
 #include <MCPlusPlus/psigenerator.h>
+#include <MCPlusPlus/transport.h>
 #include <signal.h>
 
 #include <boost/math/special_functions/sign.hpp>
@@ -26,18 +27,6 @@
 
 #include <MCPlusPlus/h5outputfile.h>
 
-#ifdef SINGLEPRECISION
-#define COSZERO (1.0-1.0E-5)
-#endif
-
-#ifdef DOUBLEPRECISION
-#define COSZERO (1.0-1.0E-12)
-#endif
-
-#ifdef LONGDOUBLEPRECISION
-#define COSZERO (1.0-1.0E-30)
-#endif
-
 using namespace boost;
 using namespace boost::math;
 using namespace boost::math::constants;
@@ -132,6 +121,17 @@ Simulation::Simulation(BaseObject *parent) :
     exitKVectorsDirsSaveFlags = 0;
     exitKVectorsSaveFlags = 0;
     timeOriginZ = 0;
+    rawOutputDetector = NULL;
+    rawReservoirSize = 0;
+    progressSlot = &_progress;
+    monitor = NULL;
+    rawWriter = NULL;
+    outputWriter = NULL;
+    liveOutputInterval = 0;
+    snapshotSlots = NULL;
+    snapshotSlot = NULL;
+    publisher = NULL;
+    sharedMemoryInterval = SHM_DEFAULT_INTERVAL;
     deflCosine.setParent(this);
     setRawOutputEnabled(false);
     r0 = (MCfloat*)calloc(3, sizeof(MCfloat));
@@ -170,7 +170,12 @@ void Simulation::clear() {
         exitKVectors[i].clear();
         walkTimes[i].clear();
         photonCounters[i] = 0;
+        rawSeen[i] = 0;
     }
+    nRawPhotons = 0;
+    reservoirEngine.seed(currentSeed());
+    _stats.clear();
+    progressSlot->reset(_totalWalkers, currentSeed());
 
     _nInteractions = NULL;
     forceTermination = false;
@@ -243,7 +248,7 @@ u_int64_t Simulation::nPhotons() const
 
 u_int64_t Simulation::currentPhoton() const
 {
-    return n;
+    return progressSlot->photons.load(boost::memory_order_relaxed);
 }
 
 void Simulation::setOutputFileName(const char *name)
@@ -264,18 +269,63 @@ void Simulation::run() {
         sprintf(outputFile, "output.h5");
         logMessage("No output file name provided, using %s", outputFile);
     }
-    if(access(outputFile,F_OK) >= 0) {
-        logMessage("File %s already exists. Aborting.", outputFile);
-        return;
+    if(!wasCloned()) {
+        if(access(outputFile,F_OK) >= 0) {
+            logMessage("File %s already exists. Aborting.", outputFile);
+            return;
+        }
+        if(!sanityCheck())
+            return;
     }
 
     installSigUSR2Handler();
     time(&startTime);
+    monotonicStartTime = monotonicTime();
+    initializeHistograms();
+
+    // raw output is streamed to the file while simulating; with multiple
+    // threads each thread writes its own shard file (see runMultipleThreads()),
+    // unless live output is enabled
+    bool live = !wasCloned() && liveOutputInterval > 0;
+    bool sharded = rawOutputStreamed() && _nThreads > 1 && !live;
+    if(!wasCloned() && (rawOutputEnabled || live)) {
+        H5OutputFile file;
+        configureOutputFile(&file);
+        file.setLatestFormat(live);
+        if(!file.newFile(outputFile, rawOutputEnabled && !sharded))
+            return;
+        file.saveSample(_sample);
+        file.close();
+    }
+    bool shared = false;
     for (size_t i = 0; i < hists.size(); ++i) {
-        Histogram *h = hists[i];
-        h->setScale(nPhotons());
-        h->initialize();
+        if(!hists[i]->sharedMemoryName().empty())
+            shared = true;
+    }
+    shared = shared && !wasCloned();
+    if(live || shared) {
+        snapshotSlots = new SnapshotSlot[_nThreads];
+        for (unsigned int i = 0; i < _nThreads; ++i) {
+            snapshotSlots[i].initialize(hists);
+        }
+        snapshotSlot = snapshotSlots;
     }
+    if(shared)
+        publisher = new HistogramPublisher(snapshotSlots, _nThreads,
+                                           sharedMemoryInterval);
+    if(live) {
+        outputWriter = new RawOutputWriter(outputFile, snapshotSlots,
+                                           _nThreads, liveOutputInterval);
+    }
+    else if(!wasCloned() && rawOutputStreamed() && !sharded)
+        outputWriter = new RawOutputWriter(outputFile);
+    if(!wasCloned() && rawOutputStreamed())
+        rawWriter = outputWriter;
+
+    // layer tables are computed anew for every run, clones share them with
+    // their parent
+    if(!wasCloned())
+        layerTables.reset();
 
     if(_nThreads == 1) {
         if(!wasCloned()) {
@@ -285,9 +335,18 @@ void Simulation::run() {
             sims.push_back(this);
             if(multipleRNGStates.size() > 0)
                 setGeneratorState(multipleRNGStates[0]);
+            if(monitor != NULL) {
+                const ProgressSlot *slot = &_progress;
+                monitor->start(&slot, 1, nPhotons());
+            }
         }
 
-        if(!runSingleThread())
+        bool ok = runSingleThread();
+        if(!wasCloned() && monitor != NULL)
+            monitor->stop();
+        if(!wasCloned())
+            stopOutputWriter();
+        if(!ok)
             return;
 
         if(!wasCloned())
@@ -295,7 +354,8 @@ void Simulation::run() {
     }
     else {
         mainSimulation = this;
-        runMultipleThreads();
+        if(!runMultipleThreads())
+            return;
     }
 
     time_t now;
@@ -315,14 +375,41 @@ void Simulation::run() {
 
     logMessage("%s\nCompleted in %.f seconds\n================\n",
                stream.str().c_str(), difftime(now, startTime));
+    logMessage(_stats.toString());
+
+    layerTables.reset();
 
     for (size_t i = 0; i < hists.size(); ++i) {
         Histogram *h = hists[i];
         h->saveToFile(outputFile);
     }
+    for (size_t i = 0; i < tallies.size(); ++i) {
+        tallies[i]->saveToFile(outputFile);
+    }
+    for (size_t i = 0; i < observers.size(); ++i) {
+        observers[i]->saveToFile(outputFile);
+    }
+
+    saveStats();
 }
 
-void Simulation::runMultipleThreads()
+/**
+ * @brief Runs the simulation in parallel threads
+ *
+ * When raw output is enabled, every thread streams it to its own shard file
+ * (see shardFileName()) through its own RawOutputWriter, so that threads only
+ * wait for their own chunks and do not contend for a single queue. The HDF5
+ * calls of the writers are still serialized (the HDF5 C++ API is not
+ * thread-safe), so that the write throughput does not grow with the number
+ * of threads. The raw datasets of the output file are then created as
+ * virtual datasets concatenating the shards in thread order (see
+ * H5OutputFile::createVirtualDatasets()).
+ *
+ * @return false if the shard files could not be created, in which case no
+ * thread is started and nothing is saved
+ */
+
+bool Simulation::runMultipleThreads()
 {
     threads.clear();
     sims.clear();
@@ -331,6 +418,43 @@ void Simulation::runMultipleThreads()
     u_int64_t walkersPerThread = nPhotons()/_nThreads;
     u_int64_t remainder = nPhotons() % _nThreads;
 
+    if(_sample != NULL && source != NULL)
+        layerTables.reset(new LayerTables(_sample, source, timeOriginZ));
+
+    // seeds and RNG states of the threads, saved after the shards have been
+    // completed
+    vector<pair<uint, string> > rngStates;
+    vector<string> shardFiles;
+    vector<RawOutputWriter *> shardWriters;
+    if(rawOutputStreamed() && rawWriter == NULL) {
+        for (unsigned int n = 0; n < _nThreads; ++n) {
+            H5OutputFile shard;
+            configureOutputFile(&shard);
+            shardFiles.push_back(shardFileName(n));
+            if(!shard.newFile(shardFiles[n].c_str())) {
+                logMessage("Cannot create shard %s. Aborting.",
+                           shardFiles[n].c_str());
+                for (size_t i = 0; i < n; ++i) {
+                    remove(shardFiles[i].c_str());
+                }
+                stopOutputWriter();
+                return false;
+            }
+            shard.close();
+        }
+        // writers are started once all the shards exist
+        for (unsigned int n = 0; n < _nThreads; ++n) {
+            shardWriters.push_back(new RawOutputWriter(shardFiles[n].c_str()));
+        }
+    }
+
+    // slots outlive the thread simulations, which are deleted at join
+    ProgressSlot *slots = new ProgressSlot[_nThreads];
+    vector<const ProgressSlot *> slotPointers;
+    for (unsigned int n = 0; n < _nThreads; ++n) {
+        slotPointers.push_back(&slots[n]);
+    }
+
     for (unsigned int n = 0; n < _nThreads; ++n) {
         Simulation *sim = (Simulation *)clone();
         u_int64_t nWalkers = walkersPerThread;
@@ -340,6 +464,16 @@ void Simulation::runMultipleThreads()
         sim->setSeed(currentSeed()+n);
         if(n<multipleRNGStates.size())
             sim->setGeneratorState(multipleRNGStates[n]);
+        sim->progressSlot = &slots[n];
+        sim->progressSlot->reset(nWalkers, sim->currentSeed());
+        if(rawOutputStreamed())
+            sim->rawWriter = rawWriter != NULL ? rawWriter : shardWriters[n];
+        if(snapshotSlots != NULL)
+            sim->snapshotSlot = &snapshotSlots[n];
+        for (size_t i = 0; i < hists.size(); ++i) {
+            if(hists[i]->sharedAcrossThreads())
+                sim->hists[i]->shareStorageWith(hists[i]);
+        }
 
         sims.push_back(sim);
 
@@ -347,6 +481,9 @@ void Simulation::runMultipleThreads()
         threads.push_back(new boost::thread(workerFunc, sims.at(n)));
     }
 
+    if(monitor != NULL)
+        monitor->start(slotPointers.data(), _nThreads, nPhotons());
+
     //wait for all threads to finish
     for (unsigned int n = 0; n < _nThreads; ++n) {
         boost::thread * thread = threads.at(n);
@@ -357,20 +494,90 @@ void Simulation::runMultipleThreads()
         for (uint i = 0; i < 4; ++i) {
             photonCounters[i] += sim->photonCounters[i];
         }
-
-        for (size_t i = 0; i < hists.size(); ++i) {
-            Histogram *h = hists[i];
-            h->appendCounts((sim->hists[i]));
+        _stats.merge(sim->_stats);
+
+        if(rawOutputEnabled) {
+            // the other shards are still being written
+            if(!shardWriters.empty())
+                delete shardWriters[n];
+            if(rawReservoirSize > 0)
+                mergeRawReservoir(sim);
+            rngStates.push_back(make_pair(sim->currentSeed(),
+                                          sim->generatorState()));
         }
 
-        sim->saveRawOutput();
+        delete thread;
+    }
 
+    // histograms are deleted with the thread simulations
+    reduceHistograms();
+    for (unsigned int n = 0; n < _nThreads; ++n) {
+        Simulation *sim = sims.at(n);
         if(mostRecentInstance == sim)
             mostRecentInstance = NULL;
-
         sims.at(n) = NULL;
         delete sim;
-        delete thread;
+    }
+
+    if(monitor != NULL)
+        monitor->stop();
+    delete[] slots;
+    stopOutputWriter();
+
+    if(!rawOutputEnabled)
+        saveRawOutput();
+    else {
+        H5OutputFile file;
+        configureOutputFile(&file);
+        file.openFile(outputFile);
+        if(!shardFiles.empty())
+            file.createVirtualDatasets(shardFiles);
+        file.saveSample(_sample);
+        file.appendPhotonCounts(photonCounters);
+        for (size_t i = 0; i < rngStates.size(); ++i) {
+            file.saveRNGState(rngStates[i].first, rngStates[i].second);
+        }
+        writeRawDatasets(&file);
+        file.close();
+        logMessage("Data written to %s", outputFile);
+    }
+    return true;
+}
+
+/**
+ * @brief Sums the per-thread histograms of the completed thread simulations
+ * into the histograms of this simulation
+ *
+ * The per-thread copies are summed pairwise in parallel, in
+ * \f$ \lceil \log_2 N \rceil \f$ rounds for \f$ N \f$ threads, rather than
+ * one after the other into the main histograms. Histograms shared across
+ * threads already hold all the counts and are skipped.
+ */
+
+void Simulation::reduceHistograms()
+{
+    for (size_t stride = 1; stride < sims.size(); stride *= 2) {
+        boost::thread_group group;
+        for (size_t n = 0; n + stride < sims.size(); n += 2 * stride) {
+            group.create_thread(boost::bind(&Simulation::appendHistograms,
+                                            sims[n], sims[n + stride]));
+        }
+        group.join_all();
+    }
+    if(!sims.empty())
+        appendHistograms(sims[0]);
+}
+
+void Simulation::appendHistograms(const Simulation *rhs)
+{
+    for (size_t i = 0; i < hists.size(); ++i) {
+        hists[i]->appendCounts(rhs->hists[i]);
+    }
+    for (size_t i = 0; i < tallies.size(); ++i) {
+        tallies[i]->append(rhs->tallies[i]);
+    }
+    for (size_t i = 0; i < observers.size(); ++i) {
+        observers[i]->merge(rhs->observers[i]);
     }
 }
 
@@ -381,64 +588,20 @@ bool Simulation::runSingleThread() {
     clear();
     logMessage("starting... Number of walkers = %llu, original seed = %u",
                nPhotons(), currentSeed());
-    nLayers = _sample->nLayers();
+    if(!layerTables)
+        layerTables.reset(new LayerTables(_sample, source, timeOriginZ));
 
-
-    MCfloat *uzb = (MCfloat*)malloc((nLayers + 2) * sizeof(MCfloat));
-    Material *mat = (Material*)malloc((nLayers + 2) * sizeof(Material));
-    MCfloat *mus = (MCfloat*)malloc((nLayers + 2) * sizeof(MCfloat));
-
-    for (unsigned int i = 0; i < nLayers + 1; ++i) {
-        uzb[i]=_sample->zBoundaries()->at(i);
-    }
-
-    for (unsigned int i = 0; i < nLayers + 2; ++i) {
-        Material *m = _sample->material(i);
-        m->setWavelength(source->wavelength());
-        mat[i] = *m;
-        mus[i] = 1. / mat[i].ls;
-    }
-
-    upperZBoundaries = uzb;
-    materials = mat;
-    this->mus = mus;
+    nLayers = layerTables->nLayers;
+    upperZBoundaries = layerTables->upperZBoundaries;
+    materials = layerTables->materials;
+    mus = layerTables->mus;
 
     n = 0;
     nBuf = 0;
 
-    MCfloat timeOffset = 0;
-    MCfloat pos[3];
-    pos[0] = 0; pos[1] = 0;
-
-    pos[2] = source->z0();
-    layer0 = layerAt(pos);
-    pos[2] = timeOriginZ;
-    layer1 = layerAt(pos);
-
-    uint initialLayer = layer0;
-    uint leftLayer = min(layer0, layer1);
-    uint rightLayer = max(layer0, layer1);
-    MCfloat leftPoint = min(source->z0(), timeOriginZ);
-    if(leftPoint == -1*numeric_limits<MCfloat>::infinity()) {
-        leftPoint = min(upperZBoundaries[0], timeOriginZ);
-        initialLayer = 0;
-    }
-    MCfloat rightPoint = max(source->z0(), timeOriginZ);
-    if(leftLayer != rightLayer) { //add first and last portion of distance
-        timeOffset += (upperZBoundaries[leftLayer] - leftPoint)
-                / materials[leftLayer].v;
-        timeOffset += (rightPoint - upperZBoundaries[rightLayer - 1])
-                / materials[rightLayer].v;
-        for (uint i = leftLayer + 1; i <= rightLayer - 1 ; ++i) {
-            timeOffset += (upperZBoundaries[i] - upperZBoundaries[i-1])
-                    / materials[i].v;
-        }
-    }
-    else {
-        timeOffset += fabs(rightPoint - leftPoint)
-                / materials[leftLayer].v;
-    }
-    timeOffset *= -1 * sign<MCfloat>(timeOriginZ - source->z0());
+    const MCfloat timeOffset = layerTables->timeOffset;
+    const uint initialLayer = layerTables->initialLayer;
+    const MCfloat leftPoint = layerTables->leftPoint;
 
     // layer0 must be initialized for updateLayerVariables()
     layer0 = numeric_limits<unsigned int>::max();
@@ -466,6 +629,8 @@ bool Simulation::runSingleThread() {
 
         walker.walkTime += timeOffset;
 
+        photonSteps = 0;
+        photonPathLength = 0;
         totalLengthInCurrentLayer = 0;
         updateLayerVariables(initialLayer);
 
@@ -488,49 +653,15 @@ bool Simulation::runSingleThread() {
         while(1) {
             //spin k1 (i.e. scatter) only if the material is scattering
             if(currentMaterial->ls != numeric_limits<MCfloat>::infinity()) {
-                /* using long double moves the truncation of the exponential
-                 * distribution to 44 times the mfp, then we cast to MCfloat */
-                length = exponential_distribution<long double>(currentMus)(*mt);
+                length = sampleFreePath(currentMus, mt);
                 if(kNeedsToBeScattered) {
                     nInteractions[layer0]++;
+                    _stats.scatteringEvents++;
 
                     MCfloat cosTheta = deflCosine.spin();
-                    MCfloat sinTheta = sqrt(1 - pow(cosTheta, 2));
                     //uniform in [0,2pi)
                     MCfloat psi = uniform_01<MCfloat>()(*mt) * two_pi<MCfloat>();
-                    MCfloat cosPsi, sinPsi;
-
-#ifdef DOUBLEPRECISION
-                    sincos(psi, &sinPsi, &cosPsi);
-#endif
-#ifdef LONGDOUBLEPRECISION
-                    sincosl(psi, &sinPsi, &cosPsi);
-#endif
-#ifdef SINGLEPRECISION
-                    sincosf(psi, &sinPsi, &cosPsi);
-#endif
-
-                    if(fabs(k0[2]) > COSZERO) {
-                        k1[0] = sinTheta * cosPsi;
-                        k1[1] = sinTheta * sinPsi;
-                        k1[2] = cosTheta * sign<MCfloat>(k0[2]);
-                    }
-                    else {
-                        MCfloat temp = sqrt(1 - pow(k0[2], 2));
-                        k1[0] = (sinTheta
-                                 * (k0[0] * k0[2] * cosPsi - k0[1] * sinPsi))
-                                / temp + cosTheta * k0[0];
-                        k1[1] = (sinTheta
-                                 * (k0[1] * k0[2] * cosPsi + k0[0] * sinPsi))
-                                / temp + cosTheta * k0[1];
-                        k1[2] = -sinTheta * cosPsi * temp + cosTheta * k0[2];
-                    }
-
-                    MCfloat mod = sqrt(k1[0] * k1[0] + k1[1] * k1[1]
-                            + k1[2] * k1[2]);
-                    k1[0] /= mod;
-                    k1[1] /= mod;
-                    k1[2] /= mod;
+                    scatterDirection(k0, cosTheta, psi, k1);
                 }
             }
             else //no scattering
@@ -540,6 +671,8 @@ bool Simulation::runSingleThread() {
                 length = numeric_limits<MCfloat>::infinity();
             }
 
+            photonSteps++;
+
             //compute new position
             r1[0] = r0[0] + length * k1[0];
             r1[1] = r0[1] + length * k1[1];
@@ -586,30 +719,23 @@ bool Simulation::runSingleThread() {
 #ifdef DEBUG_TRAJECTORY
         printf("\t%lf\nwalker reached layer %d\n", k1[2], layer0);
 #endif
+        _stats.addPhoton(photonSteps, photonPathLength);
         n++;
+        progressSlot->photons.store(n, boost::memory_order_relaxed);
     }
-    free(uzb);
-    free(mat);
-    free(mus);
     flushHistogram();
-    return true;
-}
-
-/**
- * @brief Determines the layer index for the given position
- * @param r0
- * @return The index of the layer containing the point r0
- *
- * Interfaces are considered to belong to the preceding layer
- */
-
-unsigned int Simulation::layerAt(const MCfloat *r0) const {
-    MCfloat z = r0[2];
-    for (unsigned int i = 0; i < nLayers + 1; ++i) {
-        if(z <= sample()->zBoundaries()->at(i))
-            return i;
+    for (size_t i = 0; i < hists.size(); ++i) {
+        hists[i]->flushCombiningBuffer();
     }
-    return nLayers+1;
+    if(snapshotSlot != NULL) {
+        snapshotSlot->sharedPhotons.store(n, boost::memory_order_release);
+        snapshotSlot->publish(hists, photonCounters, n, true);
+    }
+    if(rawWriter != NULL) {
+        flushRawOutput();
+        rawWriter->wait(&rawChunk);
+    }
+    return true;
 }
 
 /**
@@ -630,6 +756,7 @@ void Simulation::handleInterface() {
 
     totalLengthInCurrentLayer += t;
     kNeedsToBeScattered = false;
+    _stats.interfaceHits++;
 
     // so we updated r0, now it's time to update k0
 
@@ -651,6 +778,7 @@ void Simulation::handleInterface() {
 #ifdef DEBUG_TRAJECTORY
             printf("TIR ");
 #endif
+            _stats.TIREvents++;
             reflect();
         }
         else {
@@ -714,36 +842,15 @@ void Simulation::checkIfWalkerExitedSample() {
  */
 
 MCfloat Simulation::reflectionProbability() {
-    MCfloat r;
-
-    //cos(Theta0 + Theta1) and cos(Theta0 - Theta1)
-    MCfloat cThetaSum, cThetaDiff;
-
-    //sin(Theta0 + Theta1) and sin(Theta0 - Theta1)
-    MCfloat sThetaSum, sThetaDiff;
-
-    MCfloat cosTheta0 = fabs(k1[2]);
-
-    if(cosTheta0 > COSZERO) { //normal incidence
-        r = (n1-n0)/(n1+n0);
-        r *= r;
-    }
-    else { //general case
-        cThetaSum = cosTheta0 * cosTheta1 - sinTheta0 * sinTheta1;
-        cThetaDiff = cosTheta0 * cosTheta1 + sinTheta0 * sinTheta1;
-        sThetaSum = sinTheta0 * cosTheta1 + cosTheta0 * sinTheta1;
-        sThetaDiff = sinTheta0 * cosTheta1 - cosTheta0 * sinTheta1;
-        r = 0.5 * sThetaDiff * sThetaDiff
-                * (cThetaDiff * cThetaDiff + cThetaSum * cThetaSum)
-                / (sThetaSum * sThetaSum * cThetaDiff * cThetaDiff);
-    }
-    return r;
+    return fresnelReflectionProbability(fabs(k1[2]), sinTheta0, cosTheta1,
+                                        sinTheta1, n0, n1);
 }
 
 void Simulation::reflect() {
 #ifdef DEBUG_TRAJECTORY
     printf("reflect ...\n");
 #endif
+    _stats.reflections++;
     k1[2] *= -1; //flip k1 along z
 }
 
@@ -757,6 +864,7 @@ void Simulation::refract() {
 #ifdef DEBUG_TRAJECTORY
     printf("refract ...\n");
 #endif
+    _stats.refractions++;
 
     if(fabs(k1[2]) <= COSZERO)  // not normal incidence
     {
@@ -794,6 +902,8 @@ void Simulation::appendExitKVector(walkerType type)
 void Simulation::appendWalker(walkerType type)
 {
     photonCounters[type]++;
+    progressSlot->counters[type].store(photonCounters[type],
+                                       boost::memory_order_relaxed);
     Walker *w = &walkerBuf[nBuf++];
 
     memcpy(w->r0, r0, 3 * sizeof(MCfloat));
@@ -801,6 +911,27 @@ void Simulation::appendWalker(walkerType type)
     w->walkTime = walker.walkTime;
     w->type = type;
 
+    if(rawOutputDetector != NULL && !rawOutputDetector->accept(w))
+        return;
+
+    if(rawReservoirSize > 0) {
+        sampleRawPhoton(type);
+        return;
+    }
+
+    appendRawPhoton(type);
+
+    if(rawWriter != NULL && ++nRawPhotons == RAW_OUTPUT_CHUNK_SIZE)
+        flushRawOutput();
+}
+
+/**
+ * @brief Appends the raw output of the current photon selected by the save
+ * flags
+ */
+
+void Simulation::appendRawPhoton(walkerType type)
+{
     walkerFlags flags = walkerTypeToFlag(type);
 
     if(exitPointsSaveFlags & flags)
@@ -813,6 +944,174 @@ void Simulation::appendWalker(walkerType type)
         appendExitKVector(type);
 }
 
+/**
+ * @brief Offers the current photon to the reservoir of its type
+ *
+ * Algorithm R: the first rawReservoirSize photons are kept, then the
+ * \f$ i \f$-th photon replaces a random one with probability
+ * rawReservoirSize / \f$ i \f$. The photon is appended and then moved into
+ * the replaced slot of each raw output vector.
+ */
+
+void Simulation::sampleRawPhoton(walkerType type)
+{
+    const u_int64_t seen = ++rawSeen[type];
+    if(seen <= rawReservoirSize) {
+        appendRawPhoton(type);
+        return;
+    }
+    boost::random::uniform_int_distribution<u_int64_t> slot(0, seen - 1);
+    const u_int64_t j = slot(reservoirEngine);
+    if(j >= rawReservoirSize)
+        return;
+
+    vector<MCfloat> *vectors[3] = {
+        &exitPoints[type], &walkTimes[type], &exitKVectors[type]
+    };
+    size_t sizes[3];
+    for (uint i = 0; i < 3; ++i)
+        sizes[i] = vectors[i]->size();
+    appendRawPhoton(type);
+    for (uint i = 0; i < 3; ++i) {
+        vector<MCfloat> &v = *vectors[i];
+        const size_t stride = v.size() - sizes[i];
+        if(stride == 0)
+            continue;
+        copy(v.begin() + sizes[i], v.end(), v.begin() + j * stride);
+        v.resize(sizes[i]);
+    }
+}
+
+/**
+ * @brief Merges the raw output reservoirs of another simulation into the ones
+ * of this simulation
+ * @param rhs
+ *
+ * If the two reservoirs of a type are uniform samples of \f$ N_1 \f$ and
+ * \f$ N_2 \f$ photons, the merged reservoir is a uniform sample of the
+ * \f$ N_1 + N_2 \f$ photons: each photon of the merged reservoir is drawn
+ * from the first reservoir with probability proportional to the photons of
+ * the first population not drawn yet (i.e. the number of photons taken from
+ * each side is hypergeometric), then uniformly among the photons of that
+ * reservoir not taken yet.
+ */
+
+void Simulation::mergeRawReservoir(const Simulation *rhs)
+{
+    uint nDirs = 0;
+    for (uint d = DIR_X; d <= DIR_Z; d <<= 1)
+        nDirs += (exitKVectorsDirsSaveFlags & d) != 0;
+
+    for (uint type = 0; type < 4; ++type) {
+        const u_int64_t n1 = rawSeen[type];
+        const u_int64_t n2 = rhs->rawSeen[type];
+        rawSeen[type] = n1 + n2;
+        if(n2 == 0)
+            continue;
+
+        const walkerFlags flag = walkerTypeToFlag((walkerType)type);
+        vector<MCfloat> *dest[3] = {
+            &exitPoints[type], &walkTimes[type], &exitKVectors[type]
+        };
+        const vector<MCfloat> *src[3] = {
+            &rhs->exitPoints[type], &rhs->walkTimes[type],
+            &rhs->exitKVectors[type]
+        };
+        const size_t strides[3] = {
+            exitPointsSaveFlags & flag ? 2u : 0u,
+            walkTimesSaveFlags & flag ? 1u : 0u,
+            exitKVectorsSaveFlags & flag ? nDirs : 0u
+        };
+
+        if(n1 + n2 <= rawReservoirSize) {
+            for (uint i = 0; i < 3; ++i)
+                dest[i]->insert(dest[i]->end(), src[i]->begin(),
+                                src[i]->end());
+            continue;
+        }
+
+        // (reservoir, record) pairs not taken yet
+        vector<size_t> pool[2];
+        pool[0].resize(std::min(n1, rawReservoirSize));
+        pool[1].resize(std::min(n2, rawReservoirSize));
+        for (uint s = 0; s < 2; ++s) {
+            for (size_t r = 0; r < pool[s].size(); ++r)
+                pool[s][r] = r;
+        }
+        u_int64_t remaining[2] = {n1, n2};
+
+        vector<MCfloat> merged[3];
+        for (uint i = 0; i < 3; ++i)
+            merged[i].reserve(rawReservoirSize * strides[i]);
+        for (u_int64_t m = 0; m < rawReservoirSize; ++m) {
+            boost::random::uniform_int_distribution<u_int64_t> side(
+                        0, remaining[0] + remaining[1] - 1);
+            const uint s = side(reservoirEngine) < remaining[0] ? 0 : 1;
+            remaining[s]--;
+            boost::random::uniform_int_distribution<size_t> pick(
+                        0, pool[s].size() - 1);
+            const size_t p = pick(reservoirEngine);
+            const size_t r = pool[s][p];
+            pool[s][p] = pool[s].back();
+            pool[s].pop_back();
+            for (uint i = 0; i < 3; ++i) {
+                const vector<MCfloat> &v = s == 0 ? *dest[i] : *src[i];
+                merged[i].insert(merged[i].end(),
+                                 v.begin() + r * strides[i],
+                                 v.begin() + (r + 1) * strides[i]);
+            }
+        }
+        for (uint i = 0; i < 3; ++i)
+            dest[i]->swap(merged[i]);
+    }
+}
+
+/**
+ * @brief Whether raw output is streamed to the output file while simulating,
+ * i.e. enabled and not sampled by reservoirs
+ */
+
+bool Simulation::rawOutputStreamed() const
+{
+    return rawOutputEnabled && rawReservoirSize == 0;
+}
+
+/**
+ * @brief Stops the RawOutputWriter of the main simulation, if any, and
+ * releases the snapshot slots
+ */
+
+void Simulation::stopOutputWriter()
+{
+    delete outputWriter;
+    outputWriter = NULL;
+    rawWriter = NULL;
+    delete publisher;
+    publisher = NULL;
+    delete[] snapshotSlots;
+    snapshotSlots = NULL;
+    snapshotSlot = NULL;
+}
+
+/**
+ * @brief Hands the raw output collected so far to the RawOutputWriter
+ *
+ * Waits for the previously submitted chunk to be written, then swaps the raw
+ * output vectors with the chunk ones.
+ */
+
+void Simulation::flushRawOutput()
+{
+    rawWriter->wait(&rawChunk);
+    for (uint type = 0; type < 4; ++type) {
+        rawChunk.exitPoints[type].swap(exitPoints[type]);
+        rawChunk.walkTimes[type].swap(walkTimes[type]);
+        rawChunk.exitKVectors[type].swap(exitKVectors[type]);
+    }
+    rawWriter->submit(&rawChunk);
+    nRawPhotons = 0;
+}
+
 /**
  * @brief Print progress information
  *
@@ -833,14 +1132,33 @@ void Simulation::reportProgress() const
     if(currentPhoton() > 0) {
         time_t now;
         time(&now);
-        double secsPerWalker = difftime(now,startTime) / currentPhoton();
-        time_t eta = now + secsPerWalker * (nPhotons() - currentPhoton());
+        double secsPerWalker = (monotonicTime() - monotonicStartTime)
+                / currentPhoton();
+        time_t eta = now + (time_t)(secsPerWalker
+                                    * (nPhotons() - currentPhoton()) + 0.5);
         struct tm * timeinfo;
         timeinfo = localtime (&eta);
         strftime (buffer, 80, "%F %T", timeinfo);
         ss << "ETA: " << buffer;
     }
     logMessage(ss.str());
+    // the counters of a running thread are only read through its slot
+    SimulationStats stats = progressSlot->stats();
+    if(stats.nPhotons > 0)
+        logMessage(stats.toString());
+}
+
+/**
+ * @brief Event counters of the transport loop
+ * @return
+ *
+ * After a multithreaded run, the counters of all the threads are merged.
+ * \see SimulationStats
+ */
+
+const SimulationStats *Simulation::stats() const
+{
+    return &_stats;
 }
 
 /**
@@ -881,27 +1199,51 @@ BaseObject* Simulation::clone_impl() const
     sim->fresnelReflectionsEnabled = fresnelReflectionsEnabled;
     sim->setSource((Source*)source->clone());
     sim->_sample = _sample;
-    sim->setOutputFileName(outputFile);
+    if(outputFile != NULL)
+        sim->setOutputFileName(outputFile);
     sim->exitPointsSaveFlags = exitPointsSaveFlags;
     sim->walkTimesSaveFlags = walkTimesSaveFlags;
     sim->exitKVectorsSaveFlags = exitKVectorsSaveFlags;
     sim->exitKVectorsDirsSaveFlags = exitKVectorsDirsSaveFlags;
     sim->setTimeOriginZ(timeOriginZ);
     sim->setRawOutputEnabled(rawOutputEnabled);
+    sim->rawReservoirSize = rawReservoirSize;
+    for (uint i = 0; i < 4; ++i) {
+        sim->rawDatasetOptions[i] = rawDatasetOptions[i];
+    }
+    if(rawOutputDetector != NULL)
+        sim->setRawOutputDetector((Detector *)rawOutputDetector->clone());
+    sim->layerTables = layerTables;
     for (size_t i = 0; i < hists.size(); ++i) {
         Histogram *h = hists[i];
         sim->addHistogram((Histogram *)h->clone());
     }
+    for (size_t i = 0; i < tallies.size(); ++i) {
+        sim->addSummaryTally((SummaryTally *)tallies[i]->clone());
+    }
+    for (size_t i = 0; i < observers.size(); ++i) {
+        sim->addExitObserver((ExitObserver *)observers[i]->clone());
+    }
     return sim;
 }
 
 bool Simulation::sanityCheck_impl() const
 {
+    if(rawOutputDetector != NULL && !rawOutputDetector->sanityCheck())
+        return false;
     for (size_t i = 0; i < hists.size(); ++i) {
         Histogram *h = hists[i];
         if(!h->sanityCheck())
             return false;
     }
+    for (size_t i = 0; i < tallies.size(); ++i) {
+        if(!tallies[i]->sanityCheck())
+            return false;
+    }
+    for (size_t i = 0; i < observers.size(); ++i) {
+        if(!observers[i]->sanityCheck())
+            return false;
+    }
     return true;
 }
 
@@ -917,6 +1259,7 @@ void Simulation::saveRawOutput()
 {
     H5OutputFile file;
 
+    configureOutputFile(&file);
     if(access(outputFile, F_OK)<0) {
         file.newFile(outputFile, rawOutputEnabled);
     }
@@ -925,36 +1268,117 @@ void Simulation::saveRawOutput()
         file.newFile("output.h5");
     }
 
-    file.saveSample(_sample);
-    file.appendPhotonCounts(photonCounters);
+    writeRawOutput(&file);
+    file.close();
 
+    if(rawOutputEnabled)
+        logMessage("Data written to %s", outputFile);
+}
 
-    if(!rawOutputEnabled) {
-        file.close();
-        return;
+/**
+ * @brief Name of the file the raw output of the given thread is written to
+ * @param thread
+ * @return the output file name, without the ".h5" extension if present,
+ * followed by ".shard-<thread>.h5"
+ */
+
+string Simulation::shardFileName(unsigned int thread) const
+{
+    string name = outputFile;
+    size_t len = name.size();
+    if(len > 3 && name.compare(len - 3, 3, ".h5") == 0)
+        name.erase(len - 3);
+    stringstream ss;
+    ss << name << ".shard-" << thread << ".h5";
+    return ss.str();
+}
+
+/**
+ * @brief Sets the raw datasets to be created and their storage options
+ * @param file
+ */
+
+void Simulation::configureOutputFile(H5OutputFile *file) const
+{
+    file->setRawDatasetFlags(walkTimesSaveFlags, exitPointsSaveFlags,
+                             exitKVectorsSaveFlags, exitKVectorsDirsSaveFlags);
+    for (uint i = DATA_POINTS; i <= DATA_TIMES; ++i) {
+        file->setRawDatasetOptions((MCData)i, rawDatasetOptions[i]);
     }
+}
+
+/**
+ * @brief Writes the sample description, the photon counters and, if enabled,
+ * the raw output to the given file
+ * @param file an open file
+ */
+
+void Simulation::writeRawOutput(H5OutputFile *file)
+{
+    file->saveSample(_sample);
+    file->appendPhotonCounts(photonCounters);
+
+    if(!rawOutputEnabled)
+        return;
 
-    file.saveRNGState(currentSeed(), generatorState());
+    file->saveRNGState(currentSeed(), generatorState());
 
+    // the reservoirs of work units are written once merged, see
+    // SimulationBatch
+    if(rawReservoirSize > 0 && wasCloned())
+        return;
+
+    writeRawDatasets(file);
+}
+
+/**
+ * @brief Appends the raw output held in memory to the raw datasets of the
+ * given file
+ * @param file an open file
+ *
+ * When the raw output is sampled by reservoirs, the fraction of the photons
+ * of each type that have been kept is recorded in the "sampling-fraction"
+ * attribute of its datasets.
+ */
+
+void Simulation::writeRawDatasets(H5OutputFile *file)
+{
     for (uint type = 0; type < 4; ++type) {
         //exit points
-        if(photonCounters[type] && exitPointsSaveFlags & walkerTypeToFlag(type))
-            file.appendExitPoints((walkerType)type, exitPoints[type].data(),
-                                  exitPoints[type].size());
+        if(!exitPoints[type].empty()
+                && exitPointsSaveFlags & walkerTypeToFlag(type))
+            file->appendExitPoints((walkerType)type, exitPoints[type].data(),
+                                   exitPoints[type].size());
         //walk times
-        if(photonCounters[type] && walkTimesSaveFlags & walkerTypeToFlag(type))
-            file.appendWalkTimes((walkerType)type, walkTimes[type].data(),
-                                 walkTimes[type].size());
+        if(!walkTimes[type].empty()
+                && walkTimesSaveFlags & walkerTypeToFlag(type))
+            file->appendWalkTimes((walkerType)type, walkTimes[type].data(),
+                                  walkTimes[type].size());
         //exit k vectors
-        if(photonCounters[type]
+        if(!exitKVectors[type].empty()
                 && exitKVectorsSaveFlags & walkerTypeToFlag(type))
-            file.appendExitKVectors((walkerType)type, exitKVectors[type].data(),
-                                    exitKVectors[type].size());
+            file->appendExitKVectors((walkerType)type,
+                                     exitKVectors[type].data(),
+                                     exitKVectors[type].size());
+        if(rawReservoirSize > 0) {
+            u_int64_t kept = std::min(rawSeen[type], rawReservoirSize);
+            file->setSamplingFraction((walkerType)type, rawSeen[type] > 0
+                                      ? (double)kept / rawSeen[type] : 1.);
+        }
     }
+}
 
-    file.close();
+/**
+ * @brief Writes the event counters to the output file
+ */
 
-    logMessage("Data written to %s", outputFile);
+void Simulation::saveStats()
+{
+    H5OutputFile file;
+    if(!file.openFile(outputFile))
+        return;
+    file.saveStats(&_stats);
+    file.close();
 }
 
 void Simulation::describe_impl() const
@@ -977,7 +1401,9 @@ void Simulation::describe_impl() const
 void Simulation::switchToLayer(const uint layer)
 {
     walker.walkTime += totalLengthInCurrentLayer / currentMaterial->v;
+    photonPathLength += totalLengthInCurrentLayer;
     totalLengthInCurrentLayer = 0;
+    _stats.layerSwitches++;
     updateLayerVariables(layer);
 }
 
@@ -1006,13 +1432,66 @@ void Simulation::updateLayerVariables(const uint layer) {
         currLayerUpperBoundary = numeric_limits<MCfloat>::infinity();
 }
 
+/**
+ * @brief Sets up the histograms, summary tallies and exit observers for a
+ * new run
+ */
+
+void Simulation::initializeHistograms()
+{
+    walkerBatch.clearRequirements();
+    for (size_t i = 0; i < hists.size(); ++i) {
+        Histogram *h = hists[i];
+        h->setScale(nPhotons());
+        h->initialize();
+        h->requireColumns(&walkerBatch);
+    }
+    for (size_t i = 0; i < tallies.size(); ++i) {
+        SummaryTally *t = tallies[i];
+        // the tallies of the threads and work units are merged
+        t->initialize(currentSeed());
+        t->requireColumns(&walkerBatch);
+    }
+    for (size_t i = 0; i < observers.size(); ++i) {
+        ExitObserver *o = observers[i];
+        o->initialize();
+        o->requireColumns(&walkerBatch);
+    }
+}
+
+/**
+ * @brief Histograms, tallies and observes the buffered walkers
+ *
+ * The quantities needed by the histograms, tallies and observers are
+ * computed once for all of them, see WalkerBatch.
+ */
+
 void Simulation::flushHistogram()
 {
+    if(!hists.empty() || !tallies.empty() || !observers.empty())
+        walkerBatch.fill(walkerBuf, nBuf);
     for (size_t i = 0; i < hists.size(); ++i) {
         Histogram *h = hists[i];
-        h->run(walkerBuf, nBuf);
+        h->run(walkerBatch);
+    }
+    for (size_t i = 0; i < tallies.size(); ++i) {
+        tallies[i]->run(walkerBatch);
+    }
+    for (size_t i = 0; i < observers.size(); ++i) {
+        observers[i]->observe(walkerBuf, nBuf, walkerBatch);
     }
     nBuf = 0;
+    // once per buffer: the counters are only read at human time scales
+    progressSlot->publishStats(_stats);
+    if(snapshotSlot != NULL) {
+        // keep the shared histograms in step with sharedPhotons
+        for (size_t i = 0; i < hists.size(); ++i) {
+            hists[i]->flushCombiningBuffer();
+        }
+        snapshotSlot->sharedPhotons.store(n, boost::memory_order_release);
+        if(snapshotSlot->requested.load(boost::memory_order_relaxed))
+            snapshotSlot->publish(hists, photonCounters, n);
+    }
 }
 
 void Simulation::setRNG_impl()
@@ -1073,6 +1552,36 @@ void Simulation::addHistogram(Histogram *hist)
     hist->setParent(this);
 }
 
+/**
+ * @brief Adds a summary tally to be computed during the simulation
+ * @param tally
+ *
+ * The simulation is automatically set as the tally's parent. Tallies are fed
+ * the same buffered walkers as the histograms and are saved in the H5 output
+ * file after them, each in a dataset named after the tally.
+ */
+
+void Simulation::addSummaryTally(SummaryTally *tally)
+{
+    tallies.push_back(tally);
+    tally->setParent(this);
+}
+
+/**
+ * @brief Adds a user-defined observer of the exiting photons
+ * @param observer
+ *
+ * The simulation is automatically set as the observer's parent. Observers
+ * are fed the same buffered walkers as the histograms and are saved in the
+ * H5 output file after the tallies; see ExitObserver.
+ */
+
+void Simulation::addExitObserver(ExitObserver *observer)
+{
+    observers.push_back(observer);
+    observer->setParent(this);
+}
+
 /**
  * @brief Enables raw output
  * @param enable
@@ -1088,6 +1597,133 @@ void Simulation::setRawOutputEnabled(bool enable)
     rawOutputEnabled = enable;
 }
 
+/**
+ * @brief Periodically writes the progress of run() as JSON lines
+ * @param monitor
+ *
+ * The simulation is automatically set as the monitor's parent. See
+ * ProgressMonitor for the output format.
+ */
+
+void Simulation::setProgressMonitor(ProgressMonitor *monitor)
+{
+    monitor->setParent(this);
+    this->monitor = monitor;
+}
+
+/**
+ * @brief Enables live output, readable while the simulation is running
+ * @param seconds interval between updates; 0 (the default) disables live
+ * output
+ *
+ * The output file is created with the latest HDF5 file format in SWMR mode.
+ * Every interval the merged histograms and photon counters are written in the
+ * "live" group and the raw output streamed so far is flushed, so that
+ * external readers can open the file concurrently (see RawOutputWriter). The
+ * simulating threads are never blocked: they copy their histograms every
+ * WALKER_BUFSIZE photons, only after a new snapshot has been requested (see
+ * SnapshotSlot).
+ *
+ * With multiple threads, raw output is written to the output file itself
+ * rather than to per-thread shards. The final results are saved as usual
+ * when the simulation completes.
+ */
+
+void Simulation::setLiveOutputInterval(double seconds)
+{
+    liveOutputInterval = seconds;
+}
+
+/**
+ * @brief Sets the interval between updates of the histograms published in
+ * shared memory
+ * @param seconds defaults to SHM_DEFAULT_INTERVAL
+ *
+ * Only histograms with a shared memory name are published, see
+ * Histogram::setSharedMemoryName() and HistogramPublisher. As with live
+ * output, the simulating threads are never blocked.
+ */
+
+void Simulation::setSharedMemoryInterval(double seconds)
+{
+    sharedMemoryInterval = seconds;
+}
+
+/**
+ * @brief Restricts raw output to the photons accepted by the given detector
+ * @param detector
+ *
+ * Photons that are not accepted are still counted in the photon counters, but
+ * their exit points, walk times and k vectors are not stored. This greatly
+ * reduces memory usage and output file size when only a small area or a narrow
+ * acceptance cone is of interest. Histograms are not affected; see
+ * Histogram::setDetector().
+ *
+ * The Simulation takes ownership of the detector, unless the detector already
+ * has a parent. Pass NULL to store all the photons.
+ */
+
+void Simulation::setRawOutputDetector(Detector *detector)
+{
+    if(detector != NULL && detector->parent() == NULL)
+        detector->setParent(this);
+    rawOutputDetector = detector;
+}
+
+/**
+ * @brief Keeps only a uniform random sample of the raw output
+ * @param nPhotons maximum number of photons kept per photon type; 0 (the
+ * default) keeps all the photons
+ *
+ * Rather than being streamed to the output file, the raw output of each
+ * photon type is kept in memory by reservoir sampling, so that memory does not
+ * grow with the number of simulated photons. The reservoirs of the threads
+ * (or of the work units of a SimulationBatch) are merged at the end so that
+ * the result is a uniform sample of all the simulated photons of that type
+ * (see mergeRawReservoir()).
+ *
+ * The raw datasets have the same names as with full raw output; the fraction
+ * of photons kept is recorded in their "sampling-fraction" attribute. A
+ * separate random generator is used for sampling, so that the transport of
+ * the photons is the same with and without the reservoirs. The photons
+ * offered to the reservoirs are those accepted by the raw output detector, if
+ * any.
+ */
+
+void Simulation::setRawOutputReservoirSize(u_int64_t nPhotons)
+{
+    rawReservoirSize = nPhotons;
+}
+
+u_int64_t Simulation::rawOutputReservoirSize() const
+{
+    return rawReservoirSize;
+}
+
+
+/**
+ * @brief Sets chunking, compression and encoding of a group of raw datasets
+ * @param group DATA_POINTS, DATA_TIMES or DATA_K
+ * @param options
+ *
+ * For example, to compress the walk times with shuffle and deflate:
+ * \code
+ * sim->setRawDatasetOptions(DATA_TIMES, RawDatasetOptions(65536, 4, true));
+ * \endcode
+ * or to store the exit k vectors in 4 bytes per photon:
+ * \code
+ * sim->setRawDatasetOptions(DATA_K, RawDatasetOptions(
+ *     RAW_DEFAULT_CHUNK_PHOTONS, 0, false, RAW_ENCODING_OCTAHEDRAL));
+ * \endcode
+ */
+
+void Simulation::setRawDatasetOptions(MCData group,
+                                      const RawDatasetOptions &options)
+{
+    if(group == DATA_NONE || group > DATA_TIMES)
+        return;
+    rawDatasetOptions[group] = options;
+}
 
 void Simulation::setWalkTimesSaveFlags(unsigned int value)
 {
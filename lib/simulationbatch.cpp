@@ -0,0 +1,439 @@
+/*
+  This file is part of MCPlusPlus.
+
+  MCPlusPlus is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Mcplusplus is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with MCPlusPlus.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <MCPlusPlus/simulationbatch.h>
+#include <MCPlusPlus/h5outputfile.h>
+
+#include <signal.h>
+#include <boost/thread.hpp>
+#include <boost/bind.hpp>
+
+using namespace MCPP;
+
+#define BATCH_SIGNAL_POLL_MS 100
+
+// set by the handler, polled by SimulationBatch::run()
+static volatile sig_atomic_t batchSigTermReceived = 0;
+
+void batchSigTermHandler(int sig, siginfo_t *siginfo, void *context) {
+    batchSigTermReceived = 1;
+}
+
+void installBatchSigTermHandler(struct sigaction *oldAction) {
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_sigaction = batchSigTermHandler;
+    sa.sa_flags = SA_SIGINFO;
+    sigaction(SIGTERM, &sa, oldAction);
+}
+
+SimulationBatch::SimulationBatch(BaseObject *parent) :
+    BaseObject(parent)
+{
+    _nThreads = 1;
+    _chunkSize = BATCH_DEFAULT_CHUNK_SIZE;
+    outputFile = NULL;
+    nextUnit = 0;
+    forceTermination = false;
+}
+
+SimulationBatch::~SimulationBatch()
+{
+    for (size_t i = 0; i < configs.size(); ++i) {
+        delete configs[i];
+    }
+    if(outputFile != NULL)
+        free(outputFile);
+}
+
+/**
+ * @brief Adds a configuration to the batch
+ * @param sim a fully set up Simulation
+ * @param groupName the name of the group the results are saved into. Defaults
+ * to "simulation-N", where N is the index of the configuration.
+ *
+ * The batch is automatically set as the simulation's parent.
+ */
+
+void SimulationBatch::addSimulation(Simulation *sim, const char *groupName)
+{
+    Configuration *cfg = new Configuration();
+    cfg->sim = sim;
+    if(groupName != NULL)
+        cfg->groupName = groupName;
+    else {
+        stringstream ss;
+        ss << "simulation-" << configs.size();
+        cfg->groupName = ss.str();
+    }
+    cfg->nUnits = 0;
+    cfg->unitsDone = 0;
+    cfg->saved = false;
+    configs.push_back(cfg);
+    sim->setParent(this);
+}
+
+size_t SimulationBatch::nSimulations() const
+{
+    return configs.size();
+}
+
+/**
+ * @brief Sets the number of threads in the pool shared by all the
+ * configurations
+ * @param value
+ */
+
+void SimulationBatch::setNThreads(unsigned int value)
+{
+    _nThreads = value;
+}
+
+unsigned int SimulationBatch::nThreads() const
+{
+    return _nThreads;
+}
+
+/**
+ * @brief Sets the maximum number of photons simulated by a single work unit
+ * @param nPhotons
+ *
+ * Smaller chunks improve load balancing at the end of the batch, at the cost
+ * of some overhead for each work unit (cloning the simulation, merging
+ * histograms and writing raw output). Defaults to BATCH_DEFAULT_CHUNK_SIZE.
+ */
+
+void SimulationBatch::setChunkSize(u_int64_t nPhotons)
+{
+    _chunkSize = nPhotons;
+}
+
+u_int64_t SimulationBatch::chunkSize() const
+{
+    return _chunkSize;
+}
+
+void SimulationBatch::setOutputFileName(const char *name)
+{
+    copyToInternalVariable(&outputFile, name);
+}
+
+/**
+ * @brief Runs all the configurations of the batch
+ *
+ * Configurations failing the sanity check are skipped. The function returns
+ * when all the work units have been completed and saved.
+ */
+
+void SimulationBatch::run()
+{
+    if(outputFile == NULL) {
+        logMessage("No output file name provided. Aborting.");
+        return;
+    }
+    if(access(outputFile, F_OK) >= 0) {
+        logMessage("File %s already exists. Aborting.", outputFile);
+        return;
+    }
+    if(!sanityCheck())
+        return;
+
+    time_t startTime, now;
+    time(&startTime);
+
+    H5FileHelper *helper = new H5FileHelper();
+    bool ok = helper->newFile(outputFile);
+    delete helper;
+    if(!ok)
+        return;
+
+    forceTermination = false;
+    prepareConfigurations();
+
+    logMessage("starting... %lu simulations, %lu work units, %u threads",
+               configs.size(), units.size(), _nThreads);
+
+    running.assign(_nThreads, NULL);
+    nextUnit = 0;
+
+    // the handler only sets a flag: this thread polls it while waiting for
+    // the workers and terminates the batch
+    struct sigaction oldSigTermAction;
+    batchSigTermReceived = 0;
+    installBatchSigTermHandler(&oldSigTermAction);
+    boost::thread_group threads;
+    vector<boost::thread *> workers;
+    for (unsigned int i = 0; i < _nThreads; ++i) {
+        workers.push_back(threads.create_thread(
+                    boost::bind(&SimulationBatch::processWorkUnits, this, i)));
+    }
+    const boost::posix_time::milliseconds poll(BATCH_SIGNAL_POLL_MS);
+    for (size_t i = 0; i < workers.size(); ++i) {
+        while(!workers[i]->timed_join(poll)) {
+            if(batchSigTermReceived) {
+                batchSigTermReceived = 0;
+                logMessage("SIGTERM received... terminating the batch");
+                terminate();
+            }
+        }
+    }
+    sigaction(SIGTERM, &oldSigTermAction, NULL);
+
+    // if terminated, save whatever was simulated
+    for (size_t i = 0; i < configs.size(); ++i) {
+        Configuration *cfg = configs[i];
+        if(cfg->nUnits > 0 && !cfg->saved)
+            saveConfiguration(cfg);
+        cfg->sim->layerTables.reset();
+    }
+
+    time(&now);
+    logMessage("Batch completed in %.f seconds. Data written to %s",
+               difftime(now, startTime), outputFile);
+}
+
+/**
+ * @brief Gracefully terminates the batch
+ *
+ * Running work units are terminated as in Simulation::terminate(), pending
+ * work units are skipped. The results simulated up to that moment are saved.
+ *
+ * This is also triggered by sending the TERM signal to the process running
+ * the batch.
+ */
+
+void SimulationBatch::terminate()
+{
+    boost::mutex::scoped_lock lock(scheduleMutex);
+    forceTermination = true;
+    for (size_t i = 0; i < running.size(); ++i) {
+        if(running[i] != NULL)
+            running[i]->terminate();
+    }
+}
+
+/**
+ * @brief Print progress information
+ */
+
+void SimulationBatch::reportProgress() const
+{
+    boost::mutex::scoped_lock lock(scheduleMutex);
+    size_t completed = 0;
+    for (size_t i = 0; i < configs.size(); ++i) {
+        if(configs[i]->saved)
+            completed++;
+    }
+    logMessage("progress = %.1lf%% (%lu / %lu work units started), "
+               "%lu / %lu simulations completed",
+               units.size() ? 100. * nextUnit / units.size() : 0.,
+               nextUnit, units.size(), completed, configs.size());
+}
+
+/**
+ * @brief Sets up the configurations and splits them into work units
+ *
+ * Layer tables are computed here, once per configuration, and shared between
+ * configurations when possible.
+ */
+
+void SimulationBatch::prepareConfigurations()
+{
+    vector<boost::shared_ptr<const LayerTables> > tables;
+    units.clear();
+
+    for (size_t i = 0; i < configs.size(); ++i) {
+        Configuration *cfg = configs[i];
+        Simulation *sim = cfg->sim;
+        cfg->nUnits = 0;
+        cfg->unitsDone = 0;
+        cfg->saved = false;
+
+        if(!sim->sanityCheck()) {
+            logMessage("Skipping simulation %s", cfg->groupName.c_str());
+            continue;
+        }
+
+        sim->clear();
+        sim->initializeHistograms();
+
+        sim->layerTables.reset();
+        for (size_t j = 0; j < tables.size(); ++j) {
+            if(tables[j]->matches(sim->_sample, sim->source,
+                                  sim->timeOriginZ)) {
+                sim->layerTables = tables[j];
+                break;
+            }
+        }
+        if(!sim->layerTables) {
+            sim->layerTables.reset(new LayerTables(sim->_sample, sim->source,
+                                                   sim->timeOriginZ));
+            tables.push_back(sim->layerTables);
+        }
+
+        u_int64_t remaining = sim->nPhotons();
+        u_int64_t index = 0;
+        while(remaining > 0) {
+            WorkUnit unit;
+            unit.config = i;
+            unit.index = index++;
+            unit.nPhotons = min(remaining, _chunkSize);
+            units.push_back(unit);
+            remaining -= unit.nPhotons;
+        }
+        cfg->nUnits = index;
+
+        H5OutputFile file;
+        file.openFile(outputFile);
+        sim->configureOutputFile(&file);
+        file.openRootGroup(cfg->groupName.c_str(), sim->rawOutputEnabled);
+        file.close();
+    }
+}
+
+void SimulationBatch::processWorkUnits(unsigned int slot)
+{
+    while(true) {
+        WorkUnit unit;
+        Simulation *sim;
+        {
+            // Simulation's constructor and destructor are not reentrant
+            boost::mutex::scoped_lock lock(scheduleMutex);
+            if(forceTermination || nextUnit == units.size())
+                return;
+            unit = units[nextUnit++];
+            sim = createUnitSimulation(unit);
+            running[slot] = sim;
+        }
+
+        sim->initializeHistograms();
+        bool ok = sim->runSingleThread();
+
+        {
+            boost::mutex::scoped_lock lock(scheduleMutex);
+            running[slot] = NULL;
+        }
+
+        if(ok)
+            mergeWorkUnit(unit, sim);
+
+        boost::mutex::scoped_lock lock(scheduleMutex);
+        delete sim;
+    }
+}
+
+Simulation *SimulationBatch::createUnitSimulation(const WorkUnit &unit) const
+{
+    const Simulation *parentSim = configs[unit.config]->sim;
+    Simulation *sim = (Simulation *)parentSim->clone();
+    sim->setNPhotons(unit.nPhotons);
+    sim->setSeed(parentSim->currentSeed() + unit.index);
+    if(unit.index < parentSim->multipleRNGStates.size())
+        sim->setGeneratorState(parentSim->multipleRNGStates[unit.index]);
+    return sim;
+}
+
+/**
+ * @brief Merges the results of a completed work unit into its configuration
+ * @param unit
+ * @param unitSim
+ *
+ * Raw output is written right away, unless it is sampled by reservoirs (see
+ * Simulation::setRawOutputReservoirSize()), which are merged into those of
+ * the configuration. When the last work unit of a configuration is merged,
+ * the configuration's histograms and reservoirs are saved too.
+ */
+
+void SimulationBatch::mergeWorkUnit(const WorkUnit &unit, Simulation *unitSim)
+{
+    Configuration *cfg = configs[unit.config];
+
+    {
+        boost::mutex::scoped_lock lock(fileMutex);
+        H5OutputFile file;
+        file.openFile(outputFile);
+        file.openRootGroup(cfg->groupName.c_str(),
+                           unitSim->rawOutputEnabled);
+        unitSim->writeRawOutput(&file);
+        file.close();
+    }
+
+    bool last = false;
+    {
+        boost::mutex::scoped_lock lock(cfg->mutex);
+        Simulation *sim = cfg->sim;
+        for (uint i = 0; i < 4; ++i) {
+            sim->photonCounters[i] += unitSim->photonCounters[i];
+        }
+        sim->_stats.merge(unitSim->_stats);
+        for (size_t i = 0; i < sim->hists.size(); ++i) {
+            sim->hists[i]->appendCounts(unitSim->hists[i]);
+        }
+        for (size_t i = 0; i < sim->tallies.size(); ++i) {
+            sim->tallies[i]->append(unitSim->tallies[i]);
+        }
+        for (size_t i = 0; i < sim->observers.size(); ++i) {
+            sim->observers[i]->merge(unitSim->observers[i]);
+        }
+        if(sim->rawReservoirSize > 0)
+            sim->mergeRawReservoir(unitSim);
+        cfg->unitsDone++;
+        last = cfg->unitsDone == cfg->nUnits;
+    }
+
+    if(last)
+        saveConfiguration(cfg);
+}
+
+void SimulationBatch::saveConfiguration(Configuration *cfg)
+{
+    boost::mutex::scoped_lock lock(fileMutex);
+    Simulation *sim = cfg->sim;
+    for (size_t i = 0; i < sim->hists.size(); ++i) {
+        sim->hists[i]->saveToFile(outputFile, cfg->groupName.c_str());
+    }
+    for (size_t i = 0; i < sim->tallies.size(); ++i) {
+        sim->tallies[i]->saveToFile(outputFile, cfg->groupName.c_str());
+    }
+    for (size_t i = 0; i < sim->observers.size(); ++i) {
+        sim->observers[i]->saveToFile(outputFile, cfg->groupName.c_str());
+    }
+    H5OutputFile file;
+    file.openFile(outputFile);
+    file.openRootGroup(cfg->groupName.c_str(), sim->rawOutputEnabled);
+    file.saveStats(&sim->_stats);
+    if(sim->rawOutputEnabled && sim->rawReservoirSize > 0)
+        sim->writeRawDatasets(&file);
+    file.close();
+    cfg->saved = true;
+
+    stringstream stream;
+    for (uint i = 0; i < 4; ++i) {
+        stream << "\t" << walkerTypeToString(i) << ": "
+               << sim->photonCounters[i];
+    }
+    logMessage("Simulation %s completed (%lu / %lu work units)%s",
+               cfg->groupName.c_str(), cfg->unitsDone, cfg->nUnits,
+               stream.str().c_str());
+}
+
+bool SimulationBatch::sanityCheck_impl() const
+{
+    if(_nThreads == 0 || _chunkSize == 0)
+        return false;
+    return true;
+}
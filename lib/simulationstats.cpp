@@ -0,0 +1,77 @@
+/*
+  This file is part of MCPlusPlus.
+
+  MCPlusPlus is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Mcplusplus is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with MCPlusPlus.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <MCPlusPlus/simulationstats.h>
+
+#include <cstring>
+#include <cstdio>
+
+using namespace MCPP;
+
+SimulationStats::SimulationStats()
+{
+    clear();
+}
+
+void SimulationStats::clear()
+{
+    nPhotons = 0;
+    totalSteps = 0;
+    scatteringEvents = 0;
+    interfaceHits = 0;
+    reflections = 0;
+    refractions = 0;
+    TIREvents = 0;
+    layerSwitches = 0;
+    memset(stepsHisto, 0, STATS_LOG2_BINS * sizeof(u_int64_t));
+    memset(pathLengthHisto, 0, STATS_LOG2_BINS * sizeof(u_int64_t));
+}
+
+void SimulationStats::merge(const SimulationStats &rhs)
+{
+    nPhotons += rhs.nPhotons;
+    totalSteps += rhs.totalSteps;
+    scatteringEvents += rhs.scatteringEvents;
+    interfaceHits += rhs.interfaceHits;
+    reflections += rhs.reflections;
+    refractions += rhs.refractions;
+    TIREvents += rhs.TIREvents;
+    layerSwitches += rhs.layerSwitches;
+    for (uint i = 0; i < STATS_LOG2_BINS; ++i) {
+        stepsHisto[i] += rhs.stepsHisto[i];
+        pathLengthHisto[i] += rhs.pathLengthHisto[i];
+    }
+}
+
+/**
+ * @brief A one line summary of the counters, normalized to the number of
+ * photons
+ * @return
+ */
+
+string SimulationStats::toString() const
+{
+    double N = nPhotons > 0 ? nPhotons : 1;
+    char buffer[256];
+    snprintf(buffer, 256, "per photon: steps = %.2lf, scatterings = %.2lf, "
+             "interface hits = %.2lf, reflections = %.2lf (TIR = %.2lf), "
+             "refractions = %.2lf, layer switches = %.2lf",
+             totalSteps / N, scatteringEvents / N, interfaceHits / N,
+             reflections / N, TIREvents / N, refractions / N,
+             layerSwitches / N);
+    return string(buffer);
+}
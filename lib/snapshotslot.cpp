@@ -0,0 +1,161 @@
+/*
+  This file is part of MCPlusPlus.
+
+  MCPlusPlus is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Mcplusplus is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with MCPlusPlus.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <MCPlusPlus/snapshotslot.h>
+
+#include <string.h>
+
+using namespace MCPP;
+
+static vector<Histogram *> cloneAll(const vector<Histogram *> &hists)
+{
+    vector<Histogram *> clones;
+    for (size_t i = 0; i < hists.size(); ++i) {
+        Histogram *h = (Histogram *)hists[i]->clone();
+        h->initialize();
+        clones.push_back(h);
+    }
+    return clones;
+}
+
+SnapshotSlot::SnapshotSlot()
+{
+    requested.store(true, boost::memory_order_relaxed);
+    sharedPhotons.store(0, boost::memory_order_relaxed);
+    memset(photonCounters, 0, 4 * sizeof(u_int64_t));
+    photons = 0;
+}
+
+SnapshotSlot::~SnapshotSlot()
+{
+    for (size_t i = 0; i < hists.size(); ++i) {
+        delete hists[i];
+    }
+}
+
+/**
+ * @brief Allocates a copy of the given (initialized) histograms
+ * @param hists
+ */
+
+void SnapshotSlot::initialize(const vector<Histogram *> &hists)
+{
+    this->hists = cloneAll(hists);
+    sources.assign(hists.begin(), hists.end());
+}
+
+/**
+ * @brief Allocates a new set of empty histograms with the same layout as the
+ * ones of the slot
+ * @return the histograms, owned by the caller
+ */
+
+vector<Histogram *> SnapshotSlot::cloneHistograms() const
+{
+    return cloneAll(hists);
+}
+
+/**
+ * @brief Copies the given histograms and photon counters into the slot
+ * @param hists the histograms of the simulating thread, with the same layout
+ * as the ones given to initialize()
+ * @param photonCounters
+ * @param photons number of photons the histograms refer to
+ * @param wait if false, nothing is copied when merge() is reading the slot
+ * @return true if the slot has been updated
+ *
+ * Called by the simulating thread. When the copy is skipped the request is
+ * left pending, so that it is retried at the next call.
+ */
+
+bool SnapshotSlot::publish(const vector<Histogram *> &hists,
+                           const u_int64_t *photonCounters,
+                           const u_int64_t photons, const bool wait)
+{
+    boost::mutex::scoped_lock lock(mutex, boost::defer_lock);
+    if(wait)
+        lock.lock();
+    else if(!lock.try_lock())
+        return false;
+    for (size_t i = 0; i < hists.size(); ++i) {
+        this->hists[i]->clearCounts();
+        this->hists[i]->appendCounts(hists[i]);
+    }
+    memcpy(this->photonCounters, photonCounters, 4 * sizeof(u_int64_t));
+    this->photons = photons;
+    requested.store(false, boost::memory_order_relaxed);
+    return true;
+}
+
+/**
+ * @brief Merges the current content of the given slots and requests a new
+ * copy from every slot
+ * @param slots
+ * @param nSlots
+ * @param dest histograms with the same layout as the ones of the slots (see
+ * cloneHistograms()), overwritten with the merged counts
+ * @param photonCounters overwritten with the merged photon counters
+ * @param histPhotons overwritten with the number of photons each of the
+ * merged histograms refers to
+ * @return the number of photons of the merged copies of the slots
+ *
+ * The counts of shared histograms are more recent than the copies. They are
+ * read before the photons of sharedPhotons, so that they refer to at most
+ * WALKER_BUFSIZE photons less per thread than reported.
+ */
+
+u_int64_t SnapshotSlot::merge(SnapshotSlot *slots, const unsigned int nSlots,
+                              const vector<Histogram *> &dest,
+                              u_int64_t *photonCounters,
+                              vector<u_int64_t> *histPhotons)
+{
+    u_int64_t photons = 0;
+    memset(photonCounters, 0, 4 * sizeof(u_int64_t));
+    for (size_t i = 0; i < dest.size(); ++i) {
+        dest[i]->clearCounts();
+    }
+    for (unsigned int n = 0; n < nSlots; ++n) {
+        SnapshotSlot *slot = &slots[n];
+        boost::mutex::scoped_lock lock(slot->mutex);
+        for (size_t i = 0; i < dest.size(); ++i) {
+            dest[i]->appendCounts(slot->hists[i]);
+        }
+        for (uint i = 0; i < 4; ++i) {
+            photonCounters[i] += slot->photonCounters[i];
+        }
+        photons += slot->photons;
+        slot->requested.store(true, boost::memory_order_relaxed);
+    }
+    // the counts of shared histograms are not in the slots
+    bool shared = false;
+    for (size_t i = 0; nSlots > 0 && i < dest.size(); ++i) {
+        if(slots[0].sources[i]->sharing) {
+            dest[i]->appendCounts(slots[0].sources[i]);
+            shared = true;
+        }
+    }
+    u_int64_t sharedPhotons = 0;
+    for (unsigned int n = 0; shared && n < nSlots; ++n) {
+        sharedPhotons += slots[n].sharedPhotons.load(
+                    boost::memory_order_acquire);
+    }
+    histPhotons->assign(dest.size(), photons);
+    for (size_t i = 0; shared && i < dest.size(); ++i) {
+        if(slots[0].sources[i]->sharing)
+            (*histPhotons)[i] = sharedPhotons;
+    }
+    return photons;
+}
@@ -0,0 +1,463 @@
+/*
+  This file is part of MCPlusPlus.
+
+  MCPlusPlus is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Mcplusplus is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with MCPlusPlus.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <MCPlusPlus/summarytally.h>
+
+#include <cmath>
+#include <limits>
+
+using namespace MCPP;
+
+SummaryTally::SummaryTally(BaseObject *parent) :
+    BaseObject(parent)
+{
+    type = DATA_NONE;
+    photonTypeFlags = -1;
+    _detector = NULL;
+    k = KLL_DEFAULT_K;
+    tallyName = "";
+
+    const double defaultQuantiles[] = {0.01, 0.05, 0.5, 0.95, 0.99};
+    _quantiles.assign(defaultQuantiles, defaultQuantiles + 5);
+    clear();
+}
+
+SummaryTally::~SummaryTally()
+{
+}
+
+/**
+ * @brief Sets the observable to be summarized
+ * @param type one of DATA_TIMES, DATA_POINTS (exit radius), DATA_K (exit
+ * angle, in degrees), DATA_COS_THETA and DATA_AZIMUTH (in degrees)
+ */
+
+void SummaryTally::setDataDomain(const MCData type)
+{
+    this->type = type;
+}
+
+MCData SummaryTally::dataDomain() const
+{
+    return type;
+}
+
+void SummaryTally::setPhotonTypeFlags(int value)
+{
+    photonTypeFlags = value;
+}
+
+/**
+ * @brief Restricts the tallied photons to those accepted by the given
+ * detector
+ * @param detector
+ *
+ * The SummaryTally takes ownership of the detector, unless the detector
+ * already has a parent. Pass NULL to tally all the photons of the selected
+ * types.
+ */
+
+void SummaryTally::setDetector(Detector *detector)
+{
+    if(detector != NULL && detector->parent() == NULL)
+        detector->setParent(this);
+    _detector = detector;
+}
+
+const Detector *SummaryTally::detector() const
+{
+    return _detector;
+}
+
+/**
+ * @brief Sets the quantiles to be estimated and saved
+ * @param q fractions between 0 and 1, e.g. 0.5 for the median
+ */
+
+void SummaryTally::setQuantiles(const vector<double> &q)
+{
+    _quantiles = q;
+}
+
+vector<double> SummaryTally::quantiles() const
+{
+    return _quantiles;
+}
+
+/**
+ * @brief Sets the size \f$ k \f$ of the quantile sketches
+ * @param k
+ *
+ * Larger sketches are more accurate, see KLLSketch. Defaults to
+ * KLL_DEFAULT_K. Clears the tally.
+ */
+
+void SummaryTally::setSketchSize(const uint k)
+{
+    this->k = k;
+    clear();
+}
+
+uint SummaryTally::sketchSize() const
+{
+    return k;
+}
+
+void SummaryTally::setName(const char *name)
+{
+    tallyName = name;
+}
+
+/**
+ * @brief Name of the dataset the tally is saved into
+ * @return the name set with setName(), or "summary"
+ */
+
+string SummaryTally::name() const
+{
+    return tallyName.empty() ? "summary" : tallyName;
+}
+
+/**
+ * @brief Sets up the tally for a new run, clearing the accumulated data
+ * @param seed seed of the quantile sketches, see KLLSketch::setSeed()
+ *
+ * Tallies that are going to be merged, e.g. those of different threads,
+ * should be given different seeds.
+ */
+
+bool SummaryTally::initialize(const uint seed)
+{
+    if(!sanityCheck())
+        return false;
+    clear();
+    for (uint t = 0; t < 4; ++t) {
+        sketches[t].setSeed(seed);
+    }
+    return true;
+}
+
+/**
+ * @brief Registers the column of the observable with the given batch
+ * @param batch
+ */
+
+void SummaryTally::requireColumns(WalkerBatch *batch) const
+{
+    switch(type) {
+    case DATA_K:
+        batch->require(COLUMN_ANGLES);
+        break;
+    case DATA_POINTS:
+        batch->require(COLUMN_RADII);
+        break;
+    case DATA_TIMES:
+        batch->require(COLUMN_TIMES);
+        break;
+    case DATA_COS_THETA:
+        batch->require(COLUMN_COSINES);
+        break;
+    case DATA_AZIMUTH:
+        batch->require(COLUMN_AZIMUTHS);
+        break;
+    default:
+        break;
+    }
+}
+
+const MCfloat *SummaryTally::column(const WalkerBatch &batch) const
+{
+    switch(type) {
+    case DATA_K:
+        return batch.angles();
+    case DATA_POINTS:
+        return batch.radii();
+    case DATA_TIMES:
+        return batch.times();
+    case DATA_COS_THETA:
+        return batch.cosines();
+    case DATA_AZIMUTH:
+        return batch.azimuths();
+    default:
+        return NULL;
+    }
+}
+
+/**
+ * @brief Tallies the walkers of the given batch
+ * @param batch
+ *
+ * The moments of the rows of each type are computed in two passes over the
+ * contiguous column, then merged into the running moments.
+ */
+
+void SummaryTally::run(const WalkerBatch &batch)
+{
+    const MCfloat *col = column(batch);
+    if(col == NULL)
+        return;
+    for (uint t = 0; t < 4; ++t) {
+        if(!(photonTypeFlags & (1 << t)))
+            continue;
+        const MCfloat *x = col + batch.begin(t);
+        size_t n = batch.end(t) - batch.begin(t);
+        if(_detector != NULL) {
+            selected.clear();
+            for (size_t r = batch.begin(t); r < batch.end(t); ++r) {
+                if(_detector->accept(batch.walker(r)))
+                    selected.push_back(col[r]);
+            }
+            x = selected.empty() ? NULL : &selected[0];
+            n = selected.size();
+        }
+        if(n == 0)
+            continue;
+
+        Moments m;
+        double sum = 0;
+        for (size_t i = 0; i < n; ++i)
+            sum += x[i];
+        m.n = n;
+        m.mean = sum / n;
+        m.m2 = 0;
+        for (size_t i = 0; i < n; ++i) {
+            const double d = x[i] - m.mean;
+            m.m2 += d * d;
+        }
+        merge(moments[t], m);
+
+        KLLSketch &s = sketches[t];
+        for (size_t i = 0; i < n; ++i)
+            s.update(x[i]);
+    }
+}
+
+/**
+ * @brief Merges the data of another tally with the same settings
+ * @param rhs
+ */
+
+void SummaryTally::append(const SummaryTally *rhs)
+{
+    for (uint t = 0; t < 4; ++t) {
+        merge(moments[t], rhs->moments[t]);
+        sketches[t].merge(rhs->sketches[t]);
+    }
+}
+
+void SummaryTally::clear()
+{
+    for (uint t = 0; t < 4; ++t) {
+        moments[t].n = 0;
+        moments[t].mean = 0;
+        moments[t].m2 = 0;
+        sketches[t].setK(k);
+    }
+}
+
+/**
+ * @brief Number of tallied photons of the given #walkerType
+ */
+
+u_int64_t SummaryTally::count(const uint type) const
+{
+    return moments[type].n;
+}
+
+/**
+ * @brief Mean of the observable for the given #walkerType, or NaN if no
+ * photon was tallied
+ */
+
+double SummaryTally::mean(const uint type) const
+{
+    if(moments[type].n == 0)
+        return numeric_limits<double>::quiet_NaN();
+    return moments[type].mean;
+}
+
+/**
+ * @brief Unbiased sample variance of the observable for the given
+ * #walkerType, or NaN if less than two photons were tallied
+ */
+
+double SummaryTally::variance(const uint type) const
+{
+    if(moments[type].n < 2)
+        return numeric_limits<double>::quiet_NaN();
+    return moments[type].m2 / (moments[type].n - 1);
+}
+
+double SummaryTally::min(const uint type) const
+{
+    if(moments[type].n == 0)
+        return numeric_limits<double>::quiet_NaN();
+    return sketches[type].min();
+}
+
+double SummaryTally::max(const uint type) const
+{
+    if(moments[type].n == 0)
+        return numeric_limits<double>::quiet_NaN();
+    return sketches[type].max();
+}
+
+/**
+ * @brief Estimated quantile of the observable for the given #walkerType
+ * @param type
+ * @param q fraction between 0 and 1
+ */
+
+double SummaryTally::quantile(const uint type, const double q) const
+{
+    return sketches[type].quantile(q);
+}
+
+/**
+ * @brief Saves the tally in the given H5 file
+ * @param fileName
+ * @param groupName if not NULL, the dataset is created within this (existing)
+ * group
+ */
+
+void SummaryTally::saveToFile(const char *fileName,
+                              const char *groupName) const
+{
+    string _dsName = name();
+    if(groupName != NULL)
+        _dsName = string(groupName) + "/" + _dsName;
+    H5FileHelper *file = new H5FileHelper(0);
+    if(access(fileName, F_OK)<0)
+        file->newFile(fileName);
+    else
+        file->openFile(fileName);
+    writeDataset(file, _dsName.c_str());
+    file->close();
+    delete file;
+}
+
+/**
+ * @brief Writes the tally in a new dataset of the given file
+ * @param file
+ * @param datasetName
+ *
+ * The dataset has a row per #walkerType and the columns "type", "count",
+ * "mean", "variance", "min", "max" followed by a column per quantile, named
+ * after the quantile (e.g. "q-0.95"). Rows of types that were not tallied
+ * have zero count and NaN values.
+ */
+
+void SummaryTally::writeDataset(H5FileHelper *file,
+                                const char *datasetName) const
+{
+    const uint ncols = 6 + _quantiles.size();
+    hsize_t dims[2] = {4, ncols};
+    if(!file->newDataset(datasetName, 2, dims))
+        return;
+
+    string colNames[ncols];
+    colNames[0] = "type";
+    colNames[1] = "count";
+    colNames[2] = "mean";
+    colNames[3] = "variance";
+    colNames[4] = "min";
+    colNames[5] = "max";
+    for (size_t j = 0; j < _quantiles.size(); ++j) {
+        stringstream ss;
+        ss << "q-" << _quantiles[j];
+        colNames[6 + j] = ss.str();
+    }
+
+    vector<double> data(4 * ncols);
+    for (uint t = 0; t < 4; ++t) {
+        double *row = &data[t * ncols];
+        row[0] = t;
+        row[1] = count(t);
+        row[2] = mean(t);
+        row[3] = variance(t);
+        row[4] = min(t);
+        row[5] = max(t);
+        for (size_t j = 0; j < _quantiles.size(); ++j)
+            row[6 + j] = quantile(t, _quantiles[j]);
+    }
+
+    hsize_t start[2] = {0, 0};
+    file->writeHyperSlabDouble(start, dims, &data[0]);
+    file->writeColumnNames(ncols, colNames);
+    file->closeDataSet();
+}
+
+/**
+ * @brief Chan's formula for the moments of the union of two samples
+ */
+
+void SummaryTally::merge(Moments &lhs, const Moments &rhs)
+{
+    if(rhs.n == 0)
+        return;
+    if(lhs.n == 0) {
+        lhs = rhs;
+        return;
+    }
+    const u_int64_t n = lhs.n + rhs.n;
+    const double delta = rhs.mean - lhs.mean;
+    lhs.mean += delta * rhs.n / n;
+    lhs.m2 += rhs.m2 + delta * delta * ((double)lhs.n * rhs.n / n);
+    lhs.n = n;
+}
+
+bool SummaryTally::sanityCheck_impl() const
+{
+    if(photonTypeFlags < 0)
+        return false;
+    if(_detector != NULL && !_detector->sanityCheck())
+        return false;
+    switch(type) {
+    case DATA_K:
+    case DATA_POINTS:
+    case DATA_TIMES:
+    case DATA_COS_THETA:
+    case DATA_AZIMUTH:
+        break;
+    default:
+        return false;
+    }
+    for (size_t j = 0; j < _quantiles.size(); ++j) {
+        if(!(_quantiles[j] >= 0 && _quantiles[j] <= 1))
+            return false;
+    }
+    return true;
+}
+
+BaseObject *SummaryTally::clone_impl() const
+{
+    SummaryTally *s = new SummaryTally(NULL);
+    s->type = type;
+    s->photonTypeFlags = photonTypeFlags;
+    s->_quantiles = _quantiles;
+    s->tallyName = tallyName;
+    s->setSketchSize(k);
+    if(_detector != NULL)
+        s->setDetector((Detector *)_detector->clone());
+    return s;
+}
+
+void SummaryTally::describe_impl() const
+{
+    logMessage("name = %s, %lu quantiles, sketch size = %u",
+               name().c_str(), _quantiles.size(), k);
+}
@@ -0,0 +1,211 @@
+/*
+  This file is part of MCPlusPlus.
+
+  MCPlusPlus is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Mcplusplus is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with MCPlusPlus.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <MCPlusPlus/tiledcounts.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+using namespace MCPP;
+
+TiledCounts::TiledCounts(const uint64_t nBins)
+{
+    _nBins = nBins;
+    Tile empty = {NULL, NULL};
+    tiles.assign((nBins + TILE_BINS - 1) >> TILE_SHIFT, empty);
+}
+
+TiledCounts::~TiledCounts()
+{
+    for (size_t i = 0; i < tiles.size(); ++i) {
+        free(tiles[i].c32);
+        free(tiles[i].c64);
+    }
+}
+
+uint64_t TiledCounts::count(const uint64_t bin) const
+{
+    const Tile &t = tiles[bin >> TILE_SHIFT];
+    const size_t offset = bin & (TILE_BINS - 1);
+    if(t.c64 != NULL)
+        return t.c64[offset];
+    if(t.c32 != NULL)
+        return t.c32[offset];
+    return 0;
+}
+
+/**
+ * @brief Adds the given value to a bin
+ * @param bin
+ * @param value
+ */
+
+void TiledCounts::add(const uint64_t bin, const uint64_t value)
+{
+    if(value == 0)
+        return;
+    Tile &t = tiles[bin >> TILE_SHIFT];
+    const size_t offset = bin & (TILE_BINS - 1);
+    if(t.c64 == NULL) {
+        if(t.c32 == NULL)
+            allocate(t);
+        if(t.c32[offset] + value <= UINT32_MAX) {
+            t.c32[offset] += value;
+            return;
+        }
+        promote(t);
+    }
+    t.c64[offset] += value;
+}
+
+/**
+ * @brief Adds the counts of another array with the same number of bins
+ * @param rhs
+ *
+ * Only the tiles allocated in rhs are visited.
+ */
+
+void TiledCounts::add(const TiledCounts *rhs)
+{
+    for (size_t i = 0; i < tiles.size(); ++i) {
+        addTile(rhs, i);
+    }
+}
+
+/**
+ * @brief Adds the counts of a single tile of another array with the same
+ * number of bins
+ * @param rhs
+ * @param tile
+ */
+
+void TiledCounts::addTile(const TiledCounts *rhs, const size_t tile)
+{
+    const Tile &r = rhs->tiles[tile];
+    if(r.c32 == NULL && r.c64 == NULL)
+        return;
+    const uint64_t first = (uint64_t)tile << TILE_SHIFT;
+    const size_t size = tileSize(tile);
+    for (size_t j = 0; j < size; ++j) {
+        add(first + j, r.c64 != NULL ? r.c64[j] : r.c32[j]);
+    }
+}
+
+size_t TiledCounts::nTiles() const
+{
+    return tiles.size();
+}
+
+/**
+ * @brief Whether the given tile is allocated, i.e. might hold nonzero counts
+ */
+
+bool TiledCounts::allocated(const size_t tile) const
+{
+    return tiles[tile].c32 != NULL || tiles[tile].c64 != NULL;
+}
+
+/**
+ * @brief Adds the counts to a dense array of nBins() counters
+ * @param dest
+ */
+
+void TiledCounts::addTo(uint64_t *dest) const
+{
+    for (size_t i = 0; i < tiles.size(); ++i) {
+        addTileTo(dest, i);
+    }
+}
+
+/**
+ * @brief Adds the counts of a single tile to a dense array of nBins()
+ * counters
+ * @param dest
+ * @param tile
+ */
+
+void TiledCounts::addTileTo(uint64_t *dest, const size_t tile) const
+{
+    const Tile &t = tiles[tile];
+    if(t.c32 == NULL && t.c64 == NULL)
+        return;
+    uint64_t *d = dest + ((uint64_t)tile << TILE_SHIFT);
+    const size_t size = tileSize(tile);
+    for (size_t j = 0; j < size; ++j) {
+        d[j] += t.c64 != NULL ? t.c64[j] : t.c32[j];
+    }
+}
+
+/**
+ * @brief Sets all the counts to zero
+ *
+ * Allocated tiles are kept, as they are likely to be populated again.
+ */
+
+void TiledCounts::clear()
+{
+    for (size_t i = 0; i < tiles.size(); ++i) {
+        Tile &t = tiles[i];
+        if(t.c64 != NULL)
+            memset(t.c64, 0, TILE_BINS * sizeof(uint64_t));
+        else if(t.c32 != NULL)
+            memset(t.c32, 0, TILE_BINS * sizeof(uint32_t));
+    }
+}
+
+uint64_t TiledCounts::nBins() const
+{
+    return _nBins;
+}
+
+/**
+ * @brief Number of bins in the allocated tiles
+ */
+
+uint64_t TiledCounts::allocatedBins() const
+{
+    uint64_t n = 0;
+    for (size_t i = 0; i < tiles.size(); ++i) {
+        if(tiles[i].c32 != NULL || tiles[i].c64 != NULL)
+            n += TILE_BINS;
+    }
+    return n;
+}
+
+void TiledCounts::allocate(Tile &t)
+{
+    t.c32 = (uint32_t *)calloc(TILE_BINS, sizeof(uint32_t));
+}
+
+/**
+ * @brief Switches the given tile to 64-bit counters
+ */
+
+void TiledCounts::promote(Tile &t)
+{
+    t.c64 = (uint64_t *)malloc(TILE_BINS * sizeof(uint64_t));
+    for (size_t j = 0; j < TILE_BINS; ++j) {
+        t.c64[j] = t.c32[j];
+    }
+    free(t.c32);
+    t.c32 = NULL;
+}
+
+size_t TiledCounts::tileSize(const size_t tile) const
+{
+    uint64_t first = (uint64_t)tile << TILE_SHIFT;
+    return _nBins - first < TILE_BINS ? _nBins - first : TILE_BINS;
+}
@@ -0,0 +1,169 @@
+/*
+  This file is part of MCPlusPlus.
+
+  MCPlusPlus is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Mcplusplus is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with MCPlusPlus.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <MCPlusPlus/walkerbatch.h>
+
+#include <cmath>
+#include <algorithm>
+#include <boost/math/constants/constants.hpp>
+
+using namespace boost::math::constants;
+using namespace MCPP;
+
+WalkerBatch::WalkerBatch()
+{
+    columns = 0;
+    for (uint i = 0; i < 5; ++i) {
+        offsets[i] = 0;
+    }
+}
+
+/**
+ * @brief Requests the given columns to be computed by fill()
+ * @param columns a combination of #batchColumns
+ */
+
+void WalkerBatch::require(unsigned int columns)
+{
+    this->columns |= columns;
+}
+
+/**
+ * @brief Requests the column of \f$ \rho^p \f$ to be computed by fill()
+ * @param exponent \f$ p \f$
+ */
+
+void WalkerBatch::requireMomentExponent(const double exponent)
+{
+    for (size_t i = 0; i < exponents.size(); ++i) {
+        if(exponents[i] == exponent)
+            return;
+    }
+    exponents.push_back(exponent);
+    powers.push_back(vector<MCfloat>(_radii.size()));
+    columns |= COLUMN_RADII;
+}
+
+void WalkerBatch::clearRequirements()
+{
+    columns = 0;
+    exponents.clear();
+    powers.clear();
+}
+
+/**
+ * @brief Partitions the given walkers by type and computes the required
+ * columns
+ * @param buf
+ * @param size
+ */
+
+void WalkerBatch::fill(const Walker * const buf, const size_t size)
+{
+    if(walkers.size() < size) {
+        walkers.resize(size);
+        _times.resize(size);
+        _radii.resize(size);
+        _angles.resize(size);
+        _cosines.resize(size);
+        _azimuths.resize(size);
+        for (size_t i = 0; i < powers.size(); ++i) {
+            powers[i].resize(size);
+        }
+    }
+
+    // counting sort by walker type (comparisons rather than count[type]++,
+    // which serializes on the store to count)
+    size_t count[4] = {0, 0, 0, 0};
+    for (size_t i = 0; i < size; ++i) {
+        const int type = buf[i].type;
+        count[0] += type == 0;
+        count[1] += type == 1;
+        count[2] += type == 2;
+        count[3] += type == 3;
+    }
+    offsets[0] = 0;
+    for (uint t = 0; t < 4; ++t) {
+        offsets[t + 1] = offsets[t] + count[t];
+    }
+    if(size == 0)
+        return;
+
+    // _radii temporarily holds the squared radii, _angles the cosines
+    const bool times = columns & COLUMN_TIMES;
+    const bool radii = columns & COLUMN_RADII;
+    const bool angles = columns & COLUMN_ANGLES;
+    const bool cosines = columns & COLUMN_COSINES;
+    const bool azimuths = columns & COLUMN_AZIMUTHS;
+    const MCfloat degPerRad = 180 / pi<MCfloat>();
+    size_t next[4] = {offsets[0], offsets[1], offsets[2], offsets[3]};
+    for (size_t i = 0; i < size; ++i) {
+        const Walker * const w = &buf[i];
+        size_t r = next[w->type]++;
+        walkers[r] = w;
+        if(times)
+            _times[r] = w->walkTime;
+        if(radii)
+            _radii[r] = w->r0[0] * w->r0[0] + w->r0[1] * w->r0[1];
+        if(angles)
+            _angles[r] = w->k0[2];
+        if(cosines)
+            _cosines[r] = fabs(w->k0[2]);
+        if(azimuths) {
+            MCfloat phi = atan2(w->k0[1], w->k0[0]) * degPerRad;
+            _azimuths[r] = phi < 0 ? phi + 360 : phi;
+        }
+    }
+
+    if(angles) {
+        for (size_t i = 0; i < size; ++i) {
+            _angles[i] = acos(_angles[i]) * degPerRad;
+        }
+    }
+    if(radii) {
+        for (size_t j = 0; j < exponents.size(); ++j) {
+            if(exponents[j] == 2)
+                copy(_radii.begin(), _radii.begin() + size, powers[j].begin());
+        }
+        for (size_t i = 0; i < size; ++i) {
+            _radii[i] = sqrt(_radii[i]);
+        }
+        for (size_t j = 0; j < exponents.size(); ++j) {
+            MCfloat *p = &powers[j][0];
+            if(exponents[j] != 2) {
+                for (size_t i = 0; i < size; ++i) {
+                    p[i] = pow(_radii[i], exponents[j]);
+                }
+            }
+        }
+    }
+}
+
+/**
+ * @brief The column of \f$ \rho^p \f$
+ * @param exponent \f$ p \f$, previously registered with
+ * requireMomentExponent()
+ * @return NULL if the exponent was not registered
+ */
+
+const MCfloat *WalkerBatch::radialPowers(const double exponent) const
+{
+    for (size_t i = 0; i < exponents.size(); ++i) {
+        if(exponents[i] == exponent)
+            return powers[i].empty() ? NULL : &powers[i][0];
+    }
+    return NULL;
+}
@@ -0,0 +1,103 @@
+#include "tests.h"
+
+#include <iostream>
+#include <cmath>
+
+using namespace std;
+using namespace MCPP;
+
+const char outputFileName[] = "testAutoRange.h5";
+vector<Material *> materials;  // see newBilayerSimulation()
+
+void pass() {
+    cout << "testAutoRange PASSED" << endl;
+    remove(outputFileName);
+    exit(EXIT_SUCCESS);
+}
+
+void fail() {
+    cout << "FAILED" << endl;
+    remove(outputFileName);
+    exit(EXIT_FAILURE);
+}
+
+bool close(MCfloat a, MCfloat b) {
+    return fabs(a - b) <= 1e-9 * fabs(b);
+}
+
+Histogram *newHistogram(const char *name, MCfloat max, bool autoRange,
+                        bool tiled) {
+    Histogram *hist = new Histogram();
+    hist->setDataDomain(DATA_TIMES);
+    hist->setPhotonTypeFlags(FLAG_TRANSMITTED | FLAG_REFLECTED);
+    hist->setMax(max);
+    hist->setBinSize(0.625);
+    hist->setAutoRange(0, autoRange);
+    hist->setTiledStorage(tiled);
+    if(!tiled)
+        hist->addMomentExponent(2);
+    hist->setName(name);
+    return hist;
+}
+
+int main() {
+    remove(outputFileName);
+
+    Histogram *h = newHistogram("invalid", 40, true, false);
+    h->setDataDomain(DATA_K);
+    if(h->sanityCheck()) fail();
+    delete h;
+
+    const u_int64_t N = 100000;
+    const size_t nRef = 4096, nAuto = 64;
+    Simulation *sim = newBilayerSimulation(N, 4, &materials);
+    sim->setOutputFileName(outputFileName);
+    // the reference covers all the exit times with the initial bin width
+    sim->addHistogram(newHistogram("reference", nRef * 0.625, false, false));
+    sim->addHistogram(newHistogram("auto", nAuto * 0.625, true, false));
+    sim->addHistogram(newHistogram("autoTiled", nAuto * 0.625, true, true));
+    sim->run();
+    delete sim;
+    deleteMaterials(&materials);
+
+    H5OutputFile file;
+    file.openFile(outputFileName);
+    MCfloat ref[(nRef + 1) * 3];
+    MCfloat a[(nAuto + 1) * 3];
+    MCfloat b[(nAuto + 1) * 2];
+    file.openDataSet("reference");
+    file.loadAll(ref);
+    file.openDataSet("auto");
+    file.loadAll(a);
+    file.openDataSet("autoTiled");
+    file.loadAll(b);
+
+    if(ref[3 * nRef + 1] != 0) fail();
+
+    // the range has been doubled at least once, as recorded by the centers
+    MCfloat width = 2 * a[0];
+    size_t group = round(width / 0.625);
+    if(group < 2 || (group & (group - 1)) != 0) fail();
+    if(!close(b[0], a[0])) fail();
+
+    for (size_t i = 0; i < nAuto; ++i) {
+        if(!close(a[3 * i], (i + 0.5) * width)) fail();
+        MCfloat counts = 0, moments = 0;
+        for (size_t j = i * group; j < (i + 1) * group && j < nRef; ++j) {
+            MCfloat c = ref[3 * j + 1];
+            counts += c;
+            if(c > 0)
+                moments += ref[3 * j + 2] * c;
+        }
+        if(counts == 0) {
+            if(a[3 * i + 1] != 0 || b[2 * i + 1] != 0) fail();
+            continue;
+        }
+        if(!close(a[3 * i + 1], counts)) fail();
+        if(!close(b[2 * i + 1], counts)) fail();
+        if(!close(a[3 * i + 2], moments / counts)) fail();
+    }
+
+    pass();
+    return 0;
+}
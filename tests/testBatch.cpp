@@ -0,0 +1,74 @@
+#include "tests.h"
+#include <MCPlusPlus/simulationbatch.h>
+
+#include <iostream>
+
+using namespace std;
+using namespace MCPP;
+
+const char outputFileName[] = "testBatch.h5";
+const char referenceFileName[] = "testBatchReference.h5";
+vector<Material *> materials;  // see newBilayerSimulation()
+
+void pass() {
+    cout << "testBatch PASSED" << endl;
+    remove(outputFileName);
+    remove(referenceFileName);
+    exit(EXIT_SUCCESS);
+}
+
+void fail() {
+    cout << "FAILED" << endl;
+    remove(outputFileName);
+    remove(referenceFileName);
+    exit(EXIT_FAILURE);
+}
+
+int main() {
+    remove(outputFileName);
+    remove(referenceFileName);
+
+    // 4 threads with seeds 0..3 are equivalent to 4 work units
+    Simulation *sim = newBilayerSimulation(200000, 4, &materials);
+    sim->setOutputFileName(referenceFileName);
+    sim->run();
+    delete sim;
+    deleteMaterials(&materials);
+
+    SimulationBatch *batch = new SimulationBatch();
+    batch->addSimulation(newBilayerSimulation(200000, 1, &materials), "first");
+    batch->addSimulation(newBilayerSimulation(200000, 1, &materials), "second");
+    batch->setChunkSize(50000);
+    batch->setNThreads(3);
+    batch->setOutputFileName(outputFileName);
+    batch->run();
+    delete batch;
+    deleteMaterials(&materials);
+
+    H5OutputFile reference, file;
+    reference.openFile(referenceFileName);
+    file.openFile(outputFileName);
+
+    MCfloat refBuf[51*3], buf[51*3];
+    reference.openDataSet("times");
+    reference.loadAll(refBuf);
+
+    const char *groups[] = {"first", "second"};
+    for (int g = 0; g < 2; ++g) {
+        if(!file.openRootGroup(groups[g])) fail();
+        for (int i = 0; i < 4; ++i) {
+            if(file.photonCounters()[i] != reference.photonCounters()[i])
+                fail();
+        }
+
+        string dsName = string(groups[g]) + "/times";
+        if(!file.openDataSet(dsName.c_str())) fail();
+        file.loadAll(buf);
+        for (int i = 0; i < 51*3; ++i) {
+            if(fabs(buf[i] - refBuf[i]) > 1e-13 * fabs(refBuf[i])) fail();
+        }
+    }
+
+    pass();
+    return 0;
+}
@@ -0,0 +1,141 @@
+#include "tests.h"
+#include <MCPlusPlus/beamconvolver.h>
+
+#include <iostream>
+#include <cmath>
+
+using namespace std;
+using namespace MCPP;
+
+const char pencilFileName[] = "testBeamConvolution.h5";
+const char beamFileName[] = "testBeamConvolutionGaussian.h5";
+vector<Material *> materials;  // see newBilayerSimulation()
+
+void pass() {
+    cout << "testBeamConvolution PASSED" << endl;
+    remove(pencilFileName);
+    remove(beamFileName);
+    exit(EXIT_SUCCESS);
+}
+
+void fail() {
+    cout << "FAILED" << endl;
+    remove(pencilFileName);
+    remove(beamFileName);
+    exit(EXIT_FAILURE);
+}
+
+const u_int64_t nPhotons = 200000;
+const double FWHM = 40;
+const size_t nRadii = 20, nTimes = 50;
+
+Simulation *newSimulation(Source *src) {
+    Simulation *sim = newBilayerSimulation(nPhotons, 4, &materials);
+    if(src != NULL) {
+        src->setWalkTimeDistribution(new DeltaDistribution(0));
+        sim->setSource(src);
+    }
+
+    Histogram *hist = new Histogram();
+    hist->setDataDomain(DATA_POINTS);
+    hist->setPhotonTypeFlags(FLAG_TRANSMITTED);
+    hist->setMax(10 * nRadii);
+    hist->setBinSize(10);
+    hist->setName("radii");
+    if(src == NULL)
+        hist->addBeamConvolution(FWHM, "beam");
+    sim->addHistogram(hist);
+
+    if(src == NULL) {
+        hist = new Histogram();
+        hist->setDataDomain(DATA_POINTS, DATA_TIMES);
+        hist->setPhotonTypeFlags(FLAG_TRANSMITTED);
+        hist->setMax(10 * nRadii, nTimes);
+        hist->setBinSize(10, 1);
+        hist->setName("resolved");
+        hist->addBeamConvolution(FWHM, "beam");
+        sim->addHistogram(hist);
+    }
+    return sim;
+}
+
+int main() {
+    remove(pencilFileName);
+    remove(beamFileName);
+
+    // all the counts are kept, the overflow included
+    vector<double> edges;
+    for (size_t i = 0; i <= 5; ++i)
+        edges.push_back(2 * i);
+    BeamConvolver convolver(edges, 3);
+    if(!convolver.valid()) fail();
+    double in[6] = {1, 0, 2, 0, 3, 4}, out[6];
+    convolver.convolve(in, out);
+    double total = 0;
+    for (size_t i = 0; i < 6; ++i) {
+        if(out[i] < 0) fail();
+        total += out[i];
+    }
+    if(fabs(total - 10) > 1e-9 || out[5] <= 4) fail();
+
+    Histogram *h = new Histogram();
+    h->setDataDomain(DATA_TIMES);
+    h->setPhotonTypeFlags(FLAG_TRANSMITTED);
+    h->setMax(100);
+    h->setBinSize(1);
+    h->addBeamConvolution(FWHM, "beam");
+    if(h->sanityCheck()) fail();
+    delete h;
+
+    Simulation *sim = newSimulation(NULL);
+    sim->setOutputFileName(pencilFileName);
+    sim->run();
+    delete sim;
+    deleteMaterials(&materials);
+
+    sim = newSimulation(new GaussianBeamSource(FWHM));
+    sim->setOutputFileName(beamFileName);
+    sim->run();
+    delete sim;
+    deleteMaterials(&materials);
+
+    // the convolved pencil-beam response matches the simulated beam within
+    // the statistical errors
+    H5OutputFile pencil, beam;
+    pencil.openFile(pencilFileName);
+    beam.openFile(beamFileName);
+    const size_t rows = nRadii + 1;
+    MCfloat expected[rows * 2], convolved[rows * 2];
+    beam.openDataSet("radii");
+    beam.loadAll(expected);
+    pencil.openDataSet("radii_beam");
+    pencil.loadAll(convolved);
+    for (size_t i = 0; i < rows; ++i) {
+        if(convolved[2 * i] != expected[2 * i]) fail();
+        double a = convolved[2 * i + 1], b = expected[2 * i + 1];
+        double counts = b * nPhotons * M_PI * 100 * (2 * i + 1);
+        if(fabs(a - b) > 5 * b / sqrt(counts) + 1e-12) fail();
+    }
+
+    // the radial axis comes first: the counts of each time bin are
+    // redistributed among the radii, counts being normalized to the area of
+    // the rings
+    const size_t cols = nTimes + 2;
+    MCfloat ref[rows * cols], conv[rows * cols];
+    pencil.openDataSet("resolved");
+    pencil.loadAll(ref);
+    pencil.openDataSet("resolved_beam");
+    pencil.loadAll(conv);
+    for (size_t j = 1; j < cols; ++j) {
+        double refSum = 0, convSum = 0;
+        for (size_t i = 0; i < rows; ++i) {
+            double area = 100 * ((i + 1) * (i + 1) - i * i);
+            refSum += ref[i * cols + j] * area;
+            convSum += conv[i * cols + j] * area;
+        }
+        if(fabs(refSum - convSum) > 1e-5 * (refSum + 1e-9)) fail();
+    }
+
+    pass();
+    return 0;
+}
@@ -0,0 +1,115 @@
+#include "tests.h"
+
+#include <iostream>
+#include <cmath>
+
+using namespace std;
+using namespace MCPP;
+
+const char outputFileName[] = "testBinning.h5";
+vector<Material *> materials;  // see newBilayerSimulation()
+
+void pass() {
+    cout << "testBinning PASSED" << endl;
+    remove(outputFileName);
+    exit(EXIT_SUCCESS);
+}
+
+void fail() {
+    cout << "FAILED" << endl;
+    remove(outputFileName);
+    exit(EXIT_FAILURE);
+}
+
+Histogram *newHistogram(const char *name, enum MCData type) {
+    Histogram *hist = new Histogram();
+    hist->setDataDomain(type);
+    hist->setPhotonTypeFlags(FLAG_TRANSMITTED | FLAG_REFLECTED);
+    hist->setName(name);
+    return hist;
+}
+
+void load(H5OutputFile *file, const char *name, MCfloat *buf) {
+    file->openDataSet(name);
+    file->loadAll(buf);
+}
+
+bool close(MCfloat a, MCfloat b) {
+    return fabs(a - b) <= 1e-9 * fabs(b);
+}
+
+int main() {
+    remove(outputFileName);
+
+    // invalid binnings
+    Histogram *h = newHistogram("invalid", DATA_TIMES);
+    h->setLogBinning(0, 0, 100, 10);
+    if(h->sanityCheck()) fail();
+    vector<double> edges;
+    edges.push_back(0);
+    edges.push_back(2);
+    edges.push_back(2);
+    h->setBinEdges(0, edges);
+    if(h->sanityCheck()) fail();
+    delete h;
+
+    const uint n = 30;
+    Histogram *uniform = newHistogram("uniform", DATA_TIMES);
+    uniform->setMax(200);
+    uniform->setBinSize(2);
+
+    edges.clear();
+    for (uint i = 0; i <= 100; ++i)
+        edges.push_back(2 * i);
+    Histogram *uniformEdges = newHistogram("uniformEdges", DATA_TIMES);
+    uniformEdges->setBinEdges(0, edges);
+
+    // radii in [1, 1000) um, ten bins per decade
+    Histogram *log = newHistogram("log", DATA_POINTS);
+    log->setLogBinning(0, 1, 1000, n);
+
+    edges.clear();
+    for (uint i = 0; i <= n; ++i)
+        edges.push_back(pow(10., 3. * i / n));
+    Histogram *logEdges = newHistogram("logEdges", DATA_POINTS);
+    logEdges->setBinEdges(0, edges);
+
+    Simulation *sim = newBilayerSimulation(200000, 4, &materials);
+    sim->setOutputFileName(outputFileName);
+    sim->addHistogram(uniform);
+    sim->addHistogram(uniformEdges);
+    sim->addHistogram(log);
+    sim->addHistogram(logEdges);
+    sim->run();
+    delete sim;
+    deleteMaterials(&materials);
+
+    H5OutputFile file;
+    file.openFile(outputFileName);
+
+    // times with non-uniform binning are normalized to the bin width
+    MCfloat a[101 * 2], b[101 * 2];
+    load(&file, "uniform", a);
+    load(&file, "uniformEdges", b);
+    for (size_t i = 0; i < 100; ++i) {
+        if(a[2 * i] != b[2 * i]) fail();
+        if(!close(2 * b[2 * i + 1], a[2 * i + 1])) fail();
+    }
+
+    // logarithmic bins are the same as the equivalent edges, and normalized
+    // to the area of each ring
+    MCfloat c[(n + 1) * 2], d[(n + 1) * 2];
+    load(&file, "log", c);
+    load(&file, "logEdges", d);
+    MCfloat total = 0;
+    for (size_t i = 0; i < n; ++i) {
+        if(!close(c[2 * i], sqrt(edges[i] * edges[i + 1]))) fail();
+        if(!close(c[2 * i + 1], d[2 * i + 1])) fail();
+        total += c[2 * i + 1] * M_PI
+                * (edges[i + 1] * edges[i + 1] - edges[i] * edges[i]);
+    }
+    if(total <= 0 || total > 1) fail();
+
+    pass();
+    return 0;
+}
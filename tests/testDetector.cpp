@@ -0,0 +1,90 @@
+#include "tests.h"
+
+#include <iostream>
+#include <cmath>
+
+using namespace std;
+using namespace MCPP;
+
+const char outputFileName[] = "testDetector.h5";
+vector<Material *> materials;  // see newBilayerSimulation()
+
+void pass() {
+    cout << "testDetector PASSED" << endl;
+    remove(outputFileName);
+    exit(EXIT_SUCCESS);
+}
+
+void fail() {
+    cout << "FAILED" << endl;
+    remove(outputFileName);
+    exit(EXIT_FAILURE);
+}
+
+const double rMin = 10, rMax = 30;
+const double binSize = 2;
+const size_t nBins = 50;
+
+Histogram *newRadialHistogram(const char *name, Detector *detector) {
+    Histogram *hist = new Histogram();
+    hist->setDataDomain(DATA_POINTS);
+    hist->setPhotonTypeFlags(FLAG_TRANSMITTED);
+    hist->setMax(nBins * binSize);
+    hist->setBinSize(binSize);
+    hist->setName(name);
+    hist->setDetector(detector);
+    return hist;
+}
+
+int main() {
+    remove(outputFileName);
+
+    const u_int64_t nPhotons = 100000;
+    Simulation *sim = newBilayerSimulation(nPhotons, 4, &materials);
+    sim->setOutputFileName(outputFileName);
+    sim->addHistogram(newRadialHistogram("all", NULL));
+    sim->addHistogram(newRadialHistogram(
+                          "detected", new RadialRangeDetector(rMin, rMax)));
+    sim->setRawOutputEnabled(true);
+    sim->setExitPointsSaveFlags(FLAG_TRANSMITTED);
+    sim->setRawOutputDetector(new RadialRangeDetector(rMin, rMax));
+    sim->run();
+    delete sim;
+    deleteMaterials(&materials);
+
+    H5OutputFile file;
+    file.openFile(outputFileName);
+
+    // the filtered histogram is the unfiltered one restricted to the bins
+    // within the detector
+    const size_t rows = nBins + 1;
+    MCfloat all[rows * 2], detected[rows * 2];
+    file.openDataSet("all");
+    file.loadAll(all);
+    file.openDataSet("detected");
+    file.loadAll(detected);
+    double expectedCounts = 0;
+    for (size_t i = 0; i < rows; ++i) {
+        double lo = i * binSize, hi = (i + 1) * binSize;
+        bool inside = lo >= rMin && hi <= rMax;
+        double expected = inside ? all[2 * i + 1] : 0;
+        if(detected[2 * i + 1] != expected) fail();
+        if(inside)
+            expectedCounts += expected * nPhotons * M_PI * (hi * hi - lo * lo);
+    }
+    if(expectedCounts == 0) fail();
+
+    // raw output holds all and only the accepted photons
+    u_int64_t n = file.rawDataSize(DATA_POINTS, TRANSMITTED) / 2;
+    if(fabs(n - expectedCounts) > 0.5) fail();
+    vector<MCfloat> points(2 * n);
+    file.loadExitPoints(TRANSMITTED, points.data());
+    for (size_t i = 0; i < n; ++i) {
+        MCfloat r = sqrt(points[2 * i] * points[2 * i]
+                + points[2 * i + 1] * points[2 * i + 1]);
+        if(r < rMin * (1 - 1e-6) || r > rMax * (1 + 1e-6)) fail();
+    }
+
+    pass();
+    return 0;
+}
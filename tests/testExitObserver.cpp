@@ -0,0 +1,155 @@
+#include "tests.h"
+#include <MCPlusPlus/simulationbatch.h>
+
+#include <iostream>
+#include <cmath>
+
+using namespace std;
+using namespace MCPP;
+
+const char outputFileName[] = "testExitObserver.h5";
+const char batchFileName[] = "testExitObserverBatch.h5";
+vector<Material *> materials;  // see newBilayerSimulation()
+
+void cleanup() {
+    remove(outputFileName);
+    remove(batchFileName);
+    for (uint i = 0; i < 4; ++i) {
+        stringstream ss;
+        ss << "testExitObserver.shard-" << i << ".h5";
+        remove(ss.str().c_str());
+    }
+}
+
+void pass() {
+    cout << "testExitObserver PASSED" << endl;
+    cleanup();
+    exit(EXIT_SUCCESS);
+}
+
+void fail() {
+    cout << "FAILED" << endl;
+    cleanup();
+    exit(EXIT_FAILURE);
+}
+
+// counts the photons of each type from the buffer and sums the walk times of
+// the transmitted ones from the batch column
+class TimeObserver : public ExitObserver
+{
+public:
+    TimeObserver() : ExitObserver() {
+        initialize();
+    }
+
+    virtual void initialize() {
+        for (uint t = 0; t < 4; ++t)
+            counts[t] = 0;
+        sum = 0;
+    }
+
+    virtual void requireColumns(WalkerBatch *batch) const {
+        batch->require(COLUMN_TIMES);
+    }
+
+    virtual void observe(const Walker * const buf, const size_t size,
+                         const WalkerBatch &batch) {
+        if(batch.size() != size)
+            fail();
+        for (size_t i = 0; i < size; ++i)
+            counts[buf[i].type]++;
+        const MCfloat *times = batch.times();
+        for (size_t r = batch.begin(TRANSMITTED);
+             r < batch.end(TRANSMITTED); ++r)
+            sum += times[r];
+    }
+
+    virtual void merge(const ExitObserver *rhs) {
+        const TimeObserver *o = (const TimeObserver *)rhs;
+        for (uint t = 0; t < 4; ++t)
+            counts[t] += o->counts[t];
+        sum += o->sum;
+    }
+
+    virtual void saveToFile(const char *fileName,
+                            const char *groupName) const {
+        string name = "observer";
+        if(groupName != NULL)
+            name = string(groupName) + "/" + name;
+        H5FileHelper file;
+        if(access(fileName, F_OK) < 0)
+            file.newFile(fileName);
+        else
+            file.openFile(fileName);
+        hsize_t dims[2] = {1, 5};
+        file.newDataset(name.c_str(), 2, dims);
+        double data[5] = {(double)counts[0], (double)counts[1],
+                          (double)counts[2], (double)counts[3], sum};
+        hsize_t start[2] = {0, 0};
+        file.writeHyperSlabDouble(start, dims, data);
+        file.closeDataSet();
+        file.close();
+    }
+
+    virtual BaseObject *clone_impl() const {
+        return new TimeObserver();
+    }
+
+    u_int64_t counts[4];
+    double sum;
+};
+
+Simulation *newSimulation(uint nThreads) {
+    Simulation *sim = newBilayerSimulation(40000, nThreads, &materials);
+    sim->setRawOutputEnabled(true);
+    sim->setWalkTimesSaveFlags(FLAG_TRANSMITTED);
+    sim->addExitObserver(new TimeObserver());
+    return sim;
+}
+
+void check(H5OutputFile *file, const char *datasetName) {
+    double data[5];
+    if(!file->openDataSet(datasetName)) fail();
+    file->loadAll(data);
+    const u_int64_t *counters = file->photonCounters();
+    for (uint t = 0; t < 4; ++t) {
+        if(data[t] != counters[t]) fail();
+    }
+
+    u_int64_t n = counters[TRANSMITTED];
+    vector<MCfloat> times(n);
+    file->loadWalkTimes(TRANSMITTED, times.data());
+    double sum = 0;
+    for (size_t i = 0; i < n; ++i)
+        sum += times[i];
+    if(n == 0 || fabs(data[4] - sum) > 1e-9 * sum) fail();
+}
+
+int main() {
+    cleanup();
+
+    Simulation *sim = newSimulation(4);
+    sim->setOutputFileName(outputFileName);
+    sim->run();
+    delete sim;
+    deleteMaterials(&materials);
+
+    SimulationBatch *batch = new SimulationBatch();
+    batch->addSimulation(newSimulation(1), "observed");
+    batch->setChunkSize(10000);
+    batch->setNThreads(2);
+    batch->setOutputFileName(batchFileName);
+    batch->run();
+    delete batch;
+    deleteMaterials(&materials);
+
+    H5OutputFile file, batchFile;
+    file.openFile(outputFileName);
+    check(&file, "observer");
+    batchFile.openFile(batchFileName);
+    if(!batchFile.openRootGroup("observed")) fail();
+    check(&batchFile, "observed/observer");
+
+    pass();
+    return 0;
+}
@@ -0,0 +1,114 @@
+#include "tests.h"
+
+#include <iostream>
+#include <cmath>
+
+using namespace std;
+using namespace MCPP;
+
+const char outputFileName[] = "testNDHistogram.h5";
+vector<Material *> materials;  // see newBilayerSimulation()
+
+void pass() {
+    cout << "testNDHistogram PASSED" << endl;
+    remove(outputFileName);
+    exit(EXIT_SUCCESS);
+}
+
+void fail() {
+    cout << "FAILED" << endl;
+    remove(outputFileName);
+    exit(EXIT_FAILURE);
+}
+
+bool close(MCfloat a, MCfloat b) {
+    return fabs(a - b) <= 1e-9 * fabs(b);
+}
+
+int main() {
+    remove(outputFileName);
+
+    // time x radius, as a reference
+    Histogram *map = new Histogram();
+    map->setDataDomain(DATA_TIMES, DATA_POINTS);
+    map->setPhotonTypeFlags(FLAG_TRANSMITTED | FLAG_REFLECTED);
+    map->setMax(50, 100);
+    map->setBinSize(5, 10);
+    map->setName("map");
+
+    // time x radius x photon type
+    Histogram *byType = new Histogram();
+    byType->setDataDomain(DATA_TIMES, DATA_POINTS, DATA_PHOTON_TYPE);
+    byType->setPhotonTypeFlags(FLAG_TRANSMITTED | FLAG_REFLECTED);
+    byType->setMax(50, 100);
+    byType->setBinSize(5, 10);
+    byType->setName("byType");
+
+    // time x radius x cos(theta) x photon type, tiled and shared
+    Histogram *joint = new Histogram();
+    joint->setAxis(0, DATA_TIMES, 0, 50, 5);
+    joint->setAxis(1, DATA_POINTS, 0, 100, 10);
+    joint->setAxis(2, DATA_COS_THETA, 0, 1, 0.25);
+    joint->setAxis(3, DATA_PHOTON_TYPE, 0, 0, 0);
+    joint->setPhotonTypeFlags(FLAG_TRANSMITTED | FLAG_REFLECTED);
+    joint->setTiledStorage(true);
+    joint->setSharedAcrossThreads(true);
+    joint->setName("joint");
+
+    if(joint->nAxes() != 4) fail();
+
+    Simulation *sim = newBilayerSimulation(100000, 4, &materials);
+    sim->setOutputFileName(outputFileName);
+    sim->addHistogram(map);
+    sim->addHistogram(byType);
+    sim->addHistogram(joint);
+    sim->run();
+    delete sim;
+    deleteMaterials(&materials);
+
+    H5OutputFile file;
+    file.openFile(outputFileName);
+
+    // marginals of the N-D histograms match the 2D one
+    const size_t nT = 11, nR = 11, nC = 5, nP = 5;
+    MCfloat ref[nT * (nR + 1)];
+    MCfloat a[nT * nR * nP];
+    MCfloat b[nT * nR * nC * nP];
+    file.openDataSet("map");
+    file.loadAll(ref);
+    file.openDataSet("byType");
+    if(file.getRank() != 3) fail();
+    file.loadAll(a);
+    file.openDataSet("joint");
+    if(file.getRank() != 4) fail();
+    file.loadAll(b);
+
+    for (size_t i = 0; i < nT; ++i) {
+        for (size_t j = 0; j < nR; ++j) {
+            MCfloat sumA = 0, sumB = 0;
+            for (size_t p = 0; p < nP; ++p) {
+                sumA += a[(i * nR + j) * nP + p];
+                for (size_t c = 0; c < nC; ++c)
+                    sumB += b[((i * nR + j) * nC + c) * nP + p];
+            }
+            MCfloat expected = ref[i * (nR + 1) + j + 1];
+            if(!close(sumA, expected)) fail();
+            if(!close(sumB, expected)) fail();
+            // no ballistic photons are histogrammed
+            if(a[(i * nR + j) * nP + BALLISTIC] != 0) fail();
+        }
+    }
+
+    // edges of the regular bins
+    MCfloat edges[nC];
+    file.openDataSet("joint_edges_2");
+    file.loadAll(edges);
+    if(!close(edges[0], 90) || fabs(edges[nC - 1]) > 1e-6) fail();
+    MCfloat types[nP];
+    file.openDataSet("joint_edges_3");
+    file.loadAll(types);
+    if(types[0] != -0.5 || types[nP - 1] != 3.5) fail();
+
+    pass();
+    return 0;
+}
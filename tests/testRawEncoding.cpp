@@ -0,0 +1,92 @@
+#include "tests.h"
+
+#include <iostream>
+
+using namespace std;
+using namespace MCPP;
+
+const char outputFileName[] = "testRawEncoding.h5";
+const char referenceFileName[] = "testRawEncodingReference.h5";
+vector<Material *> materials;  // see newBilayerSimulation()
+
+void pass() {
+    cout << "testRawEncoding PASSED" << endl;
+    remove(outputFileName);
+    remove(referenceFileName);
+    exit(EXIT_SUCCESS);
+}
+
+void fail() {
+    cout << "FAILED" << endl;
+    remove(outputFileName);
+    remove(referenceFileName);
+    exit(EXIT_FAILURE);
+}
+
+Simulation *newRawSimulation(const char *fileName) {
+    Simulation *sim = newBilayerSimulation(20000, 1, &materials);
+    sim->setRawOutputEnabled(true);
+    sim->setWalkTimesSaveFlags(FLAG_REFLECTED);
+    sim->setExitPointsSaveFlags(FLAG_REFLECTED);
+    sim->setExitKVectorsSaveFlags(FLAG_REFLECTED);
+    sim->setExitKVectorsDirsSaveFlags(ALL_DIRS);
+    sim->setOutputFileName(fileName);
+    return sim;
+}
+
+bool compare(H5OutputFile *reference, H5OutputFile *file, MCData group,
+             MCfloat tolerance) {
+    hsize_t n = reference->rawDataSize(group, REFLECTED);
+    if(n == 0 || file->rawDataSize(group, REFLECTED) != n)
+        return false;
+    vector<MCfloat> refBuf(n), buf(n);
+    reference->loadData(group, REFLECTED, refBuf.data());
+    file->loadData(group, REFLECTED, buf.data());
+    for (hsize_t i = 0; i < n; ++i) {
+        if(fabs(refBuf[i] - buf[i]) > tolerance)
+            return false;
+    }
+
+    // partial load
+    hsize_t start = 3, count = 6;
+    file->loadData(group, REFLECTED, buf.data(), &start, &count);
+    for (hsize_t i = 0; i < count; ++i) {
+        if(fabs(refBuf[start + i] - buf[i]) > tolerance)
+            return false;
+    }
+    return true;
+}
+
+int main() {
+    remove(outputFileName);
+    remove(referenceFileName);
+
+    Simulation *sim = newRawSimulation(referenceFileName);
+    sim->run();
+    delete sim;
+    deleteMaterials(&materials);
+
+    sim = newRawSimulation(outputFileName);
+    sim->setRawDatasetOptions(DATA_TIMES, RawDatasetOptions(
+        RAW_DEFAULT_CHUNK_PHOTONS, 0, false, RAW_ENCODING_FIXED_POINT, 1e-3));
+    sim->setRawDatasetOptions(DATA_POINTS, RawDatasetOptions(
+        RAW_DEFAULT_CHUNK_PHOTONS, 0, false, RAW_ENCODING_FLOAT32));
+    sim->setRawDatasetOptions(DATA_K, RawDatasetOptions(
+        RAW_DEFAULT_CHUNK_PHOTONS, 0, false, RAW_ENCODING_OCTAHEDRAL));
+    sim->run();
+    delete sim;
+    deleteMaterials(&materials);
+
+    H5OutputFile reference, file;
+    reference.openFile(referenceFileName);
+    file.openFile(outputFileName);
+
+    if(!compare(&reference, &file, DATA_TIMES, 5e-4))
+        fail();
+    if(!compare(&reference, &file, DATA_POINTS, 1e-3))
+        fail();
+    if(!compare(&reference, &file, DATA_K, 1e-4))
+        fail();
+
+    pass();
+}
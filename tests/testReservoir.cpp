@@ -0,0 +1,139 @@
+#include "tests.h"
+#include <MCPlusPlus/simulationbatch.h>
+
+#include <iostream>
+#include <set>
+#include <cmath>
+
+using namespace std;
+using namespace MCPP;
+
+const char fullFileName[] = "testReservoirFull.h5";
+const char outputFileName[] = "testReservoir.h5";
+const char batchFileName[] = "testReservoirBatch.h5";
+vector<Material *> materials;  // see newBilayerSimulation()
+
+void cleanup() {
+    remove(fullFileName);
+    remove(outputFileName);
+    remove(batchFileName);
+    for (uint i = 0; i < 4; ++i) {
+        stringstream ss;
+        ss << "testReservoirFull.shard-" << i << ".h5";
+        remove(ss.str().c_str());
+    }
+}
+
+void pass() {
+    cout << "testReservoir PASSED" << endl;
+    cleanup();
+    exit(EXIT_SUCCESS);
+}
+
+void fail() {
+    cout << "FAILED" << endl;
+    cleanup();
+    exit(EXIT_FAILURE);
+}
+
+const u_int64_t K = 500;
+
+Simulation *newSimulation(uint nThreads, u_int64_t reservoirSize) {
+    Simulation *sim = newBilayerSimulation(40000, nThreads, &materials);
+    sim->setRawOutputEnabled(true);
+    sim->setWalkTimesSaveFlags(FLAG_TRANSMITTED | FLAG_REFLECTED);
+    sim->setExitPointsSaveFlags(FLAG_TRANSMITTED);
+    sim->setRawOutputReservoirSize(reservoirSize);
+    return sim;
+}
+
+// the sample has the expected size and only holds simulated photons, with
+// consistent exit points and walk times
+void checkSample(H5OutputFile *file, H5OutputFile *full) {
+    for (uint t = TRANSMITTED; t <= REFLECTED; t += REFLECTED - TRANSMITTED) {
+        walkerType type = (walkerType)t;
+        u_int64_t n = file->photonCounters()[type];
+        if(n != full->photonCounters()[type] || n <= K) fail();
+        if(file->rawDataSize(DATA_TIMES, type) != K) fail();
+        double fraction = file->samplingFraction(DATA_TIMES, type);
+        if(fabs(fraction - (double)K / n) > 1e-12) fail();
+        if(full->samplingFraction(DATA_TIMES, type) != 1) fail();
+
+        hsize_t nFull = full->rawDataSize(DATA_TIMES, type);
+        vector<MCfloat> fullTimes(nFull), times(K);
+        full->loadWalkTimes(type, fullTimes.data());
+        file->loadWalkTimes(type, times.data());
+        set<MCfloat> all(fullTimes.begin(), fullTimes.end());
+        for (size_t i = 0; i < K; ++i) {
+            if(all.count(times[i]) == 0) fail();
+        }
+
+        if(type != TRANSMITTED)
+            continue;
+
+        // exit points are kept together with the walk times
+        if(file->rawDataSize(DATA_POINTS, type) != 2 * K) fail();
+        vector<MCfloat> fullPoints(2 * nFull), points(2 * K);
+        full->loadExitPoints(type, fullPoints.data());
+        file->loadExitPoints(type, points.data());
+        set<pair<MCfloat, MCfloat> > records;
+        for (size_t i = 0; i < nFull; ++i)
+            records.insert(make_pair(fullTimes[i], fullPoints[2 * i]));
+        for (size_t i = 0; i < K; ++i) {
+            if(records.count(make_pair(times[i], points[2 * i])) == 0)
+                fail();
+        }
+
+        // uniform sample: the mean walk time is unbiased
+        double mean = 0, variance = 0, sampleMean = 0;
+        for (size_t i = 0; i < nFull; ++i)
+            mean += fullTimes[i];
+        mean /= nFull;
+        for (size_t i = 0; i < nFull; ++i)
+            variance += (fullTimes[i] - mean) * (fullTimes[i] - mean);
+        variance /= nFull;
+        for (size_t i = 0; i < K; ++i)
+            sampleMean += times[i];
+        sampleMean /= K;
+        if(fabs(sampleMean - mean) > 5 * sqrt(variance / K)) fail();
+    }
+}
+
+int main() {
+    cleanup();
+
+    // the sampling RNG does not affect transport: the full raw output of the
+    // same simulation is the reference
+    Simulation *sim = newSimulation(4, 0);
+    sim->setOutputFileName(fullFileName);
+    sim->run();
+    delete sim;
+    deleteMaterials(&materials);
+
+    sim = newSimulation(4, K);
+    sim->setOutputFileName(outputFileName);
+    sim->run();
+    delete sim;
+    deleteMaterials(&materials);
+
+    // 4 work units with seeds 0..3, as the threads above
+    SimulationBatch *batch = new SimulationBatch();
+    batch->addSimulation(newSimulation(1, K), "sampled");
+    batch->setChunkSize(10000);
+    batch->setNThreads(2);
+    batch->setOutputFileName(batchFileName);
+    batch->run();
+    delete batch;
+    deleteMaterials(&materials);
+
+    H5OutputFile full, file, batchFile;
+    full.openFile(fullFileName);
+    file.openFile(outputFileName);
+    checkSample(&file, &full);
+    batchFile.openFile(batchFileName);
+    if(!batchFile.openRootGroup("sampled")) fail();
+    checkSample(&batchFile, &full);
+
+    pass();
+    return 0;
+}
@@ -0,0 +1,65 @@
+#include "tests.h"
+
+#include <iostream>
+
+using namespace std;
+using namespace MCPP;
+
+const char outputFileName[] = "testSharedHistograms.h5";
+vector<Material *> materials;  // see newBilayerSimulation()
+
+void pass() {
+    cout << "testSharedHistograms PASSED" << endl;
+    remove(outputFileName);
+    exit(EXIT_SUCCESS);
+}
+
+void fail() {
+    cout << "FAILED" << endl;
+    remove(outputFileName);
+    exit(EXIT_FAILURE);
+}
+
+Histogram *newMap(const char *name, bool shared, bool tiled) {
+    Histogram *hist = new Histogram();
+    hist->setDataDomain(DATA_POINTS, DATA_TIMES);
+    hist->setPhotonTypeFlags(FLAG_TRANSMITTED | FLAG_REFLECTED);
+    hist->setMax(500, 50);
+    hist->setBinSize(2, 1);
+    hist->setName(name);
+    hist->setSharedAcrossThreads(shared);
+    hist->setTiledStorage(tiled);
+    return hist;
+}
+
+int main() {
+    remove(outputFileName);
+
+    // shared histograms hold the same counts as per-thread ones
+    Simulation *sim = newBilayerSimulation(200000, 5, &materials);
+    sim->setOutputFileName(outputFileName);
+    sim->addHistogram(newMap("perThread", false, false));
+    sim->addHistogram(newMap("shared", true, false));
+    sim->addHistogram(newMap("sharedTiled", true, true));
+    sim->run();
+    delete sim;
+    deleteMaterials(&materials);
+
+    H5OutputFile file;
+    file.openFile(outputFileName);
+    size_t size = 251 * 52;
+    MCfloat reference[size], buf[size];
+    file.openDataSet("perThread");
+    file.loadAll(reference);
+    const char *names[] = {"shared", "sharedTiled"};
+    for (uint n = 0; n < 2; ++n) {
+        file.openDataSet(names[n]);
+        file.loadAll(buf);
+        for (size_t i = 0; i < size; ++i) {
+            if(buf[i] != reference[i]) fail();
+        }
+    }
+
+    pass();
+    return 0;
+}
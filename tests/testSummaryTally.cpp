@@ -0,0 +1,149 @@
+#include "tests.h"
+
+#include <iostream>
+#include <cmath>
+
+using namespace std;
+using namespace MCPP;
+
+const char outputFileName[] = "testSummaryTally.h5";
+vector<Material *> materials;  // see newBilayerSimulation()
+
+void pass() {
+    cout << "testSummaryTally PASSED" << endl;
+    remove(outputFileName);
+    exit(EXIT_SUCCESS);
+}
+
+void fail() {
+    cout << "FAILED" << endl;
+    remove(outputFileName);
+    exit(EXIT_FAILURE);
+}
+
+// rank error of the quantile estimates of a sketch holding a permutation of
+// 0, ..., n - 1
+bool checkSketch(const KLLSketch &s, const u_int64_t n, const double eps) {
+    if(s.count() != n)
+        return false;
+    if(s.min() != 0 || s.max() != n - 1)
+        return false;
+    for (uint i = 1; i < 100; ++i) {
+        double q = i / 100.;
+        if(fabs(s.quantile(q) - q * n) > eps * n)
+            return false;
+    }
+    return true;
+}
+
+int main() {
+    remove(outputFileName);
+
+    // small samples are exact
+    KLLSketch small;
+    for (uint i = 0; i < 101; ++i)
+        small.update((i * 37) % 101);
+    if(small.quantile(0.5) != 50) fail();
+    if(small.quantile(0.01) != 1) fail();
+
+    // large streams, single and merged
+    const u_int64_t N = 1000000;
+    KLLSketch single, merged, parts[4];
+    for (u_int64_t i = 0; i < N; ++i) {
+        double x = (i * 7919) % N;
+        single.update(x);
+        parts[i % 4].update(x);
+    }
+    for (uint i = 0; i < 4; ++i)
+        merged.merge(parts[i]);
+    if(single.retained() > 4 * KLL_DEFAULT_K) fail();
+    if(!checkSketch(single, N, 0.01)) fail();
+    if(!checkSketch(merged, N, 0.01)) fail();
+
+    // many sketches, e.g. one per thread, seeded as Simulation does: their
+    // compaction errors must not add up in the merged sketch
+    const uint nThreads = 64;
+    vector<KLLSketch> threads(nThreads);
+    for (uint i = 0; i < nThreads; ++i)
+        threads[i].setSeed(i);
+    for (u_int64_t i = 0; i < N; ++i)
+        threads[(i * 31) % nThreads].update((i * 7919) % N);
+    KLLSketch reduced;
+    reduced.setSeed(nThreads);
+    for (uint i = 0; i < nThreads; ++i)
+        reduced.merge(threads[i]);
+    if(!checkSketch(reduced, N, 0.01)) fail();
+
+    SummaryTally *t = new SummaryTally();
+    t->setPhotonTypeFlags(FLAG_TRANSMITTED);
+    if(t->sanityCheck()) fail();
+    t->setDataDomain(DATA_PHOTON_TYPE);
+    if(t->sanityCheck()) fail();
+    t->setDataDomain(DATA_TIMES);
+    if(!t->sanityCheck()) fail();
+    t->setName("timeSummary");
+
+    // reference histogram covering all the exit times
+    const size_t nBins = 4096;
+    const MCfloat binSize = 0.625;
+    Histogram *h = new Histogram();
+    h->setDataDomain(DATA_TIMES);
+    h->setPhotonTypeFlags(FLAG_TRANSMITTED);
+    h->setMax(nBins * binSize);
+    h->setBinSize(binSize);
+    h->setName("reference");
+
+    Simulation *sim = newBilayerSimulation(100000, 4, &materials);
+    sim->setOutputFileName(outputFileName);
+    sim->addHistogram(h);
+    sim->addSummaryTally(t);
+    sim->run();
+    delete sim;
+    deleteMaterials(&materials);
+
+    H5OutputFile file;
+    file.openFile(outputFileName);
+    MCfloat ref[(nBins + 1) * 2];
+    MCfloat s[4 * 11];
+    file.openDataSet("reference");
+    file.loadAll(ref);
+    file.openDataSet("timeSummary");
+    file.loadAll(s);
+
+    if(ref[2 * nBins + 1] != 0) fail();
+    double total = 0, sum = 0, sum2 = 0;
+    for (size_t i = 0; i < nBins; ++i) {
+        total += ref[2 * i + 1];
+        sum += ref[2 * i + 1] * ref[2 * i];
+        sum2 += ref[2 * i + 1] * ref[2 * i] * ref[2 * i];
+    }
+    double mean = sum / total;
+    double variance = sum2 / total - mean * mean;
+
+    const MCfloat *row = s + 11 * TRANSMITTED;
+    if(row[0] != TRANSMITTED || row[1] < 1000) fail();
+    if(fabs(row[2] - mean) > binSize / 2) fail();
+    if(fabs(row[3] - variance) > 0.02 * variance) fail();
+    if(row[4] < 0 || row[4] > row[5]) fail();
+
+    // the estimated quantiles fall where the histogram CDF crosses them
+    const double q[5] = {0.01, 0.05, 0.5, 0.95, 0.99};
+    for (uint j = 0; j < 5; ++j) {
+        double cdfLow = 0, cdfHigh = 0;
+        for (size_t i = 0; i < nBins; ++i) {
+            if(ref[2 * i] + binSize / 2 <= row[6 + j])
+                cdfLow += ref[2 * i + 1];
+            if(ref[2 * i] - binSize / 2 <= row[6 + j])
+                cdfHigh += ref[2 * i + 1];
+        }
+        if(cdfLow / total > q[j] + 0.01 || cdfHigh / total < q[j] - 0.01)
+            fail();
+    }
+
+    // types that were not tallied
+    row = s + 11 * REFLECTED;
+    if(row[1] != 0 || !isnan(row[2])) fail();
+
+    pass();
+    return 0;
+}
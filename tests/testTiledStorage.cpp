@@ -0,0 +1,80 @@
+#include "tests.h"
+
+#include <iostream>
+
+using namespace std;
+using namespace MCPP;
+
+const char outputFileName[] = "testTiledStorage.h5";
+vector<Material *> materials;  // see newBilayerSimulation()
+
+void pass() {
+    cout << "testTiledStorage PASSED" << endl;
+    remove(outputFileName);
+    exit(EXIT_SUCCESS);
+}
+
+void fail() {
+    cout << "FAILED" << endl;
+    remove(outputFileName);
+    exit(EXIT_FAILURE);
+}
+
+Histogram *newMap(const char *name, bool tiled) {
+    Histogram *hist = new Histogram();
+    hist->setDataDomain(DATA_POINTS, DATA_TIMES);
+    hist->setPhotonTypeFlags(FLAG_TRANSMITTED | FLAG_REFLECTED);
+    hist->setMax(2000, 500);
+    hist->setBinSize(1, 0.5);
+    hist->setName(name);
+    hist->setTiledStorage(tiled);
+    return hist;
+}
+
+int main() {
+    remove(outputFileName);
+
+    // counters are promoted to 64 bits on overflow
+    TiledCounts counts(3 * TILE_BINS);
+    counts.add(TILE_BINS + 5, UINT32_MAX);
+    counts.increment(TILE_BINS + 5);
+    counts.increment(TILE_BINS + 6);
+    counts.add(2 * TILE_BINS, 3);
+    counts.add(2 * TILE_BINS, UINT32_MAX);
+    if(counts.count(TILE_BINS + 5) != (uint64_t)UINT32_MAX + 1) fail();
+    if(counts.count(TILE_BINS + 6) != 1) fail();
+    if(counts.count(2 * TILE_BINS) != (uint64_t)UINT32_MAX + 3) fail();
+    if(counts.count(0) != 0) fail();
+    if(counts.allocatedBins() != 2 * TILE_BINS) fail();
+
+    // a tiled histogram is saved exactly as a dense one
+    Simulation *sim = newBilayerSimulation(200000, 4, &materials);
+    sim->setOutputFileName(outputFileName);
+    Histogram *dense = newMap("dense", false);
+    Histogram *tiled = newMap("tiled", true);
+    sim->addHistogram(dense);
+    sim->addHistogram(tiled);
+    sim->run();
+
+    if(tiled->allocatedBins() >= dense->allocatedBins() / 2) fail();
+
+    H5OutputFile file;
+    file.openFile(outputFileName);
+    size_t size = 2001 * 1002;
+    MCfloat *bufDense = new MCfloat[size];
+    MCfloat *bufTiled = new MCfloat[size];
+    file.openDataSet("dense");
+    file.loadAll(bufDense);
+    file.openDataSet("tiled");
+    file.loadAll(bufTiled);
+    for (size_t i = 0; i < size; ++i) {
+        if(bufDense[i] != bufTiled[i]) fail();
+    }
+    delete[] bufDense;
+    delete[] bufTiled;
+    delete sim;
+    deleteMaterials(&materials);
+
+    pass();
+    return 0;
+}
@@ -0,0 +1,174 @@
+#include "tests.h"
+#include <MCPlusPlus/pulseconvolver.h>
+
+#include <iostream>
+#include <cmath>
+
+using namespace std;
+using namespace MCPP;
+
+const char outputFileName[] = "testTimeConvolution.h5";
+vector<Material *> materials;  // see newBilayerSimulation()
+
+void pass() {
+    cout << "testTimeConvolution PASSED" << endl;
+    remove(outputFileName);
+    exit(EXIT_SUCCESS);
+}
+
+void fail() {
+    cout << "FAILED" << endl;
+    remove(outputFileName);
+    exit(EXIT_FAILURE);
+}
+
+bool close(double a, double b, double tolerance) {
+    return fabs(a - b) <= tolerance;
+}
+
+const double mean = 20, scale = 3;
+
+// probability of a delay of k bins of the Sech2 profile
+double kernel(int k) {
+    double hi = 1. / (1. + exp(-((k + 0.5) - mean) / scale));
+    double lo = 1. / (1. + exp(-((k - 0.5) - mean) / scale));
+    return hi - lo;
+}
+
+// compares the columns of a convolved table with the direct convolution of
+// the impulse response, in the regular bins
+void checkTable(const MCfloat *ref, const MCfloat *conv, size_t rows,
+                size_t cols, size_t countCols, bool delta) {
+    double maxValue = 0;
+    for (size_t i = 0; i < rows * cols; ++i)
+        maxValue = std::max(maxValue, (double)fabs(ref[i]));
+    for (size_t i = 0; i < rows - 1; ++i) {
+        if(conv[i * cols] != ref[i * cols]) fail();
+        for (size_t c = 1; c <= countCols; ++c) {
+            double expected = 0;
+            for (size_t j = 0; j < rows - 1; ++j) {
+                double p = delta ? (i == j) : kernel((int)i - (int)j);
+                expected += ref[j * cols + c] * p;
+            }
+            if(!close(conv[i * cols + c], expected, 1e-9 * maxValue)) fail();
+        }
+    }
+}
+
+int main() {
+    remove(outputFileName);
+
+    // the FFT round trip and the identity kernel
+    vector<complex<double> > a(64);
+    for (size_t i = 0; i < a.size(); ++i)
+        a[i] = complex<double>(sin(i * 0.3), i % 5);
+    vector<complex<double> > b = a;
+    PulseConvolver::fft(b, false);
+    PulseConvolver::fft(b, true);
+    for (size_t i = 0; i < a.size(); ++i) {
+        if(abs(a[i] - b[i]) > 1e-12) fail();
+    }
+
+    DeltaDistribution delta(0);
+    PulseConvolver identity(&delta, 1, 5);
+    double in[6] = {1, 2, 3, 4, 5, 6}, out[6];
+    identity.convolve(in, out);
+    for (size_t i = 0; i < 6; ++i) {
+        if(!close(out[i], in[i], 1e-12)) fail();
+    }
+
+    // delays beyond the last bin end up in the overflow
+    DeltaDistribution shift(2);
+    PulseConvolver shifted(&shift, 1, 5);
+    shifted.convolve(in, out);
+    if(!close(out[0], 0, 1e-12) || !close(out[2], 1, 1e-12)
+            || !close(out[4], 3, 1e-12) || !close(out[5], 6 + 4 + 5, 1e-12))
+        fail();
+
+    // including delays beyond the kernel, i.e. of more than nBins - 1 bins
+    DeltaDistribution late(7);
+    PulseConvolver lateConvolver(&late, 1, 5);
+    lateConvolver.convolve(in, out);
+    for (size_t i = 0; i < 5; ++i) {
+        if(!close(out[i], 0, 1e-12)) fail();
+    }
+    if(!close(out[5], 6 + 1 + 2 + 3 + 4 + 5, 1e-12)) fail();
+
+    Histogram *h = new Histogram();
+    h->setDataDomain(DATA_POINTS);
+    h->setPhotonTypeFlags(FLAG_TRANSMITTED);
+    h->setMax(100);
+    h->setBinSize(1);
+    h->addTimeConvolution(new DeltaDistribution(0), "delta");
+    if(h->sanityCheck()) fail();
+    delete h;
+
+    const size_t nBins = 200;
+    Histogram *times = new Histogram();
+    times->setDataDomain(DATA_TIMES);
+    times->setPhotonTypeFlags(FLAG_TRANSMITTED | FLAG_REFLECTED);
+    times->setMax(nBins);
+    times->setBinSize(1);
+    times->addMomentExponent(2);
+    times->setName("dtof");
+    times->addTimeConvolution(new DeltaDistribution(0), "delta");
+    times->addTimeConvolution(new Sech2Distribution(mean, scale), "sech");
+
+    const size_t nRadii = 10;
+    Histogram *resolved = new Histogram();
+    resolved->setDataDomain(DATA_TIMES, DATA_POINTS);
+    resolved->setPhotonTypeFlags(FLAG_TRANSMITTED);
+    resolved->setMax(nBins, 10 * nRadii);
+    resolved->setBinSize(1, 10);
+    resolved->setName("resolved");
+    resolved->addTimeConvolution(new Sech2Distribution(mean, scale), "sech");
+
+    Simulation *sim = newBilayerSimulation(100000, 4, &materials);
+    sim->setOutputFileName(outputFileName);
+    sim->addHistogram(times);
+    sim->addHistogram(resolved);
+    sim->run();
+    delete sim;
+    deleteMaterials(&materials);
+
+    H5OutputFile file;
+    file.openFile(outputFileName);
+
+    const size_t rows = nBins + 1;
+    MCfloat ref[rows * 3], conv[rows * 3];
+    file.openDataSet("dtof");
+    file.loadAll(ref);
+    file.openDataSet("dtof_delta");
+    file.loadAll(conv);
+    checkTable(ref, conv, rows, 3, 1, true);
+    file.openDataSet("dtof_sech");
+    file.loadAll(conv);
+    checkTable(ref, conv, rows, 3, 1, false);
+
+    // moments: ratio of the convolved moment sums and counts
+    for (size_t i = 0; i < nBins; ++i) {
+        double sums = 0, counts = 0;
+        for (size_t j = 0; j < nBins; ++j) {
+            if(ref[3 * j + 1] == 0)
+                continue;
+            double p = kernel((int)i - (int)j);
+            sums += ref[3 * j + 1] * ref[3 * j + 2] * p;
+            counts += ref[3 * j + 1] * p;
+        }
+        if(counts < 1e-9)
+            continue;
+        if(!close(conv[3 * i + 2], sums / counts, 1e-6 * sums / counts))
+            fail();
+    }
+
+    const size_t cols = nRadii + 2;
+    MCfloat ref2[rows * cols], conv2[rows * cols];
+    file.openDataSet("resolved");
+    file.loadAll(ref2);
+    file.openDataSet("resolved_sech");
+    file.loadAll(conv2);
+    checkTable(ref2, conv2, rows, cols, nRadii + 1, false);
+
+    pass();
+    return 0;
+}
@@ -3,21 +3,60 @@
 using namespace MCPP;
 
 void testBilayer(const char *outputFileName) {
-    Material mat1, mat2;
-    Air air;
+    vector<Material *> materials;
+    Simulation *sim = newBilayerSimulation(1000000, 4, &materials);
+    sim->setOutputFileName(outputFileName);
+
+    sim->run();
 
-    mat1.n=1.5;
-    mat1.ls = 1;
-    mat1.g = 0;
+    delete sim;
+    deleteMaterials(&materials);
+}
 
-    mat2.n=1.3;
-    mat2.ls = 2;
-    mat2.g = 0.5;
+/**
+ * @brief Deletes the materials returned by newBilayerSimulation()
+ * @param materials
+ *
+ * The simulations using them must have been deleted.
+ */
+
+void deleteMaterials(vector<Material *> *materials) {
+    for (size_t i = 0; i < materials->size(); ++i) {
+        delete (*materials)[i];
+    }
+    materials->clear();
+}
+
+/**
+ * @brief Creates a simulation of a bilayer sample
+ * @param nPhotons
+ * @param nThreads
+ * @param materials the materials of the sample are appended here: they are
+ * not owned by the sample and must be deleted by the caller, see
+ * deleteMaterials()
+ */
+
+Simulation *newBilayerSimulation(u_int64_t nPhotons, uint nThreads,
+                                 vector<Material *> *materials) {
+    Material *mat1 = new Material();
+    Material *mat2 = new Material();
+    Air *air = new Air();
+    materials->push_back(mat1);
+    materials->push_back(mat2);
+    materials->push_back(air);
+
+    mat1->n=1.5;
+    mat1->ls = 1;
+    mat1->g = 0;
+
+    mat2->n=1.3;
+    mat2->ls = 2;
+    mat2->g = 0.5;
 
     Sample *sample = new Sample();
-    sample->addLayer(&mat1,40);
-    sample->addLayer(&mat2,40);
-    sample->setSurroundingEnvironment(&air);
+    sample->addLayer(mat1,40);
+    sample->addLayer(mat2,40);
+    sample->setSurroundingEnvironment(air);
 
     Source *src = new PencilBeamSource();
     src->setWalkTimeDistribution(new DeltaDistribution(0));
@@ -25,7 +64,6 @@ void testBilayer(const char *outputFileName) {
     Simulation *sim = new Simulation(0);
     sim->setSample(sample);
     sim->setSource(src);
-    sim->setOutputFileName(outputFileName);
 
 
     Histogram *hist = new Histogram(0);
@@ -62,11 +100,9 @@ void testBilayer(const char *outputFileName) {
     sim->addHistogram(hist);
 
 
-    sim->setNPhotons(1000000);
-    sim->setNThreads(4);
+    sim->setNPhotons(nPhotons);
+    sim->setNThreads(nThreads);
     sim->setSeed(0);
 
-    sim->run();
-
-    delete sim;
+    return sim;
 }
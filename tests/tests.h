@@ -4,6 +4,12 @@
 #include <MCPlusPlus/h5outputfile.h>
 #include <MCPlusPlus/simulation.h>
 
+#include <vector>
+
 void testBilayer(const char *outputFileName);
+MCPP::Simulation *newBilayerSimulation(
+        u_int64_t nPhotons, uint nThreads,
+        std::vector<MCPP::Material *> *materials);
+void deleteMaterials(std::vector<MCPP::Material *> *materials);
 
 #endif // TESTS_H